@@ -15,6 +15,8 @@
 #import "ENQueryFilter.h"
 #import "ENAdvertisement.h"
 #import "ENAdvertisementDatabaseQuerySession.h"
+#import "ENDetectionMetrics.h"
+#import "ENTEKCache.h"
 
 NS_ASSUME_NONNULL_BEGIN
 
@@ -27,6 +29,11 @@ NS_ASSUME_NONNULL_BEGIN
  */
 @property (nonatomic, strong, nullable) ENQueryFilter *inlineQueryFilter;
 
+/*
+ *  Stage timing for the exposure detection session currently querying the database.
+ */
+@property (nonatomic, strong, nullable) ENDetectionMetrics *metrics;
+
 /*
  *  Total count of advertisements in the database, this will include advertisements
  *  persisted on disk + advertisements in the cache. This will return nil if the
@@ -34,6 +41,18 @@ NS_ASSUME_NONNULL_BEGIN
  */
 @property (nonatomic, readonly, nullable) NSNumber *storedAdvertisementCount;
 
+/*
+ *  Count of advertisements ever saved in the central store, or nil if it cannot be read. Unchanged
+ *  between two reads only if no advertisement was saved in between.
+ */
+@property (nonatomic, readonly, nullable) NSNumber *advertisementHighWaterMark;
+
+/*
+ *  Record of TEKs that matched no advertisement in earlier detection runs against the central store.
+ *  Nil if the central store is not open.
+ */
+@property (nonatomic, readonly, nullable) ENTEKCache *tekCache;
+
 /*
  *  Total count of advertisements dropped due to ENIN filtering.
  */
@@ -59,10 +78,13 @@ NS_ASSUME_NONNULL_BEGIN
  *  Collect all advertisements from the database that were derived from the provided daily
  *  key buffer with RSSI values above the provided threshold. These results will be returned
  *  as the raw underlying struct data, with invalid advertisements having daily_key_index
- *  set to DAILY_KEY_INDEX_INVALID.
+ *  set to DAILY_KEY_INDEX_INVALID. If outAEMKs is provided, it is set to the EN_AEMK_LEN
+ *  byte AEMK of each daily key, in order, derived along with the RPIK so callers scoring
+ *  the advertisements do not derive it again.
  */
 - (nullable NSData *)advertisementsBufferMatchingDailyKeys:(NSArray<ENTemporaryExposureKey *> *)dailyKeys
-                                      attenuationThreshold:(uint8_t)attenuationThreshold;
+                                      attenuationThreshold:(uint8_t)attenuationThreshold
+                                                     aemks:(NSData * _Nullable __autoreleasing * _Nullable)outAEMKs;
 
 /*
  *  For easy query access to the database, create a query session. A query session will manager
@@ -19,18 +19,65 @@
 
 #pragma mark - Definitions
 
-#define ADVERTISEMENT_TOLERANCE_CTIN (12)   // 2 hours (2 * 60 * 60 / (10 * 60))
-#define ADVERTISEMENT_AGE_THRESHOLD (14 * 24 * 60 * 60) // 2 weeks
-
-/// Number of seconds in 1 ENIntervalNumber.
-#define ENSecondsPerENIntervalNumber        ( 60 * 10 )
-
 /// Converts CFAbsoluteTime to ENIntervalNumber for generating RPIs.
 static inline ENIntervalNumber CFAbsoluteTimeToENIntervalNumber(CFAbsoluteTime inCFTime)
 {
     return ((ENIntervalNumber) ((inCFTime + kCFAbsoluteTimeIntervalSince1970) / ENSecondsPerENIntervalNumber));
 }
 
+#pragma mark - Advertisement Validation
+
+typedef struct {
+    uint64_t expiredCount;
+    uint64_t ctinCount;
+    uint64_t attenuationCount;
+} ENAdvertisementDropCounts;
+
+/*
+ *  Checks each matched advertisement's age, CTIN and attenuation, setting its bit in validityBitmap if it passes.
+ *  aemks holds the EN_AEMK_LEN byte AEMK of each of keyCount TEKs, derived along with the RPIK when the RPIs were
+ *  generated, so no key is derived again here.
+ */
+static void ENValidateMatchingAdvertisements(const en_advertisement_t *advertisements, size_t advertisementCount,
+                                             const uint8_t *aemks, const uint32_t *rollingStartNumbers, size_t keyCount,
+                                             CFAbsoluteTime timestampThreshold, uint8_t attenuationThreshold,
+                                             uint64_t *validityBitmap, ENAdvertisementDropCounts *dropCounts)
+{
+    for (size_t i = 0; i < advertisementCount; i++) {
+        const en_advertisement_t *advertisement = &advertisements[i];
+        const uint32_t keyIndex = advertisement->daily_key_index;
+        if (keyIndex >= keyCount) {
+            continue;
+        }
+
+        // verify the duration is within the expiration period (the daily purge may not have run yet)
+        if (advertisement->timestamp < timestampThreshold) {
+            dropCounts->expiredCount++;
+            continue;
+        }
+
+        uint32_t dailyKeyRPIIndex = advertisement->rpi_index + rollingStartNumbers[keyIndex];
+        uint32_t minValidCTIN = dailyKeyRPIIndex - ADVERTISEMENT_TOLERANCE_CTIN;
+        uint32_t maxValidCTIN = dailyKeyRPIIndex + ADVERTISEMENT_TOLERANCE_CTIN;
+        uint32_t observedCTIN = CFAbsoluteTimeToENIntervalNumber(advertisement->timestamp - kCFAbsoluteTimeIntervalSince1970);
+        if (observedCTIN < minValidCTIN || observedCTIN > maxValidCTIN) {
+            dropCounts->ctinCount++;
+            continue;
+        }
+
+        uint8_t attenuation = ENCalculateAttnWithAEMK(&aemks[keyIndex * EN_AEMK_LEN], EN_AEMK_LEN,
+                                                      (const uint8_t *) advertisement->rpi, ENRPILength,
+                                                      (const uint8_t *) advertisement->encrypted_aem, AEM_LENGTH,
+                                                      advertisement->rssi, advertisement->saturated);
+        if (attenuation >= attenuationThreshold) {
+            dropCounts->attenuationCount++;
+            continue;
+        }
+
+        validityBitmap[i / 64] |= (UINT64_C(1) << (i % 64));
+    }
+}
+
 #pragma mark - Database
 
 @implementation ENAdvertisementDatabase {
@@ -75,6 +122,7 @@ static inline ENIntervalNumber CFAbsoluteTimeToENIntervalNumber(CFAbsoluteTime i
     _centralStore = [ENAdvertisementSQLiteStore centralStoreInFolderPath:_databaseFolderPath];
 
     if (_centralStore) {
+        _tekCache = [ENTEKCache tekCacheInFolderPath:_databaseFolderPath storeIdentifier:[_centralStore storeIdentifier]];
         return YES;
     }
     return NO;
@@ -91,6 +139,20 @@ static inline ENIntervalNumber CFAbsoluteTimeToENIntervalNumber(CFAbsoluteTime i
     return [_centralStore storedAdvertisementCount];
 }
 
+- (NSNumber *)advertisementHighWaterMark
+{
+    if (!_centralStore) {
+        return nil;
+    }
+
+    NSError *error = nil;
+    NSNumber *highWaterMark = [_centralStore highWaterMarkWithError:&error];
+    if (!highWaterMark) {
+        EN_ERROR_PRINTF("failed to read advertisement high water mark error:%ld", (long) [error code]);
+    }
+    return highWaterMark;
+}
+
 - (nullable ENQueryFilter *)queryFilterWithBufferSize:(NSUInteger)bufferSize
                                             hashCount:(NSUInteger)hashCount
                                  attenuationThreshold:(uint8_t)attenuationThreshold
@@ -114,9 +176,13 @@ static inline ENIntervalNumber CFAbsoluteTimeToENIntervalNumber(CFAbsoluteTime i
         return nil;
     }
     int possibleRPICount = 0;
+    uint64_t checkedRPICount = 0;
+    [_metrics addCount:(bufferRPICount * sizeof(bool)) toCounter:ENDetectionCounterAllocatedBytes];
 
     // populate the validity buffer
+    ENDetectionStageTimer filterTimer = [_metrics beginStage];
     const char *rpiBuffer = (const char *) [buffer bytes];
+    ENQueryFilter *queryFilter = _inlineQueryFilter;
     for (uint32_t exposureKeyIndex = 0; exposureKeyIndex < [exposureKeys count]; exposureKeyIndex++) {
 
         // determine how many RPI to look at
@@ -127,23 +193,33 @@ static inline ENIntervalNumber CFAbsoluteTimeToENIntervalNumber(CFAbsoluteTime i
         } else if ([exposureKey rollingPeriod] > ENTEKRollingPeriod) {
             // if the TEK has a rollingPeriod > ENTEKRollingPeriod, log an error and
             // continue as to not consider any of these TEK in the matching process
-            EN_ERROR_PRINTF("invalid TEK rollingPeriod: %d", [exposureKey rollingPeriod]);
+            EN_ERROR_PRINTF_LIMITED(EN_LOG_HOT_LOOP_LIMIT, "invalid TEK rollingPeriod: %d", [exposureKey rollingPeriod]);
             continue;
         }
 
-        // check if those RPI are possibly valid
-        for (uint32_t rpiIndex = 0; rpiIndex < rollingPeriod; rpiIndex++) {
-            uint32_t rpiBufferIndex = (exposureKeyIndex * ENTEKRollingPeriod) + rpiIndex;
-            if (![_inlineQueryFilter shouldIgnoreRPI:&rpiBuffer[rpiBufferIndex * ENRPILength]]) {
-                validityBuffer[rpiBufferIndex] = true;
-                possibleRPICount++;
+        // check if those RPI are possibly valid, under the filter's lock as the store may be adding to it
+        checkedRPICount += rollingPeriod;
+        uint32_t rpiBufferIndex = exposureKeyIndex * ENTEKRollingPeriod;
+        if (queryFilter) {
+            possibleRPICount += (int) [queryFilter markPossibleRPIs:&rpiBuffer[rpiBufferIndex * ENRPILength]
+                                                              count:rollingPeriod
+                                                     validityBuffer:&validityBuffer[rpiBufferIndex]];
+        } else {
+            for (uint32_t rpiIndex = 0; rpiIndex < rollingPeriod; rpiIndex++) {
+                validityBuffer[rpiBufferIndex + rpiIndex] = true;
             }
+            possibleRPICount += rollingPeriod;
         }
     }
 
+    [_metrics endStage:ENDetectionStageQueryFilter timer:filterTimer];
+    [_metrics addCount:possibleRPICount toCounter:ENDetectionCounterFilterPasses];
+    [_metrics addCount:(checkedRPICount - possibleRPICount) toCounter:ENDetectionCounterFilterRejects];
+
     EN_INFO_PRINTF("querying sqlite for advertisements count:%d filteredCount:%llu", possibleRPICount, (bufferRPICount - possibleRPICount));
 
     // retreive raw data of matching advertisements
+    ENDetectionStageTimer matchTimer = [_metrics beginStage];
     en_advertisement_t *matchingAdvertisementsBuffer = NULL;
     NSError *matchError = nil;
     NSUInteger matchingAdvertisementCount = [_centralStore getAdvertisementsMatchingRPIBuffer:rpiBuffer
@@ -152,6 +228,7 @@ static inline ENIntervalNumber CFAbsoluteTimeToENIntervalNumber(CFAbsoluteTime i
                                                                                 validRPICount:possibleRPICount
                                                                   matchingAdvertisementBuffer:&matchingAdvertisementsBuffer
                                                                                         error:&matchError];
+    [_metrics endStage:ENDetectionStageSQLiteMatch timer:matchTimer];
     free(validityBuffer);
 
     if (!matchingAdvertisementsBuffer) {
@@ -167,11 +244,15 @@ static inline ENIntervalNumber CFAbsoluteTimeToENIntervalNumber(CFAbsoluteTime i
     }
 
     EN_INFO_PRINTF("sqlite matching advertisements count:%lu", (unsigned long) matchingAdvertisementCount);
+    [_metrics addCount:matchingAdvertisementCount toCounter:ENDetectionCounterSQLiteRows];
+    [_metrics addCount:([[_centralStore storedAdvertisementCount] unsignedIntegerValue] * sizeof(en_advertisement_t))
+             toCounter:ENDetectionCounterAllocatedBytes];
     return [NSData dataWithBytesNoCopy:matchingAdvertisementsBuffer length:(matchingAdvertisementCount * sizeof(en_advertisement_t))];
 }
 
 - (nullable NSData *)advertisementsBufferMatchingDailyKeys:(NSArray<ENTemporaryExposureKey *> *)dailyKeys
                                       attenuationThreshold:(uint8_t)attenuationThreshold
+                                                     aemks:(NSData * _Nullable __autoreleasing * _Nullable)outAEMKs
 {
     EN_INFO_PRINTF("ExposureNotification: generating RPI data from tracing key count:%lu", (unsigned long) [dailyKeys count]);
 
@@ -182,19 +263,39 @@ static inline ENIntervalNumber CFAbsoluteTimeToENIntervalNumber(CFAbsoluteTime i
         EN_ERROR_PRINTF("failed to allocate RPI buffer");
         return nil;
     }
+    [_metrics addCount:rpiBufferSize toCounter:ENDetectionCounterAllocatedBytes];
+
+    // the AEMK of each key is derived from the same HKDF-Extract as its RPIK, and kept for validation and scoring
+    NSMutableData *aemkData = [[NSMutableData alloc] initWithLength:[dailyKeys count] * EN_AEMK_LEN];
+    if (!aemkData) {
+        EN_ERROR_PRINTF("failed to allocate AEMK buffer");
+        free(rpiBuffer);
+        return nil;
+    }
+    uint8_t *aemks = (uint8_t *) [aemkData mutableBytes];
 
     // generate the RPI data
+    ENDetectionStageTimer rpiTimer = [_metrics beginStage];
     __block BOOL success = YES;
     [dailyKeys enumerateObjectsUsingBlock:^(ENTemporaryExposureKey *exposureKey, NSUInteger index, BOOL *stop) {
-        BTResult result = ENGenerate144RollingProximityIdentifiers((uint8_t *) [[exposureKey keyData] bytes], [[exposureKey keyData] length],
-                                                                   [exposureKey rollingStartNumber],
-                                                                   (uint8_t *) &rpiBuffer[index * ENTEKRollingPeriod], ENTEKRollingPeriod * ENRPILength);
+        uint8_t rpik[EN_RPIK_LEN];
+        BTResult result = ENDeriveTEKSubkeys((uint8_t *) [[exposureKey keyData] bytes], [[exposureKey keyData] length],
+                                             rpik, sizeof(rpik), &aemks[index * EN_AEMK_LEN], EN_AEMK_LEN);
+        if (result == BT_SUCCESS) {
+            result = ENGenerate144RollingProximityIdentifiersWithRPIK(rpik, sizeof(rpik), [exposureKey rollingStartNumber],
+                                                                      (uint8_t *) &rpiBuffer[index * ENTEKRollingPeriod], ENTEKRollingPeriod * ENRPILength);
+        }
+        memset(rpik, 0, sizeof(rpik));
         if (result != BT_SUCCESS) {
             EN_CRITICAL_PRINTF("Failed to generate RPI data TEK:%@ rollingStartNumber:%d", [exposureKey keyData], [exposureKey rollingStartNumber]);
             success = NO;
             *stop = YES;
         }
     }];
+    [_metrics endStage:ENDetectionStageRPIGeneration timer:rpiTimer];
+    if (success) {
+        [_metrics addCount:([dailyKeys count] * ENTEKRollingPeriod) toCounter:ENDetectionCounterRPIsGenerated];
+    }
 
     // Find the matching advertisements
     NSData *rpiBufferData = [[NSData alloc] initWithBytesNoCopy:rpiBuffer length:rpiBufferSize];
@@ -209,48 +310,49 @@ static inline ENIntervalNumber CFAbsoluteTimeToENIntervalNumber(CFAbsoluteTime i
     NSUInteger matchingAdvertisementCount = [matchingAdvertisementStructs length] / sizeof(en_advertisement_t);
     en_advertisement_t *matchingAdvertisementsBuffer = (en_advertisement_t *) [matchingAdvertisementStructs bytes];
 
-    // hydrate the buffer data into objects
+    // validate the matched advertisements
     CFAbsoluteTime timestampThreshold = (CFAbsoluteTimeGetCurrent() + kCFAbsoluteTimeIntervalSince1970) - ADVERTISEMENT_AGE_THRESHOLD;
-    if (success) {
-        for (NSUInteger i = 0; i < matchingAdvertisementCount; i++) @autoreleasepool {
-            en_advertisement_t *advertisementStruct = &matchingAdvertisementsBuffer[i];
-            ENTemporaryExposureKey *tek = [dailyKeys objectAtIndex:advertisementStruct->daily_key_index];
-
-            // verify the duration is within the expiration period (the daily purge may not have run yet)
-            if (advertisementStruct->timestamp < timestampThreshold) {
-                EN_NOTICE_PRINTF("Dropping outdated advertisement TEK:%@ timestamp:%0.2f threshold:%0.2f", tek, advertisementStruct->timestamp, timestampThreshold);
-                advertisementStruct->daily_key_index = DAILY_KEY_INDEX_INVALID;
-                _droppedAdvertisementCount++;
-                continue;
+    ENDetectionStageTimer validationTimer = [_metrics beginStage];
+    ENAdvertisementDropCounts dropCounts = {0};
+    if (success && matchingAdvertisementCount > 0) {
+        NSUInteger keyCount = [dailyKeys count];
+        uint32_t *rollingStartNumbers = (uint32_t *) malloc(keyCount * sizeof(uint32_t));
+        uint64_t *validityBitmap = (uint64_t *) calloc((matchingAdvertisementCount + 63) / 64, sizeof(uint64_t));
+        if (rollingStartNumbers && validityBitmap) {
+            NSUInteger keyIndex = 0;
+            for (ENTemporaryExposureKey *tek in dailyKeys) {
+                rollingStartNumbers[keyIndex] = [tek rollingStartNumber];
+                keyIndex++;
             }
 
-            uint32_t dailyKeyRPIIndex = advertisementStruct->rpi_index + [tek rollingStartNumber];
-            uint32_t minValidCTIN = dailyKeyRPIIndex - ADVERTISEMENT_TOLERANCE_CTIN;
-            uint32_t maxValidCTIN = dailyKeyRPIIndex + ADVERTISEMENT_TOLERANCE_CTIN;
-            uint32_t observedCTIN = CFAbsoluteTimeToENIntervalNumber(advertisementStruct->timestamp - kCFAbsoluteTimeIntervalSince1970);
-
-            if (minValidCTIN <= observedCTIN && observedCTIN <= maxValidCTIN) {
-                NSData *tekData = [tek keyData];
-                uint8_t attenuation = ENCalculateAttnForDiscoveredRPI((uint8_t *) [tekData bytes], [tekData length],
-                                                                      (uint8_t *) advertisementStruct->rpi, ENRPILength,
-                                                                      (uint8_t *) advertisementStruct->encrypted_aem, AEM_LENGTH,
-                                                                      advertisementStruct->rssi, advertisementStruct->saturated);
-                EN_NOTICE_PRINTF("RPI : %.16P Attenuation : %u", advertisementStruct->rpi, attenuation);
-
-                if (attenuation >= attenuationThreshold) {
-                    EN_NOTICE_PRINTF("dropping advertisement due to attenuation threshold");
-                    advertisementStruct->daily_key_index = DAILY_KEY_INDEX_INVALID;
-                    _droppedAdvertisementCount++;
+            ENValidateMatchingAdvertisements(matchingAdvertisementsBuffer, matchingAdvertisementCount, aemks, rollingStartNumbers, keyCount,
+                                             timestampThreshold, attenuationThreshold, validityBitmap, &dropCounts);
+
+            for (NSUInteger i = 0; i < matchingAdvertisementCount; i++) {
+                if (!(validityBitmap[i / 64] & (UINT64_C(1) << (i % 64)))) {
+                    matchingAdvertisementsBuffer[i].daily_key_index = DAILY_KEY_INDEX_INVALID;
                 }
-            } else {
-                EN_NOTICE_PRINTF("ExposureNotification: Dropping advertisement %@ with invalid CTIN : %u, rpiIndex : %u",
-                                 [[dailyKeys objectAtIndex:advertisementStruct->daily_key_index] keyData], observedCTIN, dailyKeyRPIIndex);
-                advertisementStruct->daily_key_index = DAILY_KEY_INDEX_INVALID;
-                _droppedAdvertisementCount++;
             }
+            EN_INFO_PRINTF("validated matching advertisements count:%lu expired:%llu invalidCTIN:%llu attenuation:%llu",
+                           (unsigned long) matchingAdvertisementCount, dropCounts.expiredCount, dropCounts.ctinCount, dropCounts.attenuationCount);
+        } else {
+            EN_ERROR_PRINTF("failed to allocate advertisement validation buffers");
+            matchingAdvertisementStructs = nil;
         }
+        free(rollingStartNumbers);
+        free(validityBitmap);
+    }
+    _droppedAdvertisementCount += dropCounts.expiredCount + dropCounts.ctinCount + dropCounts.attenuationCount;
+    [_metrics endStage:ENDetectionStageAdvertisementValidation timer:validationTimer];
+    [_metrics addCount:dropCounts.expiredCount toCounter:ENDetectionCounterExpiredDrops];
+    [_metrics addCount:dropCounts.ctinCount toCounter:ENDetectionCounterCTINDrops];
+    [_metrics addCount:dropCounts.attenuationCount toCounter:ENDetectionCounterAttenuationDrops];
+
+    if (outAEMKs && matchingAdvertisementStructs) {
+        *outAEMKs = aemkData;
+    } else {
+        memset(aemks, 0, [aemkData length]);
     }
-
     return matchingAdvertisementStructs;
 }
 
@@ -11,6 +11,8 @@
 #import <Foundation/Foundation.h>
 #import <ExposureNotification/ExposureNotification.h>
 
+#import "ENDetectionMetrics.h"
+
 NS_ASSUME_NONNULL_BEGIN
 
 typedef void ( ^ENExposureInfoEnumerationHandler )(NSArray<ENExposureInfo *> * _Nullable exposureInfoBatch,  NSError * _Nullable error);
@@ -31,10 +33,18 @@ typedef void ( ^ENExposureInfoEnumerationHandler )(NSArray<ENExposureInfo *> * _
 
 @property (nonatomic, strong, nullable) ENExposureConfiguration *configuration;
 
+/*
+ *  Stage timing for scoring matched advertisements.
+ */
+@property (nonatomic, strong, nullable) ENDetectionMetrics *metrics;
+
 /*
  *  Retrieves the count of matches found in the on-device database for the provided Temporary
  *  Exposure Keys. If the cacheExposureInfo property is set to YES, the generated ENExposureInfo
- *  can be enumerated at a later time via the enumerateCachedExposureInfo methods.
+ *  can be enumerated at a later time via the enumerateCachedExposureInfo methods. Each TEK is only
+ *  matched the first time it is provided to the session; later copies, in this or any later call,
+ *  are skipped. TEKs that matched nothing in an earlier session are also skipped, unless
+ *  advertisements have been saved since (see ENTEKCache).
  */
 - (uint64_t) matchCountForKeys:(NSArray<ENTemporaryExposureKey *> *)inKeys
           attenuationThreshold:(uint8_t)attenuationThreshold
@@ -44,11 +54,19 @@ typedef void ( ^ENExposureInfoEnumerationHandler )(NSArray<ENExposureInfo *> * _
  *  Retrieves the generated ENExposureInfo for matches found in the on-device database for the
  *  provided Temporary Exposure Keys. If the cacheExposureInfo property is set to YES, the generated
  *  ENExposureInfo can be enumerated at a later time via the enumerateCachedExposureInfo methods.
+ *  TEKs already provided to the session are skipped, as for matchCountForKeys.
  */
 - (nullable NSArray<ENExposureInfo *> *) exposureInfoForKeys:(NSArray <ENTemporaryExposureKey *> *) inKeys
                                         attenuationThreshold:(uint8_t)attenuationThreshold
                                                        error:(ENErrorOutType)outError;
 
+/*
+ *  Record the TEKs that matched nothing in this session in the database's ENTEKCache, so later
+ *  sessions can skip them. Call once the session's keys have all been matched; it can be called
+ *  again after matching more. Sessions sharing the cache may save concurrently.
+ */
+- (BOOL)saveTEKCacheWithError:(NSError * _Nullable __autoreleasing * _Nullable)error;
+
 /*
  *  ENExposureInfo caching
  *  If the cacheExposureInfo property is set to YES, the above matching methods will cache all
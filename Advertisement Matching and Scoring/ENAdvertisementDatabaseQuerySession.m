@@ -35,6 +35,8 @@
 
 #define DEFAULT_ALLOWABLE_RPI_BROADCAST_DURATION (20 * 60.0f)
 
+#define TEK_SET_INITIAL_CAPACITY (1024) // must be a power of 2
+
 typedef char rpi_t[ENRPILength];
 typedef char daily_tracing_key_t[ENTEKLength];
 
@@ -46,6 +48,129 @@ typedef struct __attribute__((packed)) {
     ENRiskLevel transmission_risk;
 } en_exposure_info_t;
 
+/*
+ *  Open addressing set of 16 byte TEK values, used to match each TEK at most once per session
+ *  regardless of how many batches or files it appears in. Linear probing, kept at most half full.
+ */
+typedef struct {
+    daily_tracing_key_t *keys;
+    bool *occupied;
+    size_t capacity;
+    size_t count;
+    uint64_t seed;
+} en_tek_set_t;
+
+static inline size_t en_tek_set_slot(const en_tek_set_t *set, const uint8_t *tek)
+{
+    // TEKs are random, but the seed keeps a crafted key file from forcing collisions.
+    uint64_t low, high;
+    memcpy(&low, tek, sizeof(low));
+    memcpy(&high, tek + sizeof(low), sizeof(high));
+    uint64_t hash = (low ^ set->seed) * 0x9E3779B97F4A7C15ULL;
+    hash ^= (high + (hash >> 29)) * 0xBF58476D1CE4E5B9ULL;
+    return (size_t) (hash ^ (hash >> 32)) & (set->capacity - 1);
+}
+
+static bool en_tek_set_init(en_tek_set_t *set, size_t capacity)
+{
+    set->keys = (daily_tracing_key_t *) calloc(capacity, sizeof(daily_tracing_key_t));
+    set->occupied = (bool *) calloc(capacity, sizeof(bool));
+    set->capacity = capacity;
+    set->count = 0;
+    set->seed = ((uint64_t) arc4random() << 32) | arc4random();
+    if (!set->keys || !set->occupied) {
+        free(set->keys);
+        free(set->occupied);
+        memset(set, 0, sizeof(*set));
+        return false;
+    }
+    return true;
+}
+
+static void en_tek_set_free(en_tek_set_t *set)
+{
+    if (set->keys) {
+        memset(set->keys, 0, set->capacity * sizeof(daily_tracing_key_t));
+    }
+    free(set->keys);
+    free(set->occupied);
+    memset(set, 0, sizeof(*set));
+}
+
+static bool en_tek_set_grow(en_tek_set_t *set)
+{
+    en_tek_set_t grown;
+    if (!en_tek_set_init(&grown, set->capacity * 2)) {
+        return false;
+    }
+    grown.seed = set->seed;
+    for (size_t i = 0; i < set->capacity; i++) {
+        if (!set->occupied[i]) {
+            continue;
+        }
+        size_t slot = en_tek_set_slot(&grown, (const uint8_t *) set->keys[i]);
+        while (grown.occupied[slot]) {
+            slot = (slot + 1) & (grown.capacity - 1);
+        }
+        memcpy(grown.keys[slot], set->keys[i], ENTEKLength);
+        grown.occupied[slot] = true;
+        grown.count++;
+    }
+    en_tek_set_free(set);
+    *set = grown;
+    return true;
+}
+
+/*
+ *  Adds the TEK to the set. Returns true if it was not already present. If the set cannot
+ *  grow, the TEK is treated as new so that it is still matched.
+ */
+static bool en_tek_set_insert(en_tek_set_t *set, const uint8_t *tek)
+{
+    if ((set->count + 1) * 2 > set->capacity && !en_tek_set_grow(set)) {
+        return true;
+    }
+    size_t slot = en_tek_set_slot(set, tek);
+    while (set->occupied[slot]) {
+        if (memcmp(set->keys[slot], tek, ENTEKLength) == 0) {
+            return false;
+        }
+        slot = (slot + 1) & (set->capacity - 1);
+    }
+    memcpy(set->keys[slot], tek, ENTEKLength);
+    set->occupied[slot] = true;
+    set->count++;
+    return true;
+}
+
+/*
+ *  Removes the TEK from the set if present. Later entries of its probe run are shifted back
+ *  into the gap when their home slot allows it, so lookups never stop early at the gap.
+ */
+static void en_tek_set_remove(en_tek_set_t *set, const uint8_t *tek)
+{
+    size_t mask = set->capacity - 1;
+    size_t hole = en_tek_set_slot(set, tek);
+    while (set->occupied[hole] && memcmp(set->keys[hole], tek, ENTEKLength) != 0) {
+        hole = (hole + 1) & mask;
+    }
+    if (!set->occupied[hole]) {
+        return;
+    }
+
+    for (size_t next = (hole + 1) & mask; set->occupied[next]; next = (next + 1) & mask) {
+        // an entry can fill the hole if the hole lies between its home slot and where it is now
+        size_t home = en_tek_set_slot(set, (const uint8_t *) set->keys[next]);
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            memcpy(set->keys[hole], set->keys[next], ENTEKLength);
+            hole = next;
+        }
+    }
+    memset(set->keys[hole], 0, ENTEKLength);
+    set->occupied[hole] = false;
+    set->count--;
+}
+
 ENExposureInfo *exposureInfoFromStructRepresentation(en_exposure_info_t structRepresentation)
 {
     ENExposureInfo *exposureInfo = [[ENExposureInfo alloc] init];
@@ -139,8 +264,16 @@ static NSArray<ENAdvertisement *> *temporalyCombineAdvertisements(NSArray<ENAdve
     en_exposure_info_t *_exposureInfoBuffer;
     uint32_t _exposureInfoBufferSize;
 
+    // TEKs already matched in this session
+    en_tek_set_t _matchedTEKs;
+
+    // store high water mark when the query filter was built, nil if unknown
+    NSNumber *_highWaterMark;
+
     // debug stats counters
     uint32_t _tekCount;
+    uint32_t _duplicateTEKCount;
+    uint32_t _cachedTEKCount;
 }
 
 - (instancetype)initWithDatabase:(ENAdvertisementDatabase *)database attenuationThreshold:(uint8_t)attenuationThreshold
@@ -160,8 +293,19 @@ static NSArray<ENAdvertisement *> *temporalyCombineAdvertisements(NSArray<ENAdve
             return nil;
         }
 
+        if (!en_tek_set_init(&_matchedTEKs, TEK_SET_INITIAL_CAPACITY)) {
+            EN_ERROR_PRINTF("Failed to allocate TEK set");
+            free(_exposureInfoBuffer);
+            return nil;
+        }
+
         _cachedExposureInfoCount = 0;
         _tekCount = 0;
+        _duplicateTEKCount = 0;
+        _cachedTEKCount = 0;
+
+        // read before the filter is built, so no advertisement the filter misses is counted as seen
+        _highWaterMark = [database tekCache] ? [database advertisementHighWaterMark] : nil;
 
         [_database setInlineQueryFilter:[_database queryFilterWithBufferSize:DEFAULT_FILTER_BUFFER_SIZE
                                                                    hashCount:DEFAULT_FILTER_HASH_COUNT
@@ -172,11 +316,22 @@ static NSArray<ENAdvertisement *> *temporalyCombineAdvertisements(NSArray<ENAdve
 
 - (void)dealloc
 {
-    EN_NOTICE_PRINTF("query session complete. tekCount:%d exposureInfoCount:%d",
-                     _tekCount, (int) _cachedExposureInfoCount);
+    EN_NOTICE_PRINTF("query session complete. tekCount:%d duplicateTEKCount:%d cachedTEKCount:%d exposureInfoCount:%d",
+                     _tekCount, _duplicateTEKCount, _cachedTEKCount, (int) _cachedExposureInfoCount);
 
     [_database setInlineQueryFilter:nil];
     free(_exposureInfoBuffer);
+    en_tek_set_free(&_matchedTEKs);
+}
+
+- (BOOL)saveTEKCacheWithError:(NSError * _Nullable __autoreleasing * _Nullable)error
+{
+    // keys are only recorded against a high water mark, so without one there is nothing to save
+    if (!_highWaterMark) {
+        return YES;
+    }
+
+    return [[_database tekCache] saveWithError:error];
 }
 
 - (uint8_t)weightedAttenuationValueForDurations:(uint32_t *)attenuationDurations
@@ -211,7 +366,7 @@ static NSArray<ENAdvertisement *> *temporalyCombineAdvertisements(NSArray<ENAdve
     return MIN(UINT8_MAX, weightedAttenuationValue);
 }
 
-- (NSArray<ENAdvertisement *> *)filterAdvertisements:(NSArray<ENAdvertisement *> *)advertisements fromKey:(ENTemporaryExposureKey *)key
+- (NSArray<ENAdvertisement *> *)filterAdvertisements:(NSArray<ENAdvertisement *> *)advertisements withAEMK:(const uint8_t *)aemk
 {
     NSMutableArray<ENAdvertisement *> *validAttenuationAdvertisements = [[NSMutableArray alloc] init];
 
@@ -222,15 +377,15 @@ static NSArray<ENAdvertisement *> *temporalyCombineAdvertisements(NSArray<ENAdve
         // Any advertisement with a transmission power outside of what is used on iOS and Android devices will be dropped.
 
         int8_t txPower = 0;
-        BTResult result = ENRetrieveTxPowerFromEncryptedAEM((uint8_t *)[[advertisement encryptedAEM] bytes], ENAEMLength,
-                                                            (uint8_t *)[[key keyData] bytes], ENTEKLength,
-                                                            (uint8_t *)[[advertisement rpi] bytes], ENRPILength, &txPower);
+        BTResult result = ENRetrieveTxPowerWithAEMK(aemk, EN_AEMK_LEN, (const uint8_t *)[[advertisement rpi] bytes], ENRPILength,
+                                                    (const uint8_t *)[[advertisement encryptedAEM] bytes], [[advertisement encryptedAEM] length],
+                                                    &txPower);
         if (result != BT_SUCCESS) {
             continue;
         }
 
         if (txPower < VALID_TX_POWER_MIN || txPower > VALID_TX_POWER_MAX) {
-            EN_NOTICE_PRINTF("dropping advertisement due to invalid txPower: %d", txPower);
+            EN_NOTICE_PRINTF_LIMITED(EN_LOG_HOT_LOOP_LIMIT, "dropping advertisement due to invalid txPower: %d", txPower);
             continue;
         }
 
@@ -238,13 +393,12 @@ static NSArray<ENAdvertisement *> *temporalyCombineAdvertisements(NSArray<ENAdve
         // tx power (zero signal loss). A zero signal loss reading would only be possible if the tx power of within
         // the AEM is not the tx power actually used.
 
-        uint8_t advertisementAttenuation = ENCalculateAttnForDiscoveredRPI((uint8_t *)[[key keyData] bytes], ENTEKLength,
-                                                                           (uint8_t *)[[advertisement rpi] bytes], ENRPILength,
-                                                                           (uint8_t *)[[advertisement encryptedAEM] bytes], [[advertisement encryptedAEM] length],
-                                                                           [advertisement rssi], [advertisement saturated]);
+        uint8_t advertisementAttenuation = ENCalculateAttnWithAEMK(aemk, EN_AEMK_LEN, (const uint8_t *)[[advertisement rpi] bytes], ENRPILength,
+                                                                   (const uint8_t *)[[advertisement encryptedAEM] bytes], [[advertisement encryptedAEM] length],
+                                                                   [advertisement rssi], [advertisement saturated]);
 
         if (advertisementAttenuation < VALID_ATTENUATION_MIN || advertisementAttenuation > VALID_ATTENUATION_MAX) {
-            EN_NOTICE_PRINTF("dropping advertisement due to invalid attenuation: %u", advertisementAttenuation);
+            EN_NOTICE_PRINTF_LIMITED(EN_LOG_HOT_LOOP_LIMIT, "dropping advertisement due to invalid attenuation: %u", advertisementAttenuation);
             continue;
         }
 
@@ -272,7 +426,7 @@ static NSArray<ENAdvertisement *> *temporalyCombineAdvertisements(NSArray<ENAdve
         NSDate *currentBroadcastDate = [NSDate dateWithTimeIntervalSince1970:[advertisement timestamp]];
         NSTimeInterval broadcastDuration = [currentBroadcastDate timeIntervalSinceDate:initialBroadcastDate];
         if (broadcastDuration > DEFAULT_ALLOWABLE_RPI_BROADCAST_DURATION) {
-            EN_NOTICE_PRINTF("dropping advertisement due to invalid broadcast duration: %0.3f", broadcastDuration);
+            EN_NOTICE_PRINTF_LIMITED(EN_LOG_HOT_LOOP_LIMIT, "dropping advertisement due to invalid broadcast duration: %0.3f", broadcastDuration);
             continue;
         }
 
@@ -282,11 +436,13 @@ static NSArray<ENAdvertisement *> *temporalyCombineAdvertisements(NSArray<ENAdve
     return validBroadcastDurationAdvertisements;
 }
 
-- (ENExposureInfo *)exposureInfoForAdvertisements:(NSArray<ENAdvertisement *> *)advertisements
+/*
+ *  All advertisements are from one TEK, whose AEMK was derived along with its RPIK when its RPIs were generated.
+ */
+- (ENExposureInfo *)exposureInfoForAdvertisements:(NSArray<ENAdvertisement *> *)advertisements aemk:(const uint8_t *)aemk
 {
     // Filter advertisements to discard any suspicious behaviors
-    ENTemporaryExposureKey *key = [[advertisements firstObject] temporaryExposureKey];
-    NSArray<ENAdvertisement *> *filteredAdvertisements = [self filterAdvertisements:advertisements fromKey:key];
+    NSArray<ENAdvertisement *> *filteredAdvertisements = [self filterAdvertisements:advertisements withAEMK:aemk];
     if ([filteredAdvertisements count] == 0) {
         return nil;
     }
@@ -337,11 +493,9 @@ static NSArray<ENAdvertisement *> *temporalyCombineAdvertisements(NSArray<ENAdve
 
         // compute the attenuation duration values if not saturated
         if ([advertisement rssi] != INT8_MAX) {
-            NSData *tek = [[advertisement temporaryExposureKey] keyData];
-            uint8_t advertisementAttenuation = ENCalculateAttnForDiscoveredRPI((uint8_t *)[tek bytes], ENTEKLength,
-                                                                               (uint8_t *)[[advertisement rpi] bytes], ENRPILength,
-                                                                               (uint8_t *)[[advertisement encryptedAEM] bytes], [[advertisement encryptedAEM] length],
-                                                                               [advertisement rssi], [advertisement saturated]);
+            uint8_t advertisementAttenuation = ENCalculateAttnWithAEMK(aemk, EN_AEMK_LEN, (const uint8_t *)[[advertisement rpi] bytes], ENRPILength,
+                                                                       (const uint8_t *)[[advertisement encryptedAEM] bytes], [[advertisement encryptedAEM] length],
+                                                                       [advertisement rssi], [advertisement saturated]);
 
             // bucket duration by attenuation thresholds for API
             for (int i = 0; i < ATTENUATION_DURATION_BUCKET_COUNT; i++) {
@@ -395,6 +549,7 @@ static NSArray<ENAdvertisement *> *temporalyCombineAdvertisements(NSArray<ENAdve
 
 - (NSArray<ENExposureInfo *> *)aggregateExposureInfoForAdvertisementBuffer:(NSData *)advertisementBuffer
                                                               exposureKeys:(NSArray<ENTemporaryExposureKey *> *)exposureKeys
+                                                                     aemks:(NSData *)aemks
 {
     // aggregate advertisements per TEK
     NSMutableArray<ENExposureInfo *> *aggregateExposureInfo = [[NSMutableArray alloc] init];
@@ -434,32 +589,96 @@ static NSArray<ENAdvertisement *> *temporalyCombineAdvertisements(NSArray<ENAdve
 
         EN_NOTICE_PRINTF("Converting matching advertisement batch to ExposureInfo tekStartIndex:%d count:%d invalidAdvertisementCount:%d",
                          (int) tekStartIndex, (int) (advertisementIndex - tekStartIndex), (int) invalidAdvertisementCount);
-        [aggregateExposureInfo addObject:[self exposureInfoForAdvertisements:advertisementBatch]];
+        const uint8_t *aemk = (const uint8_t *) [aemks bytes] + (currentTEKIndex * EN_AEMK_LEN);
+        [aggregateExposureInfo addObject:[self exposureInfoForAdvertisements:advertisementBatch aemk:aemk]];
     }
 
     return aggregateExposureInfo;
 }
 
+- (void)recordUnmatchedKeys:(NSArray<ENTemporaryExposureKey *> *)exposureKeys
+      inAdvertisementBuffer:(NSData *)advertisementBuffer
+                   tekCache:(ENTEKCache *)tekCache
+       attenuationThreshold:(uint8_t)attenuationThreshold
+              highWaterMark:(uint64_t)highWaterMark
+{
+    // a key with no valid advertisement left in the buffer matched nothing, or only advertisements that were
+    // dropped for their age, CTIN or attenuation, which they would be again
+    NSUInteger keyCount = [exposureKeys count];
+    bool *keyMatched = (bool *) calloc(keyCount, sizeof(bool));
+    if (!keyMatched) {
+        return;
+    }
+
+    const en_advertisement_t *advertisements = (const en_advertisement_t *) [advertisementBuffer bytes];
+    NSUInteger advertisementCount = [advertisementBuffer length] / sizeof(en_advertisement_t);
+    for (NSUInteger i = 0; i < advertisementCount; i++) {
+        if (advertisements[i].daily_key_index < keyCount) {
+            keyMatched[advertisements[i].daily_key_index] = true;
+        }
+    }
+
+    for (NSUInteger keyIndex = 0; keyIndex < keyCount; keyIndex++) {
+        if (!keyMatched[keyIndex]) {
+            [tekCache addUnmatchedKey:[exposureKeys objectAtIndex:keyIndex] attenuationThreshold:attenuationThreshold highWaterMark:highWaterMark];
+        }
+    }
+    free(keyMatched);
+}
+
 - (NSArray<ENExposureInfo *> *) exposureInfoForKeys:(NSArray<ENTemporaryExposureKey *> *) inKeys
                                attenuationThreshold:(uint8_t)attenuationThreshold
                                               error:(ENErrorOutType) outError
 {
-    // dedup exposure keys
+    // dedup exposure keys against every key already matched in this session, keeping the file order,
+    // and skip keys that matched nothing in an earlier session if no advertisement was saved since
     _tekCount += [inKeys count];
-    NSMutableDictionary<NSData *, ENTemporaryExposureKey *> *exposureKeyMap = [[NSMutableDictionary alloc] init];
+    ENTEKCache *tekCache = _highWaterMark ? [_database tekCache] : nil;
+    uint64_t highWaterMark = [_highWaterMark unsignedLongLongValue];
+    NSUInteger cachedTEKCount = 0;
+    NSMutableArray<ENTemporaryExposureKey *> *uniqueExposureKeys = [[NSMutableArray alloc] initWithCapacity:[inKeys count]];
     for (ENTemporaryExposureKey *exposureKey in inKeys) {
-        [exposureKeyMap setObject:exposureKey forKey:[exposureKey keyData]];
+        NSData *keyData = [exposureKey keyData];
+        if ([keyData length] == ENTEKLength && !en_tek_set_insert(&_matchedTEKs, (const uint8_t *) [keyData bytes])) {
+            _duplicateTEKCount++;
+            continue;
+        }
+        if ([tekCache shouldSkipKey:exposureKey attenuationThreshold:attenuationThreshold highWaterMark:highWaterMark]) {
+            cachedTEKCount++;
+            continue;
+        }
+        [uniqueExposureKeys addObject:exposureKey];
+    }
+    _cachedTEKCount += cachedTEKCount;
+    [_metrics addCount:cachedTEKCount toCounter:ENDetectionCounterCachedKeySkips];
+    if ([uniqueExposureKeys count] == 0) {
+        return @[];
     }
-    NSArray<ENTemporaryExposureKey *> *uniqueExposureKeys = [exposureKeyMap allValues];
 
     NSArray<ENExposureInfo *> *aggregateExposureInfo = nil;
     __block NSData *matchingAdvertisementBuffer = nil;
 
     @autoreleasepool {
-        matchingAdvertisementBuffer = [self->_database advertisementsBufferMatchingDailyKeys:uniqueExposureKeys attenuationThreshold:attenuationThreshold];
+        NSData *aemks = nil;
+        matchingAdvertisementBuffer = [self->_database advertisementsBufferMatchingDailyKeys:uniqueExposureKeys
+                                                                        attenuationThreshold:attenuationThreshold
+                                                                                       aemks:&aemks];
+
+        if (matchingAdvertisementBuffer && tekCache) {
+            [self recordUnmatchedKeys:uniqueExposureKeys
+                inAdvertisementBuffer:matchingAdvertisementBuffer
+                             tekCache:tekCache
+                 attenuationThreshold:attenuationThreshold
+                        highWaterMark:highWaterMark];
+        }
 
         if (matchingAdvertisementBuffer) {
-            aggregateExposureInfo = [self aggregateExposureInfoForAdvertisementBuffer:matchingAdvertisementBuffer exposureKeys:uniqueExposureKeys];
+            ENDetectionStageTimer scoringTimer = [_metrics beginStage];
+            aggregateExposureInfo = [self aggregateExposureInfoForAdvertisementBuffer:matchingAdvertisementBuffer
+                                                                         exposureKeys:uniqueExposureKeys
+                                                                                aemks:aemks];
+            [_metrics endStage:ENDetectionStageScoring timer:scoringTimer];
+            [_metrics addCount:[aggregateExposureInfo count] toCounter:ENDetectionCounterExposures];
 
             // check bounds on the buffer as records could be added during a query session
             if (_cacheExposureInfo && (_cachedExposureInfoCount < _exposureInfoBufferSize)) {
@@ -476,6 +695,14 @@ static NSArray<ENAdvertisement *> *temporalyCombineAdvertisements(NSArray<ENAdve
     }
 
     if (!matchingAdvertisementBuffer) {
+        // the keys were never matched, so a retry with the same keys must not skip them as duplicates
+        for (ENTemporaryExposureKey *exposureKey in uniqueExposureKeys) {
+            NSData *keyData = [exposureKey keyData];
+            if ([keyData length] == ENTEKLength) {
+                en_tek_set_remove(&_matchedTEKs, (const uint8_t *) [keyData bytes]);
+            }
+        }
+
         NSDictionary *errorUserInfo = @{
             NSLocalizedDescriptionKey: @"Error encountered querying database"
         };
@@ -49,17 +49,43 @@ typedef NS_ERROR_ENUM(ENAdvertisementStoreErrorDomain, ENAdvertisementStoreError
 /*
  *  Current count of advertisements stored in SQLite database. This class does
  *  no in-memory caching of advertisements, so this represents the actual count
- *  persisted on disk;
+ *  persisted on disk. It is kept up to date as advertisements are saved;
  */
 @property (nonatomic, nullable, readonly) NSNumber *storedAdvertisementCount;
 
+/*
+ *  Random identifier chosen when the database was created. A store that is erased and
+ *  recreated gets a new identifier, so anything recorded against the old one can be discarded.
+ */
+@property (nonatomic, readonly) uint64_t storeIdentifier;
+
+/*
+ *  Count of advertisements ever inserted into the store, persisted with them. It never decreases,
+ *  so an unchanged high water mark means no advertisement has been saved since it was read,
+ *  including by another connection to the same database. Returns nil if it cannot be read.
+ */
+- (nullable NSNumber *)highWaterMarkWithError:(NSError * _Nullable __autoreleasing * _Nullable)error;
+
 /*
  *  Generate a query filter for this backing store. A query filter can be used eliminate RPIs that
- *  cannot possibly be in the database.
+ *  cannot possibly be in the database. RPIs saved while the filter is alive are added to it.
  */
 - (nullable ENQueryFilter *)queryFilterWithBufferSize:(NSUInteger)bufferSize
                                             hashCount:(NSUInteger)hashCount
                                  attenuationThreshold:(uint8_t)attenuationThreshold;
+
+/*
+ *  Save a batch of advertisements, such as all advertisements aggregated from one scan,
+ *  in a single transaction. The rpi, encrypted_aem, timestamp, scan_interval, rssi,
+ *  saturated and count fields are stored. An advertisement with the same RPI and
+ *  timestamp as one already stored is skipped. If any insert fails, the whole batch
+ *  is rolled back. May be called from any thread; the store serializes it with queries,
+ *  and live query filters hold every saved RPI by the time it returns.
+ */
+- (BOOL)saveAdvertisements:(const en_advertisement_t *)advertisements
+                     count:(NSUInteger)count
+                     error:(NSError * _Nullable __autoreleasing * _Nullable)error;
+
 /*
  *  Get a list of en_advertisement_t with RPIs contained in the input RPI buffer.
  *
@@ -8,6 +8,7 @@
  *
  */
 
+#import <os/lock.h>
 #import <sqlite3.h>
 
 #import "ENAdvertisement_Private.h"
@@ -20,6 +21,7 @@
 #define MAX_TEMPORARY_STORES (10)
 #define CENTRAL_STORE_FILENAME "en_advertisements.db"
 #define ADVERTISEMENT_TABLE_NAME "en_advertisements"
+#define STORE_STATE_TABLE_NAME "en_advertisement_store_state"
 
 NSString *const ENAdvertisementStoreErrorDomain = @"ENAdvertisementStoreErrorDomain";
 
@@ -40,6 +42,9 @@ typedef NS_ENUM(NSUInteger, ENAdvertisementDatabaseStatementType) {
     ENAdvertisementDatabaseStatementTypeRowCount,
     ENAdvertisementDatabaseStatementTypeList,
     ENAdvertisementDatabaseStatementTypeQuery,
+    ENAdvertisementDatabaseStatementTypeInsert,
+    ENAdvertisementDatabaseStatementTypeStoreState,
+    ENAdvertisementDatabaseStatementTypeAdvanceHighWaterMark,
     ENAdvertisementDatabaseStatementTypeCount
 };
 
@@ -52,11 +57,21 @@ typedef BOOL (^ENAdvertisementEnumerationCallback)(en_advertisement_t advertisem
 
 @end
 
+/*
+ *  The store is saved to from the manager's aggregation queue while query sessions read it on their own threads,
+ *  so each public method holds _lock for as long as it uses the database handle, the prepared statements, the
+ *  cached count or the set of active query filters. The private helpers, including the ...Locked bodies of the
+ *  public methods, expect the caller to hold it.
+ */
 @implementation ENAdvertisementSQLiteStore {
+    os_unfair_lock _lock;
     sqlite3 *_database;
     sqlite3_stmt **_preparedStatements;
+    NSHashTable<ENQueryFilter *> *_activeQueryFilters;
 }
 
+@synthesize storedAdvertisementCount = _storedAdvertisementCount;
+
 #pragma mark - Initialization
 
 + (instancetype)centralStoreInFolderPath:(NSString *)folderPath
@@ -68,7 +83,9 @@ typedef BOOL (^ENAdvertisementEnumerationCallback)(en_advertisement_t advertisem
 - (instancetype)initWithPath:(NSString *)path
 {
     if (self = [super init]) {
+        _lock = OS_UNFAIR_LOCK_INIT;
         _databasePath = path;
+        _activeQueryFilters = [NSHashTable weakObjectsHashTable];
         if (![self connectToDatabase]) {
             return nil;
         }
@@ -95,9 +112,23 @@ typedef BOOL (^ENAdvertisementEnumerationCallback)(en_advertisement_t advertisem
             return @"SELECT * FROM " ADVERTISEMENT_TABLE_NAME ";";
 
         case ENAdvertisementDatabaseStatementTypeQuery:
+            // Exposure info is aggregated over runs of the same key, so matches must come out grouped by key. The join alone
+            // doesn't promise any order.
             return @"SELECT " ADVERTISEMENT_TABLE_NAME ".*, rpi_buffer.daily_tracing_key_index, rpi_buffer.rpi_index "
             "FROM " ADVERTISEMENT_TABLE_NAME ", en_sqlite_rpi_buffer(?1, ?2, ?3, ?4) AS rpi_buffer "
-            "WHERE " ADVERTISEMENT_TABLE_NAME ".rpi=rpi_buffer.rpi;";
+            "WHERE " ADVERTISEMENT_TABLE_NAME ".rpi=rpi_buffer.rpi "
+            "ORDER BY rpi_buffer.daily_tracing_key_index;";
+
+        case ENAdvertisementDatabaseStatementTypeInsert:
+            return @"INSERT OR IGNORE INTO " ADVERTISEMENT_TABLE_NAME " "
+            "(rpi, encrypted_aem, timestamp, scan_interval, rssi, saturated, counter) "
+            "VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7);";
+
+        case ENAdvertisementDatabaseStatementTypeStoreState:
+            return @"SELECT store_identifier, high_water_mark FROM " STORE_STATE_TABLE_NAME " WHERE id=0;";
+
+        case ENAdvertisementDatabaseStatementTypeAdvanceHighWaterMark:
+            return @"UPDATE " STORE_STATE_TABLE_NAME " SET high_water_mark=high_water_mark+?1 WHERE id=0;";
 
         default:
             return nil;
@@ -148,6 +179,15 @@ typedef BOOL (^ENAdvertisementEnumerationCallback)(en_advertisement_t advertisem
         }
     }
 
+    // query the store identifier
+    if (result == SQLITE_OK) {
+        NSError *stateQueryError = nil;
+        if (![self highWaterMarkLockedWithError:&stateQueryError]) {
+            result = SQLITE_ERROR;
+            EN_ERROR_PRINTF("Failed to read store state. exposureNotificationDatabasePath: %s", path);
+        }
+    }
+
     // clean up if anything failed
     if (result != SQLITE_OK) {
         // Failed to open database
@@ -218,6 +258,21 @@ typedef BOOL (^ENAdvertisementEnumerationCallback)(en_advertisement_t advertisem
             EN_ERROR_PRINTF("Failed to create timestamp index with error %d (%s, %d)", result, sqlite3_errmsg(_database), sqlite3_extended_errcode(_database));
         }
     }
+
+    // a single row identifying this store and counting every advertisement ever inserted into it,
+    // seeded with the rows of a store that predates the table
+    if (result == SQLITE_OK) {
+        NSString *createStateStatement = @"CREATE TABLE IF NOT EXISTS " STORE_STATE_TABLE_NAME
+                                          "(id INTEGER PRIMARY KEY, "
+                                          "store_identifier INTEGER, "
+                                          "high_water_mark INTEGER);"
+                                          "INSERT OR IGNORE INTO " STORE_STATE_TABLE_NAME " (id, store_identifier, high_water_mark) "
+                                          "VALUES (0, random(), (SELECT COUNT(*) FROM " ADVERTISEMENT_TABLE_NAME "));";
+        result = sqlite3_exec(_database, [createStateStatement UTF8String], NULL, NULL, NULL);
+        if (result != SQLITE_OK) {
+            EN_ERROR_PRINTF("Failed to create store state table with error %d (%s, %d)", result, sqlite3_errmsg(_database), sqlite3_extended_errcode(_database));
+        }
+    }
     return result;
 }
 
@@ -311,6 +366,15 @@ typedef BOOL (^ENAdvertisementEnumerationCallback)(en_advertisement_t advertisem
     return result;
 }
 
+- (int)rollbackDatabaseTransaction
+{
+    int result = sqlite3_exec(_database, "ROLLBACK;", NULL, NULL, NULL);
+    if (result != SQLITE_OK) {
+        EN_ERROR_PRINTF("Failed to roll back transaction with error %d (%s, %d)", result, sqlite3_errmsg(_database), sqlite3_extended_errcode(_database));
+    }
+    return result;
+}
+
 - (sqlite3_stmt *)preparedStatementOfType:(ENAdvertisementDatabaseStatementType)statementType
 {
     sqlite3_stmt *statement = _preparedStatements[statementType];
@@ -373,6 +437,61 @@ typedef BOOL (^ENAdvertisementEnumerationCallback)(en_advertisement_t advertisem
     return (result == SQLITE_ROW);
 }
 
+- (nullable NSNumber *)storedAdvertisementCount
+{
+    os_unfair_lock_lock(&_lock);
+    NSNumber *count = _storedAdvertisementCount;
+    os_unfair_lock_unlock(&_lock);
+    return count;
+}
+
+- (nullable NSNumber *)highWaterMarkWithError:(NSError * _Nullable __autoreleasing * _Nullable)error
+{
+    os_unfair_lock_lock(&_lock);
+    NSNumber *highWaterMark = [self highWaterMarkLockedWithError:error];
+    os_unfair_lock_unlock(&_lock);
+    return highWaterMark;
+}
+
+- (nullable NSNumber *)highWaterMarkLockedWithError:(NSError * _Nullable __autoreleasing * _Nullable)error
+{
+    sqlite3_stmt *statement = [self preparedStatementOfType:ENAdvertisementDatabaseStatementTypeStoreState];
+    NSNumber *highWaterMark = nil;
+
+    int result = sqlite3_step(statement);
+    if (result == SQLITE_ROW) {
+        _storeIdentifier = (uint64_t) sqlite3_column_int64(statement, 0);
+        highWaterMark = @((uint64_t) sqlite3_column_int64(statement, 1));
+    } else {
+        EN_ERROR_PRINTF("Failed to execute sqlite store state statement %d (%s, %d)", result, sqlite3_errmsg(_database), sqlite3_extended_errcode(_database));
+        if (error) {
+            *error = [[self class] errorForSQLiteResult:result];
+        }
+    }
+    sqlite3_reset(statement);
+
+    return highWaterMark;
+}
+
+- (int)advanceHighWaterMarkBy:(NSUInteger)insertedCount
+{
+    sqlite3_stmt *statement = [self preparedStatementOfType:ENAdvertisementDatabaseStatementTypeAdvanceHighWaterMark];
+
+    int result = sqlite3_bind_int64(statement, 1, (sqlite3_int64) insertedCount);
+    if (result == SQLITE_OK) {
+        result = sqlite3_step(statement);
+        if (result == SQLITE_DONE) {
+            result = SQLITE_OK;
+        } else {
+            EN_ERROR_PRINTF("Failed to advance high water mark %d (%s, %d)", result, sqlite3_errmsg(_database), sqlite3_extended_errcode(_database));
+        }
+    }
+    sqlite3_reset(statement);
+    sqlite3_clear_bindings(statement);
+
+    return result;
+}
+
 - (int)enumerateAdvertisements:(ENAdvertisementEnumerationCallback)callback
 {
     sqlite3_stmt *statement = [self preparedStatementOfType:ENAdvertisementDatabaseStatementTypeList];
@@ -408,6 +527,7 @@ typedef BOOL (^ENAdvertisementEnumerationCallback)(en_advertisement_t advertisem
 {
     ENQueryFilter *filter = [[ENQueryFilter alloc] initWithBufferSize:bufferSize
                                                             hashCount:hashCount];
+    os_unfair_lock_lock(&_lock);
     int result = [self enumerateAdvertisements:^(en_advertisement_t advertisement) {
         [filter addPossibleRPI:advertisement.rpi];
         return YES;
@@ -418,9 +538,117 @@ typedef BOOL (^ENAdvertisementEnumerationCallback)(en_advertisement_t advertisem
         filter = nil;
     }
 
+    // keep the filter current as new advertisements are saved, registering it before the lock is released
+    // so no batch saved after the enumeration can be missed
+    if (filter) {
+        [_activeQueryFilters addObject:filter];
+    }
+    os_unfair_lock_unlock(&_lock);
+
     return filter;
 }
 
+- (int)bindAdvertisement:(const en_advertisement_t *)advertisement toSQLiteStatement:(sqlite3_stmt *)statement
+{
+    int result = sqlite3_bind_blob(statement, 1, advertisement->rpi, ENRPILength, SQLITE_STATIC);
+    if (result == SQLITE_OK) {
+        result = sqlite3_bind_blob(statement, 2, advertisement->encrypted_aem, AEM_LENGTH, SQLITE_STATIC);
+    }
+    if (result == SQLITE_OK) {
+        result = sqlite3_bind_int64(statement, 3, (sqlite3_int64) advertisement->timestamp);
+    }
+    if (result == SQLITE_OK) {
+        result = sqlite3_bind_int(statement, 4, advertisement->scan_interval);
+    }
+    if (result == SQLITE_OK) {
+        result = sqlite3_bind_int(statement, 5, advertisement->rssi);
+    }
+    if (result == SQLITE_OK) {
+        result = sqlite3_bind_int(statement, 6, advertisement->saturated);
+    }
+    if (result == SQLITE_OK) {
+        result = sqlite3_bind_int(statement, 7, advertisement->count);
+    }
+    if (result != SQLITE_OK) {
+        EN_ERROR_PRINTF("Failed to bind advertisement to insert statement (%s, %d)", sqlite3_errmsg(_database), sqlite3_extended_errcode(_database));
+    }
+    return result;
+}
+
+- (BOOL)saveAdvertisements:(const en_advertisement_t *)advertisements
+                     count:(NSUInteger)count
+                     error:(NSError * _Nullable __autoreleasing * _Nullable)error
+{
+    if (count == 0) {
+        return YES;
+    }
+
+    os_unfair_lock_lock(&_lock);
+    BOOL success = [self saveAdvertisementsLocked:advertisements count:count error:error];
+    os_unfair_lock_unlock(&_lock);
+    return success;
+}
+
+- (BOOL)saveAdvertisementsLocked:(const en_advertisement_t *)advertisements
+                           count:(NSUInteger)count
+                           error:(NSError * _Nullable __autoreleasing * _Nullable)error
+{
+    sqlite3_stmt *statement = [self preparedStatementOfType:ENAdvertisementDatabaseStatementTypeInsert];
+    NSUInteger insertedCount = 0;
+
+    int result = [self beginDatabaseTransaction];
+
+    if (result == SQLITE_OK) {
+        // insert each advertisement with the one prepared statement, skipping ones already stored
+        for (NSUInteger advertisementIndex = 0; (result == SQLITE_OK) && (advertisementIndex < count); advertisementIndex++) {
+            result = [self bindAdvertisement:&advertisements[advertisementIndex] toSQLiteStatement:statement];
+            if (result == SQLITE_OK) {
+                result = sqlite3_step(statement);
+                if (result == SQLITE_DONE) {
+                    insertedCount += (NSUInteger) sqlite3_changes(_database);
+                    result = SQLITE_OK;
+                } else {
+                    EN_ERROR_PRINTF("Failed to insert advertisement %d (%s, %d)", result, sqlite3_errmsg(_database), sqlite3_extended_errcode(_database));
+                }
+            }
+            sqlite3_reset(statement);
+        }
+        sqlite3_clear_bindings(statement);
+
+        // advance the high water mark in the same transaction as the rows it counts
+        if (result == SQLITE_OK && insertedCount > 0) {
+            result = [self advanceHighWaterMarkBy:insertedCount];
+        }
+
+        if (result == SQLITE_OK) {
+            result = [self endDatabaseTransaction];
+        }
+
+        // leave the database as it was if any part of the batch failed
+        if (result != SQLITE_OK) {
+            [self rollbackDatabaseTransaction];
+        }
+    }
+
+    if (result != SQLITE_OK) {
+        if (error) {
+            *error = [[self class] errorForSQLiteResult:result];
+        }
+        return NO;
+    }
+
+    // update the count and any live query filters without rereading the table
+    if (_storedAdvertisementCount) {
+        _storedAdvertisementCount = @([_storedAdvertisementCount unsignedIntegerValue] + insertedCount);
+    }
+    for (ENQueryFilter *filter in _activeQueryFilters) {
+        [filter addPossibleRPIs:advertisements[0].rpi count:count stride:sizeof(en_advertisement_t)];
+    }
+
+    EN_INFO_PRINTF("Saved %lu of %lu advertisements", (unsigned long) insertedCount, (unsigned long) count);
+    return YES;
+}
+
 - (int)bindRPIBuffer:(const void *)buffer
                count:(NSUInteger)bufferRPICount
       validityBuffer:(const void *)validityBuffer
@@ -462,15 +690,33 @@ typedef BOOL (^ENAdvertisementEnumerationCallback)(en_advertisement_t advertisem
                                    validRPICount:(NSUInteger)validRPICount
                      matchingAdvertisementBuffer:(en_advertisement_t *_Nonnull *_Nullable)matchBufferOut
                                            error:(NSError * _Nullable __autoreleasing * _Nullable)error;
+{
+    os_unfair_lock_lock(&_lock);
+    NSUInteger matchingAdvertisementCount = [self getAdvertisementsMatchingRPIBufferLocked:buffer
+                                                                                     count:bufferRPICount
+                                                                            validityBuffer:validityBuffer
+                                                                             validRPICount:validRPICount
+                                                               matchingAdvertisementBuffer:matchBufferOut
+                                                                                     error:error];
+    os_unfair_lock_unlock(&_lock);
+    return matchingAdvertisementCount;
+}
+
+- (NSUInteger)getAdvertisementsMatchingRPIBufferLocked:(const void *)buffer
+                                                 count:(NSUInteger)bufferRPICount
+                                        validityBuffer:(const void *)validityBuffer
+                                         validRPICount:(NSUInteger)validRPICount
+                           matchingAdvertisementBuffer:(en_advertisement_t *_Nonnull *_Nullable)matchBufferOut
+                                                 error:(NSError * _Nullable __autoreleasing * _Nullable)error
 {
     // Ensure we know the maximum buffer size
-    if (![self storedAdvertisementCount] && ![self refreshStoredAdvertisementCountWithError:error]) {
+    if (!_storedAdvertisementCount && ![self refreshStoredAdvertisementCountWithError:error]) {
         EN_ERROR_PRINTF("Failed to refresh stored advertisement count");
         return 0;
     }
 
     NSUInteger matchingAdvertisementCount = 0;
-    NSUInteger maxAdvertisementMatches = [[self storedAdvertisementCount] unsignedIntValue];
+    NSUInteger maxAdvertisementMatches = [_storedAdvertisementCount unsignedIntValue];
 
     en_advertisement_t *matchBuffer = (en_advertisement_t *) calloc(maxAdvertisementMatches, sizeof(en_advertisement_t));
     if (!matchBuffer) {
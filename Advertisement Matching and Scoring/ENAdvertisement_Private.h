@@ -17,6 +17,13 @@
 #define AEM_LENGTH (4)
 #define DAILY_KEY_INDEX_INVALID UINT32_MAX
 
+// Matching rules shared by ENAdvertisementDatabase and ENTEKCache
+#define ADVERTISEMENT_TOLERANCE_CTIN (12)   // 2 hours (2 * 60 * 60 / (10 * 60))
+#define ADVERTISEMENT_AGE_THRESHOLD (14 * 24 * 60 * 60) // 2 weeks
+
+/// Number of seconds in 1 ENIntervalNumber.
+#define ENSecondsPerENIntervalNumber        ( 60 * 10 )
+
 typedef struct __attribute__((packed)) {
     char rpi[ENRPILength];
     char encrypted_aem[AEM_LENGTH];
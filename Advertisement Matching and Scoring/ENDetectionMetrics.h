@@ -0,0 +1,122 @@
+/*
+ *      Copyright (C) 2020 Apple Inc. All Rights Reserved.
+ *
+ *      ExposureNotification is licensed under Apple Inc.’s
+ *      Sample Code License Agreement, which is contained in
+ *      the LICENSE file distributed with ExposureNotification,
+ *      and only to those who accept that license.
+ *
+ */
+
+#pragma once
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/*
+ *  Stages of matching a key file against the on-device database, in the order they run for each batch of keys.
+ */
+typedef NS_ENUM(NSUInteger, ENDetectionStage) {
+    ENDetectionStageKeyParsing = 0,             // Reading TEKs from the ENFile
+    ENDetectionStageRPIGeneration,              // Generating the 144 RPIs for each TEK
+    ENDetectionStageQueryFilter,                // Checking RPIs against the query filter
+    ENDetectionStageSQLiteMatch,                // Looking up the remaining RPIs in SQLite
+    ENDetectionStageAdvertisementValidation,    // Checking CTIN and attenuation of matched advertisements
+    ENDetectionStageScoring,                    // Building ENExposureInfo from the valid advertisements
+    ENDetectionStageCount
+};
+
+/*
+ *  Event counts over a session. Each is added to once per batch of keys, not per RPI or advertisement.
+ */
+typedef NS_ENUM(NSUInteger, ENDetectionCounter) {
+    ENDetectionCounterKeysParsed = 0,           // TEKs read from key files
+    ENDetectionCounterCachedKeySkips,           // TEKs skipped as they matched nothing in an earlier run
+    ENDetectionCounterRPIsGenerated,            // RPIs derived from those TEKs
+    ENDetectionCounterFilterPasses,             // RPIs the query filter could not rule out
+    ENDetectionCounterFilterRejects,            // RPIs the query filter ruled out
+    ENDetectionCounterSQLiteRows,               // Rows returned by the SQLite match query
+    ENDetectionCounterExpiredDrops,             // Matched advertisements older than the age threshold
+    ENDetectionCounterCTINDrops,                // Matched advertisements seen outside their RPI's interval tolerance
+    ENDetectionCounterAttenuationDrops,         // Matched advertisements at or above the attenuation threshold
+    ENDetectionCounterExposures,                // ENExposureInfo produced
+    ENDetectionCounterAllocatedBytes,           // Bytes of RPI, validity and match buffers allocated
+    ENDetectionCounterCount
+};
+
+/*
+ *  Totals for one stage over a session.
+ */
+typedef struct {
+    uint64_t count;                 // Number of times the stage ran
+    uint64_t wallNanoseconds;
+    uint64_t cpuNanoseconds;        // CPU time of the calling thread
+    int64_t allocatedBytes;         // Net change in bytes allocated with malloc, when tracking allocations
+    int64_t allocatedBlocks;        // Net change in blocks allocated with malloc, when tracking allocations
+    uint64_t peakResidentBytes;     // Peak resident size of the process when the stage last finished, when tracking allocations
+} ENDetectionStageMetrics;
+
+/*
+ *  Start of one run of a stage.
+ */
+typedef struct {
+    uint64_t wallStart;
+    uint64_t cpuStart;
+    size_t bytesInUse;
+    size_t blocksInUse;
+} ENDetectionStageTimer;
+
+/*
+ *  Starts timing a stage. Tracking allocations reads the malloc statistics of every zone, which is cheap enough to do
+ *  per batch of keys but not per advertisement.
+ */
+ENDetectionStageTimer ENDetectionStageTimerStart(BOOL tracksAllocations);
+
+/*
+ *  Adds the time (and allocations) since the timer was started to the stage metrics.
+ */
+void ENDetectionStageTimerStop(ENDetectionStageTimer timer, BOOL tracksAllocations, ENDetectionStageMetrics *ioMetrics);
+
+/*
+ *  Per stage timing and event counts of an exposure detection session. A session has one of these, which it shares
+ *  with its query session and database. Messaging a nil ENDetectionMetrics is free of side effects, so stages are
+ *  timed and counted unconditionally. Safe to read from another thread while the session is matching.
+ */
+@interface ENDetectionMetrics : NSObject
+
+/*
+ *  Also record malloc allocations and peak resident size for each stage. Off by default.
+ */
+@property (nonatomic) BOOL tracksAllocations;
+
+- (ENDetectionStageTimer)beginStage;
+- (void)endStage:(ENDetectionStage)stage timer:(ENDetectionStageTimer)timer;
+
+- (ENDetectionStageMetrics)metricsForStage:(ENDetectionStage)stage;
+
+- (void)addCount:(uint64_t)count toCounter:(ENDetectionCounter)counter;
+- (uint64_t)valueForCounter:(ENDetectionCounter)counter;
+
+/*
+ *  Short name for the stage, e.g. "sqliteMatch".
+ */
++ (NSString *)nameForStage:(ENDetectionStage)stage;
+
+/*
+ *  Short name for the counter, e.g. "filterPasses".
+ */
++ (NSString *)nameForCounter:(ENDetectionCounter)counter;
+
+/*
+ *  All counters and stage totals in the Prometheus text exposition format. The labels, e.g. a device or fleet
+ *  identifier, are added to every sample. Label values are escaped. Labels whose names don't match
+ *  [a-zA-Z_][a-zA-Z0-9_]*, start with "__" or are "stage" are left out.
+ */
+- (NSString *)prometheusTextWithLabels:(nullable NSDictionary<NSString *, NSString *> *)labels;
+
+- (void)reset;
+
+@end
+
+NS_ASSUME_NONNULL_END
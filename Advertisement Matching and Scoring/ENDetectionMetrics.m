@@ -0,0 +1,318 @@
+/*
+ *      Copyright (C) 2020 Apple Inc. All Rights Reserved.
+ *
+ *      ExposureNotification is licensed under Apple Inc.’s
+ *      Sample Code License Agreement, which is contained in
+ *      the LICENSE file distributed with ExposureNotification,
+ *      and only to those who accept that license.
+ *
+ */
+
+#import <malloc/malloc.h>
+#import <os/lock.h>
+#import <stdatomic.h>
+#import <sys/resource.h>
+#import <time.h>
+
+#import "ENDetectionMetrics.h"
+#import "ENShims.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+ENDetectionStageTimer ENDetectionStageTimerStart(BOOL tracksAllocations)
+{
+    ENDetectionStageTimer timer = {0};
+    if (tracksAllocations) {
+        malloc_statistics_t statistics;
+        malloc_zone_statistics(NULL, &statistics);
+        timer.bytesInUse = statistics.size_in_use;
+        timer.blocksInUse = statistics.blocks_in_use;
+    }
+    timer.cpuStart = clock_gettime_nsec_np(CLOCK_THREAD_CPUTIME_ID);
+    timer.wallStart = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    return timer;
+}
+
+void ENDetectionStageTimerStop(ENDetectionStageTimer timer, BOOL tracksAllocations, ENDetectionStageMetrics *ioMetrics)
+{
+    uint64_t wallEnd = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    uint64_t cpuEnd = clock_gettime_nsec_np(CLOCK_THREAD_CPUTIME_ID);
+
+    ioMetrics->count++;
+    ioMetrics->wallNanoseconds += wallEnd - timer.wallStart;
+    ioMetrics->cpuNanoseconds += cpuEnd - timer.cpuStart;
+
+    if (tracksAllocations) {
+        malloc_statistics_t statistics;
+        malloc_zone_statistics(NULL, &statistics);
+        ioMetrics->allocatedBytes += (int64_t)statistics.size_in_use - (int64_t)timer.bytesInUse;
+        ioMetrics->allocatedBlocks += (int64_t)statistics.blocks_in_use - (int64_t)timer.blocksInUse;
+
+        // ru_maxrss is in bytes on Darwin
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) == 0) {
+            ioMetrics->peakResidentBytes = (uint64_t)usage.ru_maxrss;
+        }
+    }
+}
+
+/*
+ *  Prometheus metric name and help text for each counter.
+ */
+static const struct {
+    const char *name;
+    const char *help;
+} kENDetectionCounterDescriptions[ENDetectionCounterCount] = {
+    { "en_detection_keys_parsed_total", "Temporary exposure keys read from key files." },
+    { "en_detection_cached_key_skips_total", "Temporary exposure keys skipped as they matched nothing in an earlier run." },
+    { "en_detection_rpis_generated_total", "Rolling proximity identifiers derived from temporary exposure keys." },
+    { "en_detection_filter_passes_total", "RPIs the query filter could not rule out." },
+    { "en_detection_filter_rejects_total", "RPIs the query filter ruled out." },
+    { "en_detection_sqlite_rows_total", "Rows returned by the SQLite match query." },
+    { "en_detection_expired_drops_total", "Matched advertisements dropped for being older than the age threshold." },
+    { "en_detection_ctin_drops_total", "Matched advertisements dropped for being seen outside their RPI's interval tolerance." },
+    { "en_detection_attenuation_drops_total", "Matched advertisements dropped for being at or above the attenuation threshold." },
+    { "en_detection_exposures_total", "Exposure infos produced." },
+    { "en_detection_allocated_bytes_total", "Bytes of RPI, validity and match buffers allocated." },
+};
+
+@implementation ENDetectionMetrics {
+    os_unfair_lock _stageLock;
+    ENDetectionStageMetrics _stages[ENDetectionStageCount];
+    _Atomic uint64_t _counters[ENDetectionCounterCount];
+}
+
+- (instancetype)init
+{
+    if (self = [super init]) {
+        _stageLock = OS_UNFAIR_LOCK_INIT;
+        for (NSUInteger i = 0; i < ENDetectionCounterCount; i++) {
+            atomic_init(&_counters[i], 0);
+        }
+    }
+    return self;
+}
+
+- (ENDetectionStageTimer)beginStage
+{
+    return ENDetectionStageTimerStart(_tracksAllocations);
+}
+
+- (void)endStage:(ENDetectionStage)stage timer:(ENDetectionStageTimer)timer
+{
+    if (stage >= ENDetectionStageCount) {
+        return;
+    }
+    ENDetectionStageMetrics run = {0};
+    ENDetectionStageTimerStop(timer, _tracksAllocations, &run);
+
+    os_unfair_lock_lock(&_stageLock);
+    ENDetectionStageMetrics *metrics = &_stages[stage];
+    metrics->count += run.count;
+    metrics->wallNanoseconds += run.wallNanoseconds;
+    metrics->cpuNanoseconds += run.cpuNanoseconds;
+    metrics->allocatedBytes += run.allocatedBytes;
+    metrics->allocatedBlocks += run.allocatedBlocks;
+    if (_tracksAllocations) {
+        metrics->peakResidentBytes = run.peakResidentBytes;
+    }
+    os_unfair_lock_unlock(&_stageLock);
+}
+
+- (ENDetectionStageMetrics)metricsForStage:(ENDetectionStage)stage
+{
+    if (stage >= ENDetectionStageCount) {
+        return (ENDetectionStageMetrics){0};
+    }
+    os_unfair_lock_lock(&_stageLock);
+    ENDetectionStageMetrics metrics = _stages[stage];
+    os_unfair_lock_unlock(&_stageLock);
+    return metrics;
+}
+
+- (void)addCount:(uint64_t)count toCounter:(ENDetectionCounter)counter
+{
+    if (counter >= ENDetectionCounterCount || count == 0) {
+        return;
+    }
+    atomic_fetch_add_explicit(&_counters[counter], count, memory_order_relaxed);
+}
+
+- (uint64_t)valueForCounter:(ENDetectionCounter)counter
+{
+    if (counter >= ENDetectionCounterCount) {
+        return 0;
+    }
+    return atomic_load_explicit(&_counters[counter], memory_order_relaxed);
+}
+
++ (NSString *)nameForStage:(ENDetectionStage)stage
+{
+    switch (stage) {
+        case ENDetectionStageKeyParsing:
+            return @"keyParsing";
+        case ENDetectionStageRPIGeneration:
+            return @"rpiGeneration";
+        case ENDetectionStageQueryFilter:
+            return @"queryFilter";
+        case ENDetectionStageSQLiteMatch:
+            return @"sqliteMatch";
+        case ENDetectionStageAdvertisementValidation:
+            return @"advertisementValidation";
+        case ENDetectionStageScoring:
+            return @"scoring";
+        default:
+            return @"unknown";
+    }
+}
+
++ (NSString *)nameForCounter:(ENDetectionCounter)counter
+{
+    switch (counter) {
+        case ENDetectionCounterKeysParsed:
+            return @"keysParsed";
+        case ENDetectionCounterCachedKeySkips:
+            return @"cachedKeySkips";
+        case ENDetectionCounterRPIsGenerated:
+            return @"rpisGenerated";
+        case ENDetectionCounterFilterPasses:
+            return @"filterPasses";
+        case ENDetectionCounterFilterRejects:
+            return @"filterRejects";
+        case ENDetectionCounterSQLiteRows:
+            return @"sqliteRows";
+        case ENDetectionCounterExpiredDrops:
+            return @"expiredDrops";
+        case ENDetectionCounterCTINDrops:
+            return @"ctinDrops";
+        case ENDetectionCounterAttenuationDrops:
+            return @"attenuationDrops";
+        case ENDetectionCounterExposures:
+            return @"exposures";
+        case ENDetectionCounterAllocatedBytes:
+            return @"allocatedBytes";
+        default:
+            return @"unknown";
+    }
+}
+
+/*
+ *  Label values may not contain a raw backslash, double quote or newline.
+ */
+static NSString *ENPrometheusEscapedLabelValue(NSString *value)
+{
+    NSMutableString *escaped = [value mutableCopy];
+    [escaped replaceOccurrencesOfString:@"\\" withString:@"\\\\" options:0 range:NSMakeRange(0, escaped.length)];
+    [escaped replaceOccurrencesOfString:@"\"" withString:@"\\\"" options:0 range:NSMakeRange(0, escaped.length)];
+    [escaped replaceOccurrencesOfString:@"\n" withString:@"\\n" options:0 range:NSMakeRange(0, escaped.length)];
+    return escaped;
+}
+
+/*
+ *  Label names must match [a-zA-Z_][a-zA-Z0-9_]*. Names starting with "__" are reserved for Prometheus, and "stage"
+ *  is added to the stage samples here.
+ */
+static BOOL ENPrometheusIsValidLabelName(NSString *name)
+{
+    if (name.length == 0 || [name hasPrefix:@"__"] || [name isEqualToString:@"stage"]) {
+        return NO;
+    }
+    for (NSUInteger i = 0; i < name.length; i++) {
+        unichar c = [name characterAtIndex:i];
+        BOOL isLetter = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c == '_');
+        BOOL isDigit = (c >= '0' && c <= '9');
+        if (!isLetter && !(isDigit && i > 0)) {
+            return NO;
+        }
+    }
+    return YES;
+}
+
+static void ENPrometheusAppendSample(NSMutableString *text, const char *name, NSString *labels, NSString *stage, NSString *value)
+{
+    [text appendFormat:@"%s", name];
+    if (labels.length || stage) {
+        [text appendString:@"{"];
+        [text appendString:labels];
+        if (stage) {
+            [text appendFormat:@"%@stage=\"%@\"", (labels.length ? @"," : @""), stage];
+        }
+        [text appendString:@"}"];
+    }
+    [text appendFormat:@" %@\n", value];
+}
+
+- (NSString *)prometheusTextWithLabels:(nullable NSDictionary<NSString *, NSString *> *)labels
+{
+    NSMutableArray<NSString *> *labelPairs = [[NSMutableArray alloc] init];
+    for (NSString *key in [[labels allKeys] sortedArrayUsingSelector:@selector(compare:)]) {
+        if (!ENPrometheusIsValidLabelName(key)) {
+            EN_ERROR_PRINTF("Dropping invalid Prometheus label name '%@'", key);
+            continue;
+        }
+        [labelPairs addObject:[NSString stringWithFormat:@"%@=\"%@\"", key, ENPrometheusEscapedLabelValue(labels[key])]];
+    }
+    NSString *labelText = [labelPairs componentsJoinedByString:@","];
+
+    NSMutableString *text = [[NSMutableString alloc] init];
+    for (NSUInteger i = 0; i < ENDetectionCounterCount; i++) {
+        const char *name = kENDetectionCounterDescriptions[i].name;
+        [text appendFormat:@"# HELP %s %s\n# TYPE %s counter\n", name, kENDetectionCounterDescriptions[i].help, name];
+        ENPrometheusAppendSample(text, name, labelText, nil, @([self valueForCounter:(ENDetectionCounter)i]).stringValue);
+    }
+
+    ENDetectionStageMetrics stages[ENDetectionStageCount];
+    for (NSUInteger i = 0; i < ENDetectionStageCount; i++) {
+        stages[i] = [self metricsForStage:(ENDetectionStage)i];
+    }
+
+    [text appendString:@"# HELP en_detection_stage_runs_total Times each matching stage ran.\n"
+                       @"# TYPE en_detection_stage_runs_total counter\n"];
+    for (NSUInteger i = 0; i < ENDetectionStageCount; i++) {
+        ENPrometheusAppendSample(text, "en_detection_stage_runs_total", labelText, [[self class] nameForStage:(ENDetectionStage)i],
+                                 @(stages[i].count).stringValue);
+    }
+    [text appendString:@"# HELP en_detection_stage_seconds_total Monotonic wall time spent in each matching stage.\n"
+                       @"# TYPE en_detection_stage_seconds_total counter\n"];
+    for (NSUInteger i = 0; i < ENDetectionStageCount; i++) {
+        ENPrometheusAppendSample(text, "en_detection_stage_seconds_total", labelText, [[self class] nameForStage:(ENDetectionStage)i],
+                                 [NSString stringWithFormat:@"%.9f", stages[i].wallNanoseconds / 1e9]);
+    }
+    [text appendString:@"# HELP en_detection_stage_cpu_seconds_total CPU time of the matching thread in each matching stage.\n"
+                       @"# TYPE en_detection_stage_cpu_seconds_total counter\n"];
+    for (NSUInteger i = 0; i < ENDetectionStageCount; i++) {
+        ENPrometheusAppendSample(text, "en_detection_stage_cpu_seconds_total", labelText, [[self class] nameForStage:(ENDetectionStage)i],
+                                 [NSString stringWithFormat:@"%.9f", stages[i].cpuNanoseconds / 1e9]);
+    }
+
+    if (_tracksAllocations) {
+        // Net malloc change can be negative, so this is a gauge rather than a counter.
+        [text appendString:@"# HELP en_detection_stage_malloc_bytes Net change in malloc bytes in use across each matching stage.\n"
+                           @"# TYPE en_detection_stage_malloc_bytes gauge\n"];
+        uint64_t peakResidentBytes = 0;
+        for (NSUInteger i = 0; i < ENDetectionStageCount; i++) {
+            ENPrometheusAppendSample(text, "en_detection_stage_malloc_bytes", labelText, [[self class] nameForStage:(ENDetectionStage)i],
+                                     @(stages[i].allocatedBytes).stringValue);
+            peakResidentBytes = MAX(peakResidentBytes, stages[i].peakResidentBytes);
+        }
+        [text appendString:@"# HELP en_detection_peak_resident_bytes Peak resident size of the process seen by a matching stage.\n"
+                           @"# TYPE en_detection_peak_resident_bytes gauge\n"];
+        ENPrometheusAppendSample(text, "en_detection_peak_resident_bytes", labelText, nil, @(peakResidentBytes).stringValue);
+    }
+
+    return text;
+}
+
+- (void)reset
+{
+    os_unfair_lock_lock(&_stageLock);
+    memset(_stages, 0, sizeof(_stages));
+    os_unfair_lock_unlock(&_stageLock);
+    for (NSUInteger i = 0; i < ENDetectionCounterCount; i++) {
+        atomic_store_explicit(&_counters[i], 0, memory_order_relaxed);
+    }
+}
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -15,6 +15,7 @@
 
 #import "ENAdvertisementDatabase.h"
 #import "ENAdvertisementDatabaseQuerySession.h"
+#import "ENDetectionMetrics.h"
 #import "ENFile.h"
 
 NS_ASSUME_NONNULL_BEGIN
@@ -44,7 +45,8 @@ NS_ASSUME_NONNULL_BEGIN
 
 /*
  *  Generate an ENExposureDetectionSummary for the advertisements found in the on device database
- *  that originated from one of the TEKs provided via the addFile: method.
+ *  that originated from one of the TEKs provided via the addFile: method. Files are expected to
+ *  have all been added by now, so the TEKs that matched nothing are saved to the TEK cache.
  */
 - (ENExposureDetectionSummary *)generateSummary;
 
@@ -54,6 +56,12 @@ NS_ASSUME_NONNULL_BEGIN
  */
 - (NSArray<ENExposureInfo *> *)exposureInfo;
 
+/*
+ *  Time spent in each stage of matching the files added so far, and counts of keys, RPIs, filter results, SQLite
+ *  rows, dropped advertisements and exposures. Use -prometheusTextWithLabels: to export them.
+ */
+@property (nonatomic, readonly) ENDetectionMetrics *metrics;
+
 @end
 
 NS_ASSUME_NONNULL_END
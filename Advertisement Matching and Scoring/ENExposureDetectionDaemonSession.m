@@ -39,6 +39,10 @@
         _databaseQuerySession.attenuationDurationThresholds = _configuration.attenuationDurationThresholds;
 
         _matchedKeyCount = 0;
+
+        _metrics = [[ENDetectionMetrics alloc] init];
+        _database.metrics = _metrics;
+        _databaseQuerySession.metrics = _metrics;
     }
     return self;
 }
@@ -58,12 +62,15 @@
 
             // Match the TEKs in batches to reduce the peak memory usage
 
+            ENDetectionStageTimer parseTimer = [_metrics beginStage];
             for( ; tekCount < TEKBatchSize; ++tekCount )
             {
                 ENTemporaryExposureKey *key = [mainFile readTEKAndReturnError:&error];
                 if( !key ) break;
                 [tekArray addObject:key];
             }
+            [_metrics endStage:ENDetectionStageKeyParsing timer:parseTimer];
+            [_metrics addCount:tekCount toCounter:ENDetectionCounterKeysParsed];
             if( tekCount == 0 ) break;
 
             fileMatchCount += [_databaseQuerySession matchCountForKeys:tekArray attenuationThreshold:0xFF error:&error];
@@ -82,6 +89,10 @@
 
 - (ENExposureDetectionSummary *)generateSummary
 {
+    // All files have been added, so record the keys that matched nothing for the next detection.
+
+    [_databaseQuerySession saveTEKCacheWithError:NULL];
+
     // Process all the cached info to create the summary.
 
     __block uint32_t attenuationDurationSums[ 3 ] = { 0, 0, 0 };
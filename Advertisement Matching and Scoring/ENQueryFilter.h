@@ -48,12 +48,26 @@ NS_ASSUME_NONNULL_BEGIN
  */
 - (void)addPossibleRPI:(const void *)rpi;
 
+/*
+ *  Add count RPIs, stride bytes apart starting at rpis, taking the filter's
+ *  lock once for the batch. Used by the store as advertisements are saved.
+ */
+- (void)addPossibleRPIs:(const void *)rpis count:(NSUInteger)count stride:(size_t)stride;
+
 /*
  *  Is the provided RPI NOT in the local RPI database. RPI is
  *  assumed to be 16 bytes.
  */
 - (BOOL)shouldIgnoreRPI:(const void *)rpi;
 
+/*
+ *  Check count consecutive 16 byte RPIs under one hold of the filter's lock, setting
+ *  validityBuffer[i] to true for each one that may be in the database. Returns how
+ *  many were marked. The filter may be updated from another thread as advertisements
+ *  are saved, so all access goes through its lock.
+ */
+- (NSUInteger)markPossibleRPIs:(const void *)rpis count:(NSUInteger)count validityBuffer:(bool *)validityBuffer;
+
 @end
 
 NS_ASSUME_NONNULL_END
@@ -9,6 +9,9 @@
  */
 
 #import <ExposureNotification/ExposureNotification.h>
+#import <os/lock.h>
+
+#import "ENCommonPrivate.h"
 #import "ENQueryFilter.h"
 #import "ENShims.h"
 
@@ -24,6 +27,7 @@ uint64_t indexForRPI(const void *rpi, uint64_t salt, uint64_t bufferSize)
 }
 
 @implementation ENQueryFilter {
+    os_unfair_lock _lock;
     char *_filterBuffer;
     uint64_t *_hashSalts;
 }
@@ -38,6 +42,7 @@ uint64_t indexForRPI(const void *rpi, uint64_t salt, uint64_t bufferSize)
     EN_NOTICE_PRINTF("Initializing ENQueryFilter bufferSize:%d hashCount:%d", (int) size, (int) hashCount);
 
     if (self = [super init]) {
+        _lock = OS_UNFAIR_LOCK_INIT;
         _bufferSize = size;
         _filterBuffer = (char *) calloc(_bufferSize, 1);
         if (!_filterBuffer) {
@@ -65,7 +70,7 @@ uint64_t indexForRPI(const void *rpi, uint64_t salt, uint64_t bufferSize)
     free(_hashSalts);
 }
 
-- (void)addPossibleRPI:(const void *)rpi
+- (void)addPossibleRPILocked:(const void *)rpi
 {
     for (int i = 0; i < _hashCount; i++) {
         uint64_t index = indexForRPI(rpi, _hashSalts[i], _bufferSize * 8);
@@ -76,7 +81,7 @@ uint64_t indexForRPI(const void *rpi, uint64_t salt, uint64_t bufferSize)
     }
 }
 
-- (BOOL)shouldIgnoreRPI:(const void *)rpi
+- (BOOL)shouldIgnoreRPILocked:(const void *)rpi
 {
     for (int i = 0; i < _hashCount; i++) {
         uint64_t index = indexForRPI(rpi, _hashSalts[i], _bufferSize * 8);
@@ -90,4 +95,42 @@ uint64_t indexForRPI(const void *rpi, uint64_t salt, uint64_t bufferSize)
     return NO;
 }
 
+- (void)addPossibleRPI:(const void *)rpi
+{
+    os_unfair_lock_lock(&_lock);
+    [self addPossibleRPILocked:rpi];
+    os_unfair_lock_unlock(&_lock);
+}
+
+- (void)addPossibleRPIs:(const void *)rpis count:(NSUInteger)count stride:(size_t)stride
+{
+    os_unfair_lock_lock(&_lock);
+    for (NSUInteger rpiIndex = 0; rpiIndex < count; rpiIndex++) {
+        [self addPossibleRPILocked:(const uint8_t *) rpis + (rpiIndex * stride)];
+    }
+    os_unfair_lock_unlock(&_lock);
+}
+
+- (BOOL)shouldIgnoreRPI:(const void *)rpi
+{
+    os_unfair_lock_lock(&_lock);
+    BOOL shouldIgnore = [self shouldIgnoreRPILocked:rpi];
+    os_unfair_lock_unlock(&_lock);
+    return shouldIgnore;
+}
+
+- (NSUInteger)markPossibleRPIs:(const void *)rpis count:(NSUInteger)count validityBuffer:(bool *)validityBuffer
+{
+    NSUInteger possibleCount = 0;
+    os_unfair_lock_lock(&_lock);
+    for (NSUInteger rpiIndex = 0; rpiIndex < count; rpiIndex++) {
+        if (![self shouldIgnoreRPILocked:(const uint8_t *) rpis + (rpiIndex * ENRPILength)]) {
+            validityBuffer[rpiIndex] = true;
+            possibleCount++;
+        }
+    }
+    os_unfair_lock_unlock(&_lock);
+    return possibleCount;
+}
+
 @end
@@ -0,0 +1,78 @@
+/*
+ *      Copyright (C) 2020 Apple Inc. All Rights Reserved.
+ *
+ *      ExposureNotification is licensed under Apple Inc.’s
+ *      Sample Code License Agreement, which is contained in
+ *      the LICENSE file distributed with ExposureNotification,
+ *      and only to those who accept that license.
+ *
+ */
+
+#pragma once
+
+#import <Foundation/Foundation.h>
+#import <ExposureNotification/ExposureNotification.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/*
+ *  Persistent record of TEKs that matched no advertisement, kept next to the advertisement
+ *  store so that keys republished in later key files are not matched again. Each key is
+ *  stored as a 64 bit hash of the key, its rolling start number, rolling period and the
+ *  attenuation threshold it was matched with, together with the store high water mark it
+ *  was matched against.
+ *
+ *  A recorded key is skipped while the high water mark is unchanged, or for good once its
+ *  rolling period (plus the CTIN tolerance and a day for advertisements to be saved) had
+ *  ended before it was recorded. Only keys left without a valid advertisement after matching
+ *  are recorded, and the attenuation threshold is part of the hash, so skipping a key can
+ *  not change the exposures found.
+ */
+@interface ENTEKCache : NSObject
+
+/*
+ *  Path of the cache file for the central store in the specified folder.
+ */
++ (NSString *)tekCachePathInFolderPath:(NSString *)folderPath;
+
+/*
+ *  Open the cache for the central store in the specified folder. Records made against a
+ *  store with a different identifier are discarded.
+ */
++ (nullable instancetype)tekCacheInFolderPath:(NSString *)folderPath storeIdentifier:(uint64_t)storeIdentifier;
+
+/*
+ *  Open the cache stored at the specified path. A missing, unreadable or stale file
+ *  results in an empty cache, which replaces the file on the next save.
+ */
+- (nullable instancetype)initWithPath:(NSString *)path storeIdentifier:(uint64_t)storeIdentifier;
+
+/*
+ *  Count of records read from disk, not including records added since.
+ */
+@property (nonatomic, readonly) NSUInteger storedRecordCount;
+
+/*
+ *  Can matching this key be skipped, given the current high water mark of the store.
+ */
+- (BOOL)shouldSkipKey:(ENTemporaryExposureKey *)key
+ attenuationThreshold:(uint8_t)attenuationThreshold
+        highWaterMark:(uint64_t)highWaterMark;
+
+/*
+ *  Record a key for which the store held no advertisement when its high water mark was highWaterMark.
+ */
+- (void)addUnmatchedKey:(ENTemporaryExposureKey *)key
+   attenuationThreshold:(uint8_t)attenuationThreshold
+          highWaterMark:(uint64_t)highWaterMark;
+
+/*
+ *  Merge the added records into the file, along with any records another cache for the same
+ *  store saved since this one was read, dropping records for keys older than two weeks. The
+ *  file is replaced atomically. All methods may be called from any thread.
+ */
+- (BOOL)saveWithError:(NSError * _Nullable __autoreleasing * _Nullable)error;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,295 @@
+/*
+ *      Copyright (C) 2020 Apple Inc. All Rights Reserved.
+ *
+ *      ExposureNotification is licensed under Apple Inc.’s
+ *      Sample Code License Agreement, which is contained in
+ *      the LICENSE file distributed with ExposureNotification,
+ *      and only to those who accept that license.
+ *
+ */
+
+#import <corecrypto/ccdigest.h>
+#import <corecrypto/ccsha2.h>
+#import <os/lock.h>
+
+#import "ENTEKCache.h"
+#import "ENAdvertisement_Private.h"
+#import "ENShims.h"
+
+#pragma mark - Definitions
+
+#define TEK_CACHE_FILENAME "en_tek_cache.bin"
+#define TEK_CACHE_MAGIC (0x4B54454E) // "ENTK"
+#define TEK_CACHE_VERSION (1)
+
+#define TEK_CACHE_FINAL_HIGH_WATER_MARK UINT64_MAX
+#define TEK_CACHE_SETTLE_INTERVALS (ENTEKRollingPeriod)         // 1 day for seen advertisements to be saved
+#define TEK_CACHE_RETENTION_INTERVALS (ADVERTISEMENT_AGE_THRESHOLD / ENSecondsPerENIntervalNumber)
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t reserved;
+    uint64_t store_identifier;
+    uint64_t record_count;
+} en_tek_cache_header_t;
+
+typedef struct __attribute__((packed)) {
+    uint64_t key_hash;
+    uint64_t high_water_mark;   // TEK_CACHE_FINAL_HIGH_WATER_MARK once no new advertisement can match
+    uint32_t end_interval;      // last interval an advertisement of the key can have been seen in
+} en_tek_cache_record_t;
+
+static uint32_t ENTEKCacheCurrentInterval(void)
+{
+    return (uint32_t) ([[NSDate date] timeIntervalSince1970] / ENSecondsPerENIntervalNumber);
+}
+
+static uint32_t ENTEKCacheRollingPeriod(ENTemporaryExposureKey *key)
+{
+    uint32_t rollingPeriod = [key rollingPeriod];
+    return (rollingPeriod == 0) ? ENTEKRollingPeriod : rollingPeriod;
+}
+
+static uint64_t ENTEKCacheKeyHash(ENTemporaryExposureKey *key, uint8_t attenuationThreshold)
+{
+    uint8_t message[ENTEKLength + sizeof(uint32_t) + sizeof(uint32_t) + sizeof(uint8_t)] = {0};
+    NSData *keyData = [key keyData];
+    memcpy(message, [keyData bytes], MIN([keyData length], (NSUInteger) ENTEKLength));
+    uint32_t rollingStartNumber = OSSwapHostToLittleInt32([key rollingStartNumber]);
+    uint32_t rollingPeriod = OSSwapHostToLittleInt32(ENTEKCacheRollingPeriod(key));
+    memcpy(&message[ENTEKLength], &rollingStartNumber, sizeof(rollingStartNumber));
+    memcpy(&message[ENTEKLength + sizeof(uint32_t)], &rollingPeriod, sizeof(rollingPeriod));
+    message[sizeof(message) - 1] = attenuationThreshold;
+
+    uint8_t digest[CCSHA256_OUTPUT_SIZE];
+    ccdigest(ccsha256_di(), sizeof(message), message, digest);
+
+    uint64_t hash;
+    memcpy(&hash, digest, sizeof(hash));
+    return hash;
+}
+
+static int ENTEKCacheRecordCompare(const void *a, const void *b)
+{
+    const en_tek_cache_record_t *r1 = (const en_tek_cache_record_t *) a;
+    const en_tek_cache_record_t *r2 = (const en_tek_cache_record_t *) b;
+    if (r1->key_hash != r2->key_hash) {
+        return (r1->key_hash < r2->key_hash) ? -1 : 1;
+    }
+
+    // the newest record of a key, with the highest high water mark, sorts first
+    if (r1->high_water_mark != r2->high_water_mark) {
+        return (r1->high_water_mark > r2->high_water_mark) ? -1 : 1;
+    }
+    return 0;
+}
+
+/*
+ *  Read the cache file at path, returning its data and setting outRecords and outRecordCount if it is
+ *  current for storeIdentifier. Returns nil for a missing, unreadable or stale file.
+ */
+static NSData *ENTEKCacheReadRecords(NSString *path, uint64_t storeIdentifier,
+                                     const en_tek_cache_record_t **outRecords, NSUInteger *outRecordCount)
+{
+    NSError *error = nil;
+    NSData *data = [NSData dataWithContentsOfFile:path options:NSDataReadingMappedIfSafe error:&error];
+    if (!data) {
+        EN_INFO_PRINTF("no TEK cache at %s", [path UTF8String]);
+        return nil;
+    }
+
+    en_tek_cache_header_t header;
+    if ([data length] < sizeof(header)) {
+        EN_ERROR_PRINTF("truncated TEK cache header length:%lu", (unsigned long) [data length]);
+        return nil;
+    }
+    memcpy(&header, [data bytes], sizeof(header));
+
+    if (header.magic != TEK_CACHE_MAGIC || header.version != TEK_CACHE_VERSION || header.record_size != sizeof(en_tek_cache_record_t)) {
+        EN_ERROR_PRINTF("unsupported TEK cache magic:0x%08x version:%u recordSize:%u", header.magic, header.version, header.record_size);
+        return nil;
+    }
+    if (header.store_identifier != storeIdentifier) {
+        EN_NOTICE_PRINTF("discarding TEK cache of a previous advertisement store");
+        return nil;
+    }
+    if (header.record_count > ([data length] - sizeof(header)) / sizeof(en_tek_cache_record_t)) {
+        EN_ERROR_PRINTF("truncated TEK cache recordCount:%llu length:%lu", header.record_count, (unsigned long) [data length]);
+        return nil;
+    }
+
+    *outRecords = (const en_tek_cache_record_t *) ((const uint8_t *) [data bytes] + sizeof(header));
+    *outRecordCount = (NSUInteger) header.record_count;
+    return data;
+}
+
+#pragma mark - Cache
+
+/*
+ *  One cache is shared by every query session of a database, which may run on different threads, so all
+ *  access to the records goes through _lock.
+ */
+@implementation ENTEKCache {
+    os_unfair_lock _lock;
+    NSString *_path;
+    uint64_t _storeIdentifier;
+
+    // records read from disk, sorted by key_hash
+    NSData *_storedRecordData;
+    const en_tek_cache_record_t *_storedRecords;
+
+    // records added since the file was read, unsorted
+    NSMutableData *_addedRecordData;
+}
+
+@synthesize storedRecordCount = _storedRecordCount;
+
++ (NSString *)tekCachePathInFolderPath:(NSString *)folderPath
+{
+    return [folderPath stringByAppendingPathComponent:@TEK_CACHE_FILENAME];
+}
+
++ (instancetype)tekCacheInFolderPath:(NSString *)folderPath storeIdentifier:(uint64_t)storeIdentifier
+{
+    return [[ENTEKCache alloc] initWithPath:[self tekCachePathInFolderPath:folderPath] storeIdentifier:storeIdentifier];
+}
+
+- (instancetype)initWithPath:(NSString *)path storeIdentifier:(uint64_t)storeIdentifier
+{
+    if (self = [super init]) {
+        _lock = OS_UNFAIR_LOCK_INIT;
+        _path = path;
+        _storeIdentifier = storeIdentifier;
+        _addedRecordData = [[NSMutableData alloc] init];
+        _storedRecordData = ENTEKCacheReadRecords(_path, _storeIdentifier, &_storedRecords, &_storedRecordCount);
+        if (_storedRecordData) {
+            EN_INFO_PRINTF("loaded TEK cache recordCount:%lu", (unsigned long) _storedRecordCount);
+        }
+    }
+    return self;
+}
+
+- (NSUInteger)storedRecordCount
+{
+    os_unfair_lock_lock(&_lock);
+    NSUInteger storedRecordCount = _storedRecordCount;
+    os_unfair_lock_unlock(&_lock);
+    return storedRecordCount;
+}
+
+- (BOOL)shouldSkipKey:(ENTemporaryExposureKey *)key
+ attenuationThreshold:(uint8_t)attenuationThreshold
+        highWaterMark:(uint64_t)highWaterMark
+{
+    uint64_t keyHash = ENTEKCacheKeyHash(key, attenuationThreshold);
+
+    os_unfair_lock_lock(&_lock);
+    NSUInteger low = 0;
+    NSUInteger high = _storedRecordCount;
+    while (low < high) {
+        NSUInteger middle = low + (high - low) / 2;
+        if (_storedRecords[middle].key_hash < keyHash) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    BOOL found = (low < _storedRecordCount && _storedRecords[low].key_hash == keyHash);
+    uint64_t recordedHighWaterMark = found ? _storedRecords[low].high_water_mark : 0;
+    os_unfair_lock_unlock(&_lock);
+
+    return found && (recordedHighWaterMark == TEK_CACHE_FINAL_HIGH_WATER_MARK || recordedHighWaterMark == highWaterMark);
+}
+
+- (void)addUnmatchedKey:(ENTemporaryExposureKey *)key
+   attenuationThreshold:(uint8_t)attenuationThreshold
+          highWaterMark:(uint64_t)highWaterMark
+{
+    uint32_t endInterval = [key rollingStartNumber] + ENTEKCacheRollingPeriod(key) + ADVERTISEMENT_TOLERANCE_CTIN;
+    en_tek_cache_record_t record = {
+        .key_hash = ENTEKCacheKeyHash(key, attenuationThreshold),
+        .high_water_mark = highWaterMark,
+        .end_interval = endInterval,
+    };
+
+    // advertisements are saved as they are seen, so none can arrive for a key whose period has long ended
+    if (ENTEKCacheCurrentInterval() > endInterval + TEK_CACHE_SETTLE_INTERVALS) {
+        record.high_water_mark = TEK_CACHE_FINAL_HIGH_WATER_MARK;
+    }
+
+    os_unfair_lock_lock(&_lock);
+    [_addedRecordData appendBytes:&record length:sizeof(record)];
+    os_unfair_lock_unlock(&_lock);
+}
+
+- (BOOL)saveWithError:(NSError * _Nullable __autoreleasing * _Nullable)error
+{
+    os_unfair_lock_lock(&_lock);
+    BOOL success = [self saveLockedWithError:error];
+    os_unfair_lock_unlock(&_lock);
+    return success;
+}
+
+- (BOOL)saveLockedWithError:(NSError * _Nullable __autoreleasing * _Nullable)error
+{
+    NSUInteger addedRecordCount = [_addedRecordData length] / sizeof(en_tek_cache_record_t);
+    if (addedRecordCount == 0) {
+        return YES;
+    }
+
+    // reread the file, as another cache for the same store may have saved to it since it was loaded
+    const en_tek_cache_record_t *currentRecords = NULL;
+    NSUInteger currentRecordCount = 0;
+    NS_VALID_UNTIL_END_OF_SCOPE NSData *currentRecordData = ENTEKCacheReadRecords(_path, _storeIdentifier, &currentRecords, &currentRecordCount);
+
+    // merge the added records with the stored and current ones, keeping the newest record of each key
+    NSUInteger mergedRecordCount = _storedRecordCount + currentRecordCount + addedRecordCount;
+    en_tek_cache_header_t header = {
+        .magic = TEK_CACHE_MAGIC,
+        .version = TEK_CACHE_VERSION,
+        .record_size = sizeof(en_tek_cache_record_t),
+        .store_identifier = _storeIdentifier,
+    };
+    NSMutableData *fileData = [[NSMutableData alloc] initWithLength:sizeof(header) + (mergedRecordCount * sizeof(en_tek_cache_record_t))];
+    en_tek_cache_record_t *records = (en_tek_cache_record_t *) ((uint8_t *) [fileData mutableBytes] + sizeof(header));
+    if (_storedRecordCount > 0) {
+        memcpy(records, _storedRecords, _storedRecordCount * sizeof(en_tek_cache_record_t));
+    }
+    if (currentRecordCount > 0) {
+        memcpy(&records[_storedRecordCount], currentRecords, currentRecordCount * sizeof(en_tek_cache_record_t));
+    }
+    memcpy(&records[_storedRecordCount + currentRecordCount], [_addedRecordData bytes], addedRecordCount * sizeof(en_tek_cache_record_t));
+    qsort(records, mergedRecordCount, sizeof(en_tek_cache_record_t), ENTEKCacheRecordCompare);
+
+    uint32_t currentInterval = ENTEKCacheCurrentInterval();
+    NSUInteger keptRecordCount = 0;
+    for (NSUInteger i = 0; i < mergedRecordCount; i++) {
+        if (keptRecordCount > 0 && records[keptRecordCount - 1].key_hash == records[i].key_hash) {
+            continue;
+        }
+        if (records[i].end_interval + TEK_CACHE_RETENTION_INTERVALS < currentInterval) {
+            continue;
+        }
+        records[keptRecordCount++] = records[i];
+    }
+    header.record_count = keptRecordCount;
+    memcpy([fileData mutableBytes], &header, sizeof(header));
+    [fileData setLength:sizeof(header) + (keptRecordCount * sizeof(en_tek_cache_record_t))];
+
+    if (![fileData writeToFile:_path options:NSDataWritingAtomic error:error]) {
+        EN_ERROR_PRINTF("failed to save TEK cache at %s", [_path UTF8String]);
+        return NO;
+    }
+    EN_INFO_PRINTF("saved TEK cache addedCount:%lu recordCount:%lu", (unsigned long) addedRecordCount, (unsigned long) keptRecordCount);
+
+    // the merged records replace the mapped file, which is no longer current
+    _storedRecordData = fileData;
+    _storedRecords = (const en_tek_cache_record_t *) ((const uint8_t *) [fileData bytes] + sizeof(header));
+    _storedRecordCount = keptRecordCount;
+    [_addedRecordData setLength:0];
+    return YES;
+}
+
+@end
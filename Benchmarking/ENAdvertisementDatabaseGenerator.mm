@@ -0,0 +1,263 @@
+/*
+ *      Copyright (C) 2020 Apple Inc. All Rights Reserved.
+ *
+ *      ExposureNotification is licensed under Apple Inc.’s
+ *      Sample Code License Agreement, which is contained in
+ *      the LICENSE file distributed with ExposureNotification,
+ *      and only to those who accept that license.
+ *
+ */
+
+/*
+ * Writes a synthetic en_advertisements.db for matching benchmarks, and a companion list of the TEKs whose RPIs it
+ * contains.
+ *
+ * Usage: ENAdvertisementDatabaseGenerator outputFolder [rows] [matchingFraction] [matchingKeys] [seed] [endTime]
+ *
+ * Defaults write 915000 rows (the pathological user the exposure info buffer is sized for), 1% of which were
+ * advertised by 100 planted TEKs, with seed 1, covering the 13 whole UTC days before the current one. Matching drops
+ * advertisements over 14 days old, so every row stays valid until the end of endTime's UTC day. Passing endTime (Unix
+ * seconds) makes the output identical on every run; match the database before that day is over or the oldest rows
+ * will be filtered as too old.
+ *
+ * Rows are saved through ENAdvertisementSQLiteStore, so the table has exactly the schema the store creates. The
+ * planted TEKs are written to outputFolder/synthetic_keys.csv with their rolling period, Tx power and matching row
+ * count. ENExposureKeyFileGenerator reads that file to plant the same TEKs in a key file.
+ */
+
+#import <Foundation/Foundation.h>
+#import <stdio.h>
+#import <stdlib.h>
+#import <time.h>
+#import <algorithm>
+#import <vector>
+
+#import "ENAdvertisement_Private.h"
+#import "ENAdvertisementSQLiteStore.h"
+#import "ENCryptography.h"
+#import "ExposureNotificationBenchmarkRandom.h"
+
+#pragma mark - Generation Parameters
+
+#define GENERATOR_DEFAULT_ROW_COUNT             (915000)    // DEFAULT_EXPOSURE_INFO_BUFFER_SIZE
+#define GENERATOR_DAY_COUNT                     (13)        // Whole days, so the oldest row is under 14 days old
+#define GENERATOR_SECONDS_PER_DAY               (24 * 60 * 60)
+#define GENERATOR_SECONDS_PER_INTERVAL          (10 * 60)
+#define GENERATOR_INTERVALS_PER_KEY             (144)
+#define GENERATOR_SCANS_PER_INTERVAL            (2)         // Matching rows are spaced one scan (5 minutes) apart
+#define GENERATOR_BATCH_SIZE                    (10000)
+#define GENERATOR_BACKGROUND_RSSI_MEAN          (-80.0)
+#define GENERATOR_BACKGROUND_RSSI_DEVIATION     (10.0)
+#define GENERATOR_CONTACT_RSSI_MIN              (-85.0)
+#define GENERATOR_CONTACT_RSSI_MAX              (-50.0)
+#define GENERATOR_CONTACT_RSSI_DEVIATION        (4.0)
+#define GENERATOR_SATURATED_FRACTION            (0.01)
+
+typedef struct
+{
+    uint8_t tek[EN_TEK_LEN];
+    uint32_t rollingStartNumber;
+    int8_t txPower;
+    uint32_t rowCount;
+} GeneratorPlantedKey;
+
+#pragma mark - Rows
+
+static int8_t GeneratorClampRSSI(double rssi)
+{
+    return (int8_t)MAX(-127.0, MIN(20.0, round(rssi)));
+}
+
+// Most advertisements are seen while people are awake, so 80% of background rows fall between 07:00 and 22:00.
+static uint64_t GeneratorBackgroundTimestamp(BenchmarkRandom &random, uint64_t firstDay)
+{
+    uint64_t day = firstDay + random.uniform((uint32_t)GENERATOR_DAY_COUNT);
+    uint32_t secondOfDay;
+    if (random.uniform() < 0.8) {
+        secondOfDay = (7 * 60 * 60) + random.uniform((uint32_t)(15 * 60 * 60));
+    } else {
+        secondOfDay = random.uniform((uint32_t)GENERATOR_SECONDS_PER_DAY);
+    }
+    return (day * GENERATOR_SECONDS_PER_DAY) + secondOfDay;
+}
+
+static void GeneratorFillBackgroundRow(BenchmarkRandom &random, uint64_t firstDay, en_advertisement_t *outAdvertisement)
+{
+    random.fill((uint8_t *)outAdvertisement->rpi, sizeof(outAdvertisement->rpi));
+    random.fill((uint8_t *)outAdvertisement->encrypted_aem, sizeof(outAdvertisement->encrypted_aem));
+    outAdvertisement->timestamp = GeneratorBackgroundTimestamp(random, firstDay);
+    outAdvertisement->daily_key_index = DAILY_KEY_INDEX_INVALID;
+    outAdvertisement->scan_interval = (uint16_t)(150 + random.uniform(151));
+    outAdvertisement->rssi = GeneratorClampRSSI(random.normal(GENERATOR_BACKGROUND_RSSI_MEAN, GENERATOR_BACKGROUND_RSSI_DEVIATION));
+    outAdvertisement->saturated = (random.uniform() < GENERATOR_SATURATED_FRACTION);
+    outAdvertisement->count = (uint8_t)(1 + random.uniform(16));
+}
+
+/*
+ * Appends the rows for one planted key: a single contact starting at a random interval of the key's day, seen on
+ * consecutive scans at an RSSI around a per-contact mean.
+ */
+static BOOL GeneratorAppendContactRows(BenchmarkRandom &random, const GeneratorPlantedKey &key,
+                                       std::vector<en_advertisement_t> &rows)
+{
+    uint8_t tek[EN_TEK_LEN];
+    memcpy(tek, key.tek, sizeof(tek));
+
+    uint8_t rpik[EN_RPIK_LEN];
+    uint8_t aemk[EN_AEMK_LEN];
+    if (ENDeriveTEKSubkeys(tek, EN_TEK_LEN, rpik, sizeof(rpik), aemk, sizeof(aemk)) != BT_SUCCESS) {
+        return NO;
+    }
+
+    uint8_t rpis[GENERATOR_INTERVALS_PER_KEY * EN_RPI_LEN];
+    if (ENGenerate144RollingProximityIdentifiersWithRPIK(rpik, sizeof(rpik), key.rollingStartNumber, rpis, sizeof(rpis)) != BT_SUCCESS) {
+        return NO;
+    }
+    uint8_t metadata[EN_AEM_LEN] = { (0x01 << 6), (uint8_t)key.txPower, 0, 0 };
+    uint8_t encryptedAEMs[GENERATOR_INTERVALS_PER_KEY * EN_AEM_LEN];
+    if (ENEncryptAEMsWithAEMK(aemk, sizeof(aemk), metadata, sizeof(metadata), rpis, GENERATOR_INTERVALS_PER_KEY,
+                              encryptedAEMs, sizeof(encryptedAEMs)) != BT_SUCCESS) {
+        return NO;
+    }
+
+    uint32_t scans = GENERATOR_INTERVALS_PER_KEY * GENERATOR_SCANS_PER_INTERVAL;
+    uint32_t startScan = random.uniform(scans - key.rowCount + 1);
+    double meanRSSI = random.uniform(GENERATOR_CONTACT_RSSI_MIN, GENERATOR_CONTACT_RSSI_MAX);
+    for (uint32_t i = 0; i < key.rowCount; i++) {
+        uint32_t scan = startScan + i;
+        uint32_t interval = scan / GENERATOR_SCANS_PER_INTERVAL;
+        uint32_t offset = ((scan % GENERATOR_SCANS_PER_INTERVAL) * (GENERATOR_SECONDS_PER_INTERVAL / GENERATOR_SCANS_PER_INTERVAL)) + random.uniform(150);
+
+        en_advertisement_t advertisement = {};
+        memcpy(advertisement.rpi, rpis + (interval * EN_RPI_LEN), EN_RPI_LEN);
+        memcpy(advertisement.encrypted_aem, encryptedAEMs + (interval * EN_AEM_LEN), EN_AEM_LEN);
+        advertisement.timestamp = ((uint64_t)(key.rollingStartNumber + interval) * GENERATOR_SECONDS_PER_INTERVAL) + offset;
+        advertisement.daily_key_index = DAILY_KEY_INDEX_INVALID;
+        advertisement.scan_interval = (GENERATOR_SECONDS_PER_INTERVAL / GENERATOR_SCANS_PER_INTERVAL);
+        advertisement.rssi = GeneratorClampRSSI(random.normal(meanRSSI, GENERATOR_CONTACT_RSSI_DEVIATION));
+        advertisement.saturated = false;
+        advertisement.count = (uint8_t)(8 + random.uniform(9));
+        rows.push_back(advertisement);
+    }
+
+    memset_s(aemk, sizeof(aemk), 0, sizeof(aemk));
+    return YES;
+}
+
+#pragma mark - Output
+
+static BOOL GeneratorSaveRows(ENAdvertisementSQLiteStore *store, const std::vector<en_advertisement_t> &rows)
+{
+    for (size_t start = 0; start < rows.size(); start += GENERATOR_BATCH_SIZE) {
+        size_t count = MIN((size_t)GENERATOR_BATCH_SIZE, rows.size() - start);
+        NSError *error = nil;
+        if (![store saveAdvertisements:rows.data() + start count:count error:&error]) {
+            fprintf(stderr, "failed to save rows: %s\n", error.description.UTF8String);
+            return NO;
+        }
+    }
+    return YES;
+}
+
+static BOOL GeneratorWritePlantedKeys(NSString *path, const std::vector<GeneratorPlantedKey> &keys)
+{
+    FILE *file = fopen(path.UTF8String, "w");
+    if (!file) {
+        return NO;
+    }
+    fprintf(file, "temporaryExposureKey,rollingStartNumber,rollingPeriod,txPower,matchingRows\n");
+    for (const GeneratorPlantedKey &key : keys) {
+        for (size_t i = 0; i < sizeof(key.tek); i++) {
+            fprintf(file, "%02x", key.tek[i]);
+        }
+        fprintf(file, ",%u,%u,%d,%u\n", key.rollingStartNumber, GENERATOR_INTERVALS_PER_KEY, key.txPower, key.rowCount);
+    }
+    fclose(file);
+    return YES;
+}
+
+#pragma mark - Main
+
+int main(int argc, const char *argv[])
+{
+    @autoreleasepool {
+        if (argc < 2) {
+            fprintf(stderr, "usage: %s outputFolder [rows] [matchingFraction] [matchingKeys] [seed] [endTime]\n", argv[0]);
+            return 1;
+        }
+        NSString *outputFolder = [NSString stringWithUTF8String:argv[1]];
+        uint32_t rowCount = (argc > 2) ? (uint32_t)strtoul(argv[2], NULL, 10) : GENERATOR_DEFAULT_ROW_COUNT;
+        double matchingFraction = (argc > 3) ? strtod(argv[3], NULL) : 0.01;
+        uint32_t keyCount = (argc > 4) ? (uint32_t)strtoul(argv[4], NULL, 10) : 100;
+        uint64_t seed = (argc > 5) ? strtoull(argv[5], NULL, 10) : 1;
+        uint64_t endTime = (argc > 6) ? strtoull(argv[6], NULL, 10) : (uint64_t)time(NULL);
+        if (rowCount == 0 || matchingFraction < 0.0 || matchingFraction > 1.0) {
+            fprintf(stderr, "usage: %s outputFolder [rows] [matchingFraction] [matchingKeys] [seed] [endTime]\n", argv[0]);
+            return 1;
+        }
+
+        uint64_t endDay = endTime / GENERATOR_SECONDS_PER_DAY;
+        uint64_t firstDay = endDay - GENERATOR_DAY_COUNT;
+        BenchmarkRandom random(seed);
+
+        // Each planted key contributes one contact of at most a day of scans, so add keys if the rows need them.
+        uint32_t matchingRowCount = (uint32_t)round(rowCount * matchingFraction);
+        uint32_t maxRowsPerKey = GENERATOR_INTERVALS_PER_KEY * GENERATOR_SCANS_PER_INTERVAL;
+        if (matchingRowCount > 0) {
+            keyCount = MAX(keyCount, (matchingRowCount + maxRowsPerKey - 1) / maxRowsPerKey);
+            keyCount = MIN(keyCount, matchingRowCount);
+        } else {
+            keyCount = 0;
+        }
+
+        std::vector<GeneratorPlantedKey> keys(keyCount);
+        for (uint32_t i = 0; i < keyCount; i++) {
+            GeneratorPlantedKey &key = keys[i];
+            random.fill(key.tek, sizeof(key.tek));
+            key.rollingStartNumber = (uint32_t)((firstDay + random.uniform((uint32_t)GENERATOR_DAY_COUNT)) * GENERATOR_INTERVALS_PER_KEY);
+            key.txPower = (int8_t)(-12 + (int)random.uniform(13));
+            key.rowCount = (matchingRowCount / keyCount) + ((i < (matchingRowCount % keyCount)) ? 1 : 0);
+        }
+
+        std::vector<en_advertisement_t> rows;
+        rows.reserve(rowCount);
+        for (const GeneratorPlantedKey &key : keys) {
+            if (!GeneratorAppendContactRows(random, key, rows)) {
+                fprintf(stderr, "failed to generate RPIs for a planted key\n");
+                return 1;
+            }
+        }
+        while (rows.size() < rowCount) {
+            en_advertisement_t advertisement = {};
+            GeneratorFillBackgroundRow(random, firstDay, &advertisement);
+            rows.push_back(advertisement);
+        }
+
+        // Store the rows in the order a device would have observed them.
+        std::stable_sort(rows.begin(), rows.end(), [](const en_advertisement_t &a, const en_advertisement_t &b) {
+            return a.timestamp < b.timestamp;
+        });
+
+        NSError *error = nil;
+        if (![[NSFileManager defaultManager] createDirectoryAtPath:outputFolder withIntermediateDirectories:YES attributes:nil error:&error]) {
+            fprintf(stderr, "failed to create %s: %s\n", outputFolder.UTF8String, error.description.UTF8String);
+            return 1;
+        }
+        ENAdvertisementSQLiteStore *store = [ENAdvertisementSQLiteStore centralStoreInFolderPath:outputFolder];
+        if (!store || !GeneratorSaveRows(store, rows)) {
+            fprintf(stderr, "failed to write database in %s\n", outputFolder.UTF8String);
+            return 1;
+        }
+
+        NSString *keysPath = [outputFolder stringByAppendingPathComponent:@"synthetic_keys.csv"];
+        if (!GeneratorWritePlantedKeys(keysPath, keys)) {
+            fprintf(stderr, "failed to write %s\n", keysPath.UTF8String);
+            return 1;
+        }
+
+        printf("rows:           %u (%u matching)\n", rowCount, matchingRowCount);
+        printf("planted keys:   %u\n", keyCount);
+        printf("stored:         %s\n", store.storedAdvertisementCount.description.UTF8String);
+    }
+    return 0;
+}
@@ -0,0 +1,177 @@
+/*
+ *      Copyright (C) 2020 Apple Inc. All Rights Reserved.
+ *
+ *      ExposureNotification is licensed under Apple Inc.’s
+ *      Sample Code License Agreement, which is contained in
+ *      the LICENSE file distributed with ExposureNotification,
+ *      and only to those who accept that license.
+ *
+ */
+
+/*
+ * Checks and compares the crypto providers of ENCryptoProvider.h on this host.
+ *
+ * Usage: ENCryptoProviderBenchmark [iterations]
+ *
+ * Every provider compiled in and available is first run through ENCryptoProviderSelfTest, which checks it against the
+ * FIPS-197, SP 800-38A and RFC 5869 test vectors, against fixed Exposure Notification answers for one TEK, and against
+ * the first available provider on more TEKs. Each provider that passes is then timed on the operations of matching:
+ *
+ *   hkdfSubkeys  one HKDF-Extract and two HKDF-Expands, deriving the RPIK and AEMK of a TEK (ENDeriveTEKSubkeys)
+ *   ecb144       AES-128-ECB over 144 blocks, generating the RPIs of a TEK
+ *   ctrAEM       AES-128-CTR over 4 bytes, decrypting one AEM
+ *   tek          all of the above, as ENCryptoProviderSelectFastest measures
+ *
+ * Results are written to stdout as JSON, with the nanoseconds per operation of each provider in each iteration, the
+ * best of each, and the provider ENCryptoProviderSelectFastest picks. Exits with 2 if any provider fails its self test.
+ */
+
+#import <Foundation/Foundation.h>
+#import <chrono>
+#import <stdio.h>
+#import <stdlib.h>
+#import <vector>
+
+#import "ENCryptoProvider.h"
+
+#pragma mark - Timing
+
+static uint64_t NowNanoseconds()
+{
+    return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*
+ *  Run body count times and return the nanoseconds per run. The inputs change with every run so the
+ *  provider cannot cache a key schedule across runs.
+ */
+static double NanosecondsPerOperation(uint32_t count, void (^body)(uint32_t i))
+{
+    uint64_t start = NowNanoseconds();
+    for (uint32_t i = 0; i < count; i++) {
+        body(i);
+    }
+    return (double)(NowNanoseconds() - start) / count;
+}
+
+#pragma mark - Main
+
+int main(int argc, const char *argv[])
+{
+    @autoreleasepool {
+        int iterations = (argc > 1) ? atoi(argv[1]) : 3;
+        if (iterations < 1) {
+            fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+            return 1;
+        }
+
+        static const uint8_t rpikInfo[] = {'E', 'N', '-', 'R', 'P', 'I', 'K'};
+        static const uint8_t aemkInfo[] = {'E', 'N', '-', 'A', 'E', 'M', 'K'};
+        static const uint8_t metadata[] = {0x40, 0x08, 0x00, 0x00};
+        const uint32_t operationCount = 20000;
+
+        BOOL allPassed = YES;
+        NSMutableDictionary *selfTests = [[NSMutableDictionary alloc] init];
+        std::vector<const ENCryptoProvider *> providers;
+        for (size_t i = 0; i < ENCryptoProviderCount(); i++) {
+            const ENCryptoProvider *provider = ENCryptoProviderAtIndex(i);
+            if (!provider->isAvailable()) {
+                selfTests[@(provider->name)] = @"unavailable";
+                continue;
+            }
+            BTResult result = ENCryptoProviderSelfTest(provider);
+            selfTests[@(provider->name)] = @(result);
+            if (result == BT_SUCCESS) {
+                providers.push_back(provider);
+            } else {
+                fprintf(stderr, "%s failed its self test: %d\n", provider->name, result);
+                allPassed = NO;
+            }
+        }
+
+        NSMutableDictionary<NSString *, NSMutableDictionary<NSString *, NSNumber *> *> *best = [[NSMutableDictionary alloc] init];
+        NSMutableArray *results = [[NSMutableArray alloc] init];
+        uint8_t key[EN_CRYPTO_PROVIDER_AES_KEY_LEN] = {0};
+        uint8_t prk[EN_CRYPTO_PROVIDER_HKDF_PRK_LEN];
+        uint8_t subkeys[2][EN_CRYPTO_PROVIDER_AES_KEY_LEN];
+        uint8_t blocks[144 * EN_CRYPTO_PROVIDER_AES_BLOCK_LEN] = {0};
+        uint8_t aem[sizeof(metadata)];
+        uint8_t *keyPtr = key, *prkPtr = prk, *blocksPtr = blocks, *aemPtr = aem;
+        uint8_t (*subkeysPtr)[EN_CRYPTO_PROVIDER_AES_KEY_LEN] = subkeys;
+
+        for (int iteration = 0; iteration < iterations; iteration++) {
+            @autoreleasepool {
+                NSMutableDictionary *iterationProviders = [[NSMutableDictionary alloc] init];
+                for (const ENCryptoProvider *provider : providers) {
+                    void (^hkdfSubkeys)(uint32_t) = ^(uint32_t i) {
+                        WriteLittle32(keyPtr, i);
+                        provider->hkdfExtract(NULL, 0, keyPtr, EN_CRYPTO_PROVIDER_AES_KEY_LEN, prkPtr);
+                        provider->hkdfExpand(prkPtr, rpikInfo, sizeof(rpikInfo), subkeysPtr[0], EN_CRYPTO_PROVIDER_AES_KEY_LEN);
+                        provider->hkdfExpand(prkPtr, aemkInfo, sizeof(aemkInfo), subkeysPtr[1], EN_CRYPTO_PROVIDER_AES_KEY_LEN);
+                    };
+                    void (^ecb144)(uint32_t) = ^(uint32_t i) {
+                        WriteLittle32(keyPtr, i);
+                        provider->aesECBEncrypt(keyPtr, EN_CRYPTO_PROVIDER_AES_KEY_LEN, 144, blocksPtr, blocksPtr);
+                    };
+                    void (^ctrAEM)(uint32_t) = ^(uint32_t i) {
+                        WriteLittle32(keyPtr, i);
+                        provider->aesCTRCrypt(keyPtr, EN_CRYPTO_PROVIDER_AES_KEY_LEN, blocksPtr, sizeof(metadata), metadata, aemPtr);
+                    };
+
+                    NSDictionary *operations = @{
+                        @"hkdfSubkeys" : @(NanosecondsPerOperation(operationCount, hkdfSubkeys)),
+                        @"ecb144" : @(NanosecondsPerOperation(operationCount, ecb144)),
+                        @"ctrAEM" : @(NanosecondsPerOperation(operationCount, ctrAEM)),
+                        @"tek" : @(NanosecondsPerOperation(operationCount, ^(uint32_t i) {
+                            hkdfSubkeys(i);
+                            ecb144(i);
+                            ctrAEM(i);
+                        })),
+                    };
+                    NSString *name = @(provider->name);
+                    iterationProviders[name] = operations;
+
+                    if (!best[name]) {
+                        best[name] = [operations mutableCopy];
+                    }
+                    for (NSString *operation in operations) {
+                        if ([operations[operation] doubleValue] < best[name][operation].doubleValue) {
+                            best[name][operation] = operations[operation];
+                        }
+                    }
+                }
+                [results addObject:@{
+                    @"iteration" : @(iteration),
+                    @"nanosecondsPerOperation" : iterationProviders,
+                }];
+            }
+        }
+
+        NSString *defaultProvider = @(ENCryptoProviderCurrent()->name);
+        NSString *fastestProvider = @(ENCryptoProviderSelectFastest()->name);
+        NSDictionary *report = @{
+            @"defaultProvider" : defaultProvider,
+            @"fastestProvider" : fastestProvider,
+            @"selfTests" : selfTests,
+            @"bestNanosecondsPerOperation" : best,
+            @"iterations" : results,
+        };
+        NSError *error = nil;
+        NSData *reportData = [NSJSONSerialization dataWithJSONObject:report
+                                                             options:(NSJSONWritingPrettyPrinted | NSJSONWritingSortedKeys)
+                                                               error:&error];
+        if (!reportData) {
+            fprintf(stderr, "failed to write the report: %s\n", error.description.UTF8String);
+            return 1;
+        }
+        fwrite(reportData.bytes, 1, reportData.length, stdout);
+        printf("\n");
+
+        if (!allPassed) {
+            fprintf(stderr, "a crypto provider failed its self test\n");
+            return 2;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,391 @@
+/*
+ *      Copyright (C) 2020 Apple Inc. All Rights Reserved.
+ *
+ *      ExposureNotification is licensed under Apple Inc.’s
+ *      Sample Code License Agreement, which is contained in
+ *      the LICENSE file distributed with ExposureNotification,
+ *      and only to those who accept that license.
+ *
+ */
+
+/*
+ * Runs exposure detection end to end, from opening the advertisement database to building ENExposureInfo, and reports
+ * where the time and memory go.
+ *
+ * Usage: ENExposureDetectionBenchmark databaseFolder keyFolder [iterations]
+ *
+ * databaseFolder holds an en_advertisements.db (e.g. from ENAdvertisementDatabaseGenerator) and keyFolder is written by
+ * ENExposureKeyFileGenerator against it. Every iteration opens the database, verifies and adds each key file listed in
+ * keyFolder/manifest.json, then generates the summary and exposure info, and checks the exposures against the manifest.
+ * The TEK cache that detection saves next to the database is deleted before every iteration and at the end, so every
+ * iteration matches every key; tekCacheSkips reports any key the cache still skipped, which should be none.
+ *
+ * Deferred error descriptions are first checked against eagerly formatted ones; a mismatch is reported and exits with 2.
+ *
+ * Results are written to stdout as JSON. Each iteration has wall time, CPU time of the main thread, net malloc bytes
+ * and blocks, and peak resident size for the outer stages timed here and for the inner stages timed by the session's
+ * ENDetectionMetrics, along with the session's event counters.
+ */
+
+#import <ExposureNotification/ExposureNotification.h>
+#import <Foundation/Foundation.h>
+#import <errno.h>
+#import <stdio.h>
+#import <stdlib.h>
+#import <string.h>
+
+#import "ENAdvertisementDatabase.h"
+#import "ENCommonPrivate.h"
+#import "ENDetectionMetrics.h"
+#import "ENExposureDetectionDaemonSession.h"
+#import "ENFile.h"
+#import "ENFileSignatureVerification.h"
+#import "ENTEKCache.h"
+
+#pragma mark - Benchmark Stages
+
+typedef NS_ENUM(NSUInteger, DetectionBenchmarkStage) {
+    DetectionBenchmarkStageSessionSetup = 0,    // Opening the database and building the query filter
+    DetectionBenchmarkStageFileOpen,
+    DetectionBenchmarkStageSignatureValidation,
+    DetectionBenchmarkStageAddFile,
+    DetectionBenchmarkStageGenerateSummary,
+    DetectionBenchmarkStageExposureInfo,
+    DetectionBenchmarkStageCount
+};
+
+static NSString *const kDetectionBenchmarkStageNames[DetectionBenchmarkStageCount] = {
+    @"sessionSetup",
+    @"fileOpen",
+    @"signatureValidation",
+    @"addFile",
+    @"generateSummary",
+    @"exposureInfo",
+};
+
+static NSDictionary *DetectionBenchmarkStageDictionary(const ENDetectionStageMetrics &metrics)
+{
+    return @{
+        @"count" : @(metrics.count),
+        @"wallSeconds" : @(metrics.wallNanoseconds / 1e9),
+        @"cpuSeconds" : @(metrics.cpuNanoseconds / 1e9),
+        @"allocatedBytes" : @(metrics.allocatedBytes),
+        @"allocatedBlocks" : @(metrics.allocatedBlocks),
+        @"peakResidentBytes" : @(metrics.peakResidentBytes),
+    };
+}
+
+#pragma mark - Exposure Comparison
+
+/*
+ * The daemon session rounds durations up to whole minutes and caps them, so the manifest's raw durations are rounded
+ * the same way before comparing.
+ */
+static uint32_t DetectionBenchmarkRoundDuration(uint32_t duration)
+{
+    duration = ((duration + ENDurationIncrement - 1) / ENDurationIncrement) * ENDurationIncrement;
+    return MIN(duration, (uint32_t)ENDurationMaxSeconds);
+}
+
+static NSString *DetectionBenchmarkExposureSignature(uint64_t day, uint32_t riskLevel, uint32_t duration, NSArray<NSNumber *> *attenuationDurations)
+{
+    NSMutableString *signature = [NSMutableString stringWithFormat:@"%llu/%u/%u", (unsigned long long)day, riskLevel, duration];
+    for (NSNumber *attenuationDuration in attenuationDurations) {
+        [signature appendFormat:@"/%u", attenuationDuration.unsignedIntValue];
+    }
+    return signature;
+}
+
+static NSArray<NSString *> *DetectionBenchmarkExpectedSignatures(NSArray<NSDictionary *> *exposures, NSUInteger durationCount)
+{
+    NSMutableArray<NSString *> *signatures = [[NSMutableArray alloc] init];
+    for (NSDictionary *exposure in exposures) {
+        NSMutableArray<NSNumber *> *durations = [[NSMutableArray alloc] init];
+        NSArray<NSNumber *> *attenuationDurations = exposure[@"attenuationDurations"];
+        for (NSUInteger i = 0; i < MIN(durationCount, attenuationDurations.count); i++) {
+            [durations addObject:@(DetectionBenchmarkRoundDuration(attenuationDurations[i].unsignedIntValue))];
+        }
+        uint64_t day = [exposure[@"date"] unsignedLongLongValue] / kSecondsPerDay;
+        [signatures addObject:DetectionBenchmarkExposureSignature(day,
+                                                                  [exposure[@"transmissionRiskLevel"] unsignedIntValue],
+                                                                  DetectionBenchmarkRoundDuration([exposure[@"duration"] unsignedIntValue]),
+                                                                  durations)];
+    }
+    return [signatures sortedArrayUsingSelector:@selector(compare:)];
+}
+
+static NSArray<NSString *> *DetectionBenchmarkFoundSignatures(NSArray<ENExposureInfo *> *exposureInfo, NSUInteger durationCount)
+{
+    NSMutableArray<NSString *> *signatures = [[NSMutableArray alloc] init];
+    for (ENExposureInfo *exposure in exposureInfo) {
+        NSArray<NSNumber *> *attenuationDurations = exposure.attenuationDurations;
+        NSRange range = NSMakeRange(0, MIN(durationCount, attenuationDurations.count));
+        uint64_t day = (uint64_t)exposure.date.timeIntervalSince1970 / kSecondsPerDay;
+        [signatures addObject:DetectionBenchmarkExposureSignature(day,
+                                                                  exposure.transmissionRiskLevel,
+                                                                  (uint32_t)exposure.duration,
+                                                                  [attenuationDurations subarrayWithRange:range])];
+    }
+    return [signatures sortedArrayUsingSelector:@selector(compare:)];
+}
+
+#pragma mark - Error Format Check
+
+static NSString *DetectionBenchmarkErrorDescription(ENErrorCode code, NSString *extra)
+{
+    return [NSString stringWithFormat:@"%s (%@)", ENErrorCodeToString(code), extra];
+}
+
+static NSString *DetectionBenchmarkEagerErrorDescription(ENErrorCode code, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    NSString *extra = [[NSString alloc] initWithFormat:@(format) arguments:args];
+    va_end(args);
+    return DetectionBenchmarkErrorDescription(code, extra);
+}
+
+static NSString *DetectionBenchmarkErrorDescriptionMismatch(const char *format, NSError *error, NSString *expected)
+{
+    NSString *found = error.localizedDescription;
+    return [found isEqualToString:expected] ? nil : [NSString stringWithFormat:@"'%s': '%@' != '%@'", format, found, expected];
+}
+
+// Compares a deferred error's description with one Foundation formats eagerly from the same arguments.
+#define DETECTION_BENCHMARK_CHECK_EAGER(FORMAT, ...) \
+    do { \
+        NSString *mismatch = DetectionBenchmarkErrorDescriptionMismatch(FORMAT, ENErrorF(ENErrorCodeBadFormat, FORMAT, __VA_ARGS__), \
+            DetectionBenchmarkEagerErrorDescription(ENErrorCodeBadFormat, FORMAT, __VA_ARGS__)); \
+        if (mismatch) { \
+            return mismatch; \
+        } \
+    } while (0)
+
+// Compares a deferred error's description with a fixed one, for conversions Foundation doesn't support.
+#define DETECTION_BENCHMARK_CHECK_EXPECTED(EXPECTED, FORMAT, ...) \
+    do { \
+        NSString *mismatch = DetectionBenchmarkErrorDescriptionMismatch(FORMAT, ENErrorF(ENErrorCodeBadFormat, FORMAT, __VA_ARGS__), \
+            DetectionBenchmarkErrorDescription(ENErrorCodeBadFormat, (EXPECTED))); \
+        if (mismatch) { \
+            return mismatch; \
+        } \
+    } while (0)
+
+/*
+ * Checks that errors formatted on first read describe themselves as if formatted when created, including the %m and
+ * %.<n>P conversions Foundation doesn't support. Returns nil if they all match, otherwise the first mismatch.
+ */
+static NSString *DetectionBenchmarkErrorFormatMismatch()
+{
+    DETECTION_BENCHMARK_CHECK_EAGER("Read failed: %d of %u bytes at %llu", -3, 16U, 1234567890123ULL);
+    DETECTION_BENCHMARK_CHECK_EAGER("'%s' %@ %c %%", "path", @"object", 'x');
+    DETECTION_BENCHMARK_CHECK_EAGER("%5d|%-5d|%05x|%#x|%X", 42, 42, 255U, 255U, 255U);
+    DETECTION_BENCHMARK_CHECK_EAGER("%.3f %g %e", 3.14159, 0.5, 12345.678);
+    DETECTION_BENCHMARK_CHECK_EAGER("%*d %.*s", 6, 7, 3, "abcdef");
+    DETECTION_BENCHMARK_CHECK_EAGER("%zu %lu %ld %p", (size_t)99, 7UL, -7L, (const void *)0x1234);
+
+    // Strings with a precision needn't be NUL terminated, and bytes are copied when the error is created.
+    static const char kUnterminated[] = {'a', 'b', 'c', 'd'};
+    uint8_t bytes[] = {0xAB, 0xCD, 0x01, 0x02};
+    NSError *bytesError = ENErrorF(ENErrorCodeBadFormat, "rpi %.4P %{public}s", bytes, "done");
+    memset(bytes, 0, sizeof(bytes));
+    NSString *mismatch = DetectionBenchmarkErrorDescriptionMismatch("rpi %.4P %{public}s", bytesError,
+                                                                    DetectionBenchmarkErrorDescription(ENErrorCodeBadFormat, @"rpi abcd0102 done"));
+    if (mismatch) {
+        return mismatch;
+    }
+    DETECTION_BENCHMARK_CHECK_EXPECTED(@"abc|ab", "%.3s|%.*s", kUnterminated, 2, kUnterminated);
+    DETECTION_BENCHMARK_CHECK_EXPECTED(([NSString stringWithFormat:@"Open path failed: '/x', %d (%s)", ENOENT, strerror(ENOENT)]),
+                                       "Open path failed: '%s', %#m", "/x", ENOENT);
+    DETECTION_BENCHMARK_CHECK_EXPECTED(@"write failed: -36", "write failed: %m", -36);
+
+    // The userInfo of a deferred error is built once, with the underlying error of a nested one.
+    NSError *underlyingError = ENErrorF(ENErrorCodeInternal, "inner %d", 1);
+    NSError *error = ENNestedErrorF(underlyingError, ENErrorCodeBadParameter, "outer %d", 2);
+    if (error.userInfo != error.userInfo) {
+        return @"userInfo not cached";
+    }
+    if (error.userInfo[NSUnderlyingErrorKey] != underlyingError) {
+        return @"Underlying error missing";
+    }
+    if (error.code != ENErrorCodeBadParameter || ![error.domain isEqualToString:ENErrorDomain]) {
+        return @"Wrong code or domain";
+    }
+    return nil;
+}
+
+#undef DETECTION_BENCHMARK_CHECK_EAGER
+#undef DETECTION_BENCHMARK_CHECK_EXPECTED
+
+#pragma mark - Main
+
+int main(int argc, const char *argv[])
+{
+    @autoreleasepool {
+        if (argc < 3) {
+            fprintf(stderr, "usage: %s databaseFolder keyFolder [iterations]\n", argv[0]);
+            return 1;
+        }
+        NSString *databaseFolder = [NSString stringWithUTF8String:argv[1]];
+        NSString *keyFolder = [NSString stringWithUTF8String:argv[2]];
+        int iterations = (argc > 3) ? atoi(argv[3]) : 1;
+        if (iterations < 1) {
+            fprintf(stderr, "usage: %s databaseFolder keyFolder [iterations]\n", argv[0]);
+            return 1;
+        }
+
+        // Detection relies on error descriptions formatted on first read matching the eagerly formatted ones.
+        NSString *errorFormatMismatch = DetectionBenchmarkErrorFormatMismatch();
+        if (errorFormatMismatch) {
+            fprintf(stderr, "error format self test failed: %s\n", errorFormatMismatch.UTF8String);
+        }
+
+        NSError *error = nil;
+        NSString *manifestPath = [keyFolder stringByAppendingPathComponent:@"manifest.json"];
+        NSData *manifestData = [NSData dataWithContentsOfFile:manifestPath options:0 error:&error];
+        NSDictionary *manifest = manifestData ? [NSJSONSerialization JSONObjectWithData:manifestData options:0 error:&error] : nil;
+        if (![manifest isKindOfClass:[NSDictionary class]]) {
+            fprintf(stderr, "failed to read %s: %s\n", manifestPath.UTF8String, error.description.UTF8String);
+            return 1;
+        }
+        NSArray<NSString *> *batches = manifest[@"batches"];
+        NSArray<NSDictionary *> *expectedExposures = manifest[@"exposures"];
+
+        // The generator computes durations for the 50/70 dB thresholds; compare the three buckets those define.
+        ENExposureConfiguration *configuration = [[ENExposureConfiguration alloc] init];
+        configuration.attenuationDurationThresholds = @[ @50, @70 ];
+        NSUInteger durationCount = configuration.attenuationDurationThresholds.count + 1;
+        NSArray<NSString *> *expectedSignatures = DetectionBenchmarkExpectedSignatures(expectedExposures, durationCount);
+
+        ENFileSignatureVerification *verification = [[ENFileSignatureVerification alloc] initWithAppID:manifest[@"appleBundleID"]
+                                                                                             publicKey:manifest[@"publicKey"]];
+
+        // Detection saves the keys that matched nothing next to the database, which would let later iterations skip them.
+        NSString *tekCachePath = [ENTEKCache tekCachePathInFolderPath:databaseFolder];
+        NSFileManager *fileManager = [NSFileManager defaultManager];
+
+        BOOL allMatched = YES;
+        NSMutableArray *results = [[NSMutableArray alloc] init];
+        for (int iteration = 0; iteration < iterations; iteration++) {
+            @autoreleasepool {
+                if ([fileManager fileExistsAtPath:tekCachePath] && ![fileManager removeItemAtPath:tekCachePath error:&error]) {
+                    fprintf(stderr, "failed to delete %s: %s\n", tekCachePath.UTF8String, error.description.UTF8String);
+                    return 1;
+                }
+                ENDetectionStageMetrics stages[DetectionBenchmarkStageCount] = {};
+
+                ENDetectionStageTimer timer = ENDetectionStageTimerStart(YES);
+                ENAdvertisementDatabase *database = [[ENAdvertisementDatabase alloc] initWithDatabaseFolderPath:databaseFolder cacheCount:0];
+                ENExposureDetectionDaemonSession *session = [[ENExposureDetectionDaemonSession alloc] initWithDatabase:database
+                                                                                                        configuration:configuration];
+                ENDetectionStageTimerStop(timer, YES, &stages[DetectionBenchmarkStageSessionSetup]);
+                if (!session) {
+                    fprintf(stderr, "failed to create a detection session for %s\n", databaseFolder.UTF8String);
+                    return 1;
+                }
+                session.metrics.tracksAllocations = YES;
+
+                for (NSString *batch in batches) {
+                    NSString *batchPath = [keyFolder stringByAppendingPathComponent:batch];
+                    NSString *keyPath = [batchPath stringByAppendingPathComponent:@"export.bin"];
+                    NSString *signaturePath = [batchPath stringByAppendingPathComponent:@"export.sig"];
+
+                    timer = ENDetectionStageTimerStart(YES);
+                    ENFile *file = [[ENFile alloc] init];
+                    BOOL opened = [file openWithFileSystemRepresentation:keyPath.fileSystemRepresentation reading:YES error:&error];
+                    ENDetectionStageTimerStop(timer, YES, &stages[DetectionBenchmarkStageFileOpen]);
+                    if (!opened) {
+                        fprintf(stderr, "failed to open %s: %s\n", keyPath.UTF8String, error.description.UTF8String);
+                        return 1;
+                    }
+
+                    timer = ENDetectionStageTimerStart(YES);
+                    ENSignatureFile *signatureFile = [[ENSignatureFile alloc] init];
+                    BOOL valid = [signatureFile openWithFileSystemRepresentation:signaturePath.fileSystemRepresentation reading:YES error:&error]
+                        && [verification validateFile:file withSignatureFile:signatureFile];
+                    ENDetectionStageTimerStop(timer, YES, &stages[DetectionBenchmarkStageSignatureValidation]);
+                    [signatureFile closeAndReturnError:NULL];
+                    if (!valid) {
+                        fprintf(stderr, "signature of %s did not validate\n", keyPath.UTF8String);
+                        return 1;
+                    }
+
+                    timer = ENDetectionStageTimerStart(YES);
+                    BOOL added = [session addFile:file];
+                    ENDetectionStageTimerStop(timer, YES, &stages[DetectionBenchmarkStageAddFile]);
+                    [file closeAndReturnError:NULL];
+                    if (!added) {
+                        fprintf(stderr, "failed to match %s\n", keyPath.UTF8String);
+                        return 1;
+                    }
+                }
+
+                timer = ENDetectionStageTimerStart(YES);
+                ENExposureDetectionSummary *summary = [session generateSummary];
+                ENDetectionStageTimerStop(timer, YES, &stages[DetectionBenchmarkStageGenerateSummary]);
+
+                timer = ENDetectionStageTimerStart(YES);
+                NSArray<ENExposureInfo *> *exposureInfo = [session exposureInfo];
+                ENDetectionStageTimerStop(timer, YES, &stages[DetectionBenchmarkStageExposureInfo]);
+
+                NSArray<NSString *> *foundSignatures = DetectionBenchmarkFoundSignatures(exposureInfo, durationCount);
+                BOOL matched = [foundSignatures isEqualToArray:expectedSignatures];
+                allMatched = allMatched && matched;
+
+                NSMutableDictionary *outerStages = [[NSMutableDictionary alloc] init];
+                for (NSUInteger stage = 0; stage < DetectionBenchmarkStageCount; stage++) {
+                    outerStages[kDetectionBenchmarkStageNames[stage]] = DetectionBenchmarkStageDictionary(stages[stage]);
+                }
+                NSMutableDictionary *innerStages = [[NSMutableDictionary alloc] init];
+                for (NSUInteger stage = 0; stage < ENDetectionStageCount; stage++) {
+                    ENDetectionStageMetrics metrics = [session.metrics metricsForStage:(ENDetectionStage)stage];
+                    innerStages[[ENDetectionMetrics nameForStage:(ENDetectionStage)stage]] = DetectionBenchmarkStageDictionary(metrics);
+                }
+                NSMutableDictionary *counters = [[NSMutableDictionary alloc] init];
+                for (NSUInteger counter = 0; counter < ENDetectionCounterCount; counter++) {
+                    counters[[ENDetectionMetrics nameForCounter:(ENDetectionCounter)counter]] = @([session.metrics valueForCounter:(ENDetectionCounter)counter]);
+                }
+                [results addObject:@{
+                    @"iteration" : @(iteration),
+                    @"stages" : outerStages,
+                    @"detectionStages" : innerStages,
+                    @"detectionCounters" : counters,
+                    @"matchedKeyCount" : @(summary.matchedKeyCount),
+                    @"tekCacheSkips" : @([session.metrics valueForCounter:ENDetectionCounterCachedKeySkips]),
+                    @"exposureCount" : @(exposureInfo.count),
+                    @"expectedExposureCount" : @(expectedExposures.count),
+                    @"matchesManifest" : @(matched),
+                }];
+            }
+        }
+
+        [fileManager removeItemAtPath:tekCachePath error:NULL];
+
+        NSDictionary *report = @{
+            @"databaseFolder" : databaseFolder,
+            @"keyFolder" : keyFolder,
+            @"keyCount" : manifest[@"keyCount"] ?: @0,
+            @"fileCount" : @(batches.count),
+            @"errorFormatSelfTest" : errorFormatMismatch ?: @"passed",
+            @"iterations" : results,
+        };
+        NSData *reportData = [NSJSONSerialization dataWithJSONObject:report
+                                                             options:(NSJSONWritingPrettyPrinted | NSJSONWritingSortedKeys)
+                                                               error:&error];
+        if (!reportData) {
+            fprintf(stderr, "failed to write the report: %s\n", error.description.UTF8String);
+            return 1;
+        }
+        fwrite(reportData.bytes, 1, reportData.length, stdout);
+        printf("\n");
+
+        if (!allMatched) {
+            fprintf(stderr, "exposures did not match %s\n", manifestPath.UTF8String);
+            return 2;
+        }
+        if (errorFormatMismatch) {
+            return 2;
+        }
+    }
+    return 0;
+}
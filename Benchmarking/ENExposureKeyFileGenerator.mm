@@ -0,0 +1,506 @@
+/*
+ *      Copyright (C) 2020 Apple Inc. All Rights Reserved.
+ *
+ *      ExposureNotification is licensed under Apple Inc.’s
+ *      Sample Code License Agreement, which is contained in
+ *      the LICENSE file distributed with ExposureNotification,
+ *      and only to those who accept that license.
+ *
+ */
+
+/*
+ * Writes signed export.bin/export.sig key files with synthetic TEKs, and a JSON manifest of the exposures matching
+ * them against a synthetic advertisement database should find.
+ *
+ * Usage: ENExposureKeyFileGenerator outputFolder keyCount [databaseFolder] [seed] [keysPerFile]
+ *                                   [shortPeriodFraction] [riskLevelWeights]
+ *
+ * databaseFolder is a folder written by ENAdvertisementDatabaseGenerator, or "-" for none. The TEKs listed in its
+ * synthetic_keys.csv are planted among the random ones. keysPerFile splits the keys into batches (0, the default,
+ * writes one file). shortPeriodFraction (default 0.05) is the fraction of random keys with a rolling period under a
+ * day; like keys uploaded for the current day, they all start on the last day the file covers. riskLevelWeights is a
+ * comma separated relative weight for each transmission risk level 0-7 (default "0,1,1,1,1,1,1,1").
+ *
+ * The key files are signed with a new P-256 key. The manifest, outputFolder/manifest.json, holds its base64 public
+ * key for ENFileSignatureVerification, the batch directories, and one expected exposure per planted key found in the
+ * database. Each exposure's date, transmission risk level, duration and attenuation durations (for the default 50/70
+ * dB thresholds) are computed from the database rows with the same filtering and combining rules as
+ * ENAdvertisementDatabaseQuerySession, including dropping keys with an implausible Tx power and advertisements over 14
+ * days old as of when the generator runs (the manifest's generatedAt). Attenuation value and risk score depend on the
+ * exposure configuration, so the manifest has each exposure's duration per attenuation value bucket to derive them
+ * from instead.
+ */
+
+#import <Foundation/Foundation.h>
+#import <Security/Security.h>
+#import <sqlite3.h>
+#import <stdio.h>
+#import <stdlib.h>
+#import <time.h>
+#import <algorithm>
+#import <vector>
+
+#import "ENCryptography.h"
+#import "ENFile.h"
+#import "ENFileExporter.h"
+#import "ExposureNotificationBenchmarkRandom.h"
+
+#pragma mark - Generation Parameters
+
+#define KEY_GENERATOR_DAY_COUNT                 (14)
+#define KEY_GENERATOR_INTERVALS_PER_DAY         (144)
+#define KEY_GENERATOR_SECONDS_PER_INTERVAL      (10 * 60)
+#define KEY_GENERATOR_SECONDS_PER_DAY           (24 * 60 * 60)
+#define KEY_GENERATOR_RISK_LEVEL_COUNT          (8)
+
+// Matching rules from ENAdvertisementDatabase and ENAdvertisementDatabaseQuerySession.
+#define MATCH_TOLERANCE_CTIN                    (12)
+#define MATCH_AGE_THRESHOLD                     (14 * 24 * 60 * 60)
+#define MATCH_TX_POWER_MIN                      (-60)
+#define MATCH_TX_POWER_MAX                      (20)
+#define MATCH_MERGE_INTERVAL                    (4.0)
+#define MATCH_ALLOWABLE_RPI_BROADCAST_DURATION  (20 * 60.0)
+#define MATCH_DURATION_MAX                      (UINT16_MAX)
+#define MATCH_ATTENUATION_DURATION_BUCKET_COUNT (4)
+#define MATCH_ATTENUATION_VALUE_BUCKET_COUNT    (8)
+
+static const uint8_t kAttenuationDurationThresholds[MATCH_ATTENUATION_DURATION_BUCKET_COUNT] = {50, 70, UINT8_MAX, UINT8_MAX};
+static const uint8_t kAttenuationValueThresholds[MATCH_ATTENUATION_VALUE_BUCKET_COUNT] = {10, 15, 27, 33, 51, 63, 73, UINT8_MAX};
+
+typedef struct
+{
+    ENFileKeyRecord record;
+    int8_t txPower;
+    bool planted;
+} KeyGeneratorKey;
+
+typedef struct
+{
+    double timestamp;
+    uint16_t scanInterval;
+    int8_t rssi;
+    bool saturated;
+    uint8_t counter;
+    uint32_t rpiIndex;
+} KeyGeneratorObservation;
+
+#pragma mark - Planted Keys
+
+static BOOL KeyGeneratorParseHex(const char *hex, uint8_t *outBytes, size_t length)
+{
+    for (size_t i = 0; i < length; i++) {
+        unsigned int byte;
+        if (sscanf(hex + (i * 2), "%2x", &byte) != 1) {
+            return NO;
+        }
+        outBytes[i] = (uint8_t)byte;
+    }
+    return YES;
+}
+
+static BOOL KeyGeneratorReadPlantedKeys(NSString *path, std::vector<KeyGeneratorKey> &outKeys)
+{
+    FILE *file = fopen(path.UTF8String, "r");
+    if (!file) {
+        return NO;
+    }
+    char line[256];
+    BOOL header = YES;
+    while (fgets(line, sizeof(line), file)) {
+        if (header) {
+            header = NO;
+            continue;
+        }
+        char hex[(EN_TEK_LEN * 2) + 1];
+        unsigned int rollingStartNumber, rollingPeriod, rowCount;
+        int txPower;
+        if (sscanf(line, "%32[0-9a-f],%u,%u,%d,%u", hex, &rollingStartNumber, &rollingPeriod, &txPower, &rowCount) != 5) {
+            continue;
+        }
+        KeyGeneratorKey key = {};
+        if (!KeyGeneratorParseHex(hex, key.record.keyData, sizeof(key.record.keyData))) {
+            continue;
+        }
+        key.record.rollingStartNumber = rollingStartNumber;
+        key.record.rollingPeriod = rollingPeriod;
+        key.txPower = (int8_t)txPower;
+        key.planted = true;
+        outKeys.push_back(key);
+    }
+    fclose(file);
+    return YES;
+}
+
+#pragma mark - Expected Exposures
+
+static uint8_t KeyGeneratorAttenuation(int8_t txPower, int8_t rssi, bool saturated)
+{
+    if (rssi == 127 && saturated) {
+        return 0;
+    }
+    int16_t attenuation = txPower - rssi;
+    return (attenuation < 0) ? 0 : (uint8_t)attenuation;
+}
+
+static BOOL KeyGeneratorReadObservations(sqlite3 *database, const KeyGeneratorKey &key,
+                                         std::vector<KeyGeneratorObservation> &outObservations)
+{
+    uint8_t tek[EN_TEK_LEN];
+    memcpy(tek, key.record.keyData, sizeof(tek));
+    uint8_t rpis[KEY_GENERATOR_INTERVALS_PER_DAY * EN_RPI_LEN];
+    if (ENGenerate144RollingProximityIdentifiers(tek, EN_TEK_LEN, key.record.rollingStartNumber, rpis, sizeof(rpis)) != BT_SUCCESS) {
+        return NO;
+    }
+
+    sqlite3_stmt *statement = NULL;
+    if (sqlite3_prepare_v2(database, "SELECT timestamp, scan_interval, rssi, saturated, counter FROM en_advertisements WHERE rpi = ?1;",
+                           -1, &statement, NULL) != SQLITE_OK) {
+        return NO;
+    }
+    for (uint32_t i = 0; i < MIN(key.record.rollingPeriod, (uint32_t)KEY_GENERATOR_INTERVALS_PER_DAY); i++) {
+        sqlite3_bind_blob(statement, 1, rpis + (i * EN_RPI_LEN), EN_RPI_LEN, SQLITE_STATIC);
+        while (sqlite3_step(statement) == SQLITE_ROW) {
+            KeyGeneratorObservation observation;
+            observation.timestamp = (double)sqlite3_column_int64(statement, 0);
+            observation.scanInterval = (uint16_t)sqlite3_column_int(statement, 1);
+            observation.rssi = (int8_t)sqlite3_column_int(statement, 2);
+            observation.saturated = (sqlite3_column_int(statement, 3) != 0);
+            observation.counter = (uint8_t)sqlite3_column_int(statement, 4);
+            observation.rpiIndex = key.record.rollingStartNumber + i;
+            outObservations.push_back(observation);
+        }
+        sqlite3_reset(statement);
+    }
+    sqlite3_finalize(statement);
+    return YES;
+}
+
+/*
+ * Applies the database's and query session's rules to one key's observations: drop the key if its Tx power is out of
+ * range, drop observations older than timestampThreshold, outside the RPI's interval tolerance or with implausible
+ * attenuations and RPIs seen for too long, combine observations within 4 seconds, and truncate overlapping scan
+ * intervals. Returns nil if nothing is left.
+ */
+static NSDictionary *KeyGeneratorExpectedExposure(const KeyGeneratorKey &key, const std::vector<KeyGeneratorObservation> &observations,
+                                                  double timestampThreshold)
+{
+    if (key.txPower < MATCH_TX_POWER_MIN || key.txPower > MATCH_TX_POWER_MAX) {
+        return nil;
+    }
+
+    std::vector<KeyGeneratorObservation> valid;
+    for (const KeyGeneratorObservation &observation : observations) {
+        if (observation.timestamp < timestampThreshold) {
+            continue;
+        }
+        uint32_t observedInterval = (uint32_t)(observation.timestamp / KEY_GENERATOR_SECONDS_PER_INTERVAL);
+        if (observedInterval + MATCH_TOLERANCE_CTIN < observation.rpiIndex ||
+            observedInterval > observation.rpiIndex + MATCH_TOLERANCE_CTIN) {
+            continue;
+        }
+        if (KeyGeneratorAttenuation(key.txPower, observation.rssi, observation.saturated) < 1) {
+            continue;
+        }
+        valid.push_back(observation);
+    }
+    std::stable_sort(valid.begin(), valid.end(), [](const KeyGeneratorObservation &a, const KeyGeneratorObservation &b) {
+        return a.timestamp < b.timestamp;
+    });
+
+    std::vector<KeyGeneratorObservation> combined;
+    std::vector<double> firstSeen(KEY_GENERATOR_INTERVALS_PER_DAY, -1.0);
+    for (const KeyGeneratorObservation &observation : valid) {
+        double &first = firstSeen[observation.rpiIndex - key.record.rollingStartNumber];
+        if (first < 0) {
+            first = observation.timestamp;
+        }
+        if ((observation.timestamp - first) > MATCH_ALLOWABLE_RPI_BROADCAST_DURATION) {
+            continue;
+        }
+
+        if (!combined.empty() && (observation.timestamp - combined.back().timestamp) <= MATCH_MERGE_INTERVAL) {
+            KeyGeneratorObservation &previous = combined.back();
+            uint8_t totalCount = previous.counter + observation.counter;
+            if (!totalCount) {
+                totalCount = 1;
+            }
+            if (observation.rssi != INT8_MAX && previous.rssi != INT8_MAX) {
+                previous.rssi = (int8_t)(((previous.rssi * previous.counter) + (observation.rssi * observation.counter)) / totalCount);
+            } else {
+                previous.rssi = MIN(previous.rssi, observation.rssi);
+            }
+            previous.saturated = (previous.rssi == INT8_MAX);
+            previous.counter = totalCount;
+        } else {
+            combined.push_back(observation);
+        }
+    }
+    if (combined.empty()) {
+        return nil;
+    }
+    for (size_t i = 0; i + 1 < combined.size(); i++) {
+        if (combined[i].timestamp > (combined[i + 1].timestamp - combined[i + 1].scanInterval)) {
+            combined[i + 1].scanInterval = (uint16_t)(combined[i + 1].timestamp - combined[i].timestamp);
+        }
+    }
+
+    uint32_t attenuationDurations[MATCH_ATTENUATION_DURATION_BUCKET_COUNT] = {0};
+    uint32_t attenuationValueDurations[MATCH_ATTENUATION_VALUE_BUCKET_COUNT] = {0};
+    uint32_t totalDuration = 0;
+    for (const KeyGeneratorObservation &observation : combined) {
+        totalDuration += observation.scanInterval;
+        if (observation.rssi == INT8_MAX) {
+            continue;
+        }
+        uint8_t attenuation = KeyGeneratorAttenuation(key.txPower, observation.rssi, observation.saturated);
+        for (int i = 0; i < MATCH_ATTENUATION_DURATION_BUCKET_COUNT; i++) {
+            if (attenuation <= kAttenuationDurationThresholds[i]) {
+                attenuationDurations[i] += observation.scanInterval;
+                break;
+            }
+        }
+        for (int i = 0; i < MATCH_ATTENUATION_VALUE_BUCKET_COUNT; i++) {
+            if (attenuation <= kAttenuationValueThresholds[i]) {
+                attenuationValueDurations[(MATCH_ATTENUATION_VALUE_BUCKET_COUNT - 1) - i] += observation.scanInterval;
+                break;
+            }
+        }
+    }
+
+    NSMutableArray *durations = [[NSMutableArray alloc] init];
+    for (int i = 0; i < MATCH_ATTENUATION_DURATION_BUCKET_COUNT; i++) {
+        [durations addObject:@(MIN(attenuationDurations[i], (uint32_t)MATCH_DURATION_MAX))];
+    }
+    NSMutableArray *valueDurations = [[NSMutableArray alloc] init];
+    for (int i = 0; i < MATCH_ATTENUATION_VALUE_BUCKET_COUNT; i++) {
+        [valueDurations addObject:@(attenuationValueDurations[i])];
+    }
+    NSMutableString *keyHex = [[NSMutableString alloc] init];
+    for (size_t i = 0; i < sizeof(key.record.keyData); i++) {
+        [keyHex appendFormat:@"%02x", key.record.keyData[i]];
+    }
+    uint64_t earliest = (uint64_t)combined.front().timestamp;
+
+    return @{
+        @"temporaryExposureKey" : keyHex,
+        @"rollingStartNumber" : @(key.record.rollingStartNumber),
+        @"rollingPeriod" : @(key.record.rollingPeriod),
+        @"transmissionRiskLevel" : @(key.record.transmissionRiskLevel),
+        @"date" : @(earliest - (earliest % KEY_GENERATOR_SECONDS_PER_DAY)),
+        @"duration" : @(MIN(totalDuration, (uint32_t)MATCH_DURATION_MAX)),
+        @"attenuationDurations" : durations,
+        @"attenuationValueDurations" : valueDurations,
+        @"advertisementCount" : @(combined.size()),
+    };
+}
+
+#pragma mark - Signing
+
+static SecKeyRef KeyGeneratorCreateSigningKey(NSString **outPublicKey)
+{
+    NSDictionary *attributes = @{(id)kSecAttrKeyType : (id)kSecAttrKeyTypeECSECPrimeRandom,
+                                 (id)kSecAttrKeySizeInBits : @(256)};
+    CFErrorRef error = NULL;
+    SecKeyRef privateKey = SecKeyCreateRandomKey((__bridge CFDictionaryRef)attributes, &error);
+    if (!privateKey) {
+        if (error) {
+            CFRelease(error);
+        }
+        return NULL;
+    }
+    SecKeyRef publicKey = SecKeyCopyPublicKey(privateKey);
+    NSData *publicKeyData = publicKey ? CFBridgingRelease(SecKeyCopyExternalRepresentation(publicKey, NULL)) : nil;
+    if (publicKey) {
+        CFRelease(publicKey);
+    }
+    if (!publicKeyData) {
+        CFRelease(privateKey);
+        return NULL;
+    }
+    *outPublicKey = [publicKeyData base64EncodedStringWithOptions:0];
+    return privateKey;
+}
+
+#pragma mark - Main
+
+int main(int argc, const char *argv[])
+{
+    @autoreleasepool {
+        if (argc < 3) {
+            fprintf(stderr, "usage: %s outputFolder keyCount [databaseFolder] [seed] [keysPerFile] [shortPeriodFraction] [riskLevelWeights]\n", argv[0]);
+            return 1;
+        }
+        NSString *outputFolder = [NSString stringWithUTF8String:argv[1]];
+        uint64_t keyCount = strtoull(argv[2], NULL, 10);
+        NSString *databaseFolder = (argc > 3 && strcmp(argv[3], "-") != 0) ? [NSString stringWithUTF8String:argv[3]] : nil;
+        uint64_t seed = (argc > 4) ? strtoull(argv[4], NULL, 10) : 1;
+        size_t keysPerFile = (argc > 5) ? (size_t)strtoull(argv[5], NULL, 10) : 0;
+        double shortPeriodFraction = (argc > 6) ? strtod(argv[6], NULL) : 0.05;
+        double riskWeights[KEY_GENERATOR_RISK_LEVEL_COUNT] = {0, 1, 1, 1, 1, 1, 1, 1};
+        if (argc > 7) {
+            const char *weights = argv[7];
+            for (int i = 0; i < KEY_GENERATOR_RISK_LEVEL_COUNT && weights; i++) {
+                riskWeights[i] = strtod(weights, NULL);
+                weights = strchr(weights, ',');
+                weights = weights ? weights + 1 : NULL;
+            }
+        }
+        double totalRiskWeight = 0;
+        for (double weight : riskWeights) {
+            totalRiskWeight += weight;
+        }
+        if (keyCount == 0 || totalRiskWeight <= 0) {
+            fprintf(stderr, "usage: %s outputFolder keyCount [databaseFolder] [seed] [keysPerFile] [shortPeriodFraction] [riskLevelWeights]\n", argv[0]);
+            return 1;
+        }
+
+        BenchmarkRandom random(seed);
+        auto randomRiskLevel = [&]() -> uint8_t {
+            double pick = random.uniform(0.0, totalRiskWeight);
+            for (uint8_t level = 0; level < KEY_GENERATOR_RISK_LEVEL_COUNT; level++) {
+                if (pick < riskWeights[level]) {
+                    return level;
+                }
+                pick -= riskWeights[level];
+            }
+            return KEY_GENERATOR_RISK_LEVEL_COUNT - 1;
+        };
+
+        std::vector<KeyGeneratorKey> keys;
+        if (databaseFolder) {
+            NSString *plantedPath = [databaseFolder stringByAppendingPathComponent:@"synthetic_keys.csv"];
+            if (!KeyGeneratorReadPlantedKeys(plantedPath, keys)) {
+                fprintf(stderr, "failed to read %s\n", plantedPath.UTF8String);
+                return 1;
+            }
+        }
+        size_t plantedCount = keys.size();
+        for (KeyGeneratorKey &key : keys) {
+            key.record.transmissionRiskLevel = randomRiskLevel();
+        }
+
+        // Random keys cover the 14 days ending on the last planted key's day, or today if nothing was planted.
+        uint32_t lastDay = keys.empty() ? (uint32_t)(time(NULL) / KEY_GENERATOR_SECONDS_PER_DAY) : 0;
+        for (const KeyGeneratorKey &key : keys) {
+            lastDay = MAX(lastDay, key.record.rollingStartNumber / KEY_GENERATOR_INTERVALS_PER_DAY);
+        }
+        uint32_t firstDay = lastDay - (KEY_GENERATOR_DAY_COUNT - 1);
+
+        keys.reserve(MAX((size_t)keyCount, plantedCount));
+        while (keys.size() < keyCount) {
+            KeyGeneratorKey key = {};
+            random.fill(key.record.keyData, sizeof(key.record.keyData));
+            if (random.uniform() < shortPeriodFraction) {
+                key.record.rollingStartNumber = lastDay * KEY_GENERATOR_INTERVALS_PER_DAY;
+                key.record.rollingPeriod = 1 + random.uniform(KEY_GENERATOR_INTERVALS_PER_DAY - 1);
+            } else {
+                key.record.rollingStartNumber = (firstDay + random.uniform((uint32_t)KEY_GENERATOR_DAY_COUNT)) * KEY_GENERATOR_INTERVALS_PER_DAY;
+                key.record.rollingPeriod = KEY_GENERATOR_INTERVALS_PER_DAY;
+            }
+            key.record.transmissionRiskLevel = randomRiskLevel();
+            keys.push_back(key);
+        }
+
+        // Spread the planted keys through the files rather than leaving them all at the front.
+        for (size_t i = keys.size() - 1; i > 0; i--) {
+            std::swap(keys[i], keys[random.uniform((uint32_t)MIN(i + 1, (size_t)UINT32_MAX))]);
+        }
+
+        // Expected exposures, computed before export so the database can't change underneath. Advertisements expire
+        // relative to now, as the database drops them when matching.
+        NSMutableArray *exposures = [[NSMutableArray alloc] init];
+        time_t generatedAt = time(NULL);
+        double timestampThreshold = (double)generatedAt - MATCH_AGE_THRESHOLD;
+        if (databaseFolder) {
+            NSString *databasePath = [databaseFolder stringByAppendingPathComponent:@"en_advertisements.db"];
+            sqlite3 *database = NULL;
+            if (sqlite3_open_v2(databasePath.UTF8String, &database, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
+                fprintf(stderr, "failed to open %s\n", databasePath.UTF8String);
+                sqlite3_close(database);
+                return 1;
+            }
+            for (const KeyGeneratorKey &key : keys) {
+                if (!key.planted) {
+                    continue;
+                }
+                std::vector<KeyGeneratorObservation> observations;
+                if (!KeyGeneratorReadObservations(database, key, observations)) {
+                    fprintf(stderr, "failed to read observations: %s\n", sqlite3_errmsg(database));
+                    sqlite3_close(database);
+                    return 1;
+                }
+                NSDictionary *exposure = KeyGeneratorExpectedExposure(key, observations, timestampThreshold);
+                if (exposure) {
+                    [exposures addObject:exposure];
+                }
+            }
+            sqlite3_close(database);
+        }
+
+        NSString *publicKey = nil;
+        SecKeyRef signingKey = KeyGeneratorCreateSigningKey(&publicKey);
+        if (!signingKey) {
+            fprintf(stderr, "failed to create a signing key\n");
+            return 1;
+        }
+
+        std::vector<ENFileKeyRecord> records;
+        records.reserve(keys.size());
+        for (const KeyGeneratorKey &key : keys) {
+            records.push_back(key.record);
+        }
+
+        ENSignature *signatureTemplate = [[ENSignature alloc] init];
+        signatureTemplate.appleBundleID = @"com.example.ExposureNotificationBenchmark";
+        signatureTemplate.keyID = @"000";
+        signatureTemplate.keyVersion = @"v1";
+        signatureTemplate.signatureAlgorithm = @"1.2.840.10045.4.3.2";
+
+        ENFileExporter *exporter = [[ENFileExporter alloc] init];
+        exporter.metadata = @{
+            ENFileMetadataKeyRegion : @"000",
+            ENFileMetadataKeyPublicKeyVersion : @"v1",
+            ENFileMetadataKeyStartTimestamp : @((uint64_t)firstDay * KEY_GENERATOR_SECONDS_PER_DAY),
+            ENFileMetadataKeyEndTimestamp : @((uint64_t)(lastDay + 1) * KEY_GENERATOR_SECONDS_PER_DAY),
+        };
+        exporter.maxKeysPerFile = keysPerFile;
+        exporter.signatureTemplate = signatureTemplate;
+        exporter.signingKey = signingKey;
+        CFRelease(signingKey);
+
+        NSError *error = nil;
+        NSArray<NSString *> *batchPaths = [exporter exportKeys:records.data() count:records.size() toDirectory:outputFolder error:&error];
+        if (!batchPaths) {
+            fprintf(stderr, "failed to export keys: %s\n", error.description.UTF8String);
+            return 1;
+        }
+
+        NSMutableArray *batches = [[NSMutableArray alloc] init];
+        for (NSString *path in batchPaths) {
+            [batches addObject:[path lastPathComponent]];
+        }
+        NSDictionary *manifest = @{
+            @"seed" : @(seed),
+            @"generatedAt" : @((uint64_t)generatedAt),
+            @"keyCount" : @(keys.size()),
+            @"plantedKeyCount" : @(plantedCount),
+            @"appleBundleID" : signatureTemplate.appleBundleID,
+            @"publicKey" : publicKey,
+            @"batches" : batches,
+            @"exposures" : exposures,
+        };
+        NSData *manifestData = [NSJSONSerialization dataWithJSONObject:manifest
+                                                               options:(NSJSONWritingPrettyPrinted | NSJSONWritingSortedKeys)
+                                                                 error:&error];
+        NSString *manifestPath = [outputFolder stringByAppendingPathComponent:@"manifest.json"];
+        if (!manifestData || ![manifestData writeToFile:manifestPath options:NSDataWritingAtomic error:&error]) {
+            fprintf(stderr, "failed to write %s: %s\n", manifestPath.UTF8String, error.description.UTF8String);
+            return 1;
+        }
+
+        printf("keys:           %zu (%zu planted)\n", keys.size(), plantedCount);
+        printf("files:          %lu\n", (unsigned long)batchPaths.count);
+        printf("exposures:      %lu\n", (unsigned long)exposures.count);
+    }
+    return 0;
+}
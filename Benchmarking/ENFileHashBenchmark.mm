@@ -0,0 +1,192 @@
+/*
+ *      Copyright (C) 2020 Apple Inc. All Rights Reserved.
+ *
+ *      ExposureNotification is licensed under Apple Inc.’s
+ *      Sample Code License Agreement, which is contained in
+ *      the LICENSE file distributed with ExposureNotification,
+ *      and only to those who accept that license.
+ *
+ */
+
+/*
+ * Measures SHA-256 throughput for re-validating an archive of key files.
+ *
+ * Usage: ENFileHashBenchmark keyFolder [iterations]
+ *
+ * Every export.bin below keyFolder (e.g. as written by ENExposureKeyFileGenerator) is mapped once and hashed, serially,
+ * with each SHA-256 backend available on this CPU and with ENFileHashSHA256MultiBuffer. The bulk mode then hashes the
+ * files from disk with +[ENFile sha256DataForFileSystemRepresentations:error:], which maps them and spreads them
+ * across cores, so it includes the cost of opening and mapping. Every mode must produce the same hashes as corecrypto.
+ *
+ * Results are written to stdout as JSON, with the wall time and throughput in GB/s (10^9 bytes per second) of each mode
+ * in each iteration and the best throughput of each mode.
+ */
+
+#import <Foundation/Foundation.h>
+#import <stdio.h>
+#import <stdlib.h>
+#import <time.h>
+#import <vector>
+
+#import "ENFile.h"
+#import "ENFileHash.h"
+
+#pragma mark - Timing
+
+static uint64_t NowNanoseconds()
+{
+    return clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+}
+
+static NSDictionary *HashBenchmarkResult(uint64_t nanoseconds, uint64_t byteCount)
+{
+    double seconds = MAX(nanoseconds, (uint64_t)1) / 1e9;
+    return @{
+        @"wallSeconds" : @(seconds),
+        @"gigabytesPerSecond" : @(byteCount / seconds / 1e9),
+    };
+}
+
+#pragma mark - Main
+
+int main(int argc, const char *argv[])
+{
+    @autoreleasepool {
+        if (argc < 2) {
+            fprintf(stderr, "usage: %s keyFolder [iterations]\n", argv[0]);
+            return 1;
+        }
+        NSString *keyFolder = [NSString stringWithUTF8String:argv[1]];
+        int iterations = (argc > 2) ? atoi(argv[2]) : 3;
+        if (iterations < 1) {
+            fprintf(stderr, "usage: %s keyFolder [iterations]\n", argv[0]);
+            return 1;
+        }
+
+        NSMutableArray<NSString *> *paths = [[NSMutableArray alloc] init];
+        NSDirectoryEnumerator<NSString *> *enumerator = [[NSFileManager defaultManager] enumeratorAtPath:keyFolder];
+        for (NSString *relativePath in enumerator) {
+            if ([relativePath.lastPathComponent isEqualToString:@"export.bin"]) {
+                [paths addObject:[keyFolder stringByAppendingPathComponent:relativePath]];
+            }
+        }
+        [paths sortUsingSelector:@selector(compare:)];
+        if (paths.count == 0) {
+            fprintf(stderr, "no export.bin files in %s\n", keyFolder.UTF8String);
+            return 1;
+        }
+
+        // Map every file and touch it once so the in-memory modes measure hashing rather than page faults.
+        NSError *error = nil;
+        NSMutableArray<NSData *> *files = [[NSMutableArray alloc] init];
+        std::vector<const void *> filePtrs;
+        std::vector<size_t> fileLens;
+        uint64_t byteCount = 0;
+        for (NSString *path in paths) {
+            NSData *data = [NSData dataWithContentsOfFile:path options:NSDataReadingMappedIfSafe error:&error];
+            if (!data) {
+                fprintf(stderr, "failed to read %s: %s\n", path.UTF8String, error.description.UTF8String);
+                return 1;
+            }
+            [files addObject:data];
+            filePtrs.push_back(data.length > 0 ? data.bytes : "");
+            fileLens.push_back(data.length);
+            byteCount += data.length;
+        }
+        std::vector<uint8_t> expected(paths.count * ENFileHashLength);
+        for (size_t i = 0; i < paths.count; i++) {
+            ENFileHashSHA256WithBackend(ENFileHashBackendCoreCrypto, filePtrs[i], fileLens[i], &expected[i * ENFileHashLength]);
+        }
+
+        NSMutableArray<NSString *> *modes = [[NSMutableArray alloc] init];
+        for (int backend = 0; backend < ENFileHashBackendCount; backend++) {
+            if (ENFileHashBackendIsAvailable((ENFileHashBackend)backend)) {
+                [modes addObject:@(ENFileHashBackendName((ENFileHashBackend)backend))];
+            }
+        }
+        [modes addObject:@"multiBuffer"];
+        [modes addObject:@"bulk"];
+
+        BOOL allMatched = YES;
+        NSMutableDictionary<NSString *, NSNumber *> *best = [[NSMutableDictionary alloc] init];
+        NSMutableArray *results = [[NSMutableArray alloc] init];
+        std::vector<uint8_t> hashes(paths.count * ENFileHashLength);
+        for (int iteration = 0; iteration < iterations; iteration++) {
+            @autoreleasepool {
+                NSMutableDictionary *iterationModes = [[NSMutableDictionary alloc] init];
+                for (int backend = 0; backend < ENFileHashBackendCount; backend++) {
+                    if (!ENFileHashBackendIsAvailable((ENFileHashBackend)backend)) {
+                        continue;
+                    }
+                    uint64_t start = NowNanoseconds();
+                    for (size_t i = 0; i < paths.count; i++) {
+                        ENFileHashSHA256WithBackend((ENFileHashBackend)backend, filePtrs[i], fileLens[i], &hashes[i * ENFileHashLength]);
+                    }
+                    NSMutableDictionary *result = [HashBenchmarkResult(NowNanoseconds() - start, byteCount) mutableCopy];
+                    result[@"matchesCoreCrypto"] = @(hashes == expected);
+                    allMatched = allMatched && (hashes == expected);
+                    iterationModes[@(ENFileHashBackendName((ENFileHashBackend)backend))] = result;
+                }
+
+                uint64_t start = NowNanoseconds();
+                ENFileHashSHA256MultiBuffer(filePtrs.data(), fileLens.data(), paths.count, (uint8_t (*)[ENFileHashLength])hashes.data());
+                NSMutableDictionary *result = [HashBenchmarkResult(NowNanoseconds() - start, byteCount) mutableCopy];
+                result[@"matchesCoreCrypto"] = @(hashes == expected);
+                result[@"accelerated"] = @(ENFileHashMultiBufferIsAccelerated());
+                allMatched = allMatched && (hashes == expected);
+                iterationModes[@"multiBuffer"] = result;
+
+                start = NowNanoseconds();
+                NSArray<NSData *> *bulkHashes = [ENFile sha256DataForFileSystemRepresentations:paths error:&error];
+                result = [HashBenchmarkResult(NowNanoseconds() - start, byteCount) mutableCopy];
+                if (!bulkHashes) {
+                    fprintf(stderr, "failed to hash %s: %s\n", keyFolder.UTF8String, error.description.UTF8String);
+                    return 1;
+                }
+                BOOL bulkMatched = YES;
+                for (size_t i = 0; i < paths.count; i++) {
+                    bulkMatched = bulkMatched && (memcmp(bulkHashes[i].bytes, &expected[i * ENFileHashLength], ENFileHashLength) == 0);
+                }
+                result[@"matchesCoreCrypto"] = @(bulkMatched);
+                allMatched = allMatched && bulkMatched;
+                iterationModes[@"bulk"] = result;
+
+                for (NSString *mode in modes) {
+                    NSNumber *gigabytesPerSecond = iterationModes[mode][@"gigabytesPerSecond"];
+                    if (gigabytesPerSecond.doubleValue > best[mode].doubleValue) {
+                        best[mode] = gigabytesPerSecond;
+                    }
+                }
+                [results addObject:@{
+                    @"iteration" : @(iteration),
+                    @"modes" : iterationModes,
+                }];
+            }
+        }
+
+        NSDictionary *report = @{
+            @"keyFolder" : keyFolder,
+            @"fileCount" : @(paths.count),
+            @"byteCount" : @(byteCount),
+            @"defaultBackend" : @(ENFileHashBackendName(ENFileHashDefaultBackend())),
+            @"cpuCount" : @([NSProcessInfo processInfo].activeProcessorCount),
+            @"bestGigabytesPerSecond" : best,
+            @"iterations" : results,
+        };
+        NSData *reportData = [NSJSONSerialization dataWithJSONObject:report
+                                                             options:(NSJSONWritingPrettyPrinted | NSJSONWritingSortedKeys)
+                                                               error:&error];
+        if (!reportData) {
+            fprintf(stderr, "failed to write the report: %s\n", error.description.UTF8String);
+            return 1;
+        }
+        fwrite(reportData.bytes, 1, reportData.length, stdout);
+        printf("\n");
+
+        if (!allMatched) {
+            fprintf(stderr, "hashes did not match corecrypto\n");
+            return 2;
+        }
+    }
+    return 0;
+}
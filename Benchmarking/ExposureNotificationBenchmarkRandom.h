@@ -0,0 +1,65 @@
+/*
+ *      Copyright (C) 2020 Apple Inc. All Rights Reserved.
+ *
+ *      ExposureNotification is licensed under Apple Inc.’s
+ *      Sample Code License Agreement, which is contained in
+ *      the LICENSE file distributed with ExposureNotification,
+ *      and only to those who accept that license.
+ *
+ */
+
+#pragma once
+
+#import <math.h>
+#import <stdint.h>
+#import <string.h>
+#import <sys/param.h>
+
+#pragma mark - Random Numbers
+
+/*
+ * SplitMix64. Small, fast and fully determined by its seed, so benchmark fixtures and simulations generated with the
+ * same seed are identical on every run.
+ */
+class BenchmarkRandom
+{
+public:
+    explicit BenchmarkRandom(uint64_t seed = 0) : fState(seed) {}
+
+    uint64_t next()
+    {
+        uint64_t z = (fState += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    // Uniform in [0, 1).
+    double uniform() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+
+    double uniform(double low, double high) { return low + ((high - low) * uniform()); }
+
+    // Uniform in [0, bound).
+    uint32_t uniform(uint32_t bound) { return (uint32_t)(uniform() * bound); }
+
+    // Standard normal, Box-Muller.
+    double normal()
+    {
+        double u1 = uniform();
+        double u2 = uniform();
+        return sqrt(-2.0 * log(1.0 - u1)) * cos(2.0 * M_PI * u2);
+    }
+
+    double normal(double mean, double deviation) { return mean + (deviation * normal()); }
+
+    void fill(uint8_t *bytes, size_t length)
+    {
+        for (size_t i = 0; i < length; i += 8) {
+            uint64_t value = next();
+            memcpy(bytes + i, &value, MIN((size_t)8, length - i));
+        }
+    }
+
+private:
+    uint64_t fState;
+};
@@ -0,0 +1,104 @@
+/*
+ *      Copyright (C) 2020 Apple Inc. All Rights Reserved.
+ *
+ *      ExposureNotification is licensed under Apple Inc.’s
+ *      Sample Code License Agreement, which is contained in
+ *      the LICENSE file distributed with ExposureNotification,
+ *      and only to those who accept that license.
+ *
+ */
+
+/*
+ * Replays a synthetic stream of advertisement reports into ExposureNotificationManager at a fixed rate and reports
+ * the latency of each ingestReport call, which is the cost the Bluetooth callback thread pays per report.
+ *
+ * Usage: ExposureNotificationReportQueueBenchmark [reportsPerSecond] [seconds] [uniqueRPIs] [scanWindowSeconds]
+ *
+ * Defaults replay 100k reports/s for 10 seconds from 5000 advertisers, ending a scan window every 4 seconds so
+ * flushes run on the aggregation worker while reports keep arriving.
+ */
+
+#import <Foundation/Foundation.h>
+#import <stdio.h>
+#import <stdlib.h>
+#import <time.h>
+#import <algorithm>
+#import <vector>
+
+#import "ExposureNotificationManager.h"
+
+using namespace BT;
+
+static uint64_t NowNanoseconds()
+{
+    return clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+}
+
+static uint64_t Percentile(const std::vector<uint64_t> &sorted, double percentile)
+{
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t index = (size_t)(percentile * (double)(sorted.size() - 1));
+    return sorted[index];
+}
+
+int main(int argc, const char *argv[])
+{
+    @autoreleasepool {
+        uint64_t reportsPerSecond = (argc > 1) ? strtoull(argv[1], NULL, 10) : 100000;
+        uint64_t seconds = (argc > 2) ? strtoull(argv[2], NULL, 10) : 10;
+        uint32_t uniqueRPIs = (argc > 3) ? (uint32_t)strtoul(argv[3], NULL, 10) : 5000;
+        uint64_t scanWindowSeconds = (argc > 4) ? strtoull(argv[4], NULL, 10) : 4;
+        if (reportsPerSecond == 0 || seconds == 0 || uniqueRPIs == 0 || scanWindowSeconds == 0) {
+            fprintf(stderr, "usage: %s [reportsPerSecond] [seconds] [uniqueRPIs] [scanWindowSeconds]\n", argv[0]);
+            return 1;
+        }
+
+        // Build the advertisers up front so only ingestion is timed.
+        std::vector<ExposureNotificationReportRecord> advertisers(uniqueRPIs);
+        for (ExposureNotificationReportRecord &record : advertisers) {
+            arc4random_buf(record.serviceData, sizeof(record.serviceData));
+            record.flags = 0;
+        }
+
+        uint64_t totalReports = reportsPerSecond * seconds;
+        uint64_t reportsPerWindow = reportsPerSecond * scanWindowSeconds;
+        uint64_t intervalNanoseconds = 1000000000ULL / reportsPerSecond;
+        std::vector<uint64_t> latencies;
+        latencies.reserve(totalReports);
+
+        ExposureNotificationManager *manager = new ExposureNotificationManager();
+        uint64_t start = NowNanoseconds();
+        for (uint64_t i = 0; i < totalReports; i++) {
+            // Pace the stream so the worker sees a realistic arrival rate rather than one burst.
+            uint64_t due = start + (i * intervalNanoseconds);
+            while (NowNanoseconds() < due) {
+            }
+
+            ExposureNotificationReportRecord record = advertisers[arc4random_uniform(uniqueRPIs)];
+            record.rssi = (int8_t)(-40 - (int)arc4random_uniform(60));
+            record.timestamp = CFAbsoluteTimeGetCurrent();
+
+            uint64_t before = NowNanoseconds();
+            manager->ingestReport(record);
+            if (((i + 1) % reportsPerWindow) == 0) {
+                manager->ingestScanStop();
+            }
+            latencies.push_back(NowNanoseconds() - before);
+        }
+        uint64_t elapsed = NowNanoseconds() - start;
+        uint64_t dropped = manager->droppedReportCount();
+        delete manager;
+
+        std::sort(latencies.begin(), latencies.end());
+        printf("reports:        %llu in %.3f s (%.0f reports/s)\n", totalReports, elapsed / 1e9,
+               totalReports / (elapsed / 1e9));
+        printf("dropped:        %llu\n", dropped);
+        printf("latency p50:    %llu ns\n", Percentile(latencies, 0.50));
+        printf("latency p99:    %llu ns\n", Percentile(latencies, 0.99));
+        printf("latency p99.9:  %llu ns\n", Percentile(latencies, 0.999));
+        printf("latency max:    %llu ns\n", latencies.empty() ? 0 : latencies.back());
+    }
+    return 0;
+}
@@ -0,0 +1,484 @@
+/*
+ *      Copyright (C) 2020 Apple Inc. All Rights Reserved.
+ *
+ *      ExposureNotification is licensed under Apple Inc.’s
+ *      Sample Code License Agreement, which is contained in
+ *      the LICENSE file distributed with ExposureNotification,
+ *      and only to those who accept that license.
+ *
+ */
+
+/*
+ * Deterministic discrete-event simulation of many devices advertising and scanning for each other.
+ *
+ * Every virtual device is an ExposureNotificationManager with its own keys and a simulated clock. Devices random-walk
+ * around a square area. When a device's MAC address rotates it generates a new payload with generateAdvertisingPayload,
+ * and when it scans, every device within radio range is delivered to its bluetoothDeviceFoundCallback with an RSSI
+ * from a log-distance path loss model. Each device saves its observations to its own en_advertisements.db, exactly as
+ * a real device would, so the output can be used for ingestion and matching benchmarks.
+ *
+ * Usage: ExposureNotificationSimulator outputFolder [devices] [hours] [seed]
+ *
+ * Defaults simulate 1000 devices for 24 hours with seed 1. The same arguments always produce the same databases. The
+ * TEKs of every device are written to outputFolder/temporary_exposure_keys.csv so the databases can be matched.
+ */
+
+#import <Foundation/Foundation.h>
+#import <math.h>
+#import <stdio.h>
+#import <stdlib.h>
+#import <sys/resource.h>
+#import <time.h>
+#import <algorithm>
+#import <queue>
+#import <vector>
+
+#import "ExposureNotificationBenchmarkRandom.h"
+#import "ExposureNotificationManager.h"
+
+using namespace BT;
+
+#pragma mark - Simulation Parameters
+
+#define SIMULATION_START_TIME                       (1593561600)    // 2020-07-01 00:00:00 UTC
+#define SIMULATION_AREA_METERS                      (500.0)
+#define SIMULATION_RADIO_RANGE_METERS               (30.0)
+#define SIMULATION_MAX_SPEED_METERS_PER_SECOND      (1.4)
+#define SIMULATION_MOVE_INTERVAL_SECONDS            (30.0)
+#define SIMULATION_SCAN_INTERVAL_SECONDS            (150.0)
+#define SIMULATION_SCAN_JITTER_SECONDS              (30.0)
+#define SIMULATION_SCAN_DURATION_SECONDS            (4.0)
+#define SIMULATION_ADVERTISING_INTERVAL_SECONDS     (0.25)
+#define SIMULATION_ROTATION_MIN_SECONDS             (10.0 * 60.0)
+#define SIMULATION_ROTATION_MAX_SECONDS             (20.0 * 60.0)
+#define SIMULATION_RSSI_AT_ONE_METER                (-55.0)
+#define SIMULATION_PATH_LOSS_EXPONENT               (2.0)
+#define SIMULATION_RSSI_NOISE_DB                    (4.0)
+#define SIMULATION_RECEIVER_SENSITIVITY             (-100)
+#define SIMULATION_SATURATION_RSSI                  (-30)
+#define SIMULATION_REPORT_QUEUE_CAPACITY            (2048)
+
+static const LE_UUID kSimulatedServiceUUID = {2, {0xFD6F}};
+
+#pragma mark - Simulated Device
+
+class SimulatedDevice : public ExposureNotificationManager
+{
+public:
+    SimulatedDevice(uint32_t index, uint64_t seed, const double *clock)
+        : ExposureNotificationManager(SIMULATION_REPORT_QUEUE_CAPACITY),
+          fIndex(index),
+          fRandom(seed + index),
+          fKeySeed(BenchmarkRandom(seed ^ (0xA5A5A5A5ULL + index)).next()),
+          fClock(clock)
+    {
+        uint8_t uuidBytes[16] = {0};
+        memcpy(uuidBytes, &index, sizeof(index));
+        fUUID = [[NSUUID alloc] initWithUUIDBytes:uuidBytes];
+        fTxPower = (int8_t)fRandom.uniform(-12.0, 0.0);
+        x = fRandom.uniform(0.0, SIMULATION_AREA_METERS);
+        y = fRandom.uniform(0.0, SIMULATION_AREA_METERS);
+    }
+
+    // Generates the payload this device advertises until its next MAC address rotation.
+    BTResult rotatePayload()
+    {
+        fRandom.fill((uint8_t *)&fAddress, sizeof(fAddress));
+        return generateAdvertisingPayload(fPayload, sizeof(fPayload), fAddress);
+    }
+
+    // Delivers one advertisement report from another device, as the Bluetooth stack would.
+    void deliverReport(const SimulatedDevice &advertiser, int8_t rssi, double timestamp)
+    {
+        LeAdvertisementData advertisement;
+        advertisement.fServiceData[kSimulatedServiceUUID] = ByteBuffer(advertiser.fPayload, sizeof(advertiser.fPayload));
+        advertisement.fDeviceAddress = advertiser.fAddress;
+        advertisement.fRSSI = rssi;
+        advertisement.fIsSaturated = (rssi >= SIMULATION_SATURATION_RSSI);
+        advertisement.fTimestamp = timestamp;
+        LeAdvertisementData::AutoPtr advertisementPtr = &advertisement;
+        bluetoothDeviceFoundCallback(advertiser.fUUID, advertisementPtr);
+    }
+
+    void endScan() { scanDidStop(); }
+
+    void temporaryExposureKeyForDay(uint32_t day, uint8_t *outTEK) const
+    {
+        BenchmarkRandom random(fKeySeed ^ ((uint64_t)day * 0xD1B54A32D192ED03ULL));
+        random.fill(outTEK, EN_TEK_LEN);
+    }
+
+    uint32_t fIndex;
+    BenchmarkRandom fRandom;
+    double x;
+    double y;
+
+protected:
+    BTResult retrieveCurrentTemporaryExposureKey(uint8_t *outBuffer, size_t outBufferSize, uint32_t &outRollingStartNumber) override
+    {
+        if (outBufferSize != EN_TEK_LEN) {
+            return BT_ERROR_INVALID_ARGUMENT;
+        }
+        uint32_t day = currentIntervalNumber() / EN_PAYLOAD_SCHEDULE_INTERVAL_COUNT;
+        temporaryExposureKeyForDay(day, outBuffer);
+        outRollingStartNumber = day * EN_PAYLOAD_SCHEDULE_INTERVAL_COUNT;
+        return BT_SUCCESS;
+    }
+
+    uint32_t currentIntervalNumber() override { return (uint32_t)(*fClock / (60 * 10)); }
+
+    uint8_t getPlatformRadiatedLeTxPower() override { return (uint8_t)fTxPower; }
+
+private:
+    uint64_t fKeySeed;
+    const double *fClock;
+    NSUUID *fUUID;
+    int8_t fTxPower;
+    BTAddress fAddress = 0;
+    uint8_t fPayload[EN_RPI_LEN + EN_AEM_LEN] = {0};
+};
+
+#pragma mark - Spatial Grid
+
+/*
+ * Buckets devices by grid cell so a scan only looks at devices in the scanner's and adjacent cells. The cell size is
+ * the radio range, so every device in range is in one of those nine cells. Rebuilt with a counting sort after devices
+ * move, which keeps the bucket order, and so the simulation, deterministic.
+ */
+class SimulationGrid
+{
+public:
+    SimulationGrid() : fDimension((size_t)ceil(SIMULATION_AREA_METERS / SIMULATION_RADIO_RANGE_METERS)) {}
+
+    void rebuild(const std::vector<SimulatedDevice *> &devices)
+    {
+        fCellStarts.assign((fDimension * fDimension) + 1, 0);
+        fDeviceCells.resize(devices.size());
+        for (size_t i = 0; i < devices.size(); i++) {
+            fDeviceCells[i] = cellFor(devices[i]->x, devices[i]->y);
+            fCellStarts[fDeviceCells[i] + 1]++;
+        }
+        for (size_t cell = 1; cell < fCellStarts.size(); cell++) {
+            fCellStarts[cell] += fCellStarts[cell - 1];
+        }
+        std::vector<uint32_t> next(fCellStarts.begin(), fCellStarts.end() - 1);
+        fCellDevices.resize(devices.size());
+        for (size_t i = 0; i < devices.size(); i++) {
+            fCellDevices[next[fDeviceCells[i]]++] = (uint32_t)i;
+        }
+    }
+
+    template <typename Visitor>
+    void visitNeighbors(const SimulatedDevice &device, Visitor visitor) const
+    {
+        long column = (long)(device.x / SIMULATION_RADIO_RANGE_METERS);
+        long row = (long)(device.y / SIMULATION_RADIO_RANGE_METERS);
+        for (long r = row - 1; r <= row + 1; r++) {
+            for (long c = column - 1; c <= column + 1; c++) {
+                if (r < 0 || c < 0 || r >= (long)fDimension || c >= (long)fDimension) {
+                    continue;
+                }
+                size_t cell = ((size_t)r * fDimension) + (size_t)c;
+                for (uint32_t i = fCellStarts[cell]; i < fCellStarts[cell + 1]; i++) {
+                    visitor(fCellDevices[i]);
+                }
+            }
+        }
+    }
+
+private:
+    size_t cellFor(double x, double y) const
+    {
+        size_t column = MIN((size_t)(x / SIMULATION_RADIO_RANGE_METERS), fDimension - 1);
+        size_t row = MIN((size_t)(y / SIMULATION_RADIO_RANGE_METERS), fDimension - 1);
+        return (row * fDimension) + column;
+    }
+
+    size_t fDimension;
+    std::vector<uint32_t> fCellStarts;
+    std::vector<uint32_t> fCellDevices;
+    std::vector<uint32_t> fDeviceCells;
+};
+
+#pragma mark - Events
+
+typedef enum : uint8_t
+{
+    SimulationEventTypeMove,
+    SimulationEventTypeRotate,
+    SimulationEventTypeScan,
+} SimulationEventType;
+
+typedef struct
+{
+    double time;
+    uint64_t sequence;      // Breaks ties in scheduling order so equal times are processed deterministically.
+    uint32_t device;
+    SimulationEventType type;
+} SimulationEvent;
+
+struct SimulationEventLater
+{
+    bool operator()(const SimulationEvent &a, const SimulationEvent &b) const
+    {
+        return (a.time != b.time) ? (a.time > b.time) : (a.sequence > b.sequence);
+    }
+};
+
+#pragma mark - Simulation
+
+class Simulation
+{
+public:
+    Simulation(uint32_t deviceCount, uint64_t seed)
+    {
+        fDevices.reserve(deviceCount);
+        for (uint32_t i = 0; i < deviceCount; i++) {
+            fDevices.push_back(new SimulatedDevice(i, seed, &fClock));
+        }
+    }
+
+    ~Simulation()
+    {
+        for (SimulatedDevice *device : fDevices) {
+            delete device;
+        }
+    }
+
+    BOOL attachStores(NSString *outputFolder)
+    {
+        NSFileManager *fileManager = [NSFileManager defaultManager];
+        for (SimulatedDevice *device : fDevices) {
+            NSString *folder = [outputFolder stringByAppendingPathComponent:[NSString stringWithFormat:@"device-%05u", device->fIndex]];
+            NSError *error = nil;
+            if (![fileManager createDirectoryAtPath:folder withIntermediateDirectories:YES attributes:nil error:&error]) {
+                fprintf(stderr, "failed to create %s: %s\n", folder.UTF8String, error.description.UTF8String);
+                return NO;
+            }
+            ENAdvertisementSQLiteStore *store = [ENAdvertisementSQLiteStore centralStoreInFolderPath:folder];
+            if (!store) {
+                fprintf(stderr, "failed to open store in %s\n", folder.UTF8String);
+                return NO;
+            }
+            device->setAdvertisementStore(store);
+        }
+        return YES;
+    }
+
+    void run(double durationSeconds)
+    {
+        fClock = SIMULATION_START_TIME;
+        double end = fClock + durationSeconds;
+
+        fGrid.rebuild(fDevices);
+        schedule(fClock + SIMULATION_MOVE_INTERVAL_SECONDS, 0, SimulationEventTypeMove);
+        for (SimulatedDevice *device : fDevices) {
+            device->rotatePayload();
+            schedule(fClock + device->fRandom.uniform(SIMULATION_ROTATION_MIN_SECONDS, SIMULATION_ROTATION_MAX_SECONDS),
+                     device->fIndex, SimulationEventTypeRotate);
+            schedule(fClock + device->fRandom.uniform(0.0, SIMULATION_SCAN_INTERVAL_SECONDS),
+                     device->fIndex, SimulationEventTypeScan);
+        }
+
+        while (!fEvents.empty() && fEvents.top().time < end) {
+            SimulationEvent event = fEvents.top();
+            fEvents.pop();
+            fClock = event.time;
+
+            SimulatedDevice *device = fDevices[event.device];
+            switch (event.type) {
+                case SimulationEventTypeMove:
+                    move();
+                    schedule(fClock + SIMULATION_MOVE_INTERVAL_SECONDS, 0, SimulationEventTypeMove);
+                    break;
+
+                case SimulationEventTypeRotate:
+                    device->rotatePayload();
+                    schedule(fClock + device->fRandom.uniform(SIMULATION_ROTATION_MIN_SECONDS, SIMULATION_ROTATION_MAX_SECONDS),
+                             event.device, SimulationEventTypeRotate);
+                    break;
+
+                case SimulationEventTypeScan:
+                    scan(*device);
+                    schedule(fClock + SIMULATION_SCAN_INTERVAL_SECONDS + device->fRandom.uniform(0.0, SIMULATION_SCAN_JITTER_SECONDS),
+                             event.device, SimulationEventTypeScan);
+                    break;
+            }
+        }
+
+        for (SimulatedDevice *device : fDevices) {
+            device->waitForAggregation();
+        }
+    }
+
+    BOOL writeTemporaryExposureKeys(NSString *path, double durationSeconds) const
+    {
+        FILE *file = fopen(path.UTF8String, "w");
+        if (!file) {
+            return NO;
+        }
+        uint32_t firstDay = (uint32_t)(SIMULATION_START_TIME / (24 * 60 * 60));
+        uint32_t lastDay = (uint32_t)((SIMULATION_START_TIME + durationSeconds) / (24 * 60 * 60));
+        fprintf(file, "device,rollingStartNumber,temporaryExposureKey\n");
+        for (const SimulatedDevice *device : fDevices) {
+            for (uint32_t day = firstDay; day <= lastDay; day++) {
+                uint8_t tek[EN_TEK_LEN];
+                device->temporaryExposureKeyForDay(day, tek);
+                fprintf(file, "%u,%u,", device->fIndex, day * EN_PAYLOAD_SCHEDULE_INTERVAL_COUNT);
+                for (size_t i = 0; i < sizeof(tek); i++) {
+                    fprintf(file, "%02x", tek[i]);
+                }
+                fprintf(file, "\n");
+            }
+        }
+        fclose(file);
+        return YES;
+    }
+
+    uint64_t fScanCount = 0;
+    uint64_t fReportCount = 0;
+
+    uint64_t droppedReportCount() const
+    {
+        uint64_t dropped = 0;
+        for (const SimulatedDevice *device : fDevices) {
+            dropped += device->droppedReportCount();
+        }
+        return dropped;
+    }
+
+private:
+    void schedule(double time, uint32_t device, SimulationEventType type)
+    {
+        fEvents.push(SimulationEvent{time, fSequence++, device, type});
+    }
+
+    void move()
+    {
+        for (SimulatedDevice *device : fDevices) {
+            double speed = device->fRandom.uniform(0.0, SIMULATION_MAX_SPEED_METERS_PER_SECOND);
+            double heading = device->fRandom.uniform(0.0, 2.0 * M_PI);
+            double distance = speed * SIMULATION_MOVE_INTERVAL_SECONDS;
+            device->x = reflect(device->x + (distance * cos(heading)));
+            device->y = reflect(device->y + (distance * sin(heading)));
+        }
+        fGrid.rebuild(fDevices);
+    }
+
+    static double reflect(double position)
+    {
+        if (position < 0.0) {
+            return -position;
+        }
+        if (position > SIMULATION_AREA_METERS) {
+            return (2.0 * SIMULATION_AREA_METERS) - position;
+        }
+        return position;
+    }
+
+    void scan(SimulatedDevice &scanner)
+    {
+        fScanCount++;
+        double scanStart = fClock - kCFAbsoluteTimeIntervalSince1970;
+        uint32_t pendingReports = 0;
+        uint32_t advertisingEvents = (uint32_t)(SIMULATION_SCAN_DURATION_SECONDS / SIMULATION_ADVERTISING_INTERVAL_SECONDS);
+
+        fGrid.visitNeighbors(scanner, [&](uint32_t index) {
+            SimulatedDevice &advertiser = *fDevices[index];
+            if (&advertiser == &scanner) {
+                return;
+            }
+            double dx = advertiser.x - scanner.x;
+            double dy = advertiser.y - scanner.y;
+            double distance = MAX(sqrt((dx * dx) + (dy * dy)), 0.1);
+            if (distance > SIMULATION_RADIO_RANGE_METERS) {
+                return;
+            }
+
+            double meanRSSI = SIMULATION_RSSI_AT_ONE_METER - (10.0 * SIMULATION_PATH_LOSS_EXPONENT * log10(distance));
+            double phase = scanner.fRandom.uniform(0.0, SIMULATION_ADVERTISING_INTERVAL_SECONDS);
+            for (uint32_t i = 0; i < advertisingEvents; i++) {
+                double rssi = round(meanRSSI + (SIMULATION_RSSI_NOISE_DB * scanner.fRandom.normal()));
+                if (rssi < SIMULATION_RECEIVER_SENSITIVITY) {
+                    continue;
+                }
+                rssi = MIN(rssi, 20.0);
+                double timestamp = scanStart + phase + (i * SIMULATION_ADVERTISING_INTERVAL_SECONDS);
+                scanner.deliverReport(advertiser, (int8_t)rssi, timestamp);
+                fReportCount++;
+
+                // Let the worker catch up before the queue can fill so no report is dropped and every run matches.
+                if (++pendingReports == (SIMULATION_REPORT_QUEUE_CAPACITY / 2)) {
+                    scanner.waitForAggregation();
+                    pendingReports = 0;
+                }
+            }
+        });
+
+        scanner.endScan();
+        scanner.waitForAggregation();
+    }
+
+    std::vector<SimulatedDevice *> fDevices;
+    std::priority_queue<SimulationEvent, std::vector<SimulationEvent>, SimulationEventLater> fEvents;
+    SimulationGrid fGrid;
+    uint64_t fSequence = 0;
+    double fClock = 0;
+};
+
+#pragma mark - Main
+
+static uint64_t NowNanoseconds()
+{
+    return clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+}
+
+int main(int argc, const char *argv[])
+{
+    @autoreleasepool {
+        if (argc < 2) {
+            fprintf(stderr, "usage: %s outputFolder [devices] [hours] [seed]\n", argv[0]);
+            return 1;
+        }
+        NSString *outputFolder = [NSString stringWithUTF8String:argv[1]];
+        uint32_t deviceCount = (argc > 2) ? (uint32_t)strtoul(argv[2], NULL, 10) : 1000;
+        double hours = (argc > 3) ? strtod(argv[3], NULL) : 24.0;
+        uint64_t seed = (argc > 4) ? strtoull(argv[4], NULL, 10) : 1;
+        if (deviceCount == 0 || hours <= 0) {
+            fprintf(stderr, "usage: %s outputFolder [devices] [hours] [seed]\n", argv[0]);
+            return 1;
+        }
+
+        // Every device keeps its database open.
+        struct rlimit limit;
+        if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < (rlim_t)deviceCount + 64) {
+            limit.rlim_cur = MIN(limit.rlim_max, (rlim_t)deviceCount + 64);
+            setrlimit(RLIMIT_NOFILE, &limit);
+        }
+
+        Simulation *simulation = new Simulation(deviceCount, seed);
+        if (!simulation->attachStores(outputFolder)) {
+            delete simulation;
+            return 1;
+        }
+
+        double durationSeconds = hours * 60.0 * 60.0;
+        uint64_t start = NowNanoseconds();
+        simulation->run(durationSeconds);
+        uint64_t elapsed = NowNanoseconds() - start;
+
+        NSString *keysPath = [outputFolder stringByAppendingPathComponent:@"temporary_exposure_keys.csv"];
+        if (!simulation->writeTemporaryExposureKeys(keysPath, durationSeconds)) {
+            fprintf(stderr, "failed to write %s\n", keysPath.UTF8String);
+        }
+
+        printf("devices:        %u\n", deviceCount);
+        printf("simulated:      %.1f hours\n", hours);
+        printf("scans:          %llu\n", simulation->fScanCount);
+        printf("reports:        %llu in %.3f s (%.0f reports/s)\n", simulation->fReportCount, elapsed / 1e9,
+               simulation->fReportCount / (elapsed / 1e9));
+        printf("dropped:        %llu\n", simulation->droppedReportCount());
+        delete simulation;
+    }
+    return 0;
+}
@@ -17,6 +17,10 @@
 
 #import "ENShims.h"
 #import "ENCryptography.h"
+#import "ENAdvertisementSQLiteStore.h"
+#import "ExposureNotificationPayloadSchedule.h"
+#import "ExposureNotificationReportQueue.h"
+#import "ExposureNotificationReportsTable.h"
 
 typedef uint64_t BTAddress;
 
@@ -55,8 +59,13 @@ namespace BT
 class ByteBuffer
 {
 public:
-    size_t getSize() const { return 0; };
-    const uint8_t* getData() const { return NULL; };
+    ByteBuffer() {};
+    ByteBuffer(const uint8_t *data, size_t size) : fBytes(data, data + size) {};
+    size_t getSize() const { return fBytes.size(); };
+    const uint8_t* getData() const { return fBytes.empty() ? NULL : fBytes.data(); };
+
+private:
+    std::vector<uint8_t> fBytes;
 };
 
 class LeAdvertisementData
@@ -65,11 +74,15 @@ public:
     typedef LeAdvertisementData *AutoPtr;
     typedef std::map<LE_UUID, ByteBuffer> ServiceDataMap;
     ServiceDataMap fServiceData;
+    BTAddress fDeviceAddress = 0;
+    int8_t fRSSI = 0;
+    bool fIsSaturated = false;
+    double fTimestamp = 0.0f;
     ServiceDataMap getServiceData() { return fServiceData; };
-    BTAddress getDeviceAddress() { return 0; };
-    int8_t getRSSI() { return 0; };
-    bool getIsSaturated() { return false; };
-    double getTimestamp() { return 0.0f; };
+    BTAddress getDeviceAddress() { return fDeviceAddress; };
+    int8_t getRSSI() { return fRSSI; };
+    bool getIsSaturated() { return fIsSaturated; };
+    double getTimestamp() { return fTimestamp; };
 };
 
 #pragma mark - ExposureNotificationManager Interface
@@ -79,12 +92,43 @@ typedef struct {
     int8_t maxRSSI;
 } RSSIValues;
 
+/*
+ * Running summary of the reports for one RPI during a scan window. Each report is folded in as it arrives so the raw
+ * reports don't need to be kept until the scan stops.
+ */
+struct ExposureNotificationReportAggregate
+{
+    uint32_t reportCount = 0;
+    uint32_t validRSSICount = 0;
+    int32_t totalRSSI = 0;
+    int8_t maxRSSI = -127;
+    bool saturated = true;
+    double firstTimestamp = 0;
+
+    void addReport(int8_t rssi, bool isSaturated, double timestamp)
+    {
+        if (reportCount == 0) {
+            firstTimestamp = timestamp;
+        }
+        reportCount++;
+
+        // An RSSI of 127 means the RSSI wasn't available for the report.
+        if (rssi != 127) {
+            saturated &= isSaturated;
+            validRSSICount++;
+            totalRSSI += rssi;
+            maxRSSI = MAX(maxRSSI, rssi);
+        }
+    }
+};
+
 class ExposureNotificationManager
 {
 
 public:
     ExposureNotificationManager();
-    virtual ~ExposureNotificationManager() { };
+    explicit ExposureNotificationManager(size_t reportQueueCapacity);
+    virtual ~ExposureNotificationManager();
 
 #pragma mark - Exposure Notification Scanning
 
@@ -92,15 +136,48 @@ public:
     BTResult startScanning();
     BTResult stopScanning();
 
-private:
-    typedef std::vector<LeAdvertisementData::AutoPtr> ReportsSet;
-    typedef std::array<uint8_t, (EN_RPI_LEN + EN_AEM_LEN)> rpiData;
-    typedef std::map<rpiData, ReportsSet> ExposureNotificationReportsMap;
-    ExposureNotificationReportsMap fReports;
+    // Queues a report for aggregation. Called on the Bluetooth callback thread; never blocks or allocates.
+    // Returns false if the report was dropped because the aggregation worker has fallen behind.
+    bool ingestReport(const ExposureNotificationReportRecord &record);
+
+    // Queues the end of the current scan window. Reports queued before it are flushed together.
+    void ingestScanStop();
+
+    // Number of reports dropped because the queue was full.
+    uint64_t droppedReportCount() const { return fDroppedReportCount.load(std::memory_order_relaxed); }
 
-    double previousExposureNotificationScanCompleteTime();
+    // Store that each scan's aggregated observations are saved to.
+    void setAdvertisementStore(ENAdvertisementSQLiteStore *store);
+
+    // Blocks until every report and scan stop queued so far has been aggregated and saved.
+    void waitForAggregation();
+
+protected:
+    // Entry points for the Bluetooth stack (or a simulated one).
     void bluetoothDeviceFoundCallback(NSUUID *device, const LeAdvertisementData::AutoPtr& advData);
     void scanDidStop();
+    virtual double previousExposureNotificationScanCompleteTime();
+
+private:
+    typedef ExposureNotificationReportsTable<ExposureNotificationReportAggregate> ExposureNotificationReportsMap;
+    typedef ExposureNotificationReportsMap::Key rpiData;
+
+    // Only accessed on fAggregationQueue.
+    ExposureNotificationReportsMap fReports;
+    std::vector<en_advertisement_t> fObservationBatch;
+    ENAdvertisementSQLiteStore *fAdvertisementStore;
+
+    // Reports go from the Bluetooth callback thread to the aggregation worker through fReportQueue.
+    // fReportSource coalesces wakeups so the worker runs once per batch of reports rather than once per report.
+    ExposureNotificationReportQueue fReportQueue;
+    dispatch_queue_t fAggregationQueue;
+    dispatch_source_t fReportSource;
+    std::atomic<uint64_t> fDroppedReportCount{0};
+    // Queue position (plus one) of a scan stop that didn't fit, or 0. Set by the producer, cleared by the worker.
+    std::atomic<size_t> fScanStopSequence{0};
+
+    void drainReportQueue();
+    void flushScanReports();
 
 #pragma mark - Exposure Notification Advertising
 
@@ -108,10 +185,14 @@ public:
     BTResult generateAdvertisingPayload(uint8_t *payloadBytes, uint8_t payloadBytesLen, BTAddress &advertisingAddress);
 
 private:
-    // Exposure Notification advertisement generation related methods
-    BTResult retrieveCurrentRollingProximityIdentifier(uint8_t *outBuffer, size_t outBufferSize);
-    BTResult retrieveCurrentTemporaryExposureKey(uint8_t *outBuffer, size_t outBufferSize);
-    uint8_t getPlatformRadiatedLeTxPower();
+    // Payloads for every interval of the current TEK, recomputed when the TEK rolls.
+    ExposureNotificationPayloadSchedule fPayloadSchedule;
+
+protected:
+    // Exposure Notification advertisement generation related methods. Virtual so a simulator can supply its own keys and clock.
+    virtual BTResult retrieveCurrentTemporaryExposureKey(uint8_t *outBuffer, size_t outBufferSize, uint32_t &outRollingStartNumber);
+    virtual uint32_t currentIntervalNumber();
+    virtual uint8_t getPlatformRadiatedLeTxPower();
     
 };
 
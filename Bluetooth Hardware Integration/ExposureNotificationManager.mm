@@ -25,6 +25,12 @@ const LE_UUID LE_ExposureNotification_Service_UUID = {LE_ATT_UUID_16BIT_SIZE, {0
 #define EXPOSURE_NOTIFICATION_SCAN_DURATION_TIME_SECONDS        (4)
 #define EXPOSURE_NOTIFICATION_SCAN_AP_WAKE_DELTA_TIME_SECONDS   (300)
 
+// Enough for about 0.3 seconds of reports at 100k reports/second if the aggregation worker stalls.
+#define EXPOSURE_NOTIFICATION_REPORT_QUEUE_CAPACITY             (32 * 1024)
+
+// Slots held back for scan stop markers so a window boundary isn't lost while reports are being dropped.
+#define EXPOSURE_NOTIFICATION_REPORT_QUEUE_RESERVE              (16)
+
 const uint8_t EN_VERSION_MAJOR = 0x01;
 const uint8_t EN_VERSION_MINOR = 0x00;
 
@@ -32,8 +38,27 @@ namespace BT
 {
 
 ExposureNotificationManager::ExposureNotificationManager()
+    : ExposureNotificationManager(EXPOSURE_NOTIFICATION_REPORT_QUEUE_CAPACITY)
 {
+}
 
+ExposureNotificationManager::ExposureNotificationManager(size_t reportQueueCapacity)
+    : fReportQueue(reportQueueCapacity)
+{
+    dispatch_queue_attr_t attr = dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_SERIAL, QOS_CLASS_UTILITY, 0);
+    fAggregationQueue = dispatch_queue_create("com.apple.ExposureNotification.reportAggregation", attr);
+    fReportSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_DATA_ADD, 0, 0, fAggregationQueue);
+    dispatch_source_set_event_handler(fReportSource, ^{
+        this->drainReportQueue();
+    });
+    dispatch_resume(fReportSource);
+}
+
+ExposureNotificationManager::~ExposureNotificationManager()
+{
+    // Make sure the worker isn't still using this object.
+    dispatch_source_cancel(fReportSource);
+    dispatch_sync(fAggregationQueue, ^{ });
 }
 
 #pragma mark - Exposure Notification Scanning
@@ -84,15 +109,18 @@ void ExposureNotificationManager::bluetoothDeviceFoundCallback(NSUUID *device,
             EN_ERROR_PRINTF("Invalid service data received from device %@", device);
         } else {
 
-            // Store the observations grouped by RPI of the ExposureNotification payload
-            rpiData mapKey;
-            memcpy(mapKey.data(), svcDataBuffer.getData(), svcDataBuffer.getSize());
-            fReports[mapKey].push_back(advData);
-
-            EN_INFO_PRINTF("device %@ address:%llx rpi:%.16P aem:%.4P rssi:%d saturated:%d timestamp:%f totalReports:%lu",
-                           device, advData->getDeviceAddress(), svcDataBuffer.getData(),
-                           svcDataBuffer.getData()+EN_RPI_LEN, advData->getRSSI(), advData->getIsSaturated(),
-                           advData->getTimestamp() + kCFAbsoluteTimeIntervalSince1970, fReports[mapKey].size());
+            // Hand the observation to the aggregation worker, which groups them by RPI of the ExposureNotification payload
+            ExposureNotificationReportRecord record;
+            memcpy(record.serviceData, svcDataBuffer.getData(), sizeof(record.serviceData));
+            record.rssi = advData->getRSSI();
+            record.flags = advData->getIsSaturated() ? kExposureNotificationReportFlagSaturated : 0;
+            record.timestamp = advData->getTimestamp();
+            ingestReport(record);
+
+            EN_DEBUG_PRINTF("device %@ address:%llx rpi:%.16P aem:%.4P rssi:%d saturated:%d timestamp:%f",
+                            device, advData->getDeviceAddress(), svcDataBuffer.getData(),
+                            svcDataBuffer.getData()+EN_RPI_LEN, advData->getRSSI(), advData->getIsSaturated(),
+                            advData->getTimestamp() + kCFAbsoluteTimeIntervalSince1970);
         }
     }
 }
@@ -104,7 +132,81 @@ double ExposureNotificationManager::previousExposureNotificationScanCompleteTime
     return 0;
 }
 
+bool ExposureNotificationManager::ingestReport(const ExposureNotificationReportRecord &record)
+{
+    // While a scan stop is waiting for the worker to reach its position, later reports would land in the wrong window.
+    if (fScanStopSequence.load(std::memory_order_acquire) != 0 ||
+        !fReportQueue.push(record, EXPOSURE_NOTIFICATION_REPORT_QUEUE_RESERVE)) {
+        fDroppedReportCount.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    dispatch_source_merge_data(fReportSource, 1);
+    return true;
+}
+
+void ExposureNotificationManager::ingestScanStop()
+{
+    ExposureNotificationReportRecord record = {};
+    record.flags = kExposureNotificationReportFlagScanStop;
+    if (fScanStopSequence.load(std::memory_order_acquire) != 0) {
+        // A stop is already waiting at the current position and nothing has been queued since, so this window is empty.
+    } else if (!fReportQueue.push(record)) {
+        // Even the reserve is used up. Rather than block the caller, record where the window ends; the worker flushes
+        // when it has popped everything before it, and reports are dropped until then so none cross the boundary.
+        fScanStopSequence.store(fReportQueue.pushCount() + 1, std::memory_order_release);
+    }
+    dispatch_source_merge_data(fReportSource, 1);
+}
+
+void ExposureNotificationManager::setAdvertisementStore(ENAdvertisementSQLiteStore *store)
+{
+    // The store is only used on the aggregation worker.
+    dispatch_async(fAggregationQueue, ^{
+        this->fAdvertisementStore = store;
+    });
+}
+
+void ExposureNotificationManager::waitForAggregation()
+{
+    dispatch_sync(fAggregationQueue, ^{
+        this->drainReportQueue();
+    });
+}
+
 void ExposureNotificationManager::scanDidStop()
+{
+    ingestScanStop();
+}
+
+void ExposureNotificationManager::drainReportQueue()
+{
+    ExposureNotificationReportRecord record;
+    for (;;) {
+        size_t stopSequence = fScanStopSequence.load(std::memory_order_acquire);
+        if ((stopSequence != 0) && (fReportQueue.popCount() == stopSequence - 1)) {
+            flushScanReports();
+            fScanStopSequence.store(0, std::memory_order_release);
+        }
+        if (!fReportQueue.pop(record)) {
+            break;
+        }
+
+        if (record.flags & kExposureNotificationReportFlagScanStop) {
+            flushScanReports();
+            continue;
+        }
+
+        rpiData mapKey;
+        memcpy(mapKey.data(), record.serviceData, sizeof(record.serviceData));
+        fReports[mapKey].addReport(record.rssi, (record.flags & kExposureNotificationReportFlagSaturated) != 0,
+                                   record.timestamp);
+        if (record.rssi == 127) {
+            EN_ERROR_PRINTF("Report with invalid RSSI found (127)");
+        }
+    }
+}
+
+void ExposureNotificationManager::flushScanReports()
 {
     EN_NOTICE_PRINTF("scanDidStop, report the results for %lu total devices found", fReports.size());
 
@@ -123,86 +225,73 @@ void ExposureNotificationManager::scanDidStop()
     }
 
     for (ExposureNotificationReportsMap::iterator it = fReports.begin(); it != fReports.end(); it++) {
-        ReportsSet reports = it->second;
+        const ExposureNotificationReportAggregate &reports = it->value;
         RSSIValues rssiVals;
-        int16_t totalRSSI = 0;
-        bool saturated = true;
-
-        if (reports.size() == 0) {
-            continue;
-        }
+        bool saturated = reports.saturated;
+        double timestamp = reports.firstTimestamp + kCFAbsoluteTimeIntervalSince1970;
+        uint32_t validRSSICount = reports.validRSSICount;
 
         memset(&rssiVals, 127, sizeof(RSSIValues));
 
-        // Use the first report for the service data.
-        const LeAdvertisementData::ServiceDataMap &svcData = (*reports.begin())->getServiceData();
-
-        double timestamp = (*reports.begin())->getTimestamp() + kCFAbsoluteTimeIntervalSince1970;
-        uint8_t validRSSICount = 0;
-
-        rssiVals.maxRSSI = -127;
-        for (const LeAdvertisementData::AutoPtr &aReport : reports) {
-            int8_t rssi = aReport->getRSSI();
-            if (rssi != 127) {
-                saturated &= aReport->getIsSaturated();
-                validRSSICount++;
-                totalRSSI += rssi;
-                rssiVals.maxRSSI = MAX(rssiVals.maxRSSI, rssi);
-                EN_DEBUG_PRINTF("%d) rssi:%d saturated:%d", validRSSICount, rssi, aReport->getIsSaturated());
-            } else {
-                EN_ERROR_PRINTF("Report with invalid RSSI found (127)");
-            }
-        }
-
         // If all of the reports are saturated, reflect that in our callback.
         if (validRSSICount == 0) {
             saturated = true;
             rssiVals.maxRSSI = 127;
         } else {
-            rssiVals.avgRSSI = totalRSSI / validRSSICount;
+            rssiVals.maxRSSI = reports.maxRSSI;
+            rssiVals.avgRSSI = (int8_t)(reports.totalRSSI / (int32_t)validRSSICount);
         }
 
-        const ByteBuffer svcDataBuffer = svcData.at(LE_ExposureNotification_Service_UUID);
-        NSData *rpi = [NSData dataWithBytes:svcDataBuffer.getData() length:EN_RPI_LEN];
-        NSData *encryptedAEM = [NSData dataWithBytes:svcDataBuffer.getData() + EN_RPI_LEN length:EN_AEM_LEN];
-
-        EN_INFO_PRINTF("rpi:%@ aem:%@ avgRSSI:%d maxRSSI:%d saturated:%d timestamp:%f deltaSinceLastStop:%d reports:%lu validReports:%d", rpi, encryptedAEM, rssiVals.avgRSSI, rssiVals.maxRSSI, saturated, timestamp, delta, reports.size(), validRSSICount);
-
-        uint8_t reportCounter = reports.size() > 255 ? 255 : reports.size(); // report up to 255 reports, make sure we dont overflow;
+        // The key is the service data.
+        const uint8_t *rpi = it->key.data();
+        const uint8_t *encryptedAEM = it->key.data() + EN_RPI_LEN;
+
+        EN_INFO_PRINTF("rpi:%.16P aem:%.4P avgRSSI:%d maxRSSI:%d saturated:%d timestamp:%f deltaSinceLastStop:%d reports:%u validReports:%u", rpi, encryptedAEM, rssiVals.avgRSSI, rssiVals.maxRSSI, saturated, timestamp, delta, reports.reportCount, validRSSICount);
+
+        uint8_t reportCounter = reports.reportCount > 255 ? 255 : reports.reportCount; // report up to 255 reports, make sure we dont overflow;
+
+        // Add the observation to this scan's batch
+        en_advertisement_t advertisement = {};
+        memcpy(advertisement.rpi, rpi, EN_RPI_LEN);
+        memcpy(advertisement.encrypted_aem, encryptedAEM, EN_AEM_LEN);
+        advertisement.timestamp = timestamp;
+        advertisement.daily_key_index = DAILY_KEY_INDEX_INVALID;
+        advertisement.scan_interval = (uint16_t)MIN(delta, (uint32_t)UINT16_MAX);
+        advertisement.rssi = rssiVals.avgRSSI;
+        advertisement.saturated = saturated;
+        advertisement.count = reportCounter;
+        fObservationBatch.push_back(advertisement);
+    }
 
-        // Save observation to database
-        (void) rpi;
-        (void) encryptedAEM;
-        (void) reportCounter;
-        (void) timestamp;
-        // database->saveObservation(rpi, encryptedAEM, rssiVals, reportCounter, saturated, timestamp, delta);
+    // Save the whole scan in one transaction
+    if (fAdvertisementStore && !fObservationBatch.empty()) {
+        NSError *error = nil;
+        if (![fAdvertisementStore saveAdvertisements:fObservationBatch.data() count:fObservationBatch.size() error:&error]) {
+            EN_ERROR_PRINTF("Failed to save %lu observations: %@", fObservationBatch.size(), error);
+        }
     }
 
+    // Keeps the table's and batch's storage for the next scan.
+    fObservationBatch.clear();
     fReports.clear();
 }
 
 #pragma mark - Exposure Notification Advertising
 
-BTResult ExposureNotificationManager::retrieveCurrentRollingProximityIdentifier(uint8_t *outBuffer, size_t outBufferSize)
+BTResult ExposureNotificationManager::retrieveCurrentTemporaryExposureKey(uint8_t *outBuffer, size_t outBufferSize, uint32_t &outRollingStartNumber)
 {
-    if (outBufferSize != EN_RPI_LEN) {
+    if (outBufferSize != EN_TEK_LEN) {
         return BT_ERROR_INVALID_ARGUMENT;
     }
 
-    // Populate outBuffer with the current rolling proximity identifier
+    // Populate outBuffer with the current temporary exposure key, and outRollingStartNumber with the interval number it became valid
 
     return BT_SUCCESS;
 }
 
-BTResult ExposureNotificationManager::retrieveCurrentTemporaryExposureKey(uint8_t *outBuffer, size_t outBufferSize)
+uint32_t ExposureNotificationManager::currentIntervalNumber()
 {
-    if (outBufferSize != EN_TEK_LEN) {
-        return BT_ERROR_INVALID_ARGUMENT;
-    }
-
-    // Populate outBuffer with the current temporary exposure key
-
-    return BT_SUCCESS;
+    return (uint32_t)(time(NULL) / (60 * 10));
 }
 
 uint8_t ExposureNotificationManager::getPlatformRadiatedLeTxPower()
@@ -218,15 +307,20 @@ BTResult ExposureNotificationManager::generateAdvertisingPayload(uint8_t *payloa
         return BT_ERROR_INVALID_ARGUMENT;
     }
 
-    uint8_t currentRPI[EN_RPI_LEN] = {0};
-    BTResult result = retrieveCurrentRollingProximityIdentifier(currentRPI, EN_RPI_LEN);
+    uint8_t currentTEK[EN_TEK_LEN] = {0};
+    uint32_t rollingStartNumber = 0;
+    BTResult result = retrieveCurrentTemporaryExposureKey(currentTEK, EN_TEK_LEN, rollingStartNumber);
     if (result != BT_SUCCESS) {
         return result;
     }
 
-    uint8_t currentTEK[EN_TEK_LEN] = {0};
-    result = retrieveCurrentTemporaryExposureKey(currentTEK, EN_TEK_LEN);
+    // The RPIs and AEM keystreams only change with the TEK, so they're computed once per TEK and looked up here.
+    if (!fPayloadSchedule.isScheduledForTemporaryExposureKey(currentTEK, EN_TEK_LEN, rollingStartNumber)) {
+        result = fPayloadSchedule.setTemporaryExposureKey(currentTEK, EN_TEK_LEN, rollingStartNumber);
+    }
+    memset_s(currentTEK, sizeof(currentTEK), 0, sizeof(currentTEK));
     if (result != BT_SUCCESS) {
+        EN_ERROR_PRINTF("generateAdvertisingPayload failed to schedule payloads %d", result);
         return result;
     }
 
@@ -245,7 +339,7 @@ BTResult ExposureNotificationManager::generateAdvertisingPayload(uint8_t *payloa
     uint8_t aem[4] = {0};
     aem[0] = (EN_VERSION_MAJOR << 6) | (EN_VERSION_MINOR << 4);
     aem[1] = getPlatformRadiatedLeTxPower();
-    result = ENEncryptAEM(aem, EN_AEM_LEN, currentTEK, EN_TEK_LEN, payloadBytes, EN_RPI_LEN, payloadBytes + EN_RPI_LEN, EN_AEM_LEN);
+    result = fPayloadSchedule.getPayload(currentIntervalNumber(), aem, EN_AEM_LEN, payloadBytes, payloadBytesLen);
     EN_NOTICE_PRINTF("Payload is now %{private}.20P TXPower:%d version:0x%x", payloadBytes, aem[1], aem[0]);
 
     return result;
@@ -0,0 +1,63 @@
+/*
+ *      Copyright (C) 2020 Apple Inc. All Rights Reserved.
+ *
+ *      ExposureNotification is licensed under Apple Inc.’s
+ *      Sample Code License Agreement, which is contained in
+ *      the LICENSE file distributed with ExposureNotification,
+ *      and only to those who accept that license.
+ *
+ */
+
+#pragma once
+
+#import <stdint.h>
+
+#import "ENShims.h"
+#import "ENCryptography.h"
+
+namespace BT
+{
+
+#define EN_PAYLOAD_SCHEDULE_INTERVAL_COUNT  (144)
+
+/*
+ * Every advertising payload (RPI followed by encrypted AEM) for one TEK's rolling period, computed up front.
+ *
+ * The RPIK and AEMK are derived once when the schedule is set to a TEK. All 144 RPIs are generated with one AES
+ * call, and the AEM keystream for each RPI with another, so each rotation is a copy and a 4-byte XOR instead of a
+ * key derivation and two AES operations. Metadata (e.g. Tx power) is supplied per lookup, so changing it doesn't
+ * require recomputing the schedule.
+ *
+ * The object is a fixed size with no heap allocations, so many can be kept (e.g. one per simulated advertiser).
+ */
+class ExposureNotificationPayloadSchedule
+{
+public:
+    ExposureNotificationPayloadSchedule();
+    ~ExposureNotificationPayloadSchedule();
+
+    // Computes the schedule for a TEK whose rolling period starts at rollingStartNumber.
+    BTResult setTemporaryExposureKey(const uint8_t *tekBytes, size_t tekLen, uint32_t rollingStartNumber);
+
+    // True if the schedule was computed for this TEK and rolling start number.
+    bool isScheduledForTemporaryExposureKey(const uint8_t *tekBytes, size_t tekLen, uint32_t rollingStartNumber) const;
+
+    // True if the interval number is within the scheduled TEK's rolling period.
+    bool coversIntervalNumber(uint32_t intervalNumber) const;
+
+    // Writes the payload for the interval, encrypting metaData (EN_AEM_LEN bytes) with the precomputed keystream.
+    BTResult getPayload(uint32_t intervalNumber, const uint8_t *metaData, size_t metaDataLen,
+                        uint8_t *outPayload, size_t outPayloadLen) const;
+
+    // Clears the schedule and any key material.
+    void reset();
+
+private:
+    bool fValid;
+    uint32_t fRollingStartNumber;
+    uint8_t fTEK[EN_TEK_LEN];
+    uint8_t fRPIs[EN_PAYLOAD_SCHEDULE_INTERVAL_COUNT][EN_RPI_LEN];
+    uint8_t fAEMKeystreams[EN_PAYLOAD_SCHEDULE_INTERVAL_COUNT][EN_AEM_LEN];
+};
+
+}
@@ -0,0 +1,123 @@
+/*
+ *      Copyright (C) 2020 Apple Inc. All Rights Reserved.
+ *
+ *      ExposureNotification is licensed under Apple Inc.’s
+ *      Sample Code License Agreement, which is contained in
+ *      the LICENSE file distributed with ExposureNotification,
+ *      and only to those who accept that license.
+ *
+ */
+
+#import <string.h>
+
+#import "ExposureNotificationPayloadSchedule.h"
+#import "ENCryptography.h"
+#import "ENShims.h"
+
+namespace BT
+{
+
+ExposureNotificationPayloadSchedule::ExposureNotificationPayloadSchedule()
+{
+    reset();
+}
+
+ExposureNotificationPayloadSchedule::~ExposureNotificationPayloadSchedule()
+{
+    reset();
+}
+
+void ExposureNotificationPayloadSchedule::reset()
+{
+    fValid = false;
+    fRollingStartNumber = 0;
+    memset_s(fTEK, sizeof(fTEK), 0, sizeof(fTEK));
+    memset_s(fRPIs, sizeof(fRPIs), 0, sizeof(fRPIs));
+    memset_s(fAEMKeystreams, sizeof(fAEMKeystreams), 0, sizeof(fAEMKeystreams));
+}
+
+BTResult ExposureNotificationPayloadSchedule::setTemporaryExposureKey(const uint8_t *tekBytes, size_t tekLen, uint32_t rollingStartNumber)
+{
+    if (tekBytes == NULL || tekLen != EN_TEK_LEN) {
+        return BT_ERROR_INVALID_ARGUMENT;
+    }
+    reset();
+
+    uint8_t tek[EN_TEK_LEN];
+    memcpy(tek, tekBytes, sizeof(tek));
+
+    // The RPIK and AEMK, once, from a single HKDF-Extract.
+    uint8_t rpik[EN_RPIK_LEN] = {0};
+    uint8_t aemk[EN_AEMK_LEN] = {0};
+    BTResult result = ENDeriveTEKSubkeys(tek, EN_TEK_LEN, rpik, sizeof(rpik), aemk, sizeof(aemk));
+    if (result != BT_SUCCESS) {
+        EN_ERROR_PRINTF("PayloadSchedule ENDeriveTEKSubkeys failed %d", result);
+    }
+
+    // All RPIs for the rolling period.
+    if (result == BT_SUCCESS) {
+        result = ENGenerate144RollingProximityIdentifiersWithRPIK(rpik, sizeof(rpik), rollingStartNumber,
+                                                                  &fRPIs[0][0], sizeof(fRPIs));
+        if (result != BT_SUCCESS) {
+            EN_ERROR_PRINTF("PayloadSchedule ENGenerate144RollingProximityIdentifiersWithRPIK failed %d", result);
+        }
+    }
+
+    // The keystream for each RPI by encrypting zeroed metadata.
+    if (result == BT_SUCCESS) {
+        uint8_t zeroMetaData[EN_AEM_LEN] = {0};
+        result = ENEncryptAEMsWithAEMK(aemk, sizeof(aemk), zeroMetaData, sizeof(zeroMetaData),
+                                       &fRPIs[0][0], EN_PAYLOAD_SCHEDULE_INTERVAL_COUNT,
+                                       &fAEMKeystreams[0][0], sizeof(fAEMKeystreams));
+        if (result != BT_SUCCESS) {
+            EN_ERROR_PRINTF("PayloadSchedule ENEncryptAEMsWithAEMK failed %d", result);
+        }
+    }
+
+    memset_s(rpik, sizeof(rpik), 0, sizeof(rpik));
+    memset_s(aemk, sizeof(aemk), 0, sizeof(aemk));
+    memset_s(tek, sizeof(tek), 0, sizeof(tek));
+
+    if (result != BT_SUCCESS) {
+        reset();
+        return result;
+    }
+
+    memcpy(fTEK, tekBytes, sizeof(fTEK));
+    fRollingStartNumber = rollingStartNumber;
+    fValid = true;
+    return BT_SUCCESS;
+}
+
+bool ExposureNotificationPayloadSchedule::isScheduledForTemporaryExposureKey(const uint8_t *tekBytes, size_t tekLen, uint32_t rollingStartNumber) const
+{
+    return fValid && tekBytes != NULL && tekLen == EN_TEK_LEN && fRollingStartNumber == rollingStartNumber &&
+           memcmp(fTEK, tekBytes, EN_TEK_LEN) == 0;
+}
+
+bool ExposureNotificationPayloadSchedule::coversIntervalNumber(uint32_t intervalNumber) const
+{
+    return fValid && intervalNumber >= fRollingStartNumber &&
+           (intervalNumber - fRollingStartNumber) < EN_PAYLOAD_SCHEDULE_INTERVAL_COUNT;
+}
+
+BTResult ExposureNotificationPayloadSchedule::getPayload(uint32_t intervalNumber, const uint8_t *metaData, size_t metaDataLen,
+                                                         uint8_t *outPayload, size_t outPayloadLen) const
+{
+    if (metaData == NULL || metaDataLen != EN_AEM_LEN || outPayload == NULL || outPayloadLen != (EN_RPI_LEN + EN_AEM_LEN)) {
+        return BT_ERROR_INVALID_ARGUMENT;
+    }
+    if (!coversIntervalNumber(intervalNumber)) {
+        EN_ERROR_PRINTF("PayloadSchedule interval %u not in schedule starting %u", intervalNumber, fRollingStartNumber);
+        return BT_ERROR_INVALID_ARGUMENT;
+    }
+
+    uint32_t index = intervalNumber - fRollingStartNumber;
+    memcpy(outPayload, fRPIs[index], EN_RPI_LEN);
+    for (size_t i = 0; i < EN_AEM_LEN; i++) {
+        outPayload[EN_RPI_LEN + i] = metaData[i] ^ fAEMKeystreams[index][i];
+    }
+    return BT_SUCCESS;
+}
+
+}
@@ -0,0 +1,126 @@
+/*
+ *      Copyright (C) 2020 Apple Inc. All Rights Reserved.
+ *
+ *      ExposureNotification is licensed under Apple Inc.’s
+ *      Sample Code License Agreement, which is contained in
+ *      the LICENSE file distributed with ExposureNotification,
+ *      and only to those who accept that license.
+ *
+ */
+
+#pragma once
+
+#import <stddef.h>
+#import <stdint.h>
+#import <atomic>
+#import <vector>
+
+#import "ENCryptography.h"
+
+namespace BT
+{
+
+#pragma mark - Report Record
+
+enum : uint8_t
+{
+    kExposureNotificationReportFlagSaturated    = (1 << 0),
+    kExposureNotificationReportFlagScanStop     = (1 << 1), // Marks the end of a scan window. Not a report.
+};
+
+/*
+ * Compact copy of the parts of an advertisement report needed to aggregate it.
+ */
+typedef struct
+{
+    uint8_t serviceData[EN_RPI_LEN + EN_AEM_LEN];   // RPI followed by encrypted AEM.
+    int8_t rssi;
+    uint8_t flags;
+    double timestamp;
+} ExposureNotificationReportRecord;
+
+#pragma mark - Report Queue
+
+/*
+ * Bounded single-producer/single-consumer queue of report records.
+ *
+ * The Bluetooth callback pushes and the aggregation worker pops. Neither side takes a lock or allocates, and each
+ * index is only written by one side, so a push is a copy and a release store. The producer and consumer indexes are
+ * padded onto separate cache lines, and each side caches the other's index so the shared line is only read when
+ * the queue looks full (or empty).
+ *
+ * Pushes fail instead of blocking when the queue is full. A caller can ask for some slots to be held back so
+ * low-volume records (e.g. scan stop markers) still fit when reports are being dropped.
+ */
+class ExposureNotificationReportQueue
+{
+public:
+    // The capacity is rounded up to a power of two.
+    explicit ExposureNotificationReportQueue(size_t capacity)
+    {
+        size_t rounded = 1;
+        while (rounded < capacity) {
+            rounded <<= 1;
+        }
+        fRecords.resize(rounded);
+        fMask = rounded - 1;
+    }
+
+    size_t capacity() const { return fRecords.size(); }
+
+    // Producer only. Number of records pushed so far.
+    size_t pushCount() const { return fHead.load(std::memory_order_relaxed); }
+
+    // Consumer only. Number of records popped so far.
+    size_t popCount() const { return fTail.load(std::memory_order_relaxed); }
+
+    // Producer only. Fails if fewer than reserve + 1 slots are free.
+    bool push(const ExposureNotificationReportRecord &record, size_t reserve = 0)
+    {
+        size_t head = fHead.load(std::memory_order_relaxed);
+        size_t limit = fRecords.size() - reserve;
+        if ((head - fCachedTail) >= limit) {
+            fCachedTail = fTail.load(std::memory_order_acquire);
+            if ((head - fCachedTail) >= limit) {
+                return false;
+            }
+        }
+        fRecords[head & fMask] = record;
+        fHead.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only.
+    bool pop(ExposureNotificationReportRecord &outRecord)
+    {
+        size_t tail = fTail.load(std::memory_order_relaxed);
+        if (tail == fCachedHead) {
+            fCachedHead = fHead.load(std::memory_order_acquire);
+            if (tail == fCachedHead) {
+                return false;
+            }
+        }
+        outRecord = fRecords[tail & fMask];
+        fTail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    static const size_t kCacheLineSize = 64;
+
+    std::vector<ExposureNotificationReportRecord> fRecords;
+    size_t fMask;
+    char fPad0[kCacheLineSize];
+
+    // Producer side.
+    std::atomic<size_t> fHead{0};
+    size_t fCachedTail = 0;
+    char fPad1[kCacheLineSize - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+
+    // Consumer side.
+    std::atomic<size_t> fTail{0};
+    size_t fCachedHead = 0;
+    char fPad2[kCacheLineSize - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+};
+
+}
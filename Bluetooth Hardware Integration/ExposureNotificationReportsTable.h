@@ -0,0 +1,141 @@
+/*
+ *      Copyright (C) 2020 Apple Inc. All Rights Reserved.
+ *
+ *      ExposureNotification is licensed under Apple Inc.’s
+ *      Sample Code License Agreement, which is contained in
+ *      the LICENSE file distributed with ExposureNotification,
+ *      and only to those who accept that license.
+ *
+ */
+
+#pragma once
+
+#import <stdint.h>
+#import <stdlib.h>
+#import <string.h>
+#import <algorithm>
+#import <array>
+#import <vector>
+
+#import "ENCryptography.h"
+
+namespace BT
+{
+
+#pragma mark - Reports Table
+
+/*
+ * Open addressing hash table keyed by the 20-byte RPI+AEM service data of an ExposureNotification advertisement.
+ *
+ * Entries are kept densely in insertion order and found through a power of two array of slots holding entry indexes,
+ * probed linearly. Lookups are O(1) and iteration only visits entries in use. clear() keeps all storage, so once the
+ * table has grown to the size of a busy scan window, later windows of that size insert without allocating.
+ *
+ * The hash is seeded per table so a nearby advertiser can't pick service data that collides.
+ */
+template <typename Value>
+class ExposureNotificationReportsTable
+{
+public:
+    typedef std::array<uint8_t, (EN_RPI_LEN + EN_AEM_LEN)> Key;
+
+    struct Entry
+    {
+        Key key;
+        Value value;
+    };
+
+    typedef typename std::vector<Entry>::iterator iterator;
+
+    ExposureNotificationReportsTable() : fSeed(((uint64_t)arc4random() << 32) | arc4random())
+    {
+        rehash(kMinimumSlotCount);
+    }
+
+    size_t size() const { return fEntries.size(); }
+    bool empty() const { return fEntries.empty(); }
+
+    iterator begin() { return fEntries.begin(); }
+    iterator end() { return fEntries.end(); }
+
+    // Returns the value for the key, inserting a default value if it isn't in the table.
+    Value &operator[](const Key &key)
+    {
+        size_t slot = hash(key) & fMask;
+        for (;;) {
+            uint32_t index = fSlots[slot];
+            if (index == kEmptySlot) {
+                break;
+            }
+            Entry &entry = fEntries[index];
+            if (memcmp(entry.key.data(), key.data(), key.size()) == 0) {
+                return entry.value;
+            }
+            slot = (slot + 1) & fMask;
+        }
+
+        // Not found. Keep the load factor at or below 3/4 so probe sequences stay short.
+        if (((fEntries.size() + 1) * 4) > (fSlots.size() * 3)) {
+            rehash(fSlots.size() * 2);
+            slot = hash(key) & fMask;
+            while (fSlots[slot] != kEmptySlot) {
+                slot = (slot + 1) & fMask;
+            }
+        }
+
+        fSlots[slot] = (uint32_t)fEntries.size();
+        fEntries.push_back(Entry{key, Value()});
+        return fEntries.back().value;
+    }
+
+    // Removes all entries without releasing storage.
+    void clear()
+    {
+        if (fEntries.empty()) {
+            return;
+        }
+        fEntries.clear();
+        std::fill(fSlots.begin(), fSlots.end(), (uint32_t)kEmptySlot);
+    }
+
+private:
+    enum : uint32_t { kEmptySlot = UINT32_MAX };
+    enum : size_t { kMinimumSlotCount = 64 };
+
+    size_t hash(const Key &key) const
+    {
+        // RPIs are AES output so any 8 bytes are uniform for honest advertisers. Mixing in a seed and the rest of
+        // the key keeps probe lengths short when they aren't.
+        uint64_t a, b, c;
+        memcpy(&a, key.data(), 8);
+        memcpy(&b, key.data() + 8, 8);
+        uint32_t tail;
+        memcpy(&tail, key.data() + 16, 4);
+        c = tail;
+
+        uint64_t h = (a ^ fSeed) * 0x9E3779B97F4A7C15ULL;
+        h = (h ^ (h >> 32) ^ b) * 0xC2B2AE3D27D4EB4FULL;
+        h = (h ^ (h >> 29) ^ c) * 0x165667B19E3779F9ULL;
+        return (size_t)(h ^ (h >> 32));
+    }
+
+    void rehash(size_t slotCount)
+    {
+        fSlots.assign(slotCount, (uint32_t)kEmptySlot);
+        fMask = slotCount - 1;
+        for (uint32_t index = 0; index < fEntries.size(); index++) {
+            size_t slot = hash(fEntries[index].key) & fMask;
+            while (fSlots[slot] != kEmptySlot) {
+                slot = (slot + 1) & fMask;
+            }
+            fSlots[slot] = index;
+        }
+    }
+
+    std::vector<Entry> fEntries;
+    std::vector<uint32_t> fSlots;
+    size_t fMask;
+    uint64_t fSeed;
+};
+
+}
@@ -10,6 +10,16 @@
 
 #import <ExposureNotification/ExposureNotification.h>
 #import <Foundation/Foundation.h>
+#import <pthread.h>
+
+#if( defined( __x86_64__ ) || defined( __i386__ ) )
+	#import <cpuid.h>
+#elif( defined( __aarch64__ ) && defined( __APPLE__ ) )
+	#import <sys/sysctl.h>
+#elif( defined( __aarch64__ ) && defined( __linux__ ) )
+	#import <asm/hwcap.h>
+	#import <sys/auxv.h>
+#endif
 
 #import "ENInternal.h"
 #import "ENShims.h"
@@ -50,15 +60,409 @@ NSString * NSPrintF( const char *inFormat, ... )
 
 //===========================================================================================================================
 
+// MARK: -
+// MARK: == Deferred Formatting ==
+
+// Errors and portable log lines capture their printf-style arguments and only format them when the text is needed.
+// Only the conversions used in this project are supported: integers, doubles, %c, %s, %p, %@, os_log's %.<n>P and
+// %m, which takes an OSStatus or errno value and with # also appends its strerror text.
+
+#define kENFormatArgCountMax		8
+
+typedef union
+{
+	int64_t			s64;
+	uint64_t		u64;
+	double			f64;
+	const void *	ptr;
+	
+}	ENFormatArg;
+
+typedef struct
+{
+	ENFormatArg		args[ kENFormatArgCountMax ];
+	uint8_t			argCount;
+	uint8_t			objectMask;	// Bit per argument holding an object (%@)
+	uint8_t			stringMask;	// Bit per argument holding a C string (%s)
+	uint8_t			bytesMask;	// Bit per argument holding bytes (%.<n>P)
+	int32_t			lengths[ kENFormatArgCountMax ];	// Precision of each %s (-1 if none) and %P argument
+	
+}	ENFormatArgs;
+
+typedef struct
+{
+	char		flags[ 8 ];
+	char		width[ 8 ];			// Empty, digits or "*"
+	char		precision[ 8 ];		// Empty, digits or "*"
+	int			longCount;			// 1 for l, 2 for ll, q, j, z and t
+	BOOL		longDouble;
+	char		conversion;			// '\0' at the end of the format
+	
+}	ENFormatSpec;
+
+//===========================================================================================================================
+
+static void _ENFormatCopyChars( const char **ioPtr, const char *inSet, char *outBuf, size_t inMaxLen )
+{
+	size_t len = 0;
+	while( **ioPtr && strchr( inSet, **ioPtr ) && ( len < ( inMaxLen - 1 ) ) ) outBuf[ len++ ] = *( *ioPtr )++;
+	outBuf[ len ] = '\0';
+}
+
+/// Parses the conversion starting at inPtr, just after its '%'. Returns a pointer just past it.
+static const char * _ENFormatParseSpec( const char *inPtr, ENFormatSpec *outSpec )
+{
+	memset( outSpec, 0, sizeof( *outSpec ) );
+	
+	// Drop os_log annotations, e.g. %{public}s.
+	if( *inPtr == '{' )
+	{
+		const char *annotationEnd = strchr( inPtr, '}' );
+		inPtr = annotationEnd ? ( annotationEnd + 1 ) : ( inPtr + strlen( inPtr ) );
+	}
+	_ENFormatCopyChars( &inPtr, "-+ #0'", outSpec->flags, sizeof( outSpec->flags ) );
+	_ENFormatCopyChars( &inPtr, ( *inPtr == '*' ) ? "*" : "0123456789", outSpec->width, ( *inPtr == '*' ) ? 2 : sizeof( outSpec->width ) );
+	if( *inPtr == '.' )
+	{
+		++inPtr;
+		_ENFormatCopyChars( &inPtr, ( *inPtr == '*' ) ? "*" : "0123456789", outSpec->precision, ( *inPtr == '*' ) ? 2 : sizeof( outSpec->precision ) );
+		if( outSpec->precision[ 0 ] == '\0' ) outSpec->precision[ 0 ] = '0';
+	}
+	for( ; *inPtr && strchr( "hljztLq", *inPtr ); ++inPtr )
+	{
+		switch( *inPtr )
+		{
+			case 'l':	++outSpec->longCount; break;
+			case 'L':	outSpec->longDouble = YES; break;
+			case 'h':	break;
+			default:	outSpec->longCount = 2; break;
+		}
+	}
+	outSpec->conversion = *inPtr;
+	return( *inPtr ? ( inPtr + 1 ) : inPtr );
+}
+
+//===========================================================================================================================
+
+static BOOL _ENFormatCaptureArg( ENFormatArgs *ioArgs, ENFormatArg inArg )
+{
+	if( ioArgs->argCount >= kENFormatArgCountMax ) return( NO );
+	ioArgs->args[ ioArgs->argCount++ ] = inArg;
+	return( YES );
+}
+
+/// Copies the arguments for inFormat out of inArgs. Returns NO if the format has more arguments than fit, or a
+/// conversion that isn't supported.
+static BOOL _ENFormatCapture( const char *inFormat, va_list inArgs, ENFormatArgs *outArgs )
+{
+	memset( outArgs, 0, sizeof( *outArgs ) );
+	for( const char *ptr = strchr( inFormat, '%' ); ptr; ptr = strchr( ptr, '%' ) )
+	{
+		ENFormatSpec spec;
+		ptr = _ENFormatParseSpec( ptr + 1, &spec );
+		
+		if( ( spec.width[ 0 ] == '*' ) && !_ENFormatCaptureArg( outArgs, (ENFormatArg){ .s64 = va_arg( inArgs, int ) } ) ) return( NO );
+		int precision = -1;
+		if( spec.precision[ 0 ] == '*' )
+		{
+			precision = va_arg( inArgs, int );
+			if( !_ENFormatCaptureArg( outArgs, (ENFormatArg){ .s64 = precision } ) ) return( NO );
+			if( precision < 0 ) precision = -1;
+		}
+		else if( spec.precision[ 0 ] != '\0' )
+		{
+			precision = atoi( spec.precision );
+		}
+		
+		ENFormatArg arg;
+		switch( spec.conversion )
+		{
+			case '%':
+				continue;
+			
+			case 'd': case 'i':
+				if( spec.longCount >= 2 )		arg.s64 = va_arg( inArgs, long long );
+				else if( spec.longCount == 1 )	arg.s64 = va_arg( inArgs, long );
+				else							arg.s64 = va_arg( inArgs, int );
+				break;
+			
+			case 'o': case 'u': case 'x': case 'X':
+				if( spec.longCount >= 2 )		arg.u64 = va_arg( inArgs, unsigned long long );
+				else if( spec.longCount == 1 )	arg.u64 = va_arg( inArgs, unsigned long );
+				else							arg.u64 = va_arg( inArgs, unsigned int );
+				break;
+			
+			case 'c': case 'm':
+				arg.s64 = va_arg( inArgs, int );
+				break;
+			
+			case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+				if( spec.longDouble ) return( NO );
+				arg.f64 = va_arg( inArgs, double );
+				break;
+			
+			case 's':
+				arg.ptr = va_arg( inArgs, const char * );
+				outArgs->stringMask |= ( 1U << outArgs->argCount );
+				outArgs->lengths[ outArgs->argCount ] = precision;
+				break;
+			
+			case 'p':
+				arg.ptr = va_arg( inArgs, const void * );
+				break;
+			
+			case 'P':
+				arg.ptr = va_arg( inArgs, const void * );
+				outArgs->bytesMask |= ( 1U << outArgs->argCount );
+				outArgs->lengths[ outArgs->argCount ] = Max( precision, 0 );
+				break;
+			
+			case '@':
+				arg.ptr = (__bridge const void *) va_arg( inArgs, id );
+				outArgs->objectMask |= ( 1U << outArgs->argCount );
+				break;
+			
+			default:
+				return( NO );
+		}
+		if( !_ENFormatCaptureArg( outArgs, arg ) ) return( NO );
+	}
+	return( YES );
+}
+
+//===========================================================================================================================
+
+/// Formats inFormat with arguments captured by _ENFormatCapture.
+static NSString * _ENFormatMaterialize( const char *inFormat, const ENFormatArgs *inArgs )
+{
+	NSMutableString *result = [[NSMutableString alloc] init];
+	size_t argIndex = 0;
+	const char *ptr = inFormat;
+	for( ;; )
+	{
+		const char *literalEnd = strchr( ptr, '%' );
+		if( !literalEnd ) literalEnd = ptr + strlen( ptr );
+		if( literalEnd > ptr ) [result appendFormat:@"%.*s", (int)( literalEnd - ptr ), ptr];
+		if( *literalEnd == '\0' ) break;
+		
+		ENFormatSpec spec;
+		ptr = _ENFormatParseSpec( literalEnd + 1, &spec );
+		if( spec.conversion == '\0' ) break;
+		if( spec.conversion == '%' )
+		{
+			[result appendString:@"%"];
+			continue;
+		}
+		
+		// Rebuild the conversion without annotations and with any * resolved.
+		int precision = -1;
+		NSMutableString *conversion = [[NSMutableString alloc] initWithFormat:@"%%%s", spec.flags];
+		if( spec.width[ 0 ] == '*' )			[conversion appendFormat:@"%d", (int) inArgs->args[ argIndex++ ].s64];
+		else									[conversion appendFormat:@"%s", spec.width];
+		if( spec.precision[ 0 ] == '*' )		precision = (int) inArgs->args[ argIndex++ ].s64;
+		else if( spec.precision[ 0 ] != '\0' )	precision = atoi( spec.precision );
+		if( precision >= 0 )					[conversion appendFormat:@".%d", precision];
+		if( spec.longCount >= 2 )				[conversion appendString:@"ll"];
+		else if( spec.longCount == 1 )			[conversion appendString:@"l"];
+		[conversion appendFormat:@"%c", spec.conversion];
+		
+		const ENFormatArg arg = inArgs->args[ argIndex++ ];
+		switch( spec.conversion )
+		{
+			case 'd': case 'i':
+				if( spec.longCount >= 2 )		[result appendFormat:conversion, (long long) arg.s64];
+				else if( spec.longCount == 1 )	[result appendFormat:conversion, (long) arg.s64];
+				else							[result appendFormat:conversion, (int) arg.s64];
+				break;
+			
+			case 'o': case 'u': case 'x': case 'X':
+				if( spec.longCount >= 2 )		[result appendFormat:conversion, (unsigned long long) arg.u64];
+				else if( spec.longCount == 1 )	[result appendFormat:conversion, (unsigned long) arg.u64];
+				else							[result appendFormat:conversion, (unsigned int) arg.u64];
+				break;
+			
+			case 'c':
+				[result appendFormat:conversion, (int) arg.s64];
+				break;
+			
+			case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+				[result appendFormat:conversion, arg.f64];
+				break;
+			
+			case 's':
+				[result appendFormat:conversion, arg.ptr ? (const char *) arg.ptr : "(null)"];
+				break;
+			
+			case 'p':
+				[result appendFormat:conversion, arg.ptr];
+				break;
+			
+			case 'P':
+			{
+				const uint8_t *bytes = (const uint8_t *) arg.ptr;
+				if( !bytes ) { [result appendString:@"<null>"]; break; }
+				for( int i = 0; i < precision; ++i ) [result appendFormat:@"%02x", bytes[ i ]];
+				break;
+			}
+			
+			case 'm':
+			{
+				const int err = (int) arg.s64;
+				if( strchr( spec.flags, '#' ) && ( err > 0 ) )	[result appendFormat:@"%d (%s)", err, strerror( err )];
+				else											[result appendFormat:@"%d", err];
+				break;
+			}
+			
+			case '@':
+			{
+				__unsafe_unretained id object = (__bridge id) arg.ptr;
+				[result appendString:object ? [object description] : @"(null)"];
+				break;
+			}
+			
+			default:
+				break;
+		}
+	}
+	return( result );
+}
+
+// MARK: -
+// MARK: == Errors ==
+
+//===========================================================================================================================
+/*!	@brief	NSError that formats its description the first time its userInfo is read.
+
+	Creating one copies the format arguments but allocates nothing else, so errors made and dropped on expected
+	failure paths (end of data, skipped keys) cost one object. Archiving one archives a plain NSError.
+*/
+@interface ENDeferredError : NSError
+- (instancetype) initWithDomain:(NSErrorDomain) inDomain code:(NSInteger) inCode underlyingError:(NSError * _Nullable) inUnderlyingError
+	format:(const char *) inFormat args:(const ENFormatArgs *) inArgs;
+@end
+
+@implementation ENDeferredError
+{
+	NSError *				_underlyingError;
+	const char *			_format;
+	ENFormatArgs			_args;
+	os_unfair_lock			_lock;
+	NSDictionary *			_deferredUserInfo;
+}
+
+- (instancetype) initWithDomain:(NSErrorDomain) inDomain code:(NSInteger) inCode underlyingError:(NSError * _Nullable) inUnderlyingError
+	format:(const char *) inFormat args:(const ENFormatArgs *) inArgs
+{
+	self = [super initWithDomain:inDomain code:inCode userInfo:nil];
+	if( !self ) return( nil );
+	
+	_underlyingError = inUnderlyingError;
+	_format = inFormat;
+	_args = *inArgs;
+	_lock = OS_UNFAIR_LOCK_INIT;
+	
+	// Keep the arguments alive until the description is formatted. Strings and bytes are copied only as far as the
+	// conversion reads them, so a %.*s of a buffer without a NUL isn't read past its precision.
+	for( uint8_t i = 0; i < _args.argCount; ++i )
+	{
+		const void * const ptr = _args.args[ i ].ptr;
+		if( !ptr ) continue;
+		if( _args.objectMask & ( 1U << i ) ) CFRetain( ptr );
+		if( _args.stringMask & ( 1U << i ) )
+		{
+			_args.args[ i ].ptr = ( _args.lengths[ i ] < 0 ) ? strdup( (const char *) ptr ) : 
+				strndup( (const char *) ptr, (size_t) _args.lengths[ i ] );
+		}
+		if( _args.bytesMask & ( 1U << i ) )
+		{
+			void *bytes = malloc( (size_t) _args.lengths[ i ] + 1 );
+			if( bytes ) memcpy( bytes, ptr, (size_t) _args.lengths[ i ] );
+			_args.args[ i ].ptr = bytes;
+		}
+	}
+	return( self );
+}
+
+- (void) dealloc
+{
+	for( uint8_t i = 0; i < _args.argCount; ++i )
+	{
+		if( !_args.args[ i ].ptr ) continue;
+		if( _args.objectMask & ( 1U << i ) ) CFRelease( _args.args[ i ].ptr );
+		if( _args.stringMask & ( 1U << i ) ) free( (void *) _args.args[ i ].ptr );
+		if( _args.bytesMask & ( 1U << i ) ) free( (void *) _args.args[ i ].ptr );
+	}
+}
+
+- (NSDictionary<NSErrorUserInfoKey, id> *) userInfo
+{
+	os_unfair_lock_lock( &_lock );
+	if( !_deferredUserInfo )
+	{
+		NSString *extraStr = _ENFormatMaterialize( _format, &_args );
+		NSString *desc = [self.domain isEqualToString:ENErrorDomain]
+			? NSPrintF( "%s (%@)", ENErrorCodeToString( (ENErrorCode) self.code ), extraStr )
+			: NSPrintF( "%d (%@)", (int) self.code, extraStr );
+		_deferredUserInfo = _underlyingError
+			? @{ NSLocalizedDescriptionKey : desc, NSUnderlyingErrorKey : _underlyingError }
+			: @{ NSLocalizedDescriptionKey : desc };
+	}
+	NSDictionary *userInfo = _deferredUserInfo;
+	os_unfair_lock_unlock( &_lock );
+	return( userInfo );
+}
+
+- (NSString *) localizedDescription
+{
+	return( self.userInfo[ NSLocalizedDescriptionKey ] );
+}
+
+- (NSString *) description
+{
+	return( [[NSError errorWithDomain:self.domain code:self.code userInfo:self.userInfo] description] );
+}
+
+- (nullable id) replacementObjectForCoder:(NSCoder *) inCoder
+{
+	(void) inCoder;
+	return( [NSError errorWithDomain:self.domain code:self.code userInfo:self.userInfo] );
+}
+
+@end
+
+//===========================================================================================================================
+
+static NSError * _ENDeferredErrorV( NSErrorDomain inDomain, NSInteger inCode, NSError * _Nullable inUnderlyingError,
+	const char *inFormat, va_list inArgs )
+{
+	ENFormatArgs args;
+	va_list captureArgs;
+	va_copy( captureArgs, inArgs );
+	BOOL captured = _ENFormatCapture( inFormat, captureArgs, &args );
+	va_end( captureArgs );
+	if( captured )
+	{
+		return( [[ENDeferredError alloc] initWithDomain:inDomain code:inCode underlyingError:inUnderlyingError
+			format:inFormat args:&args] );
+	}
+	
+	// Formats that can't be captured are formatted now.
+	NSString *extraStr = NSPrintV( inFormat, inArgs );
+	NSString *desc = [inDomain isEqualToString:ENErrorDomain]
+		? NSPrintF( "%s (%@)", ENErrorCodeToString( (ENErrorCode) inCode ), extraStr )
+		: NSPrintF( "%d (%@)", (int) inCode, extraStr );
+	NSDictionary *userInfo = inUnderlyingError
+		? @{ NSLocalizedDescriptionKey : desc, NSUnderlyingErrorKey : inUnderlyingError }
+		: @{ NSLocalizedDescriptionKey : desc };
+	return( [[NSError alloc] initWithDomain:inDomain code:inCode userInfo:userInfo] );
+}
+
+//===========================================================================================================================
+
 NSError * _Nullable ENNSErrorV( OSStatus inStatus, const char *inFormat, va_list inArgs )
 {
-    if( !inStatus ) return( nil );
-    NSString *extraStr = NSPrintV(inFormat, inArgs);
-    NSString *desc = NSPrintF("%d (%@)", (int) inStatus, extraStr);
-    NSError *error = [[NSError alloc] initWithDomain:NSOSStatusErrorDomain code:inStatus userInfo:@{
-        NSLocalizedDescriptionKey        : desc,
-    }];
-    return( error );
+	if( !inStatus ) return( nil );
+	return( _ENDeferredErrorV( NSOSStatusErrorDomain, inStatus, nil, inFormat, inArgs ) );
 }
 
 //===========================================================================================================================
@@ -77,14 +481,9 @@ NSError * _Nullable ENNSErrorF( OSStatus inStatus, const char *inFormat, ... )
 
 NSError * _Nullable	ENErrorF( ENErrorCode inErrorCode, const char *inFormat, ... )
 {
-    va_list args;
-    va_start( args, inFormat );
-    const char *codeStr = ENErrorCodeToString( inErrorCode );
-	NSString *extraStr = NSPrintV( inFormat, args );
-	NSString *desc = NSPrintF( "%s (%@)", codeStr, extraStr );
-    NSError *error = [[NSError alloc] initWithDomain:ENErrorDomain code:inErrorCode userInfo:@{
-		NSLocalizedDescriptionKey	: desc, 
-	}];
+	va_list args;
+	va_start( args, inFormat );
+	NSError *error = _ENDeferredErrorV( ENErrorDomain, inErrorCode, nil, inFormat, args );
 	va_end( args );
 	return( error );
 }
@@ -95,15 +494,147 @@ NSError * _Nullable	ENNestedErrorF( NSError *inUnderlyingError, ENErrorCode inEr
 {
 	va_list args;
 	va_start( args, inFormat );
-    const char *codeStr = ENErrorCodeToString( inErrorCode );
-    NSString *extraStr = NSPrintV( inFormat, args );
-	NSString *desc = NSPrintF( "%s (%@)", codeStr, extraStr );
-    NSError *error = [[NSError alloc] initWithDomain:ENErrorDomain code:inErrorCode userInfo:@{
-		NSLocalizedDescriptionKey	: desc, 
-		NSUnderlyingErrorKey		: inUnderlyingError ?: ENNSErrorF( kUnknownErr, "Unknown" ),
-	}];
+	NSError *error = _ENDeferredErrorV( ENErrorDomain, inErrorCode, inUnderlyingError ?: ENNSErrorF( kUnknownErr, "Unknown" ),
+		inFormat, args );
 	va_end( args );
 	return( error );
 }
 
+// MARK: -
+// MARK: == CPU Features ==
+
+#if( defined( __aarch64__ ) && defined( __APPLE__ ) )
+//===========================================================================================================================
+
+/// Returns the hw.optional.arm flag, or inDefault on OS versions that don't have it.
+static Boolean _ENCPUHasARMFeature( const char *inName, Boolean inDefault )
+{
+	int value = 0;
+	size_t len = sizeof( value );
+	if( sysctlbyname( inName, &value, &len, NULL, 0 ) != 0 ) return( inDefault );
+	return( value != 0 );
+}
+#endif
+
+//===========================================================================================================================
+
+static ENCPUFeatureFlags _ENCPUFeaturesDetect( void )
+{
+	ENCPUFeatureFlags features = 0;
+	
+#if( defined( __x86_64__ ) || defined( __i386__ ) )
+	unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+	if( !__get_cpuid( 1, &eax, &ebx, &ecx, &edx ) ) return( 0 );
+	Boolean sse41 = ( ( ecx & bit_SSE4_1 ) != 0 );
+	if( ecx & bit_AES ) features |= kENCPUFeatureAES;
+	
+	// AVX2 also needs the OS to save the YMM registers.
+	
+	Boolean osAVX = false;
+	if( ( ecx & bit_OSXSAVE ) && ( ecx & bit_AVX ) )
+	{
+		uint32_t xcr0Low, xcr0High;
+		__asm__ volatile( "xgetbv" : "=a" ( xcr0Low ), "=d" ( xcr0High ) : "c" ( 0 ) );
+		osAVX = ( ( xcr0Low & 0x6 ) == 0x6 );
+	}
+	
+	if( __get_cpuid_count( 7, 0, &eax, &ebx, &ecx, &edx ) )
+	{
+		if( sse41 && ( ebx & bit_SHA ) )	features |= kENCPUFeatureSHA256;
+		if( osAVX && ( ebx & bit_AVX2 ) )	features |= kENCPUFeatureAVX2;
+	}
+#elif( defined( __aarch64__ ) )
+	// What the compiler was told the target has, for when the OS can't be asked.
+	#if( defined( __ARM_FEATURE_AES ) || defined( __ARM_FEATURE_CRYPTO ) )
+		Boolean targetAES = true;
+	#else
+		Boolean targetAES = false;
+	#endif
+	#if( defined( __ARM_FEATURE_SHA2 ) || defined( __ARM_FEATURE_CRYPTO ) )
+		Boolean targetSHA256 = true;
+	#else
+		Boolean targetSHA256 = false;
+	#endif
+	
+	#if( defined( __APPLE__ ) )
+		if( _ENCPUHasARMFeature( "hw.optional.arm.FEAT_AES", targetAES ) )			features |= kENCPUFeatureAES;
+		if( _ENCPUHasARMFeature( "hw.optional.arm.FEAT_SHA256", targetSHA256 ) )	features |= kENCPUFeatureSHA256;
+	#elif( defined( __linux__ ) )
+		(void) targetAES;
+		(void) targetSHA256;
+		unsigned long hwcap = getauxval( AT_HWCAP );
+		if( hwcap & HWCAP_AES )		features |= kENCPUFeatureAES;
+		if( hwcap & HWCAP_SHA2 )	features |= kENCPUFeatureSHA256;
+	#else
+		if( targetAES )		features |= kENCPUFeatureAES;
+		if( targetSHA256 )	features |= kENCPUFeatureSHA256;
+	#endif
+#endif
+	
+	const char *disabled = getenv( "EN_CPU_FEATURES_DISABLE" );
+	if( disabled ) features &= ~( (ENCPUFeatureFlags) strtoul( disabled, NULL, 16 ) );
+	return( features );
+}
+
+//===========================================================================================================================
+
+static ENCPUFeatureFlags		gENCPUFeatures;
+
+static void _ENCPUFeaturesInitialize( void )
+{
+	gENCPUFeatures = _ENCPUFeaturesDetect();
+}
+
+ENCPUFeatureFlags	ENCPUFeatures( void )
+{
+	static pthread_once_t		sOnce = PTHREAD_ONCE_INIT;
+	
+	pthread_once( &sOnce, _ENCPUFeaturesInitialize );
+	return( gENCPUFeatures );
+}
+
+// MARK: -
+// MARK: == Portable Logging ==
+
+#if( !EN_LOG_USE_OS_LOG )
+
+int		gENLogLevel = EN_LOG_LEVEL_NOTICE;
+
+__attribute__( ( constructor ) ) static void _ENLogInitialize( void )
+{
+	const char *level = getenv( "EN_LOG_LEVEL" );
+	if( level ) gENLogLevel = atoi( level );
+}
+
+//===========================================================================================================================
+
+void ENLogPortable( int inLevel, const char *inFormat, ... )
+{
+	static const char * const		kLevelNames[] = { "debug", "info", "notice", "error", "fault" };
+	ENFormatArgs					args;
+	va_list							varArgs;
+	va_list							captureArgs;
+	
+	va_start( varArgs, inFormat );
+	va_copy( captureArgs, varArgs );
+	BOOL captured = _ENFormatCapture( inFormat, captureArgs, &args );
+	va_end( captureArgs );
+	
+	const char *levelName = kLevelNames[ Clamp( inLevel, EN_LOG_LEVEL_DEBUG, EN_LOG_LEVEL_CRITICAL ) ];
+	if( captured )
+	{
+		fprintf( stderr, "%s: %s\n", levelName, _ENFormatMaterialize( inFormat, &args ).UTF8String );
+	}
+	else
+	{
+		// Formats that can't be captured are plain printf ones (long double, many arguments), so let stdio format them.
+		fprintf( stderr, "%s: ", levelName );
+		vfprintf( stderr, inFormat, varArgs );
+		fputc( '\n', stderr );
+	}
+	va_end( varArgs );
+}
+
+#endif // !EN_LOG_USE_OS_LOG
+
 NS_ASSUME_NONNULL_END
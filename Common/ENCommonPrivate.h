@@ -82,6 +82,20 @@ NSError * _Nullable	ENErrorF( ENErrorCode inErrorCode, const char *inFormat, ...
 EN_API_AVAILABLE_EXPORT
 NSError * _Nullable	ENNestedErrorF( NSError *inUnderlyingError, ENErrorCode inErrorCode, const char *inFormat, ... );
 
+//===========================================================================================================================
+// MARK: -
+// MARK: == CPU Features ==
+
+typedef uint32_t		ENCPUFeatureFlags;
+#define kENCPUFeatureAES			( 1U << 0 ) // AES-NI or ARMv8 AES instructions.
+#define kENCPUFeatureSHA256			( 1U << 1 ) // Intel SHA extensions or ARMv8 SHA-256 instructions.
+#define kENCPUFeatureAVX2			( 1U << 2 ) // AVX2, with the YMM registers saved by the OS.
+
+/// Returns the instruction set extensions this process may use, detected once at runtime: CPUID on x86, the
+/// hw.optional.arm sysctls on Apple arm64 and AT_HWCAP on Linux arm64. Features set in the hex mask in the
+/// EN_CPU_FEATURES_DISABLE environment variable are left out, e.g. to benchmark fallbacks on current hardware.
+ENCPUFeatureFlags	ENCPUFeatures( void );
+
 //===========================================================================================================================
 // MARK: -
 // MARK: == Temporary Exposure Key (TEK) ==
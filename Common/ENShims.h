@@ -31,13 +31,17 @@
 
 #define kUnknownErr             -6700    //! Unknown error occurred.
 #define kRangeErr               -6710    //! Index is out of range or not valid.
+#define kNotFoundErr            -6727    //! Something was not found.
+#define kNoMemoryErr            -6728    //! Could not allocate memory.
 #define kUnsupportedDataErr     -6732    //! Data is unknown or not supported.
+#define kUnsupportedErr         -6735    //! Feature or option is not supported.
 #define kSizeErr                -6743    //! Size was too big, too small, or not appropriate.
 #define kNotPreparedErr         -6745    //! Device or service is not ready.
 #define kReadErr                -6746    //! Could not read.
 #define kWriteErr               -6747    //! Could not write.
 #define kUnderrunErr            -6750    //! Less data than expected.
 #define kOverrunErr             -6751    //! More data than expected.
+#define kChecksumErr            -6754    //! Checksum is not valid.
 #define kEndOfDataErr           -6765    //! Reached the end of the data (e.g. recv returned 0).
 
 
@@ -117,16 +121,152 @@ static inline void _ENDeferCallback( ENDeferBlock *inBlock ) { ( *inBlock )(); }
 #define ENAlignedCast( PTR )        ( (void *)(PTR) )
 #define WriteLittle32( PTR, X )     do { *( (uint32_t *) ENAlignedCast( PTR ) ) = (uint32_t)(X); } while( 0 )
 #define WriteLittle64( PTR, X )     do { *( (uint64_t *) ENAlignedCast( PTR ) ) = (uint64_t)(X); } while( 0 )
+#define ReadLittle16( PTR )         ( *( (uint16_t *) ENAlignedCast( PTR ) ) )
 #define ReadLittle32( PTR )         ( *( (uint32_t *) ENAlignedCast( PTR ) ) )
 #define ReadLittle64( PTR )         ( *( (uint64_t *) ENAlignedCast( PTR ) ) )
+#define WriteBig32( PTR, X )        WriteLittle32( PTR, __builtin_bswap32( (uint32_t)(X) ) )
+#define WriteBig64( PTR, X )        WriteLittle64( PTR, __builtin_bswap64( (uint64_t)(X) ) )
+#define ReadBig32( PTR )            __builtin_bswap32( ReadLittle32( PTR ) )
 
 // Logging Macros
+//
+// Calls below EN_LOG_LEVEL are compiled out, arguments included. Calls at or above it only evaluate their arguments
+// when the level is enabled at runtime. The _LIMITED variants log at most MAX_PER_SECOND times per second from each
+// call site, for logging inside per-RPI and per-advertisement loops.
 
-#include <os/log.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+// os_unfair_lock on Apple platforms, a pthread mutex elsewhere.
+
+#if( __APPLE__ )
+    #include <os/lock.h>
+#else
+    #include <pthread.h>
+
+    typedef pthread_mutex_t                 os_unfair_lock;
+    #define OS_UNFAIR_LOCK_INIT             ( (pthread_mutex_t) PTHREAD_MUTEX_INITIALIZER )
+    #define os_unfair_lock_lock( X )        pthread_mutex_lock( (X) )
+    #define os_unfair_lock_unlock( X )      pthread_mutex_unlock( (X) )
+#endif
+
+#define EN_LOG_LEVEL_DEBUG              0
+#define EN_LOG_LEVEL_INFO               1
+#define EN_LOG_LEVEL_NOTICE             2
+#define EN_LOG_LEVEL_ERROR              3
+#define EN_LOG_LEVEL_CRITICAL           4
+#define EN_LOG_LEVEL_NONE               5
+
+#if( !defined( EN_LOG_LEVEL ) )
+    #if( DEBUG )
+        #define EN_LOG_LEVEL            EN_LOG_LEVEL_DEBUG
+    #else
+        #define EN_LOG_LEVEL            EN_LOG_LEVEL_INFO
+    #endif
+#endif
+
+// os_log on Apple platforms, stderr elsewhere (or when EN_LOG_USE_OS_LOG is set to 0).
+
+#if( !defined( EN_LOG_USE_OS_LOG ) )
+    #define EN_LOG_USE_OS_LOG           __APPLE__
+#endif
+
+#if( EN_LOG_USE_OS_LOG )
+    #include <os/log.h>
+
+    static inline os_log_type_t _ENLogTypeForLevel( int inLevel )
+    {
+        switch( inLevel )
+        {
+            case EN_LOG_LEVEL_DEBUG:    return( OS_LOG_TYPE_DEBUG );
+            case EN_LOG_LEVEL_INFO:     return( OS_LOG_TYPE_INFO );
+            case EN_LOG_LEVEL_NOTICE:   return( OS_LOG_TYPE_DEFAULT );
+            case EN_LOG_LEVEL_ERROR:    return( OS_LOG_TYPE_ERROR );
+            default:                    return( OS_LOG_TYPE_FAULT );
+        }
+    }
+
+    #define _ENLogEnabled( LEVEL )      os_log_type_enabled( OS_LOG_DEFAULT, _ENLogTypeForLevel( LEVEL ) )
+    #define _ENLogWrite( LEVEL, ... )   os_log_with_type( OS_LOG_DEFAULT, _ENLogTypeForLevel( LEVEL ), __VA_ARGS__ )
+#else
+    #ifdef __cplusplus
+    extern "C" {
+    #endif
+
+    /// Lowest level written to stderr. Defaults to EN_LOG_LEVEL_NOTICE; the EN_LOG_LEVEL environment variable
+    /// overrides it at launch.
+    extern int gENLogLevel;
+
+    /// Writes to stderr. Understands the os_log format extensions used in this project: {public}/{private}
+    /// annotations are dropped, %@ prints the object's description and %.<n>P prints n bytes as hex.
+    void ENLogPortable( int inLevel, const char *inFormat, ... );
+
+    #ifdef __cplusplus
+    }
+    #endif
+
+    #define _ENLogEnabled( LEVEL )      ( (LEVEL) >= gENLogLevel )
+    #define _ENLogWrite( LEVEL, ... )   ENLogPortable( (LEVEL), __VA_ARGS__ )
+#endif
+
+#define _EN_LOG( LEVEL, ... ) \
+    do \
+    { \
+        if( ( (LEVEL) >= EN_LOG_LEVEL ) && _ENLogEnabled( LEVEL ) ) \
+        { \
+            _ENLogWrite( (LEVEL), __VA_ARGS__ ); \
+        } \
+    \
+    }    while( 0 )
+
+typedef struct
+{
+    uint64_t        second;
+    uint32_t        count;
+
+}   ENLogRateLimit;
+
+// Racy by design: a site may log a few extra times when threads cross a second boundary together.
+static inline bool _ENLogRateLimitAllows( ENLogRateLimit *inLimit, uint32_t inMaxPerSecond )
+{
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    uint64_t second = (uint64_t) now.tv_sec;
+    uint64_t lastSecond = __atomic_load_n( &inLimit->second, __ATOMIC_RELAXED );
+    if( ( lastSecond != second ) &&
+        __atomic_compare_exchange_n( &inLimit->second, &lastSecond, second, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) )
+    {
+        __atomic_store_n( &inLimit->count, 0, __ATOMIC_RELAXED );
+    }
+    return( __atomic_add_fetch( &inLimit->count, 1, __ATOMIC_RELAXED ) <= inMaxPerSecond );
+}
+
+#define _EN_LOG_LIMITED( LEVEL, MAX_PER_SECOND, ... ) \
+    do \
+    { \
+        if( ( (LEVEL) >= EN_LOG_LEVEL ) && _ENLogEnabled( LEVEL ) ) \
+        { \
+            static ENLogRateLimit _enLogRateLimit_; \
+            if( _ENLogRateLimitAllows( &_enLogRateLimit_, (MAX_PER_SECOND) ) ) \
+            { \
+                _ENLogWrite( (LEVEL), __VA_ARGS__ ); \
+            } \
+        } \
+    \
+    }    while( 0 )
 
 #define YesNoStr( X )                   ( (X) ? "yes" : "no" )
-#define EN_DEBUG_PRINTF(...)            os_log_debug(OS_LOG_DEFAULT, __VA_ARGS__);
-#define EN_INFO_PRINTF(...)             os_log_info(OS_LOG_DEFAULT, __VA_ARGS__);
-#define EN_NOTICE_PRINTF(...)           os_log(OS_LOG_DEFAULT, __VA_ARGS__);
-#define EN_ERROR_PRINTF(...)            os_log_error(OS_LOG_DEFAULT, __VA_ARGS__);
-#define EN_CRITICAL_PRINTF(...)         os_log_fault(OS_LOG_DEFAULT, __VA_ARGS__);
+#define EN_DEBUG_PRINTF(...)            _EN_LOG( EN_LOG_LEVEL_DEBUG, __VA_ARGS__ )
+#define EN_INFO_PRINTF(...)             _EN_LOG( EN_LOG_LEVEL_INFO, __VA_ARGS__ )
+#define EN_NOTICE_PRINTF(...)           _EN_LOG( EN_LOG_LEVEL_NOTICE, __VA_ARGS__ )
+#define EN_ERROR_PRINTF(...)            _EN_LOG( EN_LOG_LEVEL_ERROR, __VA_ARGS__ )
+#define EN_CRITICAL_PRINTF(...)         _EN_LOG( EN_LOG_LEVEL_CRITICAL, __VA_ARGS__ )
+
+// Default per-site limit for logging inside per-RPI and per-advertisement loops.
+#define EN_LOG_HOT_LOOP_LIMIT           10
+
+#define EN_DEBUG_PRINTF_LIMITED( MAX_PER_SECOND, ... )      _EN_LOG_LIMITED( EN_LOG_LEVEL_DEBUG, (MAX_PER_SECOND), __VA_ARGS__ )
+#define EN_INFO_PRINTF_LIMITED( MAX_PER_SECOND, ... )       _EN_LOG_LIMITED( EN_LOG_LEVEL_INFO, (MAX_PER_SECOND), __VA_ARGS__ )
+#define EN_NOTICE_PRINTF_LIMITED( MAX_PER_SECOND, ... )     _EN_LOG_LIMITED( EN_LOG_LEVEL_NOTICE, (MAX_PER_SECOND), __VA_ARGS__ )
+#define EN_ERROR_PRINTF_LIMITED( MAX_PER_SECOND, ... )      _EN_LOG_LIMITED( EN_LOG_LEVEL_ERROR, (MAX_PER_SECOND), __VA_ARGS__ )
@@ -0,0 +1,66 @@
+/*
+ *      Copyright (C) 2020 Apple Inc. All Rights Reserved.
+ *
+ *      ExposureNotification is licensed under Apple Inc.’s
+ *      Sample Code License Agreement, which is contained in
+ *      the LICENSE file distributed with ExposureNotification,
+ *      and only to those who accept that license.
+ *
+ */
+
+#pragma once
+
+#import <Foundation/Foundation.h>
+#import <stdint.h>
+
+#import "ENShims.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define EN_AES_BITSLICED_KEY_LEN        (16)
+#define EN_AES_BITSLICED_ROUNDS         (10)
+
+/*
+ *  Blocks encrypted per pass. Each 64 bit word holds one bit of every byte of four blocks,
+ *  and each operation works on four such words at once (one AVX2 or two SSE2/NEON registers).
+ *  Batches of 144 RPIs take exactly nine passes. Up to four blocks left over, such as the single block of an
+ *  AEM, are encrypted in plain 64 bit words for about a quarter of the work; more cost a full padded pass.
+ */
+#define EN_AES_BITSLICED_BLOCKS_PER_PASS (16)
+
+/*
+ *  AES-128 round keys in bitsliced form, as produced by ENAESBitslicedExpandKey.
+ */
+typedef struct {
+    uint64_t roundKeys[(EN_AES_BITSLICED_ROUNDS + 1) * 8];
+} ENAESBitslicedKey;
+
+/*
+ *  Expand a 16 byte AES-128 key. The expanded key should be cleared when done.
+ */
+BTResult ENAESBitslicedExpandKey(const uint8_t *key, size_t keyLen, ENAESBitslicedKey *outKey);
+
+/*
+ *  AES-128-ECB encrypt blockCount 16 byte blocks from input to output, which may be the same buffer.
+ *
+ *  This is the fallback for CPUs without AES instructions, where AES libraries use lookup tables
+ *  whose cache access pattern depends on the key. The S-box is computed as a boolean circuit
+ *  (Boyar-Peralta) on bitsliced state, so there are no table lookups and no branches or memory
+ *  accesses that depend on the key or data. Uses AVX2 when available, SSE2 or NEON otherwise.
+ */
+void ENAESBitslicedEncryptECB(const ENAESBitslicedKey *key, size_t blockCount, const void *input, void *output);
+
+/*
+ *  Expand the key, encrypt the blocks and clear the expanded key, as ccecb_one_shot.
+ */
+BTResult ENAESBitslicedEncryptECBOneShot(const uint8_t *key, size_t keyLen, size_t blockCount, const void *input, void *output);
+
+#ifdef __cplusplus
+}
+#endif
+
+NS_ASSUME_NONNULL_END
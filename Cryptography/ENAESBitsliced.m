@@ -0,0 +1,317 @@
+/*
+ *      Copyright (C) 2020 Apple Inc. All Rights Reserved.
+ *
+ *      ExposureNotification is licensed under Apple Inc.’s
+ *      Sample Code License Agreement, which is contained in
+ *      the LICENSE file distributed with ExposureNotification,
+ *      and only to those who accept that license.
+ *
+ */
+
+#import "ENAESBitsliced.h"
+#import "ENCommonPrivate.h"
+#import "ENShims.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/*
+ *  This follows the 64 bit constant-time representation of BearSSL's aes_ct64 (Thomas Pornin), widened
+ *  to vectors of four independent 64 bit words. Within a word, bit (4 * b + k) of byte row/column
+ *  position b holds one state bit of block k, and word i of the eight holds bit i of every byte.
+ */
+
+#define EN_AES_BITSLICED_LANES      (4)
+#define EN_AES_BITSLICED_BLOCK_LEN  (16)
+
+// Blocks held by one 64 bit word of each of the eight bit planes.
+#define EN_AES_BITSLICED_BLOCKS_PER_WORD    (4)
+
+typedef uint64_t ENAESSlice __attribute__((vector_size(EN_AES_BITSLICED_LANES * sizeof(uint64_t))));
+
+check_compile_time(EN_AES_BITSLICED_BLOCKS_PER_PASS == EN_AES_BITSLICED_LANES * EN_AES_BITSLICED_BLOCKS_PER_WORD);
+
+#define EN_AES_ALWAYS_INLINE static inline __attribute__((always_inline))
+
+#pragma mark - Bitsliced Primitives
+
+/*
+ *  Transpose helper for the Ortho functions, on either slice type.
+ */
+#define ENAESSwapBits(LOW, HIGH, SHIFT, X, Y) do { \
+        __typeof__(X) a = (X), b = (Y); \
+        (X) = (a & (uint64_t)(LOW)) | ((b & (uint64_t)(LOW)) << (SHIFT)); \
+        (Y) = ((a & (uint64_t)(HIGH)) >> (SHIFT)) | (b & (uint64_t)(HIGH)); \
+    } while (0)
+
+// Macros rather than functions returning slices, whose ABI depends on whether AVX is enabled.
+#define ENAESSliceRotate32(X) (((X) << 32) | ((X) >> 32))
+
+// Vectors of four words, for full passes of EN_AES_BITSLICED_BLOCKS_PER_PASS blocks.
+#define EN_AES_SLICE                    ENAESSlice
+#define EN_AES_SLICE_FUNCTION(NAME)     ENAESSlice ## NAME
+#include "ENAESBitslicedRounds.h"
+#undef EN_AES_SLICE
+#undef EN_AES_SLICE_FUNCTION
+
+// Single words, for up to EN_AES_BITSLICED_BLOCKS_PER_WORD blocks and the key schedule.
+#define EN_AES_SLICE                    uint64_t
+#define EN_AES_SLICE_FUNCTION(NAME)     ENAESWord ## NAME
+#include "ENAESBitslicedRounds.h"
+#undef EN_AES_SLICE
+#undef EN_AES_SLICE_FUNCTION
+
+#pragma mark - Block Packing
+
+/*
+ *  Spread the bytes of two blocks' little endian words into the even and odd bytes of two words,
+ *  or gather them back.
+ */
+static inline void ENAESInterleaveIn(uint64_t *q0, uint64_t *q1, const uint32_t *w)
+{
+    uint64_t x[4];
+    for (int i = 0; i < 4; i++) {
+        x[i] = w[i];
+        x[i] |= (x[i] << 16);
+        x[i] &= 0x0000FFFF0000FFFFULL;
+        x[i] |= (x[i] << 8);
+        x[i] &= 0x00FF00FF00FF00FFULL;
+    }
+    *q0 = x[0] | (x[2] << 8);
+    *q1 = x[1] | (x[3] << 8);
+}
+
+static inline void ENAESInterleaveOut(uint32_t *w, uint64_t q0, uint64_t q1)
+{
+    uint64_t x[4];
+    x[0] = q0 & 0x00FF00FF00FF00FFULL;
+    x[1] = q1 & 0x00FF00FF00FF00FFULL;
+    x[2] = (q0 >> 8) & 0x00FF00FF00FF00FFULL;
+    x[3] = (q1 >> 8) & 0x00FF00FF00FF00FFULL;
+    for (int i = 0; i < 4; i++) {
+        x[i] |= (x[i] >> 8);
+        x[i] &= 0x0000FFFF0000FFFFULL;
+        w[i] = (uint32_t) x[i] | (uint32_t) (x[i] >> 16);
+    }
+}
+
+/*
+ *  Encrypt EN_AES_BITSLICED_BLOCKS_PER_PASS blocks. Lane l of the state holds blocks 4l to 4l+3.
+ */
+EN_AES_ALWAYS_INLINE void ENAESBitslicedEncryptPass(const ENAESBitslicedKey *key, const uint8_t *input, uint8_t *output)
+{
+    uint64_t words[8][EN_AES_BITSLICED_LANES];
+    for (int lane = 0; lane < EN_AES_BITSLICED_LANES; lane++) {
+        for (int block = 0; block < 4; block++) {
+            uint32_t w[4];
+            const uint8_t *in = input + ((lane * 4 + block) * EN_AES_BITSLICED_BLOCK_LEN);
+            for (int i = 0; i < 4; i++) {
+                w[i] = ReadLittle32(in + (i * 4));
+            }
+            ENAESInterleaveIn(&words[block][lane], &words[block + 4][lane], w);
+        }
+    }
+
+    ENAESSlice q[8];
+    memcpy(q, words, sizeof(q));
+    ENAESSliceOrtho(q);
+    ENAESSliceAddRoundKey(q, &key->roundKeys[0]);
+    for (int round = 1; round < EN_AES_BITSLICED_ROUNDS; round++) {
+        ENAESSliceSubBytes(q);
+        ENAESSliceShiftRows(q);
+        ENAESSliceMixColumns(q);
+        ENAESSliceAddRoundKey(q, &key->roundKeys[round * 8]);
+    }
+    ENAESSliceSubBytes(q);
+    ENAESSliceShiftRows(q);
+    ENAESSliceAddRoundKey(q, &key->roundKeys[EN_AES_BITSLICED_ROUNDS * 8]);
+    ENAESSliceOrtho(q);
+    memcpy(words, q, sizeof(words));
+
+    for (int lane = 0; lane < EN_AES_BITSLICED_LANES; lane++) {
+        for (int block = 0; block < 4; block++) {
+            uint32_t w[4];
+            uint8_t *out = output + ((lane * 4 + block) * EN_AES_BITSLICED_BLOCK_LEN);
+            ENAESInterleaveOut(w, words[block][lane], words[block + 4][lane]);
+            for (int i = 0; i < 4; i++) {
+                WriteLittle32(out + (i * 4), w[i]);
+            }
+        }
+    }
+    memset(q, 0, sizeof(q));
+    memset(words, 0, sizeof(words));
+}
+
+/*
+ *  Encrypt up to EN_AES_BITSLICED_BLOCKS_PER_WORD blocks in plain 64 bit words, for short batches such as
+ *  the single block of an AEM. Costs about a quarter of the arithmetic of a full pass.
+ */
+static void ENAESBitslicedEncryptWord(const ENAESBitslicedKey *key, size_t blockCount, const uint8_t *input, uint8_t *output)
+{
+    uint64_t q[8] = {0};
+    for (size_t block = 0; block < blockCount; block++) {
+        uint32_t w[4];
+        const uint8_t *in = input + (block * EN_AES_BITSLICED_BLOCK_LEN);
+        for (int i = 0; i < 4; i++) {
+            w[i] = ReadLittle32(in + (i * 4));
+        }
+        ENAESInterleaveIn(&q[block], &q[block + 4], w);
+    }
+
+    ENAESWordOrtho(q);
+    ENAESWordAddRoundKey(q, &key->roundKeys[0]);
+    for (int round = 1; round < EN_AES_BITSLICED_ROUNDS; round++) {
+        ENAESWordSubBytes(q);
+        ENAESWordShiftRows(q);
+        ENAESWordMixColumns(q);
+        ENAESWordAddRoundKey(q, &key->roundKeys[round * 8]);
+    }
+    ENAESWordSubBytes(q);
+    ENAESWordShiftRows(q);
+    ENAESWordAddRoundKey(q, &key->roundKeys[EN_AES_BITSLICED_ROUNDS * 8]);
+    ENAESWordOrtho(q);
+
+    for (size_t block = 0; block < blockCount; block++) {
+        uint32_t w[4];
+        uint8_t *out = output + (block * EN_AES_BITSLICED_BLOCK_LEN);
+        ENAESInterleaveOut(w, q[block], q[block + 4]);
+        for (int i = 0; i < 4; i++) {
+            WriteLittle32(out + (i * 4), w[i]);
+        }
+    }
+    memset(q, 0, sizeof(q));
+}
+
+#pragma mark - Encryption
+
+/*
+ *  The same passes compiled for the baseline vector unit (SSE2 or NEON, two instructions per
+ *  operation) and for AVX2 (one instruction per operation).
+ */
+static void ENAESBitslicedEncryptPasses(const ENAESBitslicedKey *key, size_t passCount, const uint8_t *input, uint8_t *output)
+{
+    for (size_t i = 0; i < passCount; i++) {
+        size_t offset = i * EN_AES_BITSLICED_BLOCKS_PER_PASS * EN_AES_BITSLICED_BLOCK_LEN;
+        ENAESBitslicedEncryptPass(key, input + offset, output + offset);
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static void ENAESBitslicedEncryptPassesAVX2(const ENAESBitslicedKey *key, size_t passCount, const uint8_t *input, uint8_t *output)
+{
+    for (size_t i = 0; i < passCount; i++) {
+        size_t offset = i * EN_AES_BITSLICED_BLOCKS_PER_PASS * EN_AES_BITSLICED_BLOCK_LEN;
+        ENAESBitslicedEncryptPass(key, input + offset, output + offset);
+    }
+}
+#endif
+
+void ENAESBitslicedEncryptECB(const ENAESBitslicedKey *key, size_t blockCount, const void *input, void *output)
+{
+    void (*encryptPasses)(const ENAESBitslicedKey *, size_t, const uint8_t *, uint8_t *) = ENAESBitslicedEncryptPasses;
+#if defined(__x86_64__) || defined(__i386__)
+    if (ENCPUFeatures() & kENCPUFeatureAVX2) {
+        encryptPasses = ENAESBitslicedEncryptPassesAVX2;
+    }
+#endif
+
+    const uint8_t *in = (const uint8_t *) input;
+    uint8_t *out = (uint8_t *) output;
+    size_t passCount = blockCount / EN_AES_BITSLICED_BLOCKS_PER_PASS;
+    encryptPasses(key, passCount, in, out);
+
+    // Up to a word of blocks past the last full pass are encrypted in plain words. More are encrypted in one
+    // more pass padded with zero blocks.
+    size_t doneLen = passCount * EN_AES_BITSLICED_BLOCKS_PER_PASS * EN_AES_BITSLICED_BLOCK_LEN;
+    size_t remainingLen = (blockCount * EN_AES_BITSLICED_BLOCK_LEN) - doneLen;
+    if (remainingLen == 0) {
+        return;
+    }
+    if (remainingLen <= EN_AES_BITSLICED_BLOCKS_PER_WORD * EN_AES_BITSLICED_BLOCK_LEN) {
+        ENAESBitslicedEncryptWord(key, remainingLen / EN_AES_BITSLICED_BLOCK_LEN, in + doneLen, out + doneLen);
+    } else {
+        uint8_t buffer[EN_AES_BITSLICED_BLOCKS_PER_PASS * EN_AES_BITSLICED_BLOCK_LEN] = {0};
+        memcpy(buffer, in + doneLen, remainingLen);
+        encryptPasses(key, 1, buffer, buffer);
+        memcpy(out + doneLen, buffer, remainingLen);
+        memset(buffer, 0, sizeof(buffer));
+    }
+}
+
+#pragma mark - Key Schedule
+
+/*
+ *  SubWord for the key schedule, through the same constant-time S-box on single words.
+ */
+static uint32_t ENAESBitslicedSubWord(uint32_t x)
+{
+    uint64_t q[8] = {0};
+    q[0] = x;
+    ENAESWordOrtho(q);
+    ENAESWordSubBytes(q);
+    ENAESWordOrtho(q);
+    return (uint32_t) q[0];
+}
+
+BTResult ENAESBitslicedExpandKey(const uint8_t *key, size_t keyLen, ENAESBitslicedKey *outKey)
+{
+    static const uint8_t rcon[EN_AES_BITSLICED_ROUNDS] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1B, 0x36};
+
+    if (key == NULL || keyLen != EN_AES_BITSLICED_KEY_LEN || outKey == NULL) {
+        return BT_ERROR_INVALID_ARGUMENT;
+    }
+
+    // Standard AES-128 key expansion on little endian words.
+    uint32_t w[(EN_AES_BITSLICED_ROUNDS + 1) * 4];
+    for (int i = 0; i < 4; i++) {
+        w[i] = ReadLittle32(key + (i * 4));
+    }
+    for (int i = 4; i < (int) countof(w); i++) {
+        uint32_t tmp = w[i - 1];
+        if ((i % 4) == 0) {
+            tmp = (tmp << 24) | (tmp >> 8);
+            tmp = ENAESBitslicedSubWord(tmp) ^ rcon[(i / 4) - 1];
+        }
+        w[i] = w[i - 4] ^ tmp;
+    }
+
+    // Bitslice each round key with the same key in all four blocks of a word.
+    for (int round = 0; round <= EN_AES_BITSLICED_ROUNDS; round++) {
+        uint64_t q[8];
+        ENAESInterleaveIn(&q[0], &q[4], &w[round * 4]);
+        q[1] = q[2] = q[3] = q[0];
+        q[5] = q[6] = q[7] = q[4];
+        ENAESWordOrtho(q);
+
+        for (int half = 0; half < 2; half++) {
+            uint64_t compressed = (q[half * 4 + 0] & 0x1111111111111111ULL)
+                | (q[half * 4 + 1] & 0x2222222222222222ULL)
+                | (q[half * 4 + 2] & 0x4444444444444444ULL)
+                | (q[half * 4 + 3] & 0x8888888888888888ULL);
+            for (int bit = 0; bit < 4; bit++) {
+                uint64_t x = (compressed >> bit) & 0x1111111111111111ULL;
+                outKey->roundKeys[(round * 8) + (half * 4) + bit] = (x << 4) - x;
+            }
+        }
+        memset(q, 0, sizeof(q));
+    }
+    memset(w, 0, sizeof(w));
+    return BT_SUCCESS;
+}
+
+BTResult ENAESBitslicedEncryptECBOneShot(const uint8_t *key, size_t keyLen, size_t blockCount, const void *input, void *output)
+{
+    if (input == NULL || output == NULL) {
+        return BT_ERROR_INVALID_ARGUMENT;
+    }
+
+    ENAESBitslicedKey expandedKey;
+    BTResult result = ENAESBitslicedExpandKey(key, keyLen, &expandedKey);
+    if (result == BT_SUCCESS) {
+        ENAESBitslicedEncryptECB(&expandedKey, blockCount, input, output);
+    }
+    memset(&expandedKey, 0, sizeof(expandedKey));
+    return result;
+}
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,222 @@
+/*
+ *      Copyright (C) 2020 Apple Inc. All Rights Reserved.
+ *
+ *      ExposureNotification is licensed under Apple Inc.’s
+ *      Sample Code License Agreement, which is contained in
+ *      the LICENSE file distributed with ExposureNotification,
+ *      and only to those who accept that license.
+ *
+ */
+
+/*
+ *  Bitsliced AES round functions, written once for any slice type with the bitwise operators and shifts.
+ *  ENAESBitsliced.m includes this file twice, after defining EN_AES_SLICE as the slice type and
+ *  EN_AES_SLICE_FUNCTION(NAME) as the function names: once for vectors of four words, used by full passes,
+ *  and once for a single 64 bit word of four blocks, used by short batches and the key schedule.
+ *
+ *  There is deliberately no include guard.
+ */
+
+#if !defined(EN_AES_SLICE) || !defined(EN_AES_SLICE_FUNCTION)
+    #error "Define EN_AES_SLICE and EN_AES_SLICE_FUNCTION before including ENAESBitslicedRounds.h"
+#endif
+
+/*
+ *  AES S-box on all 128 bytes of the state, as the 113 gate circuit from Boyar and Peralta,
+ *  "A new combinational logic minimization technique with applications to cryptology".
+ *  x0 is the high bit of each byte and x7 the low bit.
+ */
+EN_AES_ALWAYS_INLINE void EN_AES_SLICE_FUNCTION(SubBytes)(EN_AES_SLICE *q)
+{
+    EN_AES_SLICE x0 = q[7], x1 = q[6], x2 = q[5], x3 = q[4], x4 = q[3], x5 = q[2], x6 = q[1], x7 = q[0];
+
+    // Top linear transformation
+    EN_AES_SLICE y14 = x3 ^ x5;
+    EN_AES_SLICE y13 = x0 ^ x6;
+    EN_AES_SLICE y9 = x0 ^ x3;
+    EN_AES_SLICE y8 = x0 ^ x5;
+    EN_AES_SLICE t0 = x1 ^ x2;
+    EN_AES_SLICE y1 = t0 ^ x7;
+    EN_AES_SLICE y4 = y1 ^ x3;
+    EN_AES_SLICE y12 = y13 ^ y14;
+    EN_AES_SLICE y2 = y1 ^ x0;
+    EN_AES_SLICE y5 = y1 ^ x6;
+    EN_AES_SLICE y3 = y5 ^ y8;
+    EN_AES_SLICE t1 = x4 ^ y12;
+    EN_AES_SLICE y15 = t1 ^ x5;
+    EN_AES_SLICE y20 = t1 ^ x1;
+    EN_AES_SLICE y6 = y15 ^ x7;
+    EN_AES_SLICE y10 = y15 ^ t0;
+    EN_AES_SLICE y11 = y20 ^ y9;
+    EN_AES_SLICE y7 = x7 ^ y11;
+    EN_AES_SLICE y17 = y10 ^ y11;
+    EN_AES_SLICE y19 = y10 ^ y8;
+    EN_AES_SLICE y16 = t0 ^ y11;
+    EN_AES_SLICE y21 = y13 ^ y16;
+    EN_AES_SLICE y18 = x0 ^ y16;
+
+    // Non-linear section
+    EN_AES_SLICE t2 = y12 & y15;
+    EN_AES_SLICE t3 = y3 & y6;
+    EN_AES_SLICE t4 = t3 ^ t2;
+    EN_AES_SLICE t5 = y4 & x7;
+    EN_AES_SLICE t6 = t5 ^ t2;
+    EN_AES_SLICE t7 = y13 & y16;
+    EN_AES_SLICE t8 = y5 & y1;
+    EN_AES_SLICE t9 = t8 ^ t7;
+    EN_AES_SLICE t10 = y2 & y7;
+    EN_AES_SLICE t11 = t10 ^ t7;
+    EN_AES_SLICE t12 = y9 & y11;
+    EN_AES_SLICE t13 = y14 & y17;
+    EN_AES_SLICE t14 = t13 ^ t12;
+    EN_AES_SLICE t15 = y8 & y10;
+    EN_AES_SLICE t16 = t15 ^ t12;
+    EN_AES_SLICE t17 = t4 ^ t14;
+    EN_AES_SLICE t18 = t6 ^ t16;
+    EN_AES_SLICE t19 = t9 ^ t14;
+    EN_AES_SLICE t20 = t11 ^ t16;
+    EN_AES_SLICE t21 = t17 ^ y20;
+    EN_AES_SLICE t22 = t18 ^ y19;
+    EN_AES_SLICE t23 = t19 ^ y21;
+    EN_AES_SLICE t24 = t20 ^ y18;
+
+    EN_AES_SLICE t25 = t21 ^ t22;
+    EN_AES_SLICE t26 = t21 & t23;
+    EN_AES_SLICE t27 = t24 ^ t26;
+    EN_AES_SLICE t28 = t25 & t27;
+    EN_AES_SLICE t29 = t28 ^ t22;
+    EN_AES_SLICE t30 = t23 ^ t24;
+    EN_AES_SLICE t31 = t22 ^ t26;
+    EN_AES_SLICE t32 = t31 & t30;
+    EN_AES_SLICE t33 = t32 ^ t24;
+    EN_AES_SLICE t34 = t23 ^ t33;
+    EN_AES_SLICE t35 = t27 ^ t33;
+    EN_AES_SLICE t36 = t24 & t35;
+    EN_AES_SLICE t37 = t36 ^ t34;
+    EN_AES_SLICE t38 = t27 ^ t36;
+    EN_AES_SLICE t39 = t29 & t38;
+    EN_AES_SLICE t40 = t25 ^ t39;
+
+    EN_AES_SLICE t41 = t40 ^ t37;
+    EN_AES_SLICE t42 = t29 ^ t33;
+    EN_AES_SLICE t43 = t29 ^ t40;
+    EN_AES_SLICE t44 = t33 ^ t37;
+    EN_AES_SLICE t45 = t42 ^ t41;
+    EN_AES_SLICE z0 = t44 & y15;
+    EN_AES_SLICE z1 = t37 & y6;
+    EN_AES_SLICE z2 = t33 & x7;
+    EN_AES_SLICE z3 = t43 & y16;
+    EN_AES_SLICE z4 = t40 & y1;
+    EN_AES_SLICE z5 = t29 & y7;
+    EN_AES_SLICE z6 = t42 & y11;
+    EN_AES_SLICE z7 = t45 & y17;
+    EN_AES_SLICE z8 = t41 & y10;
+    EN_AES_SLICE z9 = t44 & y12;
+    EN_AES_SLICE z10 = t37 & y3;
+    EN_AES_SLICE z11 = t33 & y4;
+    EN_AES_SLICE z12 = t43 & y13;
+    EN_AES_SLICE z13 = t40 & y5;
+    EN_AES_SLICE z14 = t29 & y2;
+    EN_AES_SLICE z15 = t42 & y9;
+    EN_AES_SLICE z16 = t45 & y14;
+    EN_AES_SLICE z17 = t41 & y8;
+
+    // Bottom linear transformation
+    EN_AES_SLICE t46 = z15 ^ z16;
+    EN_AES_SLICE t47 = z10 ^ z11;
+    EN_AES_SLICE t48 = z5 ^ z13;
+    EN_AES_SLICE t49 = z9 ^ z10;
+    EN_AES_SLICE t50 = z2 ^ z12;
+    EN_AES_SLICE t51 = z2 ^ z5;
+    EN_AES_SLICE t52 = z7 ^ z8;
+    EN_AES_SLICE t53 = z0 ^ z3;
+    EN_AES_SLICE t54 = z6 ^ z7;
+    EN_AES_SLICE t55 = z16 ^ z17;
+    EN_AES_SLICE t56 = z12 ^ t48;
+    EN_AES_SLICE t57 = t50 ^ t53;
+    EN_AES_SLICE t58 = z4 ^ t46;
+    EN_AES_SLICE t59 = z3 ^ t54;
+    EN_AES_SLICE t60 = t46 ^ t57;
+    EN_AES_SLICE t61 = z14 ^ t57;
+    EN_AES_SLICE t62 = t52 ^ t58;
+    EN_AES_SLICE t63 = t49 ^ t58;
+    EN_AES_SLICE t64 = z4 ^ t59;
+    EN_AES_SLICE t65 = t61 ^ t62;
+    EN_AES_SLICE t66 = z1 ^ t63;
+    EN_AES_SLICE s0 = t59 ^ t63;
+    EN_AES_SLICE s6 = t56 ^ ~t62;
+    EN_AES_SLICE s7 = t48 ^ ~t60;
+    EN_AES_SLICE t67 = t64 ^ t65;
+    EN_AES_SLICE s3 = t53 ^ t66;
+    EN_AES_SLICE s4 = t51 ^ t66;
+    EN_AES_SLICE s5 = t47 ^ t65;
+    EN_AES_SLICE s1 = t64 ^ ~s3;
+    EN_AES_SLICE s2 = t55 ^ ~t67;
+
+    q[7] = s0;
+    q[6] = s1;
+    q[5] = s2;
+    q[4] = s3;
+    q[3] = s4;
+    q[2] = s5;
+    q[1] = s6;
+    q[0] = s7;
+}
+
+/*
+ *  Transpose between eight words of interleaved block bytes and eight words of byte bits.
+ *  The transpose is its own inverse.
+ */
+EN_AES_ALWAYS_INLINE void EN_AES_SLICE_FUNCTION(Ortho)(EN_AES_SLICE *q)
+{
+    for (int i = 0; i < 8; i += 2) {
+        ENAESSwapBits(0x5555555555555555ULL, 0xAAAAAAAAAAAAAAAAULL, 1, q[i], q[i + 1]);
+    }
+    for (int i = 0; i < 8; i += 4) {
+        ENAESSwapBits(0x3333333333333333ULL, 0xCCCCCCCCCCCCCCCCULL, 2, q[i], q[i + 2]);
+        ENAESSwapBits(0x3333333333333333ULL, 0xCCCCCCCCCCCCCCCCULL, 2, q[i + 1], q[i + 3]);
+    }
+    for (int i = 0; i < 4; i++) {
+        ENAESSwapBits(0x0F0F0F0F0F0F0F0FULL, 0xF0F0F0F0F0F0F0F0ULL, 4, q[i], q[i + 4]);
+    }
+}
+
+EN_AES_ALWAYS_INLINE void EN_AES_SLICE_FUNCTION(ShiftRows)(EN_AES_SLICE *q)
+{
+    for (int i = 0; i < 8; i++) {
+        EN_AES_SLICE x = q[i];
+        q[i] = (x & 0x000000000000FFFFULL)
+            | ((x & 0x00000000FFF00000ULL) >> 4)
+            | ((x & 0x00000000000F0000ULL) << 12)
+            | ((x & 0x0000FF0000000000ULL) >> 8)
+            | ((x & 0x000000FF00000000ULL) << 8)
+            | ((x & 0xF000000000000000ULL) >> 12)
+            | ((x & 0x0FFF000000000000ULL) << 4);
+    }
+}
+
+EN_AES_ALWAYS_INLINE void EN_AES_SLICE_FUNCTION(MixColumns)(EN_AES_SLICE *q)
+{
+    EN_AES_SLICE r[8];
+    for (int i = 0; i < 8; i++) {
+        r[i] = (q[i] >> 16) | (q[i] << 48);
+    }
+
+    EN_AES_SLICE q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3], q4 = q[4], q5 = q[5], q6 = q[6], q7 = q[7];
+    q[0] = q7 ^ r[7] ^ r[0] ^ ENAESSliceRotate32(q0 ^ r[0]);
+    q[1] = q0 ^ r[0] ^ q7 ^ r[7] ^ r[1] ^ ENAESSliceRotate32(q1 ^ r[1]);
+    q[2] = q1 ^ r[1] ^ r[2] ^ ENAESSliceRotate32(q2 ^ r[2]);
+    q[3] = q2 ^ r[2] ^ q7 ^ r[7] ^ r[3] ^ ENAESSliceRotate32(q3 ^ r[3]);
+    q[4] = q3 ^ r[3] ^ q7 ^ r[7] ^ r[4] ^ ENAESSliceRotate32(q4 ^ r[4]);
+    q[5] = q4 ^ r[4] ^ r[5] ^ ENAESSliceRotate32(q5 ^ r[5]);
+    q[6] = q5 ^ r[5] ^ r[6] ^ ENAESSliceRotate32(q6 ^ r[6]);
+    q[7] = q6 ^ r[6] ^ r[7] ^ ENAESSliceRotate32(q7 ^ r[7]);
+}
+
+EN_AES_ALWAYS_INLINE void EN_AES_SLICE_FUNCTION(AddRoundKey)(EN_AES_SLICE *q, const uint64_t *roundKey)
+{
+    // Every block uses the same key, so each round key word is broadcast to all lanes of a vector slice.
+    for (int i = 0; i < 8; i++) {
+        q[i] ^= roundKey[i];
+    }
+}
@@ -0,0 +1,156 @@
+/*
+ *      Copyright (C) 2020 Apple Inc. All Rights Reserved.
+ *
+ *      ExposureNotification is licensed under Apple Inc.’s
+ *      Sample Code License Agreement, which is contained in
+ *      the LICENSE file distributed with ExposureNotification,
+ *      and only to those who accept that license.
+ *
+ */
+
+#pragma once
+
+#import <Foundation/Foundation.h>
+#import <stdbool.h>
+#import <stdint.h>
+
+#import "ENShims.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ *  Providers compiled in. corecrypto is only available on Apple platforms. The OpenSSL provider
+ *  builds against OpenSSL 1.1, OpenSSL 3 or BoringSSL, and needs libcrypto to be linked.
+ */
+#if !defined(EN_CRYPTO_PROVIDER_CORECRYPTO)
+    #define EN_CRYPTO_PROVIDER_CORECRYPTO   __APPLE__
+#endif
+#if !defined(EN_CRYPTO_PROVIDER_OPENSSL)
+    #define EN_CRYPTO_PROVIDER_OPENSSL      0
+#endif
+
+#define EN_CRYPTO_PROVIDER_AES_KEY_LEN      (16)
+#define EN_CRYPTO_PROVIDER_AES_BLOCK_LEN    (16)
+#define EN_CRYPTO_PROVIDER_HKDF_PRK_LEN     (32)
+
+/*
+ *  Environment variable naming the provider to use, e.g. EN_CRYPTO_PROVIDER=openssl.
+ */
+#define EN_CRYPTO_PROVIDER_ENV              "EN_CRYPTO_PROVIDER"
+
+/*
+ *  The AES-128 and HKDF-SHA256 primitives the Exposure Notification cryptography specification is
+ *  built on. All providers compute the same functions, so which one is used only changes speed.
+ *  Functions return 0 on success and a provider specific error code otherwise.
+ */
+typedef struct {
+    const char *name;
+
+    /*
+     *  Can the provider run on this host, e.g. are the instructions or library it needs present.
+     */
+    bool (*isAvailable)(void);
+
+    /*
+     *  AES-128-ECB encrypt blockCount 16 byte blocks. Input and output may be the same buffer.
+     */
+    int (*aesECBEncrypt)(const uint8_t *key, size_t keyLen, size_t blockCount, const void *input, void *output);
+
+    /*
+     *  AES-128-CTR encrypt or decrypt length bytes, with iv as the first 16 byte big endian counter block.
+     */
+    int (*aesCTRCrypt)(const uint8_t *key, size_t keyLen, const uint8_t *iv, size_t length, const void *input, void *output);
+
+    /*
+     *  HKDF-Extract with SHA-256 as in RFC 5869. A NULL salt is HashLen zero bytes.
+     */
+    int (*hkdfExtract)(const uint8_t * _Nullable salt, size_t saltLen, const uint8_t *ikm, size_t ikmLen,
+                       uint8_t *outPRK);
+
+    /*
+     *  HKDF-Expand with SHA-256 as in RFC 5869, from an EN_CRYPTO_PROVIDER_HKDF_PRK_LEN byte PRK.
+     */
+    int (*hkdfExpand)(const uint8_t *prk, const void *info, size_t infoLen, uint8_t *out, size_t outLen);
+} ENCryptoProvider;
+
+#if EN_CRYPTO_PROVIDER_CORECRYPTO
+/*
+ *  corecrypto, with the zero salt HMAC state precomputed for HKDF-Extract. Batches of AES blocks use
+ *  the bitsliced AES in ENAESBitsliced.h on CPUs without AES instructions.
+ */
+extern const ENCryptoProvider kENCryptoProviderCoreCrypto;
+#endif
+
+/*
+ *  Self-contained: AES-NI or ARMv8 AES instructions with the bitsliced AES as fallback, and HMAC
+ *  built on the SHA-256 in ENFileHash.h (SHA-NI, ARMv8 or portable C). Always available.
+ */
+extern const ENCryptoProvider kENCryptoProviderIntrinsics;
+
+#if EN_CRYPTO_PROVIDER_OPENSSL
+/*
+ *  libcrypto from OpenSSL or BoringSSL through the EVP and HMAC interfaces.
+ */
+extern const ENCryptoProvider kENCryptoProviderOpenSSL;
+#endif
+
+/*
+ *  Providers compiled in, in order of preference.
+ */
+size_t ENCryptoProviderCount(void);
+const ENCryptoProvider *ENCryptoProviderAtIndex(size_t index);
+
+/*
+ *  Find a compiled in provider by name. Returns NULL if there is none.
+ */
+const ENCryptoProvider * _Nullable ENCryptoProviderNamed(const char *name);
+
+/*
+ *  The provider ENCryptography uses. Initially the one named by EN_CRYPTO_PROVIDER_ENV if it is
+ *  available, otherwise the first available provider. Either must first pass the known answers of
+ *  ENCryptoProviderSelfTest, checked once; one that fails is logged and the next registered provider
+ *  is tried.
+ */
+const ENCryptoProvider *ENCryptoProviderCurrent(void);
+
+/*
+ *  Make a provider current. It must be available and pass ENCryptoProviderSelfTest.
+ */
+BTResult ENCryptoProviderSetCurrent(const ENCryptoProvider *provider);
+
+/*
+ *  Time every available provider that passes its self test on the work done per TEK during
+ *  matching (deriving the RPIK and AEMK, generating 144 RPIs and decrypting an AEM), make the
+ *  fastest one current and return it.
+ */
+const ENCryptoProvider *ENCryptoProviderSelectFastest(void);
+
+/*
+ *  Check a provider against the known answer tests of the primitives (FIPS-197 and SP 800-38A for
+ *  AES-128 ECB and CTR, RFC 5869 for HKDF-SHA256), then on Exposure Notification work (RPIK and AEMK
+ *  derivation, 144 RPI blocks, AEM encryption): against fixed answers for one TEK, then against the
+ *  first available provider for more TEKs. The reference provider is held to the fixed answers too.
+ *  Returns BT_ERROR_CRYPTO_AES_FAILED or BT_ERROR_CRYPTO_HKDF_FAILED for the first mismatch.
+ */
+BTResult ENCryptoProviderSelfTest(const ENCryptoProvider *provider);
+
+/*
+ *  HKDF-Extract and HKDF-Expand on top of a one shot HMAC-SHA256, for providers without their own.
+ */
+typedef int (*ENCryptoProviderHMACFunction)(const uint8_t *key, size_t keyLen, const void *data, size_t dataLen,
+                                            uint8_t *outMAC);
+
+int ENCryptoProviderHKDFExtractWithHMAC(ENCryptoProviderHMACFunction hmac, const uint8_t * _Nullable salt, size_t saltLen,
+                                        const uint8_t *ikm, size_t ikmLen, uint8_t *outPRK);
+int ENCryptoProviderHKDFExpandWithHMAC(ENCryptoProviderHMACFunction hmac, const uint8_t *prk, const void *info, size_t infoLen,
+                                       uint8_t *out, size_t outLen);
+
+#ifdef __cplusplus
+}
+#endif
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,573 @@
+/*
+ *      Copyright (C) 2020 Apple Inc. All Rights Reserved.
+ *
+ *      ExposureNotification is licensed under Apple Inc.’s
+ *      Sample Code License Agreement, which is contained in
+ *      the LICENSE file distributed with ExposureNotification,
+ *      and only to those who accept that license.
+ *
+ */
+
+#import <pthread.h>
+#import <stdatomic.h>
+#import <stdlib.h>
+#import <string.h>
+#import <time.h>
+
+#import "ENCryptoProvider.h"
+#import "ENShims.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+#pragma mark - Registry
+
+static const ENCryptoProvider * const kENCryptoProviders[] = {
+#if EN_CRYPTO_PROVIDER_CORECRYPTO
+    &kENCryptoProviderCoreCrypto,
+#endif
+    &kENCryptoProviderIntrinsics,
+#if EN_CRYPTO_PROVIDER_OPENSSL
+    &kENCryptoProviderOpenSSL,
+#endif
+};
+
+static _Atomic(const ENCryptoProvider *) gENCryptoProviderCurrent = NULL;
+
+static BTResult ENCryptoProviderKnownAnswerTest(const ENCryptoProvider *provider);
+
+size_t ENCryptoProviderCount(void)
+{
+    return countof(kENCryptoProviders);
+}
+
+const ENCryptoProvider *ENCryptoProviderAtIndex(size_t index)
+{
+    return kENCryptoProviders[Min(index, countof(kENCryptoProviders) - 1)];
+}
+
+const ENCryptoProvider * _Nullable ENCryptoProviderNamed(const char *name)
+{
+    for (size_t i = 0; i < countof(kENCryptoProviders); i++) {
+        if (strcmp(kENCryptoProviders[i]->name, name) == 0) {
+            return kENCryptoProviders[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ *  The reference the other providers are cross-checked against.
+ */
+static const ENCryptoProvider *ENCryptoProviderFirstAvailable(void)
+{
+    for (size_t i = 0; i < countof(kENCryptoProviders); i++) {
+        if (kENCryptoProviders[i]->isAvailable()) {
+            return kENCryptoProviders[i];
+        }
+    }
+    // The intrinsics provider falls back to portable code, so it is always available.
+    return &kENCryptoProviderIntrinsics;
+}
+
+/*
+ *  Whether provider can be the default: available and matching the known answers, so a broken path (e.g. a
+ *  misdetected CPU feature) never generates RPIs.
+ */
+static bool ENCryptoProviderIsUsable(const ENCryptoProvider *provider)
+{
+    if (!provider->isAvailable()) {
+        return false;
+    }
+    BTResult result = ENCryptoProviderKnownAnswerTest(provider);
+    if (result != BT_SUCCESS) {
+        EN_ERROR_PRINTF("Crypto provider %s failed its known answer test %d", provider->name, result);
+        return false;
+    }
+    return true;
+}
+
+/*
+ *  Pick the default provider, honoring EN_CRYPTO_PROVIDER_ENV, unless one was already made current. The
+ *  first registered provider that passes its known answer test is used if the named one doesn't.
+ */
+static void ENCryptoProviderInitializeCurrent(void)
+{
+    const ENCryptoProvider *defaultProvider = NULL;
+    const ENCryptoProvider *namedProvider = NULL;
+    const char *name = getenv(EN_CRYPTO_PROVIDER_ENV);
+    if (name && *name) {
+        namedProvider = ENCryptoProviderNamed(name);
+        if (namedProvider && ENCryptoProviderIsUsable(namedProvider)) {
+            defaultProvider = namedProvider;
+        } else {
+            EN_ERROR_PRINTF("%s=%s is not a usable crypto provider", EN_CRYPTO_PROVIDER_ENV, name);
+        }
+    }
+    for (size_t i = 0; !defaultProvider && i < countof(kENCryptoProviders); i++) {
+        if (kENCryptoProviders[i] != namedProvider && ENCryptoProviderIsUsable(kENCryptoProviders[i])) {
+            defaultProvider = kENCryptoProviders[i];
+        }
+    }
+    if (!defaultProvider) {
+        // Nothing better is left. The portable fallback of the intrinsics provider is the least likely to be wrong.
+        defaultProvider = &kENCryptoProviderIntrinsics;
+        EN_ERROR_PRINTF("No crypto provider passed its known answer test, using %s", defaultProvider->name);
+    }
+    const ENCryptoProvider *expected = NULL;
+    if (atomic_compare_exchange_strong(&gENCryptoProviderCurrent, &expected, defaultProvider)) {
+        EN_INFO_PRINTF("Using crypto provider %s", defaultProvider->name);
+    }
+}
+
+const ENCryptoProvider *ENCryptoProviderCurrent(void)
+{
+    const ENCryptoProvider *provider = atomic_load_explicit(&gENCryptoProviderCurrent, memory_order_acquire);
+    if (provider) {
+        return provider;
+    }
+
+    static pthread_once_t onceToken = PTHREAD_ONCE_INIT;
+    pthread_once(&onceToken, ENCryptoProviderInitializeCurrent);
+    return atomic_load_explicit(&gENCryptoProviderCurrent, memory_order_acquire);
+}
+
+BTResult ENCryptoProviderSetCurrent(const ENCryptoProvider *provider)
+{
+    if (provider == NULL || !provider->isAvailable()) {
+        return BT_ERROR_INVALID_ARGUMENT;
+    }
+    BTResult result = ENCryptoProviderSelfTest(provider);
+    if (result != BT_SUCCESS) {
+        EN_ERROR_PRINTF("Crypto provider %s failed its self test %d", provider->name, result);
+        return result;
+    }
+    atomic_store_explicit(&gENCryptoProviderCurrent, provider, memory_order_release);
+    EN_INFO_PRINTF("Using crypto provider %s", provider->name);
+    return BT_SUCCESS;
+}
+
+#pragma mark - HKDF
+
+int ENCryptoProviderHKDFExtractWithHMAC(ENCryptoProviderHMACFunction hmac, const uint8_t * _Nullable salt, size_t saltLen,
+                                        const uint8_t *ikm, size_t ikmLen, uint8_t *outPRK)
+{
+    static const uint8_t zeroSalt[EN_CRYPTO_PROVIDER_HKDF_PRK_LEN] = {0};
+    if (salt == NULL) {
+        salt = zeroSalt;
+        saltLen = sizeof(zeroSalt);
+    }
+    return hmac(salt, saltLen, ikm, ikmLen, outPRK);
+}
+
+int ENCryptoProviderHKDFExpandWithHMAC(ENCryptoProviderHMACFunction hmac, const uint8_t *prk, const void *info, size_t infoLen,
+                                       uint8_t *out, size_t outLen)
+{
+    if (outLen > 255 * EN_CRYPTO_PROVIDER_HKDF_PRK_LEN) {
+        return BT_ERROR_INVALID_ARGUMENT;
+    }
+
+    // Each block is HMAC(PRK, T(n - 1) || info || n), so lay the message out once and update T and n in place.
+    uint8_t stackMessage[EN_CRYPTO_PROVIDER_HKDF_PRK_LEN + 64 + 1];
+    size_t messageLen = EN_CRYPTO_PROVIDER_HKDF_PRK_LEN + infoLen + 1;
+    uint8_t *message = (messageLen <= sizeof(stackMessage)) ? stackMessage : (uint8_t *) malloc(messageLen);
+    if (message == NULL) {
+        return BT_ERROR;
+    }
+    if (infoLen > 0) {
+        memcpy(message + EN_CRYPTO_PROVIDER_HKDF_PRK_LEN, info, infoLen);
+    }
+
+    int error = 0;
+    uint8_t *block = message;
+    for (uint8_t counter = 1; outLen > 0 && !error; counter++) {
+        message[messageLen - 1] = counter;
+        const uint8_t *input = (counter > 1) ? message : (message + EN_CRYPTO_PROVIDER_HKDF_PRK_LEN);
+        size_t inputLen = (counter > 1) ? messageLen : (messageLen - EN_CRYPTO_PROVIDER_HKDF_PRK_LEN);
+        error = hmac(prk, EN_CRYPTO_PROVIDER_HKDF_PRK_LEN, input, inputLen, block);
+        if (!error) {
+            size_t blockLen = Min(outLen, (size_t) EN_CRYPTO_PROVIDER_HKDF_PRK_LEN);
+            memcpy(out, block, blockLen);
+            out += blockLen;
+            outLen -= blockLen;
+        }
+    }
+
+    memset(message, 0, messageLen);
+    if (message != stackMessage) {
+        free(message);
+    }
+    return error;
+}
+
+#pragma mark - Self Test
+
+/*
+ *  FIPS-197 appendix C.1.
+ */
+static const uint8_t kFIPS197Key[] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f
+};
+static const uint8_t kFIPS197Plaintext[] = {
+    0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff
+};
+static const uint8_t kFIPS197Ciphertext[] = {
+    0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30, 0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a
+};
+
+/*
+ *  SP 800-38A F.1.1 (ECB-AES128.Encrypt) and F.5.1 (CTR-AES128.Encrypt).
+ */
+static const uint8_t kSP80038AKey[] = {
+    0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c
+};
+static const uint8_t kSP80038APlaintext[] = {
+    0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+    0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+    0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11, 0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+    0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17, 0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10
+};
+static const uint8_t kSP80038AECBCiphertext[] = {
+    0x3a, 0xd7, 0x7b, 0xb4, 0x0d, 0x7a, 0x36, 0x60, 0xa8, 0x9e, 0xca, 0xf3, 0x24, 0x66, 0xef, 0x97,
+    0xf5, 0xd3, 0xd5, 0x85, 0x03, 0xb9, 0x69, 0x9d, 0xe7, 0x85, 0x89, 0x5a, 0x96, 0xfd, 0xba, 0xaf,
+    0x43, 0xb1, 0xcd, 0x7f, 0x59, 0x8e, 0xce, 0x23, 0x88, 0x1b, 0x00, 0xe3, 0xed, 0x03, 0x06, 0x88,
+    0x7b, 0x0c, 0x78, 0x5e, 0x27, 0xe8, 0xad, 0x3f, 0x82, 0x23, 0x20, 0x71, 0x04, 0x72, 0x5d, 0xd4
+};
+static const uint8_t kSP80038ACTRCounter[] = {
+    0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff
+};
+static const uint8_t kSP80038ACTRCiphertext[] = {
+    0x87, 0x4d, 0x61, 0x91, 0xb6, 0x20, 0xe3, 0x26, 0x1b, 0xef, 0x68, 0x64, 0x99, 0x0d, 0xb6, 0xce,
+    0x98, 0x06, 0xf6, 0x6b, 0x79, 0x70, 0xfd, 0xff, 0x86, 0x17, 0x18, 0x7b, 0xb9, 0xff, 0xfd, 0xff,
+    0x5a, 0xe4, 0xdf, 0x3e, 0xdb, 0xd5, 0xd3, 0x5e, 0x5b, 0x4f, 0x09, 0x02, 0x0d, 0xb0, 0x3e, 0xab,
+    0x1e, 0x03, 0x1d, 0xda, 0x2f, 0xbe, 0x03, 0xd1, 0x79, 0x21, 0x70, 0xa0, 0xf3, 0x00, 0x9c, 0xee
+};
+
+/*
+ *  The SP 800-38A CTR plaintext with an all-ones counter block, which must wrap to zero for the second block.
+ */
+static const uint8_t kCTRWrapCiphertext[] = {
+    0xe1, 0x33, 0x38, 0xe3, 0x6c, 0xb7, 0x19, 0x62, 0xe0, 0x0d, 0x02, 0x0b, 0x4c, 0xed, 0xbd, 0x86,
+    0xd3, 0xda, 0xe1, 0x5b, 0x04, 0xbb, 0x35, 0x2f, 0xa0, 0xf5, 0x9f, 0xeb, 0xfc, 0xb4, 0xda, 0x3e
+};
+
+/*
+ *  RFC 5869 A.1 (basic test case) and A.3 (zero-length salt and info, as the EN key derivations).
+ */
+static const uint8_t kRFC5869IKM[] = {
+    0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b,
+    0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b
+};
+static const uint8_t kRFC5869Case1Salt[] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c
+};
+static const uint8_t kRFC5869Case1Info[] = {
+    0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9
+};
+static const uint8_t kRFC5869Case1PRK[] = {
+    0x07, 0x77, 0x09, 0x36, 0x2c, 0x2e, 0x32, 0xdf, 0x0d, 0xdc, 0x3f, 0x0d, 0xc4, 0x7b, 0xba, 0x63,
+    0x90, 0xb6, 0xc7, 0x3b, 0xb5, 0x0f, 0x9c, 0x31, 0x22, 0xec, 0x84, 0x4a, 0xd7, 0xc2, 0xb3, 0xe5
+};
+static const uint8_t kRFC5869Case1OKM[] = {
+    0x3c, 0xb2, 0x5f, 0x25, 0xfa, 0xac, 0xd5, 0x7a, 0x90, 0x43, 0x4f, 0x64, 0xd0, 0x36, 0x2f, 0x2a,
+    0x2d, 0x2d, 0x0a, 0x90, 0xcf, 0x1a, 0x5a, 0x4c, 0x5d, 0xb0, 0x2d, 0x56, 0xec, 0xc4, 0xc5, 0xbf,
+    0x34, 0x00, 0x72, 0x08, 0xd5, 0xb8, 0x87, 0x18, 0x58, 0x65
+};
+static const uint8_t kRFC5869Case3PRK[] = {
+    0x19, 0xef, 0x24, 0xa3, 0x2c, 0x71, 0x7b, 0x16, 0x7f, 0x33, 0xa9, 0x1d, 0x6f, 0x64, 0x8b, 0xdf,
+    0x96, 0x59, 0x67, 0x76, 0xaf, 0xdb, 0x63, 0x77, 0xac, 0x43, 0x4c, 0x1c, 0x29, 0x3c, 0xcb, 0x04
+};
+static const uint8_t kRFC5869Case3OKM[] = {
+    0x8d, 0xa4, 0xe7, 0x75, 0xa5, 0x63, 0xc1, 0x8f, 0x71, 0x5f, 0x80, 0x2a, 0x06, 0x3c, 0x5a, 0x31,
+    0xb8, 0xa1, 0x1f, 0x5c, 0x5e, 0xe1, 0x87, 0x9e, 0xc3, 0x45, 0x4e, 0x5f, 0x3c, 0x73, 0x8d, 0x2d,
+    0x9d, 0x20, 0x13, 0x95, 0xfa, 0xa4, 0xb6, 0x1a, 0x96, 0xc8
+};
+
+#define EN_CRYPTO_PROVIDER_SELF_TEST_BLOCKS     (144)
+
+static BTResult ENCryptoProviderSelfTestAES(const ENCryptoProvider *provider)
+{
+    uint8_t output[EN_CRYPTO_PROVIDER_SELF_TEST_BLOCKS * EN_CRYPTO_PROVIDER_AES_BLOCK_LEN];
+    uint8_t expected[sizeof(output)];
+
+    int error = provider->aesECBEncrypt(kFIPS197Key, sizeof(kFIPS197Key), 1, kFIPS197Plaintext, output);
+    if (error || memcmp(output, kFIPS197Ciphertext, sizeof(kFIPS197Ciphertext)) != 0) {
+        EN_ERROR_PRINTF("%s AES-ECB FIPS-197 C.1 failed %d", provider->name, error);
+        return BT_ERROR_CRYPTO_AES_FAILED;
+    }
+
+    // Every batch length up to 144 blocks, in place, so all partial passes of the batched implementations are covered.
+    for (size_t i = 0; i < EN_CRYPTO_PROVIDER_SELF_TEST_BLOCKS; i += 4) {
+        memcpy(&expected[i * EN_CRYPTO_PROVIDER_AES_BLOCK_LEN], kSP80038AECBCiphertext, sizeof(kSP80038AECBCiphertext));
+    }
+    for (size_t blockCount = 1; blockCount <= EN_CRYPTO_PROVIDER_SELF_TEST_BLOCKS; blockCount++) {
+        for (size_t i = 0; i < blockCount; i += 4) {
+            memcpy(&output[i * EN_CRYPTO_PROVIDER_AES_BLOCK_LEN], kSP80038APlaintext, sizeof(kSP80038APlaintext));
+        }
+        error = provider->aesECBEncrypt(kSP80038AKey, sizeof(kSP80038AKey), blockCount, output, output);
+        if (error || memcmp(output, expected, blockCount * EN_CRYPTO_PROVIDER_AES_BLOCK_LEN) != 0) {
+            EN_ERROR_PRINTF("%s AES-ECB SP 800-38A F.1.1 failed for %zu blocks %d", provider->name, blockCount, error);
+            return BT_ERROR_CRYPTO_AES_FAILED;
+        }
+    }
+
+    // CTR including partial blocks, as the 4 byte AEMs.
+    for (size_t length = 0; length <= sizeof(kSP80038APlaintext); length++) {
+        error = provider->aesCTRCrypt(kSP80038AKey, sizeof(kSP80038AKey), kSP80038ACTRCounter, length,
+                                      kSP80038APlaintext, output);
+        if (error || memcmp(output, kSP80038ACTRCiphertext, length) != 0) {
+            EN_ERROR_PRINTF("%s AES-CTR SP 800-38A F.5.1 failed for %zu bytes %d", provider->name, length, error);
+            return BT_ERROR_CRYPTO_AES_FAILED;
+        }
+    }
+
+    uint8_t wrapCounter[EN_CRYPTO_PROVIDER_AES_BLOCK_LEN];
+    memset(wrapCounter, 0xff, sizeof(wrapCounter));
+    error = provider->aesCTRCrypt(kSP80038AKey, sizeof(kSP80038AKey), wrapCounter, sizeof(kCTRWrapCiphertext),
+                                  kSP80038APlaintext, output);
+    if (error || memcmp(output, kCTRWrapCiphertext, sizeof(kCTRWrapCiphertext)) != 0) {
+        EN_ERROR_PRINTF("%s AES-CTR counter wrap failed %d", provider->name, error);
+        return BT_ERROR_CRYPTO_AES_FAILED;
+    }
+
+    return BT_SUCCESS;
+}
+
+static BTResult ENCryptoProviderSelfTestHKDF(const ENCryptoProvider *provider)
+{
+    uint8_t prk[EN_CRYPTO_PROVIDER_HKDF_PRK_LEN];
+    uint8_t okm[sizeof(kRFC5869Case1OKM)];
+
+    int error = provider->hkdfExtract(kRFC5869Case1Salt, sizeof(kRFC5869Case1Salt), kRFC5869IKM, sizeof(kRFC5869IKM), prk);
+    if (!error) {
+        error = provider->hkdfExpand(prk, kRFC5869Case1Info, sizeof(kRFC5869Case1Info), okm, sizeof(okm));
+    }
+    if (error || memcmp(prk, kRFC5869Case1PRK, sizeof(prk)) != 0 || memcmp(okm, kRFC5869Case1OKM, sizeof(okm)) != 0) {
+        EN_ERROR_PRINTF("%s HKDF RFC 5869 A.1 failed %d", provider->name, error);
+        return BT_ERROR_CRYPTO_HKDF_FAILED;
+    }
+
+    // A zero-length salt and no salt are both HashLen zero bytes.
+    for (int i = 0; i < 2; i++) {
+        memset(prk, 0, sizeof(prk));
+        memset(okm, 0, sizeof(okm));
+        error = provider->hkdfExtract((i == 0) ? NULL : kRFC5869Case1Salt, 0, kRFC5869IKM, sizeof(kRFC5869IKM), prk);
+        if (!error) {
+            error = provider->hkdfExpand(prk, "", 0, okm, sizeof(okm));
+        }
+        if (error || memcmp(prk, kRFC5869Case3PRK, sizeof(prk)) != 0 || memcmp(okm, kRFC5869Case3OKM, sizeof(okm)) != 0) {
+            EN_ERROR_PRINTF("%s HKDF RFC 5869 A.3 failed %d", provider->name, error);
+            return BT_ERROR_CRYPTO_HKDF_FAILED;
+        }
+    }
+
+    return BT_SUCCESS;
+}
+
+/*
+ *  The per-TEK work of matching: derive the RPIK and AEMK, generate 144 RPIs and decrypt an AEM.
+ *  Every provider is checked against fixed answers for one TEK, then against the reference provider
+ *  on more TEKs, so a reference that is wrong on EN inputs cannot pass the others by agreement.
+ */
+typedef struct {
+    uint8_t rpik[EN_CRYPTO_PROVIDER_AES_KEY_LEN];
+    uint8_t aemk[EN_CRYPTO_PROVIDER_AES_KEY_LEN];
+    uint8_t rpis[EN_CRYPTO_PROVIDER_SELF_TEST_BLOCKS * EN_CRYPTO_PROVIDER_AES_BLOCK_LEN];
+    uint8_t aem[4];
+} ENCryptoProviderTEKWork;
+
+static int ENCryptoProviderDoTEKWork(const ENCryptoProvider *provider, const uint8_t tek[EN_CRYPTO_PROVIDER_AES_KEY_LEN],
+                                     uint32_t intervalNumber, ENCryptoProviderTEKWork *outWork)
+{
+    static const uint8_t rpikInfo[] = {'E', 'N', '-', 'R', 'P', 'I', 'K'};
+    static const uint8_t aemkInfo[] = {'E', 'N', '-', 'A', 'E', 'M', 'K'};
+    static const uint8_t metadata[] = {0x40, 0x08, 0x00, 0x00};
+
+    uint8_t prk[EN_CRYPTO_PROVIDER_HKDF_PRK_LEN];
+    int error = provider->hkdfExtract(NULL, 0, tek, EN_CRYPTO_PROVIDER_AES_KEY_LEN, prk);
+    if (!error) {
+        error = provider->hkdfExpand(prk, rpikInfo, sizeof(rpikInfo), outWork->rpik, sizeof(outWork->rpik));
+    }
+    if (!error) {
+        error = provider->hkdfExpand(prk, aemkInfo, sizeof(aemkInfo), outWork->aemk, sizeof(outWork->aemk));
+    }
+    memset(prk, 0, sizeof(prk));
+    if (error) {
+        return error;
+    }
+
+    for (uint32_t i = 0; i < EN_CRYPTO_PROVIDER_SELF_TEST_BLOCKS; i++) {
+        uint8_t *p = &outWork->rpis[i * EN_CRYPTO_PROVIDER_AES_BLOCK_LEN];
+        memcpy(p, "EN-RPI\0\0\0\0\0\0", 12);
+        WriteLittle32(p + 12, intervalNumber + i);
+    }
+    error = provider->aesECBEncrypt(outWork->rpik, sizeof(outWork->rpik), EN_CRYPTO_PROVIDER_SELF_TEST_BLOCKS,
+                                    outWork->rpis, outWork->rpis);
+    if (error) {
+        return error;
+    }
+    return provider->aesCTRCrypt(outWork->aemk, sizeof(outWork->aemk), outWork->rpis, sizeof(metadata), metadata, outWork->aem);
+}
+
+/*
+ *  TEK 00 01 .. 0f at interval number 2650032, with the AEM of metadata 40 08 00 00 under the first RPI.
+ *  The EN specification publishes no test vectors; these were computed from its definitions with
+ *  OpenSSL's HMAC-SHA256 and AES-128.
+ */
+#define EN_CRYPTO_PROVIDER_KAT_INTERVAL_NUMBER  (2650032)
+
+static const uint8_t kENKATRPIK[] = {
+    0x4c, 0x36, 0x15, 0x25, 0x00, 0x75, 0xe0, 0x94, 0xe4, 0x2e, 0x1b, 0x72, 0xe5, 0x38, 0xde, 0xd2
+};
+static const uint8_t kENKATAEMK[] = {
+    0x34, 0x54, 0xdd, 0x8d, 0x8c, 0x8c, 0x83, 0x50, 0x29, 0x75, 0x4c, 0x15, 0xdf, 0x6d, 0x44, 0xd7
+};
+static const uint8_t kENKATFirstRPI[] = {
+    0x4b, 0x0c, 0xf5, 0xc1, 0xf7, 0xdf, 0x9c, 0x03, 0x47, 0x46, 0xe5, 0xd1, 0x3e, 0x84, 0xde, 0x55
+};
+static const uint8_t kENKATLastRPI[] = {
+    0xab, 0x87, 0x33, 0x98, 0xfb, 0xc3, 0xc1, 0x37, 0xcc, 0xfb, 0x76, 0x6a, 0x4d, 0xa3, 0x9e, 0x9f
+};
+static const uint8_t kENKATAEM[] = {
+    0x44, 0x82, 0xd2, 0xef
+};
+
+static BTResult ENCryptoProviderKnownAnswerTestTEKWork(const ENCryptoProvider *provider)
+{
+    ENCryptoProviderTEKWork work;
+    uint8_t tek[EN_CRYPTO_PROVIDER_AES_KEY_LEN];
+    for (size_t j = 0; j < sizeof(tek); j++) {
+        tek[j] = (uint8_t) j;
+    }
+    memset(&work, 0, sizeof(work));
+    int error = ENCryptoProviderDoTEKWork(provider, tek, EN_CRYPTO_PROVIDER_KAT_INTERVAL_NUMBER, &work);
+    if (error || memcmp(work.rpik, kENKATRPIK, sizeof(kENKATRPIK)) != 0 ||
+        memcmp(work.aemk, kENKATAEMK, sizeof(kENKATAEMK)) != 0) {
+        EN_ERROR_PRINTF("%s EN TEK subkey known answers failed %d", provider->name, error);
+        return BT_ERROR_CRYPTO_HKDF_FAILED;
+    }
+    if (memcmp(work.rpis, kENKATFirstRPI, sizeof(kENKATFirstRPI)) != 0 ||
+        memcmp(&work.rpis[(EN_CRYPTO_PROVIDER_SELF_TEST_BLOCKS - 1) * EN_CRYPTO_PROVIDER_AES_BLOCK_LEN], kENKATLastRPI,
+               sizeof(kENKATLastRPI)) != 0 ||
+        memcmp(work.aem, kENKATAEM, sizeof(kENKATAEM)) != 0) {
+        EN_ERROR_PRINTF("%s EN RPI or AEM known answers failed", provider->name);
+        return BT_ERROR_CRYPTO_AES_FAILED;
+    }
+    memset(&work, 0, sizeof(work));
+    return BT_SUCCESS;
+}
+
+/*
+ *  Compare provider with the reference on more TEKs than the known answers cover.
+ */
+static BTResult ENCryptoProviderCrossCheckTEKWork(const ENCryptoProvider *provider)
+{
+    const ENCryptoProvider *reference = ENCryptoProviderFirstAvailable();
+    if (reference == provider) {
+        return BT_SUCCESS;
+    }
+
+    ENCryptoProviderTEKWork work, referenceWork;
+    uint8_t tek[EN_CRYPTO_PROVIDER_AES_KEY_LEN];
+    int error;
+    for (uint32_t i = 0; i < 8; i++) {
+        for (size_t j = 0; j < sizeof(tek); j++) {
+            tek[j] = (uint8_t)((i * 0x9e) ^ (j * 0x3b) ^ 0xa5);
+        }
+        uint32_t intervalNumber = 2650032 + (i * 144);
+        error = ENCryptoProviderDoTEKWork(reference, tek, intervalNumber, &referenceWork);
+        if (error) {
+            EN_ERROR_PRINTF("%s failed on EN inputs %d", reference->name, error);
+            return BT_ERROR;
+        }
+        memset(&work, 0, sizeof(work));
+        error = ENCryptoProviderDoTEKWork(provider, tek, intervalNumber, &work);
+        if (error || memcmp(work.rpik, referenceWork.rpik, sizeof(work.rpik)) != 0 ||
+            memcmp(work.aemk, referenceWork.aemk, sizeof(work.aemk)) != 0) {
+            EN_ERROR_PRINTF("%s and %s derive different TEK subkeys %d", provider->name, reference->name, error);
+            return BT_ERROR_CRYPTO_HKDF_FAILED;
+        }
+        if (memcmp(work.rpis, referenceWork.rpis, sizeof(work.rpis)) != 0 ||
+            memcmp(work.aem, referenceWork.aem, sizeof(work.aem)) != 0) {
+            EN_ERROR_PRINTF("%s and %s generate different RPIs or AEMs", provider->name, reference->name);
+            return BT_ERROR_CRYPTO_AES_FAILED;
+        }
+    }
+    memset(&work, 0, sizeof(work));
+    memset(&referenceWork, 0, sizeof(referenceWork));
+    return BT_SUCCESS;
+}
+
+/*
+ *  The fixed test vectors only, which don't depend on any other provider working.
+ */
+static BTResult ENCryptoProviderKnownAnswerTest(const ENCryptoProvider *provider)
+{
+    BTResult result = ENCryptoProviderSelfTestAES(provider);
+    if (result == BT_SUCCESS) {
+        result = ENCryptoProviderSelfTestHKDF(provider);
+    }
+    if (result == BT_SUCCESS) {
+        result = ENCryptoProviderKnownAnswerTestTEKWork(provider);
+    }
+    return result;
+}
+
+BTResult ENCryptoProviderSelfTest(const ENCryptoProvider *provider)
+{
+    if (provider == NULL || !provider->isAvailable()) {
+        return BT_ERROR_INVALID_ARGUMENT;
+    }
+    BTResult result = ENCryptoProviderKnownAnswerTest(provider);
+    if (result == BT_SUCCESS) {
+        result = ENCryptoProviderCrossCheckTEKWork(provider);
+    }
+    return result;
+}
+
+#pragma mark - Selection
+
+static uint64_t ENCryptoProviderNanoseconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000) + (uint64_t) ts.tv_nsec;
+}
+
+const ENCryptoProvider *ENCryptoProviderSelectFastest(void)
+{
+    const ENCryptoProvider *fastest = NULL;
+    uint64_t fastestNanoseconds = UINT64_MAX;
+    ENCryptoProviderTEKWork work;
+    uint8_t tek[EN_CRYPTO_PROVIDER_AES_KEY_LEN] = {0};
+
+    for (size_t i = 0; i < countof(kENCryptoProviders); i++) {
+        const ENCryptoProvider *provider = kENCryptoProviders[i];
+        if (!provider->isAvailable() || ENCryptoProviderSelfTest(provider) != BT_SUCCESS) {
+            continue;
+        }
+
+        // Best of a few rounds, so a preemption or cold cache does not decide.
+        uint64_t best = UINT64_MAX;
+        for (int round = 0; round < 5; round++) {
+            uint64_t start = ENCryptoProviderNanoseconds();
+            for (uint32_t j = 0; j < 64; j++) {
+                WriteLittle32(tek, j);
+                ENCryptoProviderDoTEKWork(provider, tek, j * 144, &work);
+            }
+            best = Min(best, ENCryptoProviderNanoseconds() - start);
+        }
+        EN_INFO_PRINTF("Crypto provider %s: %llu ns per TEK", provider->name, (unsigned long long)(best / 64));
+        if (best < fastestNanoseconds) {
+            fastest = provider;
+            fastestNanoseconds = best;
+        }
+    }
+    memset(&work, 0, sizeof(work));
+
+    if (fastest && ENCryptoProviderSetCurrent(fastest) == BT_SUCCESS) {
+        return fastest;
+    }
+    return ENCryptoProviderCurrent();
+}
+
+NS_ASSUME_NONNULL_END
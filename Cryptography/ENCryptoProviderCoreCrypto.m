@@ -0,0 +1,142 @@
+/*
+ *      Copyright (C) 2020 Apple Inc. All Rights Reserved.
+ *
+ *      ExposureNotification is licensed under Apple Inc.’s
+ *      Sample Code License Agreement, which is contained in
+ *      the LICENSE file distributed with ExposureNotification,
+ *      and only to those who accept that license.
+ *
+ */
+
+#import "ENCryptoProvider.h"
+
+#if EN_CRYPTO_PROVIDER_CORECRYPTO
+
+#import <corecrypto/cc_error.h>
+#import <corecrypto/ccaes.h>
+#import <corecrypto/ccmode.h>
+#import <corecrypto/cchmac.h>
+#import <corecrypto/ccsha2.h>
+#import <pthread.h>
+
+#import "ENAESBitsliced.h"
+#import "ENCommonPrivate.h"
+#import "ENShims.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+#pragma mark - HKDF
+
+/*
+ *  HMAC-SHA256 context keyed with the HKDF-Extract salt used when none is provided: HashLen zero bytes.
+ *  The key is the same for every TEK, so the SHA-256 states after its ipad and opad blocks are computed
+ *  once and each extract starts from a copy, saving two compression function calls per derivation.
+ */
+static struct cchmac_ctx *gENCoreCryptoZeroSaltContext = NULL;
+
+static void ENCoreCryptoInitializeZeroSaltHMACContext(void)
+{
+    const struct ccdigest_info *di = ccsha256_di();
+    gENCoreCryptoZeroSaltContext = (struct cchmac_ctx *) calloc(1, cchmac_di_size(di));
+    if (gENCoreCryptoZeroSaltContext) {
+        uint8_t zeroSalt[EN_CRYPTO_PROVIDER_HKDF_PRK_LEN] = {0};
+        cchmac_init(di, gENCoreCryptoZeroSaltContext, sizeof(zeroSalt), zeroSalt);
+    }
+}
+
+static const struct cchmac_ctx *ENCoreCryptoZeroSaltHMACContext(void)
+{
+    static pthread_once_t onceToken = PTHREAD_ONCE_INIT;
+    pthread_once(&onceToken, ENCoreCryptoInitializeZeroSaltHMACContext);
+    return gENCoreCryptoZeroSaltContext;
+}
+
+/*
+ *  HKDF-Extract(salt, ikm) as in RFC 5869, bit-identical to the PRK cchkdf derives.
+ */
+static int ENCoreCryptoHKDFExtract(const uint8_t * _Nullable salt, size_t saltLen, const uint8_t *ikm, size_t ikmLen,
+                                   uint8_t *outPRK)
+{
+    const struct ccdigest_info *di = ccsha256_di();
+    cchmac_di_decl(di, hmacContext);
+    if (salt == NULL) {
+        const struct cchmac_ctx *zeroSaltContext = ENCoreCryptoZeroSaltHMACContext();
+        if (!zeroSaltContext) {
+            return CCERR_MEMORY_ALLOC_FAIL;
+        }
+        memcpy(hmacContext, zeroSaltContext, cchmac_di_size(di));
+    } else {
+        cchmac_init(di, hmacContext, saltLen, salt);
+    }
+    cchmac_update(di, hmacContext, ikmLen, ikm);
+    cchmac_final(di, hmacContext, outPRK);
+    cchmac_di_clear(di, hmacContext);
+    return CCERR_OK;
+}
+
+/*
+ *  HKDF-Expand(prk, info, outLen) as in RFC 5869.
+ */
+static int ENCoreCryptoHKDFExpand(const uint8_t *prk, const void *info, size_t infoLen, uint8_t *out, size_t outLen)
+{
+    const struct ccdigest_info *di = ccsha256_di();
+    if (outLen > 255 * EN_CRYPTO_PROVIDER_HKDF_PRK_LEN) {
+        return CCERR_PARAMETER;
+    }
+
+    uint8_t block[EN_CRYPTO_PROVIDER_HKDF_PRK_LEN];
+    cchmac_di_decl(di, hmacContext);
+    for (uint8_t counter = 1; outLen > 0; counter++) {
+        cchmac_init(di, hmacContext, EN_CRYPTO_PROVIDER_HKDF_PRK_LEN, prk);
+        if (counter > 1) {
+            cchmac_update(di, hmacContext, sizeof(block), block);
+        }
+        cchmac_update(di, hmacContext, infoLen, info);
+        cchmac_update(di, hmacContext, sizeof(counter), &counter);
+        cchmac_final(di, hmacContext, block);
+
+        size_t blockLen = Min(outLen, sizeof(block));
+        memcpy(out, block, blockLen);
+        out += blockLen;
+        outLen -= blockLen;
+    }
+    cchmac_di_clear(di, hmacContext);
+    memset(block, 0, sizeof(block));
+    return CCERR_OK;
+}
+
+#pragma mark - AES
+
+static int ENCoreCryptoAESECBEncrypt(const uint8_t *key, size_t keyLen, size_t blockCount, const void *input, void *output)
+{
+    // Without AES instructions corecrypto falls back to lookup tables, so batches use the constant-time
+    // bitsliced AES, which encrypts 144 RPIs in 9 passes of 16. Single blocks are not worth a full pass.
+    if (blockCount >= EN_AES_BITSLICED_BLOCKS_PER_PASS && !(ENCPUFeatures() & kENCPUFeatureAES)) {
+        return ENAESBitslicedEncryptECBOneShot(key, keyLen, blockCount, input, output);
+    }
+    return ccecb_one_shot(ccaes_ecb_encrypt_mode(), keyLen, key, blockCount, input, output);
+}
+
+static int ENCoreCryptoAESCTRCrypt(const uint8_t *key, size_t keyLen, const uint8_t *iv, size_t length,
+                                   const void *input, void *output)
+{
+    return ccctr_one_shot(ccaes_ctr_crypt_mode(), keyLen, key, iv, length, input, output);
+}
+
+static bool ENCoreCryptoIsAvailable(void)
+{
+    return true;
+}
+
+const ENCryptoProvider kENCryptoProviderCoreCrypto = {
+    .name           = "corecrypto",
+    .isAvailable    = ENCoreCryptoIsAvailable,
+    .aesECBEncrypt  = ENCoreCryptoAESECBEncrypt,
+    .aesCTRCrypt    = ENCoreCryptoAESCTRCrypt,
+    .hkdfExtract    = ENCoreCryptoHKDFExtract,
+    .hkdfExpand     = ENCoreCryptoHKDFExpand,
+};
+
+NS_ASSUME_NONNULL_END
+
+#endif // EN_CRYPTO_PROVIDER_CORECRYPTO
@@ -0,0 +1,353 @@
+/*
+ *      Copyright (C) 2020 Apple Inc. All Rights Reserved.
+ *
+ *      ExposureNotification is licensed under Apple Inc.’s
+ *      Sample Code License Agreement, which is contained in
+ *      the LICENSE file distributed with ExposureNotification,
+ *      and only to those who accept that license.
+ *
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+    #import <immintrin.h>
+    #define EN_INTRINSICS_AESNI     1
+#else
+    #define EN_INTRINSICS_AESNI     0
+#endif
+
+#if defined(__aarch64__) && (defined(__ARM_FEATURE_AES) || defined(__ARM_FEATURE_CRYPTO))
+    #import <arm_neon.h>
+    #define EN_INTRINSICS_ARMV8     1
+#else
+    #define EN_INTRINSICS_ARMV8     0
+#endif
+
+#import <pthread.h>
+#import <stdlib.h>
+#import <string.h>
+
+#import "ENAESBitsliced.h"
+#import "ENCommonPrivate.h"
+#import "ENCryptoProvider.h"
+#import "ENFileHash.h"
+#import "ENShims.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+#define EN_INTRINSICS_AES_ROUNDS    (10)
+
+/*
+ *  Blocks in flight per loop. AES instructions have a latency of several cycles but can issue every
+ *  cycle, so independent blocks are interleaved to keep the AES unit busy.
+ */
+#define EN_INTRINSICS_AES_BATCH     (8)
+
+#pragma mark - AES-NI
+
+#if EN_INTRINSICS_AESNI
+
+#define EN_AESNI_TARGET __attribute__((target("aes,sse2")))
+
+EN_AESNI_TARGET static inline __m128i ENAESNIExpandStep(__m128i key, __m128i assist)
+{
+    assist = _mm_shuffle_epi32(assist, 0xff);
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    return _mm_xor_si128(key, assist);
+}
+
+// The round constant of aeskeygenassist must be an immediate.
+#define ENAESNIExpandRound(RK, I, RCON) \
+    (RK)[(I)] = ENAESNIExpandStep((RK)[(I) - 1], _mm_aeskeygenassist_si128((RK)[(I) - 1], (RCON)))
+
+EN_AESNI_TARGET static void ENAESNIExpandKey(const uint8_t *key, __m128i roundKeys[EN_INTRINSICS_AES_ROUNDS + 1])
+{
+    roundKeys[0] = _mm_loadu_si128((const __m128i *) key);
+    ENAESNIExpandRound(roundKeys, 1, 0x01);
+    ENAESNIExpandRound(roundKeys, 2, 0x02);
+    ENAESNIExpandRound(roundKeys, 3, 0x04);
+    ENAESNIExpandRound(roundKeys, 4, 0x08);
+    ENAESNIExpandRound(roundKeys, 5, 0x10);
+    ENAESNIExpandRound(roundKeys, 6, 0x20);
+    ENAESNIExpandRound(roundKeys, 7, 0x40);
+    ENAESNIExpandRound(roundKeys, 8, 0x80);
+    ENAESNIExpandRound(roundKeys, 9, 0x1b);
+    ENAESNIExpandRound(roundKeys, 10, 0x36);
+}
+
+EN_AESNI_TARGET static void ENAESNIEncryptECB(const uint8_t *key, size_t blockCount, const uint8_t *input, uint8_t *output)
+{
+    __m128i roundKeys[EN_INTRINSICS_AES_ROUNDS + 1];
+    ENAESNIExpandKey(key, roundKeys);
+
+    for (; blockCount >= EN_INTRINSICS_AES_BATCH; blockCount -= EN_INTRINSICS_AES_BATCH) {
+        __m128i blocks[EN_INTRINSICS_AES_BATCH];
+        for (int i = 0; i < EN_INTRINSICS_AES_BATCH; i++) {
+            blocks[i] = _mm_xor_si128(_mm_loadu_si128((const __m128i *) input + i), roundKeys[0]);
+        }
+        for (int round = 1; round < EN_INTRINSICS_AES_ROUNDS; round++) {
+            for (int i = 0; i < EN_INTRINSICS_AES_BATCH; i++) {
+                blocks[i] = _mm_aesenc_si128(blocks[i], roundKeys[round]);
+            }
+        }
+        for (int i = 0; i < EN_INTRINSICS_AES_BATCH; i++) {
+            _mm_storeu_si128((__m128i *) output + i, _mm_aesenclast_si128(blocks[i], roundKeys[EN_INTRINSICS_AES_ROUNDS]));
+        }
+        input += EN_INTRINSICS_AES_BATCH * EN_CRYPTO_PROVIDER_AES_BLOCK_LEN;
+        output += EN_INTRINSICS_AES_BATCH * EN_CRYPTO_PROVIDER_AES_BLOCK_LEN;
+    }
+    for (; blockCount > 0; blockCount--) {
+        __m128i block = _mm_xor_si128(_mm_loadu_si128((const __m128i *) input), roundKeys[0]);
+        for (int round = 1; round < EN_INTRINSICS_AES_ROUNDS; round++) {
+            block = _mm_aesenc_si128(block, roundKeys[round]);
+        }
+        _mm_storeu_si128((__m128i *) output, _mm_aesenclast_si128(block, roundKeys[EN_INTRINSICS_AES_ROUNDS]));
+        input += EN_CRYPTO_PROVIDER_AES_BLOCK_LEN;
+        output += EN_CRYPTO_PROVIDER_AES_BLOCK_LEN;
+    }
+
+    memset(roundKeys, 0, sizeof(roundKeys));
+}
+
+#endif // EN_INTRINSICS_AESNI
+
+#pragma mark - ARMv8 AES
+
+#if EN_INTRINSICS_ARMV8
+
+/*
+ *  SubWord with the AES instructions: AESE with a zero round key is SubBytes then ShiftRows, and
+ *  ShiftRows leaves a state whose four columns are all the same word unchanged.
+ */
+static inline uint32_t ENARMv8SubWord(uint32_t word)
+{
+    uint8x16_t state = vaeseq_u8(vreinterpretq_u8_u32(vdupq_n_u32(word)), vdupq_n_u8(0));
+    return vgetq_lane_u32(vreinterpretq_u32_u8(state), 0);
+}
+
+static void ENARMv8ExpandKey(const uint8_t *key, uint8x16_t roundKeys[EN_INTRINSICS_AES_ROUNDS + 1])
+{
+    static const uint8_t rcon[EN_INTRINSICS_AES_ROUNDS] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36};
+
+    // Words are little endian, so RotWord is a right rotation by one byte and the round constant goes in the low byte.
+    uint32_t words[(EN_INTRINSICS_AES_ROUNDS + 1) * 4];
+    memcpy(words, key, EN_CRYPTO_PROVIDER_AES_KEY_LEN);
+    for (int i = 4; i < (int) countof(words); i++) {
+        uint32_t word = words[i - 1];
+        if ((i % 4) == 0) {
+            word = ENARMv8SubWord(word);
+            word = ((word >> 8) | (word << 24)) ^ rcon[(i / 4) - 1];
+        }
+        words[i] = words[i - 4] ^ word;
+    }
+    for (int i = 0; i <= EN_INTRINSICS_AES_ROUNDS; i++) {
+        roundKeys[i] = vreinterpretq_u8_u32(vld1q_u32(&words[i * 4]));
+    }
+    memset(words, 0, sizeof(words));
+}
+
+static void ENARMv8EncryptECB(const uint8_t *key, size_t blockCount, const uint8_t *input, uint8_t *output)
+{
+    uint8x16_t roundKeys[EN_INTRINSICS_AES_ROUNDS + 1];
+    ENARMv8ExpandKey(key, roundKeys);
+
+    // AESE is AddRoundKey, SubBytes and ShiftRows, so round keys are added one instruction early
+    // and the last one is a plain XOR.
+    for (; blockCount >= EN_INTRINSICS_AES_BATCH; blockCount -= EN_INTRINSICS_AES_BATCH) {
+        uint8x16_t blocks[EN_INTRINSICS_AES_BATCH];
+        for (int i = 0; i < EN_INTRINSICS_AES_BATCH; i++) {
+            blocks[i] = vld1q_u8(input + (i * EN_CRYPTO_PROVIDER_AES_BLOCK_LEN));
+        }
+        for (int round = 0; round < EN_INTRINSICS_AES_ROUNDS - 1; round++) {
+            for (int i = 0; i < EN_INTRINSICS_AES_BATCH; i++) {
+                blocks[i] = vaesmcq_u8(vaeseq_u8(blocks[i], roundKeys[round]));
+            }
+        }
+        for (int i = 0; i < EN_INTRINSICS_AES_BATCH; i++) {
+            uint8x16_t block = vaeseq_u8(blocks[i], roundKeys[EN_INTRINSICS_AES_ROUNDS - 1]);
+            vst1q_u8(output + (i * EN_CRYPTO_PROVIDER_AES_BLOCK_LEN), veorq_u8(block, roundKeys[EN_INTRINSICS_AES_ROUNDS]));
+        }
+        input += EN_INTRINSICS_AES_BATCH * EN_CRYPTO_PROVIDER_AES_BLOCK_LEN;
+        output += EN_INTRINSICS_AES_BATCH * EN_CRYPTO_PROVIDER_AES_BLOCK_LEN;
+    }
+    for (; blockCount > 0; blockCount--) {
+        uint8x16_t block = vld1q_u8(input);
+        for (int round = 0; round < EN_INTRINSICS_AES_ROUNDS - 1; round++) {
+            block = vaesmcq_u8(vaeseq_u8(block, roundKeys[round]));
+        }
+        block = vaeseq_u8(block, roundKeys[EN_INTRINSICS_AES_ROUNDS - 1]);
+        vst1q_u8(output, veorq_u8(block, roundKeys[EN_INTRINSICS_AES_ROUNDS]));
+        input += EN_CRYPTO_PROVIDER_AES_BLOCK_LEN;
+        output += EN_CRYPTO_PROVIDER_AES_BLOCK_LEN;
+    }
+
+    memset(roundKeys, 0, sizeof(roundKeys));
+}
+
+#endif // EN_INTRINSICS_ARMV8
+
+#pragma mark - AES
+
+static int ENIntrinsicsAESECBEncrypt(const uint8_t *key, size_t keyLen, size_t blockCount, const void *input, void *output)
+{
+    if (keyLen != EN_CRYPTO_PROVIDER_AES_KEY_LEN) {
+        return BT_ERROR_INVALID_ARGUMENT;
+    }
+#if EN_INTRINSICS_AESNI
+    if (ENCPUFeatures() & kENCPUFeatureAES) {
+        ENAESNIEncryptECB(key, blockCount, (const uint8_t *) input, (uint8_t *) output);
+        return BT_SUCCESS;
+    }
+#elif EN_INTRINSICS_ARMV8
+    if (ENCPUFeatures() & kENCPUFeatureAES) {
+        ENARMv8EncryptECB(key, blockCount, (const uint8_t *) input, (uint8_t *) output);
+        return BT_SUCCESS;
+    }
+#endif
+    // Without AES instructions single blocks still pay for the key schedule, but not for a padded 16 block pass.
+    return ENAESBitslicedEncryptECBOneShot(key, keyLen, blockCount, input, output);
+}
+
+static int ENIntrinsicsAESCTRCrypt(const uint8_t *key, size_t keyLen, const uint8_t *iv, size_t length,
+                                   const void *input, void *output)
+{
+    // Encrypt up to a bitsliced pass worth of counter blocks at a time. Chunks that aren't a whole pass, such as
+    // the single block of an AEM, take the bitsliced fallback's cheaper short batch route.
+    uint8_t counter[EN_CRYPTO_PROVIDER_AES_BLOCK_LEN];
+    uint8_t keystream[EN_AES_BITSLICED_BLOCKS_PER_PASS * EN_CRYPTO_PROVIDER_AES_BLOCK_LEN];
+    const uint8_t *src = (const uint8_t *) input;
+    uint8_t *dst = (uint8_t *) output;
+    int error = BT_SUCCESS;
+
+    memcpy(counter, iv, sizeof(counter));
+    while (length > 0 && !error) {
+        size_t chunkLen = Min(length, sizeof(keystream));
+        size_t blockCount = (chunkLen + EN_CRYPTO_PROVIDER_AES_BLOCK_LEN - 1) / EN_CRYPTO_PROVIDER_AES_BLOCK_LEN;
+        for (size_t i = 0; i < blockCount; i++) {
+            memcpy(&keystream[i * EN_CRYPTO_PROVIDER_AES_BLOCK_LEN], counter, sizeof(counter));
+            for (int j = EN_CRYPTO_PROVIDER_AES_BLOCK_LEN - 1; (j >= 0) && (++counter[j] == 0); j--) {}
+        }
+        error = ENIntrinsicsAESECBEncrypt(key, keyLen, blockCount, keystream, keystream);
+        if (!error) {
+            for (size_t i = 0; i < chunkLen; i++) {
+                dst[i] = src[i] ^ keystream[i];
+            }
+            src += chunkLen;
+            dst += chunkLen;
+            length -= chunkLen;
+        }
+    }
+
+    memset(counter, 0, sizeof(counter));
+    memset(keystream, 0, sizeof(keystream));
+    return error;
+}
+
+#pragma mark - HKDF
+
+#define EN_INTRINSICS_HMAC_BLOCK_LEN    (64)
+
+/*
+ *  SHA-256 states of HMAC-SHA256 after its ipad and opad key blocks, with the incremental SHA-256 of
+ *  ENFileHash.h, which picks SHA-NI or the ARMv8 SHA-256 instructions when present.
+ */
+typedef struct {
+    ENFileHashSHA256Context inner;
+    ENFileHashSHA256Context outer;
+} ENIntrinsicsHMACContext;
+
+static void ENIntrinsicsHMACInit(ENIntrinsicsHMACContext *context, const uint8_t *key, size_t keyLen)
+{
+    uint8_t keyBlock[EN_INTRINSICS_HMAC_BLOCK_LEN] = {0};
+    if (keyLen > sizeof(keyBlock)) {
+        ENFileHashSHA256(key, keyLen, keyBlock);
+    } else if (keyLen > 0) {
+        memcpy(keyBlock, key, keyLen);
+    }
+
+    uint8_t padBlock[EN_INTRINSICS_HMAC_BLOCK_LEN];
+    for (size_t i = 0; i < sizeof(keyBlock); i++) {
+        padBlock[i] = keyBlock[i] ^ 0x36;
+    }
+    ENFileHashSHA256Init(&context->inner);
+    ENFileHashSHA256Update(&context->inner, padBlock, sizeof(padBlock));
+
+    for (size_t i = 0; i < sizeof(keyBlock); i++) {
+        padBlock[i] = keyBlock[i] ^ 0x5c;
+    }
+    ENFileHashSHA256Init(&context->outer);
+    ENFileHashSHA256Update(&context->outer, padBlock, sizeof(padBlock));
+
+    memset(keyBlock, 0, sizeof(keyBlock));
+    memset(padBlock, 0, sizeof(padBlock));
+}
+
+/*
+ *  HMAC of data from a keyed context, as in RFC 2104. The context is consumed.
+ */
+static void ENIntrinsicsHMACFinal(ENIntrinsicsHMACContext *context, const void *data, size_t dataLen, uint8_t *outMAC)
+{
+    uint8_t innerHash[ENFileHashLength];
+    ENFileHashSHA256Update(&context->inner, data, dataLen);
+    ENFileHashSHA256Final(&context->inner, innerHash);
+    ENFileHashSHA256Update(&context->outer, innerHash, sizeof(innerHash));
+    ENFileHashSHA256Final(&context->outer, outMAC);
+    memset(innerHash, 0, sizeof(innerHash));
+}
+
+static int ENIntrinsicsHMACSHA256(const uint8_t *key, size_t keyLen, const void *data, size_t dataLen, uint8_t *outMAC)
+{
+    ENIntrinsicsHMACContext context;
+    ENIntrinsicsHMACInit(&context, key, keyLen);
+    ENIntrinsicsHMACFinal(&context, data, dataLen, outMAC);
+    return BT_SUCCESS;
+}
+
+/*
+ *  HMAC context keyed with the HKDF-Extract salt used when none is provided: HashLen zero bytes. The key
+ *  is the same for every TEK, so each extract starts from a copy of its ipad and opad states, saving two
+ *  compression function calls per derivation.
+ */
+static ENIntrinsicsHMACContext gENIntrinsicsZeroSaltContext;
+
+static void ENIntrinsicsInitializeZeroSaltHMACContext(void)
+{
+    uint8_t zeroSalt[EN_CRYPTO_PROVIDER_HKDF_PRK_LEN] = {0};
+    ENIntrinsicsHMACInit(&gENIntrinsicsZeroSaltContext, zeroSalt, sizeof(zeroSalt));
+}
+
+static int ENIntrinsicsHKDFExtract(const uint8_t * _Nullable salt, size_t saltLen, const uint8_t *ikm, size_t ikmLen,
+                                   uint8_t *outPRK)
+{
+    if (salt != NULL) {
+        return ENCryptoProviderHKDFExtractWithHMAC(ENIntrinsicsHMACSHA256, salt, saltLen, ikm, ikmLen, outPRK);
+    }
+
+    static pthread_once_t onceToken = PTHREAD_ONCE_INIT;
+    pthread_once(&onceToken, ENIntrinsicsInitializeZeroSaltHMACContext);
+    ENIntrinsicsHMACContext context = gENIntrinsicsZeroSaltContext;
+    ENIntrinsicsHMACFinal(&context, ikm, ikmLen, outPRK);
+    return BT_SUCCESS;
+}
+
+static int ENIntrinsicsHKDFExpand(const uint8_t *prk, const void *info, size_t infoLen, uint8_t *out, size_t outLen)
+{
+    return ENCryptoProviderHKDFExpandWithHMAC(ENIntrinsicsHMACSHA256, prk, info, infoLen, out, outLen);
+}
+
+static bool ENIntrinsicsIsAvailable(void)
+{
+    return true;
+}
+
+const ENCryptoProvider kENCryptoProviderIntrinsics = {
+    .name           = "intrinsics",
+    .isAvailable    = ENIntrinsicsIsAvailable,
+    .aesECBEncrypt  = ENIntrinsicsAESECBEncrypt,
+    .aesCTRCrypt    = ENIntrinsicsAESCTRCrypt,
+    .hkdfExtract    = ENIntrinsicsHKDFExtract,
+    .hkdfExpand     = ENIntrinsicsHKDFExpand,
+};
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,105 @@
+/*
+ *      Copyright (C) 2020 Apple Inc. All Rights Reserved.
+ *
+ *      ExposureNotification is licensed under Apple Inc.’s
+ *      Sample Code License Agreement, which is contained in
+ *      the LICENSE file distributed with ExposureNotification,
+ *      and only to those who accept that license.
+ *
+ */
+
+#import "ENCryptoProvider.h"
+
+#if EN_CRYPTO_PROVIDER_OPENSSL
+
+#import <limits.h>
+#import <openssl/evp.h>
+#import <openssl/hmac.h>
+
+#import "ENShims.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+#pragma mark - AES
+
+/*
+ *  One EVP cipher call with padding off, as the corecrypto one shot functions. EVP takes int lengths,
+ *  which is ample for RPI batches and AEMs.
+ */
+static int ENOpenSSLCipher(const EVP_CIPHER *cipher, const uint8_t *key, size_t keyLen, const uint8_t * _Nullable iv,
+                           size_t length, const void *input, void *output)
+{
+    if (keyLen != EN_CRYPTO_PROVIDER_AES_KEY_LEN || length > INT_MAX) {
+        return BT_ERROR_INVALID_ARGUMENT;
+    }
+    EVP_CIPHER_CTX *context = EVP_CIPHER_CTX_new();
+    if (context == NULL) {
+        return BT_ERROR;
+    }
+
+    int outLen = 0;
+    int finalLen = 0;
+    int ok = EVP_EncryptInit_ex(context, cipher, NULL, key, iv) &&
+             EVP_CIPHER_CTX_set_padding(context, 0) &&
+             EVP_EncryptUpdate(context, (uint8_t *) output, &outLen, (const uint8_t *) input, (int) length) &&
+             EVP_EncryptFinal_ex(context, (uint8_t *) output + outLen, &finalLen);
+    EVP_CIPHER_CTX_free(context);
+    return (ok && ((size_t)(outLen + finalLen) == length)) ? BT_SUCCESS : BT_ERROR_CRYPTO_AES_FAILED;
+}
+
+static int ENOpenSSLAESECBEncrypt(const uint8_t *key, size_t keyLen, size_t blockCount, const void *input, void *output)
+{
+    if (blockCount == 0) {
+        return BT_SUCCESS;
+    }
+    return ENOpenSSLCipher(EVP_aes_128_ecb(), key, keyLen, NULL, blockCount * EN_CRYPTO_PROVIDER_AES_BLOCK_LEN, input, output);
+}
+
+static int ENOpenSSLAESCTRCrypt(const uint8_t *key, size_t keyLen, const uint8_t *iv, size_t length,
+                                const void *input, void *output)
+{
+    if (length == 0) {
+        return BT_SUCCESS;
+    }
+    return ENOpenSSLCipher(EVP_aes_128_ctr(), key, keyLen, iv, length, input, output);
+}
+
+#pragma mark - HKDF
+
+static int ENOpenSSLHMACSHA256(const uint8_t *key, size_t keyLen, const void *data, size_t dataLen, uint8_t *outMAC)
+{
+    unsigned int macLen = 0;
+    if (keyLen > INT_MAX || !HMAC(EVP_sha256(), key, (int) keyLen, (const uint8_t *) data, dataLen, outMAC, &macLen)) {
+        return BT_ERROR_CRYPTO_HKDF_FAILED;
+    }
+    return (macLen == EN_CRYPTO_PROVIDER_HKDF_PRK_LEN) ? BT_SUCCESS : BT_ERROR_CRYPTO_HKDF_FAILED;
+}
+
+static int ENOpenSSLHKDFExtract(const uint8_t * _Nullable salt, size_t saltLen, const uint8_t *ikm, size_t ikmLen,
+                                uint8_t *outPRK)
+{
+    return ENCryptoProviderHKDFExtractWithHMAC(ENOpenSSLHMACSHA256, salt, saltLen, ikm, ikmLen, outPRK);
+}
+
+static int ENOpenSSLHKDFExpand(const uint8_t *prk, const void *info, size_t infoLen, uint8_t *out, size_t outLen)
+{
+    return ENCryptoProviderHKDFExpandWithHMAC(ENOpenSSLHMACSHA256, prk, info, infoLen, out, outLen);
+}
+
+static bool ENOpenSSLIsAvailable(void)
+{
+    return true;
+}
+
+const ENCryptoProvider kENCryptoProviderOpenSSL = {
+    .name           = "openssl",
+    .isAvailable    = ENOpenSSLIsAvailable,
+    .aesECBEncrypt  = ENOpenSSLAESECBEncrypt,
+    .aesCTRCrypt    = ENOpenSSLAESCTRCrypt,
+    .hkdfExtract    = ENOpenSSLHKDFExtract,
+    .hkdfExpand     = ENOpenSSLHKDFExpand,
+};
+
+NS_ASSUME_NONNULL_END
+
+#endif // EN_CRYPTO_PROVIDER_OPENSSL
@@ -71,11 +71,19 @@ BTResult ENGenerateRollingProximityIdentifier(uint8_t *tekBytes, uint8_t tekByte
  *  Generate 144 Rolling Proximity Identifiers for the given TEK, starting with the specified
  *  interval number. Generating 144 RPIs at a time is significantly more efficent than 144 calls
  *  to the above function, as the hardware acclerated AES can diversify all 144 keys with a single
- *  call.
+ *  call. On CPUs without AES instructions the RPIs are generated with the constant-time bitsliced
+ *  AES in ENAESBitsliced.h instead of table-based AES.
  */
 BTResult ENGenerate144RollingProximityIdentifiers(uint8_t *tekBytes, uint8_t tekBytesLen, uint32_t intervalNumber,
                                                   uint8_t *outBuffer, size_t outBufferSize);
 
+/*
+ *  Generate 144 Rolling Proximity Identifiers as above, with an RPIK previously derived
+ *  by ENGenerateRPIK or ENDeriveTEKSubkeys.
+ */
+BTResult ENGenerate144RollingProximityIdentifiersWithRPIK(uint8_t *rpik, size_t rpikLen, uint32_t intervalNumber,
+                                                          uint8_t *outBuffer, size_t outBufferSize);
+
 /*
  *  Generate the Associated Encrypted Metadata Key for a given TEK.
  *  The AMEK is deterministically generated per-TEK, and is used in the encryption
@@ -86,6 +94,12 @@ BTResult ENGenerate144RollingProximityIdentifiers(uint8_t *tekBytes, uint8_t tek
  */
 BTResult ENGenerateAEMK(uint8_t *tek, size_t tekLen, uint8_t *outAEMK, size_t outAEMKLen);
 
+/*
+ *  Derive both the RPIK and the AEMK for a given TEK, as ENGenerateRPIK and ENGenerateAEMK.
+ *  The two keys differ only in the HKDF info, so the HKDF-Extract step is done once for both.
+ */
+BTResult ENDeriveTEKSubkeys(uint8_t *tek, size_t tekLen, uint8_t *outRPIK, size_t outRPIKLen, uint8_t *outAEMK, size_t outAEMKLen);
+
 /*
  *  Encrypt the provided metadata with the specified TEK and RPI. The correct AEMK will
  *  be derived for the provided TEK and used in the encryption of the metadata.
@@ -96,6 +110,19 @@ BTResult ENGenerateAEMK(uint8_t *tek, size_t tekLen, uint8_t *outAEMK, size_t ou
 BTResult ENEncryptAEM(uint8_t *metaData, size_t metaDataLen, uint8_t *tek, size_t tekSize,
                       uint8_t *rpi, uint8_t rpiLen, uint8_t *outEncryptedMetaData, size_t outEncryptedMetaDataLen);
 
+/*
+ *  Encrypt the same metadata for a batch of RPIs generated from one TEK, with an AEMK
+ *  previously derived by ENGenerateAEMK. The encrypted metadata for each RPI is written
+ *  to outEncryptedMetaData in the same order as the RPIs, EN_AEM_LEN bytes apiece.
+ *
+ *  Each AES-CTR encryption only uses the first keystream block, which is the AES encryption
+ *  of the RPI itself, so the whole batch is encrypted with one AES-ECB call per 144 RPIs
+ *  and the AEMK is not re-derived for each RPI. Encrypting all-zero metadata produces the
+ *  keystream, which can be XORed with any later metadata.
+ */
+BTResult ENEncryptAEMsWithAEMK(uint8_t *aemk, size_t aemkLen, uint8_t *metaData, size_t metaDataLen,
+                               uint8_t *rpis, size_t rpiCount, uint8_t *outEncryptedMetaData, size_t outEncryptedMetaDataLen);
+
 /*
  *  Dencrypt the provided metadata with the specified TEK and RPI. The correct AEMK will
  *  be derived for the provided TEK and used in the decryption of the metadata.
@@ -110,6 +137,13 @@ BTResult ENRetrieveTxPowerFromEncryptedAEM(uint8_t *encryptedAEM, size_t encrypt
                                            uint8_t *tek, size_t tekLen, uint8_t *rpi, uint8_t rpiLen,
                                            int8_t *outTxPower);
 
+/*
+ *  Retrieve the Bluetooth transmission power as above, with an AEMK previously derived by
+ *  ENGenerateAEMK or ENDeriveTEKSubkeys for the advertisement's TEK.
+ */
+BTResult ENRetrieveTxPowerWithAEMK(const uint8_t *aemk, size_t aemkLen, const uint8_t *rpi, size_t rpiLen,
+                                   const uint8_t *encryptedAEM, size_t encryptedAEMLen, int8_t *outTxPower);
+
 /*
  *  Calculate the normalized attenuation for an observed ExposureNotification advertisement.
  *  The attenuation value returned will be one of the following values:
@@ -120,6 +154,14 @@ BTResult ENRetrieveTxPowerFromEncryptedAEM(uint8_t *encryptedAEM, size_t encrypt
 uint8_t ENCalculateAttnForDiscoveredRPI(uint8_t *tek, size_t tekLen, uint8_t *rpi, uint8_t rpiLen,
                                         uint8_t *aem, uint8_t aemLen, int8_t rssi, bool saturated);
 
+/*
+ *  Calculate the normalized attenuation as above, with an AEMK previously derived by
+ *  ENGenerateAEMK for the advertisement's TEK. Validating many advertisements from one
+ *  TEK then derives the AEMK once instead of once per advertisement.
+ */
+uint8_t ENCalculateAttnWithAEMK(const uint8_t *aemk, size_t aemkLen, const uint8_t *rpi, size_t rpiLen,
+                                const uint8_t *aem, size_t aemLen, int8_t rssi, bool saturated);
+
 #ifdef __cplusplus
 }
 #endif
@@ -8,24 +8,48 @@
  *
  */
 
+#if __APPLE__
 #import <CommonCrypto/CommonRandom.h>
+#else
+#import <unistd.h>
+#endif
 
-#import <corecrypto/ccaes.h>
-#import <corecrypto/ccmode.h>
-#import <corecrypto/cchkdf.h>
-
+#import "ENCryptoProvider.h"
 #import "ENCryptography.h"
 #import "ENShims.h"
 
 NS_ASSUME_NONNULL_BEGIN
 
+#pragma mark - HKDF
+
+/*
+ *  HKDF-SHA256 with a NULL salt, as cchkdf(ccsha256_di(), ikmLen, ikm, 0, NULL, infoLen, info, outLen, out).
+ */
+static int ENHKDFWithZeroSalt(const ENCryptoProvider *provider, const uint8_t *ikm, size_t ikmLen,
+                              const void *info, size_t infoLen, uint8_t *out, size_t outLen)
+{
+    uint8_t prk[EN_CRYPTO_PROVIDER_HKDF_PRK_LEN];
+    int error = provider->hkdfExtract(NULL, 0, ikm, ikmLen, prk);
+    if (!error) {
+        error = provider->hkdfExpand(prk, info, infoLen, out, outLen);
+    }
+    memset(prk, 0, sizeof(prk));
+    return error;
+}
+
+#pragma mark - Key Derivation
+
 BTResult ENGenerateTEK(uint8_t *tekBytes, size_t tekLen)
 {
     if (tekBytes == NULL || tekLen != EN_TEK_LEN) {
         return BT_ERROR_INVALID_ARGUMENT;
     }
+#if __APPLE__
     CCRNGStatus status = CCRandomGenerateBytes(tekBytes, EN_TEK_LEN);
     return (status == kCCSuccess) ? BT_SUCCESS : BT_ERROR;
+#else
+    return (getentropy(tekBytes, EN_TEK_LEN) == 0) ? BT_SUCCESS : BT_ERROR;
+#endif
 }
 
 BTResult ENGenerateRPIK(uint8_t *tekBytes, size_t tekLen, uint8_t *outRPIK, size_t outRPIKLen)
@@ -36,9 +60,10 @@ BTResult ENGenerateRPIK(uint8_t *tekBytes, size_t tekLen, uint8_t *outRPIK, size
 
     memset(outRPIK, 0, outRPIKLen);
     uint8_t rpikData[] = {'E', 'N', '-', 'R', 'P', 'I', 'K'};
-    int error = cchkdf(ccsha256_di(), tekLen, tekBytes, 0, NULL, sizeof(rpikData), rpikData, outRPIKLen, outRPIK);
+    const ENCryptoProvider *provider = ENCryptoProviderCurrent();
+    int error = ENHKDFWithZeroSalt(provider, tekBytes, tekLen, rpikData, sizeof(rpikData), outRPIK, outRPIKLen);
     if (error) {
-        EN_ERROR_PRINTF("cchkdf failed with error %d", error);
+        EN_ERROR_PRINTF("%s HKDF failed with error %d", provider->name, error);
         return BT_ERROR_CRYPTO_HKDF_FAILED;
     }
     return BT_SUCCESS;
@@ -64,9 +89,10 @@ BTResult ENGenerateRollingProximityIdentifier(uint8_t *tekBytes, uint8_t tekByte
         }
     }
 
-    int error = ccecb_one_shot(ccaes_ecb_encrypt_mode(), 16, (rpik ? rpik : _rpik), 1, paddedData, outBuffer);
+    const ENCryptoProvider *provider = ENCryptoProviderCurrent();
+    int error = provider->aesECBEncrypt((rpik ? rpik : _rpik), EN_RPIK_LEN, 1, paddedData, outBuffer);
     if (error) {
-        EN_ERROR_PRINTF("ccecb_one_shot failed with error %d", error);
+        EN_ERROR_PRINTF("%s AES-ECB failed with error %d", provider->name, error);
         return BT_ERROR_CRYPTO_AES_FAILED;
     }
 
@@ -88,6 +114,18 @@ BTResult ENGenerate144RollingProximityIdentifiers(uint8_t *tekBytes, uint8_t tek
         return result;
     }
 
+    result = ENGenerate144RollingProximityIdentifiersWithRPIK(rpik, sizeof(rpik), intervalNumber, outBuffer, outBufferSize);
+    memset(rpik, 0, sizeof(rpik));
+    return result;
+}
+
+BTResult ENGenerate144RollingProximityIdentifiersWithRPIK(uint8_t *rpik, size_t rpikLen, uint32_t intervalNumber, uint8_t *outBuffer, size_t outBufferSize)
+{
+    if (rpik == NULL || rpikLen != EN_RPIK_LEN || outBuffer == NULL || outBufferSize < (EN_RPI_LEN * 144)) {
+        return BT_ERROR_INVALID_ARGUMENT;
+    }
+    BTResult result = BT_SUCCESS;
+
     uint8_t paddedDataBuffer[144 * 16] = {0};
     char paddedData[] = {'E', 'N', '-', 'R', 'P', 'I' , 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
 
@@ -99,9 +137,10 @@ BTResult ENGenerate144RollingProximityIdentifiers(uint8_t *tekBytes, uint8_t tek
         memcpy((void *) p, &rpiIntervalNumber, sizeof(rpiIntervalNumber));
     }
 
-    int error = ccecb_one_shot(ccaes_ecb_encrypt_mode(), 16, rpik, 144, paddedDataBuffer, outBuffer);
+    const ENCryptoProvider *provider = ENCryptoProviderCurrent();
+    int error = provider->aesECBEncrypt(rpik, rpikLen, 144, paddedDataBuffer, outBuffer);
     if (error) {
-        EN_ERROR_PRINTF("ccecb_one_shot failed with error %d", error);
+        EN_ERROR_PRINTF("%s AES-ECB failed with error %d", provider->name, error);
         result = BT_ERROR_CRYPTO_AES_FAILED;
     }
     return result;
@@ -115,10 +154,43 @@ BTResult ENGenerateAEMK(uint8_t *tek, size_t tekLen, uint8_t *outAEMK, size_t ou
     memset(outAEMK, 0, outAEMKLen);
 
     char info[EN_AEMK_INFO_LEN] = {'E', 'N', '-', 'A', 'E', 'M', 'K'};
-    int error = cchkdf(ccsha256_di(), tekLen, tek, 0, NULL, sizeof(info), info, outAEMKLen, outAEMK);
+    const ENCryptoProvider *provider = ENCryptoProviderCurrent();
+    int error = ENHKDFWithZeroSalt(provider, tek, tekLen, info, sizeof(info), outAEMK, outAEMKLen);
 
     if (error) {
-        EN_ERROR_PRINTF("cchkdf failed with error %d", error);
+        EN_ERROR_PRINTF("%s HKDF failed with error %d", provider->name, error);
+        return BT_ERROR_CRYPTO_HKDF_FAILED;
+    }
+
+    return BT_SUCCESS;
+}
+
+BTResult ENDeriveTEKSubkeys(uint8_t *tek, size_t tekLen, uint8_t *outRPIK, size_t outRPIKLen, uint8_t *outAEMK, size_t outAEMKLen)
+{
+    if (tek == NULL || tekLen != EN_TEK_LEN || outRPIK == NULL || outRPIKLen != EN_RPIK_LEN || outAEMK == NULL || outAEMKLen != EN_AEMK_LEN) {
+        return BT_ERROR_INVALID_ARGUMENT;
+    }
+    memset(outRPIK, 0, outRPIKLen);
+    memset(outAEMK, 0, outAEMKLen);
+
+    // Both keys use the same TEK and (empty) salt, so they share the HKDF-Extract PRK.
+    const ENCryptoProvider *provider = ENCryptoProviderCurrent();
+    uint8_t prk[EN_CRYPTO_PROVIDER_HKDF_PRK_LEN];
+    uint8_t rpikInfo[EN_RPIK_INFO_LEN] = {'E', 'N', '-', 'R', 'P', 'I', 'K'};
+    uint8_t aemkInfo[EN_AEMK_INFO_LEN] = {'E', 'N', '-', 'A', 'E', 'M', 'K'};
+    int error = provider->hkdfExtract(NULL, 0, tek, tekLen, prk);
+    if (!error) {
+        error = provider->hkdfExpand(prk, rpikInfo, sizeof(rpikInfo), outRPIK, outRPIKLen);
+    }
+    if (!error) {
+        error = provider->hkdfExpand(prk, aemkInfo, sizeof(aemkInfo), outAEMK, outAEMKLen);
+    }
+    memset(prk, 0, sizeof(prk));
+
+    if (error) {
+        EN_ERROR_PRINTF("%s HKDF failed with error %d", provider->name, error);
+        memset(outRPIK, 0, outRPIKLen);
+        memset(outAEMK, 0, outAEMKLen);
         return BT_ERROR_CRYPTO_HKDF_FAILED;
     }
 
@@ -143,16 +215,49 @@ BTResult ENEncryptAEM(uint8_t *metaData, size_t metaDataLen, uint8_t *tek, size_
         return result;
     }
 
-    const struct ccmode_ctr *ctrMode = ccaes_ctr_crypt_mode();
-    int error = ccctr_one_shot(ctrMode, EN_AEMK_LEN, aemk, rpi, metaDataLen, metaData, outEncryptedMetaData);
+    const ENCryptoProvider *provider = ENCryptoProviderCurrent();
+    int error = provider->aesCTRCrypt(aemk, EN_AEMK_LEN, rpi, metaDataLen, metaData, outEncryptedMetaData);
     if (error) {
-        EN_ERROR_PRINTF("encryptAEM ccctr_one_shot failed with error: %d", error);
+        EN_ERROR_PRINTF("encryptAEM %s AES-CTR failed with error: %d", provider->name, error);
         return BT_ERROR_CRYPTO_AES_FAILED;
     }
 
     return BT_SUCCESS;
 }
 
+BTResult ENEncryptAEMsWithAEMK(uint8_t *aemk, size_t aemkLen, uint8_t *metaData, size_t metaDataLen,
+                               uint8_t *rpis, size_t rpiCount, uint8_t *outEncryptedMetaData, size_t outEncryptedMetaDataLen)
+{
+    if (aemk == NULL || aemkLen != EN_AEMK_LEN || metaData == NULL || metaDataLen != EN_AEM_LEN ||
+        rpis == NULL || outEncryptedMetaData == NULL || outEncryptedMetaDataLen < (rpiCount * EN_AEM_LEN)) {
+        return BT_ERROR_INVALID_ARGUMENT;
+    }
+
+    // CTR mode uses the RPI as the first counter block, so the keystream for each AEM is AES(AEMK, RPI).
+    const ENCryptoProvider *provider = ENCryptoProviderCurrent();
+    uint8_t keystreamBuffer[144 * 16];
+    while (rpiCount > 0) {
+        size_t blockCount = MIN(rpiCount, (size_t) 144);
+        int error = provider->aesECBEncrypt(aemk, EN_AEMK_LEN, blockCount, rpis, keystreamBuffer);
+        if (error) {
+            EN_ERROR_PRINTF("encryptAEMs %s AES-ECB failed with error: %d", provider->name, error);
+            return BT_ERROR_CRYPTO_AES_FAILED;
+        }
+
+        for (size_t i = 0; i < blockCount; i++) {
+            for (size_t j = 0; j < EN_AEM_LEN; j++) {
+                outEncryptedMetaData[j] = metaData[j] ^ keystreamBuffer[(i * 16) + j];
+            }
+            outEncryptedMetaData += EN_AEM_LEN;
+        }
+        rpis += blockCount * EN_RPI_LEN;
+        rpiCount -= blockCount;
+    }
+
+    memset(keystreamBuffer, 0, sizeof(keystreamBuffer));
+    return BT_SUCCESS;
+}
+
 BTResult ENDecryptAEM(uint8_t *encryptedData, size_t dataLen, uint8_t *tek, size_t tekLen, uint8_t *rpi, uint8_t rpiLen, uint8_t *outMetaData, size_t outMedataDataLen)
 {
     uint8_t aemk[EN_AEMK_LEN] = {0};
@@ -168,10 +273,10 @@ BTResult ENDecryptAEM(uint8_t *encryptedData, size_t dataLen, uint8_t *tek, size
         return result;
     }
 
-    const struct ccmode_ctr *ctrMode = ccaes_ctr_crypt_mode();
-    int error = ccctr_one_shot(ctrMode, EN_AEMK_LEN, aemk, rpi, dataLen, encryptedData, outMetaData);
+    const ENCryptoProvider *provider = ENCryptoProviderCurrent();
+    int error = provider->aesCTRCrypt(aemk, EN_AEMK_LEN, rpi, dataLen, encryptedData, outMetaData);
     if (error) {
-        EN_ERROR_PRINTF("decryptAEM ccctr_one_shot failed with error:%d", error);
+        EN_ERROR_PRINTF("decryptAEM %s AES-CTR failed with error:%d", provider->name, error);
         return BT_ERROR_CRYPTO_AES_FAILED;
     }
 
@@ -188,26 +293,70 @@ BTResult ENRetrieveTxPowerFromEncryptedAEM(uint8_t *encryptedAEM, size_t encrypt
     return result;
 }
 
-uint8_t ENCalculateAttnForDiscoveredRPI(uint8_t *tek, size_t tekLen, uint8_t *rpi, uint8_t rpiLen, uint8_t *aem, uint8_t aemLen, int8_t rssi, bool saturated)
+BTResult ENRetrieveTxPowerWithAEMK(const uint8_t *aemk, size_t aemkLen, const uint8_t *rpi, size_t rpiLen,
+                                   const uint8_t *encryptedAEM, size_t encryptedAEMLen, int8_t *outTxPower)
 {
-    int8_t txPower;
-    BTResult result = ENRetrieveTxPowerFromEncryptedAEM(aem, aemLen, tek, tekLen, rpi, rpiLen, &txPower);
-    EN_INFO_PRINTF("calculateAttnForDiscoveredRPI Decrypted payload TXPower:%d rssi:%d saturated:%d tek:%{private}.16P rpi:%{private}.16P result:%d", txPower, rssi, saturated, tek, rpi, result);
+    if (aemk == NULL || aemkLen != EN_AEMK_LEN || rpi == NULL || rpiLen != EN_RPI_LEN ||
+        encryptedAEM == NULL || encryptedAEMLen != EN_AEM_LEN || outTxPower == NULL) {
+        return BT_ERROR_INVALID_ARGUMENT;
+    }
+
+    // As in ENCalculateAttnWithAEMK, the keystream of the AEM is AES(AEMK, RPI).
+    const ENCryptoProvider *provider = ENCryptoProviderCurrent();
+    uint8_t keystream[EN_RPI_LEN];
+    int error = provider->aesECBEncrypt(aemk, EN_AEMK_LEN, 1, rpi, keystream);
+    if (error) {
+        EN_ERROR_PRINTF_LIMITED(EN_LOG_HOT_LOOP_LIMIT, "retrieveTxPowerWithAEMK %s AES-ECB failed with error:%d", provider->name, error);
+        return BT_ERROR_CRYPTO_AES_FAILED;
+    }
+    *outTxPower = (int8_t)(encryptedAEM[1] ^ keystream[1]);
+    memset(keystream, 0, sizeof(keystream));
+    return BT_SUCCESS;
+}
 
+uint8_t ENCalculateAttnForDiscoveredRPI(uint8_t *tek, size_t tekLen, uint8_t *rpi, uint8_t rpiLen, uint8_t *aem, uint8_t aemLen, int8_t rssi, bool saturated)
+{
+    uint8_t aemk[EN_AEMK_LEN] = {0};
+    BTResult result = ENGenerateAEMK(tek, tekLen, aemk, EN_AEMK_LEN);
     if (result != BT_SUCCESS) {
-        EN_ERROR_PRINTF("calculateAttnForDiscoveredRPI retrieveTxPowerFromEncryptedEAM failed with error:%d returning attn=0xFF", result);
+        EN_ERROR_PRINTF_LIMITED(EN_LOG_HOT_LOOP_LIMIT, "calculateAttnForDiscoveredRPI ENGenerateAEMK failed with error:%d returning attn=0xFF", result);
+        return 0xFF;
+    }
+
+    uint8_t attn = ENCalculateAttnWithAEMK(aemk, EN_AEMK_LEN, rpi, rpiLen, aem, aemLen, rssi, saturated);
+    memset(aemk, 0, sizeof(aemk));
+    return attn;
+}
+
+uint8_t ENCalculateAttnWithAEMK(const uint8_t *aemk, size_t aemkLen, const uint8_t *rpi, size_t rpiLen,
+                                const uint8_t *aem, size_t aemLen, int8_t rssi, bool saturated)
+{
+    if (aemk == NULL || aemkLen != EN_AEMK_LEN || rpi == NULL || rpiLen != EN_RPI_LEN || aem == NULL || aemLen != EN_AEM_LEN) {
+        EN_ERROR_PRINTF_LIMITED(EN_LOG_HOT_LOOP_LIMIT, "calculateAttnWithAEMK invalid arguments returning attn=0xFF");
+        return 0xFF;
+    }
+
+    // The AEM is AES-CTR encrypted with the RPI as the only counter block, so the keystream is AES(AEMK, RPI).
+    const ENCryptoProvider *provider = ENCryptoProviderCurrent();
+    uint8_t keystream[EN_RPI_LEN];
+    int error = provider->aesECBEncrypt(aemk, EN_AEMK_LEN, 1, rpi, keystream);
+    if (error) {
+        EN_ERROR_PRINTF_LIMITED(EN_LOG_HOT_LOOP_LIMIT, "calculateAttnWithAEMK %s AES-ECB failed with error:%d returning attn=0xFF", provider->name, error);
         return 0xFF;
     }
+    int8_t txPower = (int8_t)(aem[1] ^ keystream[1]);
+    memset(keystream, 0, sizeof(keystream));
+    EN_DEBUG_PRINTF("calculateAttnWithAEMK Decrypted payload TXPower:%d rssi:%d saturated:%d rpi:%{private}.16P", txPower, rssi, saturated, rpi);
 
     if (rssi == 127 && saturated) {
-        EN_ERROR_PRINTF("calculateAttnForDiscoveredRPI saturated RSSI level");
+        EN_ERROR_PRINTF_LIMITED(EN_LOG_HOT_LOOP_LIMIT, "calculateAttnWithAEMK saturated RSSI level");
         return 0;
     }
 
     int16_t attn = txPower - rssi;
-    EN_INFO_PRINTF("calculateAttnForDiscoveredRPI attn:%d", attn);
+    EN_DEBUG_PRINTF("calculateAttnWithAEMK attn:%d", attn);
     if (attn < 0) {
-        EN_ERROR_PRINTF("calculateAttnForDiscoveredRPI returning 0 txPower:%d rssi:%d attn:%d AEM:%.4P", txPower, rssi, attn, aem);
+        EN_ERROR_PRINTF_LIMITED(EN_LOG_HOT_LOOP_LIMIT, "calculateAttnWithAEMK returning 0 txPower:%d rssi:%d attn:%d AEM:%.4P", txPower, rssi, attn, aem);
         return 0;
     }
 
@@ -34,6 +34,23 @@ extern "C" {
 
 #define ENFileSignatureMaxSize					( 64 * 1024 )
 
+//===========================================================================================================================
+/*!	@brief	Packed key record for bulk writing with -writeTEKs:count:error:.
+*/
+typedef struct
+{
+	uint8_t			keyData[ 16 ];			// Raw TEK bytes.
+	uint32_t		rollingStartNumber;		// ENIntervalNumber the key became valid.
+	uint32_t		rollingPeriod;			// Number of 10 minute intervals the key is valid. 0 omits it from the file.
+	uint8_t			transmissionRiskLevel;
+	
+}	ENFileKeyRecord;
+
+/// Largest encoded size of an ENFileKeyRecord. Every field has a 1 byte tag: record tag and length (2), key data tag,
+/// length, and 16 bytes (18), rolling start number and period varints of up to 5 bytes each (6 + 6), and the
+/// transmission risk level varint of up to 2 bytes (3).
+#define ENFileKeyRecordMaxEncodedSize			35
+
 //===========================================================================================================================
 /*!	@brief	File Metadata Keys
 */
@@ -65,15 +82,38 @@ EN_API_AVAILABLE_EXPORT
 /// Metadata for the file.
 @property (readwrite, copy, nullable, nonatomic) NSDictionary *		metadata;
 
-/// SHA-256 hash of the file contents. Readable after open returns successfully.
+/// SHA-256 hash of the file contents. Readable after open returns successfully when reading or after close when writing.
 @property (readonly, copy, nullable, nonatomic) NSData *			sha256Data;
 
+/// Without an index, metadata is read only from the records before the first key, which is where the canonical layout
+/// puts it, so opening never scans the keys. Metadata placed after the keys isn't seen. For files like that, set this
+/// before opening to scan the whole file once and build indexData so later opens read all of the metadata directly.
+@property (readwrite, assign, nonatomic) BOOL							buildsIndex;
+
+/// Small index of the metadata record offsets and key range. Readable after opening with buildsIndex. Callers may cache
+/// it and set it before opening the same file again to read metadata directly. It's ignored if the file has changed.
+@property (readwrite, copy, nullable, nonatomic) NSData *			indexData;
+
+/// Returns the SHA-256 hash of each file, in order, for bulk re-validation of many files. Files are hashed concurrently,
+/// several per pass with multi-buffer SHA-256 where the CPU benefits from it. Each hash equals sha256Data of the file.
++ (NSArray <NSData *> * _Nullable)
+	sha256DataForFileSystemRepresentations:	(NSArray <NSString *> *)	inPaths
+	error:									(ENErrorOutType)			outError;
+
 /// Opens a file from an open file descriptor. This takes ownership of the file descriptor and will handle closing it.
 - (BOOL) openWithFD:(int) inFD reading:(BOOL) inReading error:(ENErrorOutType) outError;
 
 /// Open a file from a path.
 - (BOOL) openWithFileSystemRepresentation:(const char *) inPath reading:(BOOL) inReading error:(ENErrorOutType) outError;
 
+/// Opens a member of a zip archive for reading (e.g. ENFileArchiveMainMemberName). Stored and deflate members are
+/// supported. The member is decompressed as it's parsed, without a temporary file. sha256Data is the hash of the
+/// decompressed member, which is what the signature covers.
+- (BOOL)
+	openWithArchiveFileSystemRepresentation:	(const char *)		inPath
+	memberName:									(const char *)		inMemberName
+	error:										(ENErrorOutType)	outError;
+
 /// Closes the file.
 - (BOOL) closeAndReturnError:(ENErrorOutType) outError;
 
@@ -83,6 +123,13 @@ EN_API_AVAILABLE_EXPORT
 /// Writes a TEK to the end of the file.
 - (BOOL) writeTEK:(ENTemporaryExposureKey*) inKey error:(ENErrorOutType) outError;
 
+/// Writes an array of packed keys to the end of the file.
+///
+/// Records are encoded directly into the file's output buffer without creating any objects. This is intended for
+/// key servers generating large export files. The file hash is updated as data is written so sha256Data is available
+/// for signing as soon as the file is closed, without reading it back.
+- (BOOL) writeTEKs:(const ENFileKeyRecord *) inKeys count:(size_t) inCount error:(ENErrorOutType) outError;
+
 @end
 
 //===========================================================================================================================
@@ -100,6 +147,12 @@ EN_API_AVAILABLE_EXPORT
 	length:					(size_t)			inLen
 	error:					(ENErrorOutType)	outError;
 
+/// Reads and decodes a signature file from a member of a zip archive (e.g. ENFileArchiveSignatureMemberName).
++ (ENSignatureFile * _Nullable)
+	signatureFileWithArchiveFileSystemRepresentation:	(const char *)		inPath
+	memberName:											(const char *)		inMemberName
+	error:												(ENErrorOutType)	outError;
+
 /// Open a file from a path.
 - (BOOL) openWithFileSystemRepresentation:(const char *) inPath reading:(BOOL) inReading error:(ENErrorOutType) outError;
 
@@ -9,6 +9,7 @@
  */
 
 #import <corecrypto/ccdigest.h>
+#import <corecrypto/ccsha2.h>
 #import <ExposureNotification/ExposureNotification.h>
 #import <sys/clonefile.h>
 #import <sys/mman.h>
@@ -18,6 +19,8 @@
 #import "ENInternal.h"
 #import "ENProtobufUtils.h"
 #import "ENFile.h"
+#import "ENFileArchive.h"
+#import "ENFileHash.h"
 #import "ENShims.h"
 
 NS_ASSUME_NONNULL_BEGIN
@@ -79,17 +82,126 @@ typedef uint32_t		ENFileMetadataFlags;
 #define ENSignatureInfoTagKeyID					4 // LengthDelimited (string)
 #define ENSignatureInfoTagSignatureAlgorithm	5 // LengthDelimited (string)
 
+// Side index for locating metadata without scanning. Record offsets are indexed by tag and 0 if not present.
+
+#define ENFileIndexVersion						1
+
+typedef struct
+{
+	uint8_t			version;
+	uint8_t			reserved[ 7 ];
+	uint8_t			sha256[ CCSHA256_OUTPUT_SIZE ];	// Hash of the file the index was built for.
+	uint64_t		keysStart;						// Offset of the first key record.
+	uint64_t		keysEnd;						// Offset after the last key record.
+	uint64_t		metadataOffsets[ ENFileTagKey ];
+	
+}	ENFileIndex;
+
+// Writing.
+
+#define ENFileWriteBufferSize					( 1024 * 1024 )
+check_compile_time( ENFileKeyRecordMaxEncodedSize <= ENFileWriteBufferSize );
+
+// Largest varint encoding of an unsigned integer type: 7 bits per byte.
+#define ENFileVarIntMaxSize( TYPE )				( ( ( sizeof( TYPE ) * 8 ) + 6 ) / 7 )
+
+// What _ENFileEncodeKeyRecord writes at most: record header, then tag + value for each field.
+check_compile_time( ENFileKeyRecordMaxEncodedSize == ( 2 +
+	( 1 + 1 + sizeof( ( (ENFileKeyRecord *) 0 )->keyData ) ) +
+	( 1 + ENFileVarIntMaxSize( uint32_t ) ) +
+	( 1 + ENFileVarIntMaxSize( uint32_t ) ) +
+	( 1 + ENFileVarIntMaxSize( uint8_t ) ) ) );
+
+// The record length is written as a single byte.
+check_compile_time( ( ENFileKeyRecordMaxEncodedSize - 2 ) < 128 );
+
+// Reading archives.
+
+#define ENFileArchiveHashBufferSize				( 256 * 1024 )
+
+//===========================================================================================================================
+
+static inline uint8_t * _ENFileWriteVarInt( uint8_t *inDst, uint64_t inValue )
+{
+	while( inValue > 0x7F )
+	{
+		*inDst++ = 0x80 | ( (uint8_t)( inValue & 0x7F ) );
+		inValue >>= 7;
+	}
+	*inDst++ = (uint8_t) inValue;
+	return( inDst );
+}
+
+//===========================================================================================================================
+
+static size_t _ENFileEncodeKeyRecord( uint8_t *inBuf, const ENFileKeyRecord *inKey )
+{
+	// Encode the key message after the record header. Key messages are always < 128 bytes so the length is 1 byte.
+	
+	uint8_t *dst = inBuf + 2;
+	*dst++ = ( ENKeyTagKeyData << 3 ) | ProtobufTypeLengthDelimited;
+	*dst++ = (uint8_t) sizeof( inKey->keyData );
+	memcpy( dst, inKey->keyData, sizeof( inKey->keyData ) );
+	dst += sizeof( inKey->keyData );
+	
+	*dst++ = ( ENKeyTagIntervalNumber << 3 ) | ProtobufTypeVarInt;
+	dst = _ENFileWriteVarInt( dst, inKey->rollingStartNumber );
+	
+	if( inKey->rollingPeriod != 0 )
+	{
+		*dst++ = ( ENKeyTagIntervalCount << 3 ) | ProtobufTypeVarInt;
+		dst = _ENFileWriteVarInt( dst, inKey->rollingPeriod );
+	}
+	
+	*dst++ = ( ENKeyTagTransmissionRisk << 3 ) | ProtobufTypeVarInt;
+	dst = _ENFileWriteVarInt( dst, inKey->transmissionRiskLevel );
+	
+	inBuf[ 0 ] = ( ENFileTagKey << 3 ) | ProtobufTypeLengthDelimited;
+	inBuf[ 1 ] = (uint8_t)( dst - ( inBuf + 2 ) );
+	return( (size_t)( dst - inBuf ) );
+}
+
+//===========================================================================================================================
+
+static BOOL _ENFileMapFD( int inFD, const void * _Nullable * _Nonnull outPtr, size_t *outLen, ENErrorOutType outError )
+{
+	struct stat st;
+	OSStatus err = fstat( inFD, &st );
+	err = map_global_noerr_errno( err );
+	require_return_no( !err, outError, ENNSErrorF( err, "fstat failed" ) );
+	require_return_no( ( (uint64_t) st.st_size ) < SIZE_MAX, outError, 
+		ENNSErrorF( err, "File too big: %lld", (long long) st.st_size ) );
+	
+	// mmap rejects empty mappings. An empty file hashes the same as an empty buffer.
+	
+	size_t mapLen = (size_t) st.st_size;
+	void *mapMem = NULL;
+	if( mapLen > 0 )
+	{
+		mapMem = mmap( 0, mapLen, PROT_READ, MAP_PRIVATE, inFD, 0 );
+		err = map_global_value_errno( mapMem != MAP_FAILED, mapMem );
+		require_return_no( !err, outError, ENNSErrorF( err, "mmap failed" ) );
+	}
+	*outPtr = mapMem;
+	*outLen = mapLen;
+	return( YES );
+}
+
 //===========================================================================================================================
 
 @implementation ENFile
 {
 	FILE *						_fileHandle;
+	ENFileArchiveReader *		_archiveReader;
 	NSUInteger					_keyIndex;
 	BOOL						_reading;
 	ENFileMetadataFlags			_metadataFlags;
 	NSMutableDictionary *		_mutableMetadata;
 	ENProtobufCoder *			_protobufCoder;
 	ENProtobufCoder *			_tekProtobufCoder;
+	uint8_t *					_writeBuffer;
+	size_t						_writeLen;
+	struct ccdigest_ctx *		_writeDigestCtx;
 }
 
 //===========================================================================================================================
@@ -106,7 +218,10 @@ typedef uint32_t		ENFileMetadataFlags;
 
 - (void) dealloc
 {
+	if( _fileHandle && !_reading ) [self _flushWriteBufferAndReturnError:NULL];
 	ForgetANSIFile( &_fileHandle );
+	free( _writeBuffer );
+	free( _writeDigestCtx );
 }
 
 //===========================================================================================================================
@@ -151,19 +266,113 @@ typedef uint32_t		ENFileMetadataFlags;
 
 //===========================================================================================================================
 
+- (BOOL)
+	openWithArchiveFileSystemRepresentation:	(const char *)		inPath
+	memberName:									(const char *)		inMemberName
+	error:										(ENErrorOutType)	outError
+{
+	EN_DEBUG_PRINTF("Open archive '%s', member '%s'", inPath, inMemberName );
+	require_return_no( !_fileHandle && !_archiveReader, outError, ENErrorF( ENErrorCodeAPIMisuse, "File already open" ) );
+	
+    ENFileArchiveReader *archiveReader = [[ENFileArchiveReader alloc] initWithFileSystemRepresentation:inPath
+		memberName:inMemberName error:outError];
+	require_return_value( archiveReader, NO );
+	_archiveReader = archiveReader;
+	_reading = YES;
+	
+	BOOL good = [self _readArchivePrepareAndReturnError:outError];
+	require_return_value( good, NO );
+	
+	return( YES );
+}
+
+//===========================================================================================================================
+
 - (BOOL) closeAndReturnError:(ENErrorOutType) outError
 {
+	if( _archiveReader )
+	{
+		EN_DEBUG_PRINTF("Close: archive" );
+		_protobufCoder = nil;
+		_archiveReader = nil;
+		return( YES );
+	}
+	
 	FILE *fileHandle = _fileHandle;
 	EN_DEBUG_PRINTF("Close: fileHandle %s", YesNoStr( fileHandle ) );
 	require_return_no( fileHandle, outError, ENErrorF( ENErrorCodeAPIMisuse, "File not open" ) );
 	
+	NSError *error = nil;
+	BOOL good = _reading || [self _writeFinishAndReturnError:&error];
+	
 	int err = fclose( fileHandle );
 	_fileHandle = NULL;
+	require_return_no( good, outError, error );
 	require_return_no( !err, outError, ENErrorF( ENErrorCodeUnknown, "fclose failed: %#m", errno ) );
 	
 	return( YES );
 }
 
+//===========================================================================================================================
+
++ (NSArray <NSData *> * _Nullable)
+	sha256DataForFileSystemRepresentations:	(NSArray <NSString *> *)	inPaths
+	error:									(ENErrorOutType)			outError
+{
+	size_t count = inPaths.count;
+	const void **ptrs = (const void **) calloc( Max( count, 1U ), sizeof( *ptrs ) );
+	size_t *lens = (size_t *) calloc( Max( count, 1U ), sizeof( *lens ) );
+	uint8_t ( *hashes )[ ENFileHashLength ] = (uint8_t ( * )[ ENFileHashLength ]) calloc( Max( count, 1U ), ENFileHashLength );
+	ENDefer
+	{
+		for( size_t i = 0; ptrs && lens && ( i < count ); ++i )
+		{
+			if( ptrs[ i ] ) munmap( (void *) ptrs[ i ], lens[ i ] );
+		}
+		free( ptrs );
+		free( lens );
+		free( hashes );
+	};
+	require_return_nil( ptrs && lens && hashes, outError, ENNSErrorF( kNoMemoryErr, "No memory for %zu files", count ) );
+	
+	// Map every file up front. The mappings don't need the descriptors to stay open.
+	
+	for( size_t i = 0; i < count; ++i )
+	{
+		const char *path = inPaths[ i ].fileSystemRepresentation;
+		int fileFD = open( path, O_RDONLY );
+		OSStatus err = map_fd_creation_errno( fileFD );
+		require_return_nil( !err, outError, ENErrorF( ENErrorCodeBadParameter, "Open path failed: '%s', %#m", path, err ) );
+		
+		BOOL good = _ENFileMapFD( fileFD, &ptrs[ i ], &lens[ i ], outError );
+		close( fileFD );
+		require_return_value( good, nil );
+	}
+	
+	// Hash one group per core. Each group is a multiple of the lane count so multi-buffer lanes stay full.
+	
+	size_t cpuCount = Max( [NSProcessInfo processInfo].activeProcessorCount, 1U );
+	size_t groupSize = Max( RoundUp( ( count + cpuCount - 1 ) / cpuCount, ENFileHashMultiBufferLanes ), ENFileHashMultiBufferLanes );
+	size_t groupCount = ( count + groupSize - 1 ) / groupSize;
+	const void * const *groupPtrs = ptrs;
+	const size_t *groupLens = lens;
+	uint8_t ( *groupHashes )[ ENFileHashLength ] = hashes;
+	dispatch_apply( groupCount, dispatch_get_global_queue( QOS_CLASS_UTILITY, 0 ),
+	^( size_t inIndex )
+	{
+		size_t start = inIndex * groupSize;
+		ENFileHashSHA256MultiBuffer( &groupPtrs[ start ], &groupLens[ start ], Min( groupSize, count - start ),
+			&groupHashes[ start ] );
+	} );
+	
+    NSMutableArray <NSData *> *hashArray = [[NSMutableArray alloc] initWithCapacity:count];
+	for( size_t i = 0; i < count; ++i )
+	{
+		[hashArray addObject:[[NSData alloc] initWithBytes:hashes[ i ] length:ENFileHashLength]];
+	}
+	return( hashArray );
+}
+
 // MARK: -
 
 //===========================================================================================================================
@@ -207,53 +416,132 @@ typedef uint32_t		ENFileMetadataFlags;
 
 //===========================================================================================================================
 
-- (BOOL) _readHash:(ENErrorOutType) outError
+- (BOOL) _readArchivePrepareAndReturnError:(ENErrorOutType) outError
 {
-    FILE *fileHandle = _fileHandle;
-	require_return_no( fileHandle, outError, ENErrorF( ENErrorCodeAPIMisuse, "File not open" ) );
-	int fileFD = fileno( fileHandle );
+    ENFileArchiveReader *archiveReader = _archiveReader;
+	require_return_no( archiveReader, outError, ENErrorF( ENErrorCodeAPIMisuse, "Archive not open" ) );
 	
-	struct stat st;
-	OSStatus err = fstat( fileFD, &st );
-	err = map_global_noerr_errno( err );
-	require_return_no( !err, outError, ENNSErrorF( err, "fstat failed" ) );
-	require_return_no( ( (uint64_t) st.st_size ) < SIZE_MAX, outError, 
-		ENNSErrorF( err, "File too big: %lld", (long long) st.st_size ) );
+	// Hash the decompressed member first so sha256Data is available for signature verification right after open.
+	// This also verifies the member's CRC. Then start over to parse it, decompressing again instead of keeping a copy.
+	
+	BOOL good = [self _readArchiveHash:outError];
+	require_return_value( good, NO );
+	
+	good = [archiveReader seekToOffset:0 error:outError];
+	require_return_value( good, NO );
+	
+	// Read and verify the identifier section.
+	
+	char buf[ ENFileIdentifierLen ];
+	size_t len = 0;
+	while( len < sizeof( buf ) )
+	{
+		NSError *error = nil;
+		size_t n = [archiveReader readBytes:&buf[ len ] maxLength:sizeof( buf ) - len error:&error];
+		require_return_no( n > 0, outError, 
+			ENNestedErrorF( error, ENErrorCodeBadFormat, "read identifier failed: %zu bytes", len ) );
+		len += n;
+	}
+	EN_DEBUG_PRINTF("Read identifier: '%.*s'", (int) sizeof( buf ), buf );
+	require_return_no( memcmp( buf, ENFileIdentifierStr, ENFileIdentifierLen ) == 0, outError, 
+		ENErrorF( ENErrorCodeBadFormat, "File identifier mismatch" ) );
+	
+	// Read metadata. The protobuf coder pulls decompressed data through its read-ahead buffer.
+	
+	_protobufCoder = [[ENProtobufCoder alloc] init];
+	[_protobufCoder setReadSource:archiveReader];
+	
+	_mutableMetadata = [[NSMutableDictionary alloc] init];
+	_metadata = _mutableMetadata;
+	
+	good = [self _readMetadata:outError];
+	require_return_value( good, NO );
 	
-    size_t mapLen = (size_t) st.st_size;
-	void *mapMem = mmap( 0, mapLen, PROT_READ, MAP_PRIVATE, fileFD, 0 );
-	err = map_global_value_errno( mapMem != MAP_FAILED, mapMem );
-	require_return_no( !err, outError, ENNSErrorF( err, "mmap failed" ) );
+	return( YES );
+}
+
+//===========================================================================================================================
 
+- (BOOL) _readArchiveHash:(ENErrorOutType) outError
+{
+    ENFileArchiveReader *archiveReader = _archiveReader;
+	const struct ccdigest_info * const di = ccsha256_di();
+	ccdigest_di_decl( di, digestCtx );
+	ccdigest_init( di, digestCtx );
+	
+	uint8_t * const buf = (uint8_t *) malloc( ENFileArchiveHashBufferSize );
+	require_return_no( buf, outError, ENNSErrorF( kNoMemoryErr, "No memory for hash buffer" ) );
+	
+	NSError *error = nil;
+	for( ;; )
+	{
+		size_t n = [archiveReader readBytes:buf maxLength:ENFileArchiveHashBufferSize error:&error];
+		if( n == 0 ) break;
+		ccdigest_update( di, digestCtx, n, buf );
+	}
+	free( buf );
+	require_return_no( !error, outError, error );
+	
     uint8_t hashBytes[ CCSHA256_OUTPUT_SIZE ];
-	ccdigest( ccsha256_di(), mapLen, mapMem, hashBytes );
+	ccdigest_final( di, digestCtx, hashBytes );
+	ccdigest_di_clear( di, digestCtx );
 	_sha256Data = [[NSData alloc] initWithBytes:hashBytes length:sizeof( hashBytes )];
-    munmap( mapMem, mapLen );
 	return( YES );
 }
 
 //===========================================================================================================================
 
-- (BOOL) _readMetadata:(ENErrorOutType) outError
+- (BOOL) _readHash:(ENErrorOutType) outError
 {
-	// Save off the original file position and restore on before existing in case there are any keys before metadata.
-	
     FILE *fileHandle = _fileHandle;
 	require_return_no( fileHandle, outError, ENErrorF( ENErrorCodeAPIMisuse, "File not open" ) );
 	
-	fpos_t originalFilePosition;
-	int err = fgetpos( fileHandle, &originalFilePosition );
-	err = map_global_noerr_errno( err );
-	require_return_no( !err, outError, ENNSErrorF( err, "fgetpos failed" ) );
-	ENDefer { fsetpos( fileHandle, &originalFilePosition ); };
-	
-	// Read each protobuf message until we've found all the metadata or reach the end.
+	const void *mapMem = NULL;
+	size_t mapLen = 0;
+	BOOL good = _ENFileMapFD( fileno( fileHandle ), &mapMem, &mapLen, outError );
+	require_return_value( good, NO );
 	
+    uint8_t hashBytes[ ENFileHashLength ];
+	ENFileHashSHA256( mapMem ?: "", mapLen, hashBytes );
+	_sha256Data = [[NSData alloc] initWithBytes:hashBytes length:sizeof( hashBytes )];
+	if( mapMem ) munmap( (void *) mapMem, mapLen );
+	return( YES );
+}
+
+//===========================================================================================================================
+
+- (BOOL) _readMetadata:(ENErrorOutType) outError
+{
     ENProtobufCoder *protobufCoder = _protobufCoder;
 	require_return_no( protobufCoder, outError, ENErrorF( ENErrorCodeAPIMisuse, "ProtobufCoder not prepared" ) );
 	
-	while( ( _metadataFlags & ENFileMetadataFlagsAll ) != ENFileMetadataFlagsAll )
+	// If there's an index for this file then read the metadata directly from the offsets it recorded.
+	
+	ENIfLet( indexData, _indexData )
+	{
+		const ENFileIndex *index = (const ENFileIndex *) indexData.bytes;
+		if( ( indexData.length == sizeof( *index ) ) && ( index->version == ENFileIndexVersion ) &&
+			_sha256Data && ( memcmp( index->sha256, _sha256Data.bytes, sizeof( index->sha256 ) ) == 0 ) )
+		{
+			BOOL good = [self _readMetadataWithIndex:index error:outError];
+			return( good );
+		}
+		EN_NOTICE_PRINTF( "Ignoring file index for a different file" );
+		_indexData = nil;
+	}
+	
+	// Read records until the first key. Canonical files put all metadata before the keys, whichever optional records
+	// they have, so that's all that's read. If building an index, keep scanning to the end to find metadata after the
+	// keys and the range of the keys.
+	
+	ENFileIndex index;
+	memset( &index, 0, sizeof( index ) );
+	
+	uint64_t keysStart	= 0;
+	uint64_t keysEnd	= 0;
+	for( ;; )
 	@autoreleasepool {
+		uint64_t recordOffset = protobufCoder.fileOffset;
 		uint8_t type = 0;
 		uint64_t tag = 0;
 		NSError *error = nil;
@@ -261,62 +549,133 @@ typedef uint32_t		ENFileMetadataFlags;
 		if( !good && !error ) break;
 		require_return_no( good, outError, error );
 		
-		switch( tag )
+		if( tag == ENFileTagKey )
 		{
-			case ENFileTagStartTimestamp:
-			{
-				uint64_t u64 = 0;
-				good = [protobufCoder readFixedUInt64:&u64 error:outError];
-				require_return_value( good, NO );
-				_mutableMetadata[ ENFileMetadataKeyStartTimestamp ] = @(u64);
-				_metadataFlags |= ENFileMetadataFlagsStartTimestamp;
-				break;
-			}
-			
-			case ENFileTagEndTimestamp:
-			{
-				uint64_t u64 = 0;
-				good = [protobufCoder readFixedUInt64:&u64 error:outError];
-				require_return_value( good, NO );
-				_mutableMetadata[ ENFileMetadataKeyEndTimestamp ] = @(u64);
-				_metadataFlags |= ENFileMetadataFlagsEndTimestamp;
-				break;
-			}
-			
-			case ENFileTagRegion:
-			{
-				NSString *str = [protobufCoder readNSStringAndReturnError:outError];
-				require_return_value( str, NO );
-				_mutableMetadata[ ENFileMetadataKeyRegion ] = str;
-				_metadataFlags |= ENFileMetadataFlagsRegion;
-				break;
-			}
+			if( keysStart == 0 ) keysStart = recordOffset;
+			if( !_buildsIndex ) break;
 			
-			case ENFileTagBatchNumber:
-			{
-				uint32_t u32 = 0;
-				good = [protobufCoder readVarIntUInt32:&u32 error:outError];
-				require_return_value( good, NO );
-				_mutableMetadata[ ENFileMetadataKeyBatchNumber ] = @(u32);
-				_metadataFlags |= ENFileMetadataFlagsBatchNumber;
-				break;
-			}
-			
-			case ENFileTagBatchSize:
-			{
-				uint32_t u32 = 0;
-				good = [protobufCoder readVarIntUInt32:&u32 error:outError];
-				require_return_value( good, NO );
-				_mutableMetadata[ ENFileMetadataKeyBatchSize ] = @(u32);
-				_metadataFlags |= ENFileMetadataFlagsBatchSize;
-				break;
-			}
-			
-			default:
-				good = [protobufCoder skipType:type error:outError];
-				require_return_value( good, NO );
-				break;
+			good = [protobufCoder skipType:type error:outError];
+			require_return_value( good, NO );
+			keysEnd = protobufCoder.fileOffset;
+			continue;
+		}
+		if( tag < countof( index.metadataOffsets ) ) index.metadataOffsets[ tag ] = recordOffset;
+		
+		good = [self _readMetadataRecordWithType:type tag:tag error:outError];
+		require_return_value( good, NO );
+	}
+	
+	// Position at the first key (or the end if there are none) so reading keys doesn't re-read the metadata.
+	
+	if( keysStart == 0 ) keysStart = protobufCoder.fileOffset;
+	if( keysEnd == 0 ) keysEnd = keysStart;
+	BOOL good = [protobufCoder seekToFileOffset:keysStart error:outError];
+	require_return_value( good, NO );
+	
+	if( _buildsIndex )
+	{
+		NSData *sha256Data = _sha256Data;
+		require_return_no( sha256Data.length == sizeof( index.sha256 ), outError, 
+			ENErrorF( ENErrorCodeInternal, "No hash for index" ) );
+		index.version	= ENFileIndexVersion;
+		index.keysStart	= keysStart;
+		index.keysEnd	= keysEnd;
+		memcpy( index.sha256, sha256Data.bytes, sizeof( index.sha256 ) );
+		_indexData = [[NSData alloc] initWithBytes:&index length:sizeof( index )];
+	}
+	return( YES );
+}
+
+//===========================================================================================================================
+
+- (BOOL) _readMetadataWithIndex:(const ENFileIndex *) inIndex error:(ENErrorOutType) outError
+{
+    ENProtobufCoder *protobufCoder = _protobufCoder;
+	for( size_t tag = 0; tag < countof( inIndex->metadataOffsets ); ++tag )
+	@autoreleasepool {
+		uint64_t offset = inIndex->metadataOffsets[ tag ];
+		if( offset == 0 ) continue;
+		
+		BOOL good = [protobufCoder seekToFileOffset:offset error:outError];
+		require_return_value( good, NO );
+		
+		uint8_t type = 0;
+		uint64_t recordTag = 0;
+		good = [protobufCoder readType:&type tag:&recordTag eofOkay:NO error:outError];
+		require_return_value( good, NO );
+		require_return_no( recordTag == tag, outError, 
+			ENErrorF( ENErrorCodeBadFormat, "File index mismatch: tag %llu at %llu", recordTag, offset ) );
+		
+		good = [self _readMetadataRecordWithType:type tag:recordTag error:outError];
+		require_return_value( good, NO );
+	}
+	
+	BOOL good = [protobufCoder seekToFileOffset:inIndex->keysStart error:outError];
+	require_return_value( good, NO );
+	return( YES );
+}
+
+//===========================================================================================================================
+
+- (BOOL) _readMetadataRecordWithType:(uint8_t) type tag:(uint64_t) tag error:(ENErrorOutType) outError
+{
+    ENProtobufCoder *protobufCoder = _protobufCoder;
+	BOOL good;
+	switch( tag )
+	{
+		case ENFileTagStartTimestamp:
+		{
+			uint64_t u64 = 0;
+			good = [protobufCoder readFixedUInt64:&u64 error:outError];
+			require_return_value( good, NO );
+			_mutableMetadata[ ENFileMetadataKeyStartTimestamp ] = @(u64);
+			_metadataFlags |= ENFileMetadataFlagsStartTimestamp;
+			break;
+		}
+		
+		case ENFileTagEndTimestamp:
+		{
+			uint64_t u64 = 0;
+			good = [protobufCoder readFixedUInt64:&u64 error:outError];
+			require_return_value( good, NO );
+			_mutableMetadata[ ENFileMetadataKeyEndTimestamp ] = @(u64);
+			_metadataFlags |= ENFileMetadataFlagsEndTimestamp;
+			break;
+		}
+		
+		case ENFileTagRegion:
+		{
+			NSString *str = [protobufCoder readNSStringAndReturnError:outError];
+			require_return_value( str, NO );
+			_mutableMetadata[ ENFileMetadataKeyRegion ] = str;
+			_metadataFlags |= ENFileMetadataFlagsRegion;
+			break;
+		}
+		
+		case ENFileTagBatchNumber:
+		{
+			uint32_t u32 = 0;
+			good = [protobufCoder readVarIntUInt32:&u32 error:outError];
+			require_return_value( good, NO );
+			_mutableMetadata[ ENFileMetadataKeyBatchNumber ] = @(u32);
+			_metadataFlags |= ENFileMetadataFlagsBatchNumber;
+			break;
+		}
+		
+		case ENFileTagBatchSize:
+		{
+			uint32_t u32 = 0;
+			good = [protobufCoder readVarIntUInt32:&u32 error:outError];
+			require_return_value( good, NO );
+			_mutableMetadata[ ENFileMetadataKeyBatchSize ] = @(u32);
+			_metadataFlags |= ENFileMetadataFlagsBatchSize;
+			break;
 		}
+		
+		default:
+			good = [protobufCoder skipType:type error:outError];
+			require_return_value( good, NO );
+			break;
 	}
 	return( YES );
 }
@@ -328,16 +687,90 @@ typedef uint32_t		ENFileMetadataFlags;
 	FILE *fileHandle = _fileHandle;
 	require_return_no( fileHandle, outError, ENErrorF( ENErrorCodeAPIMisuse, "File not open" ) );
 	
-	size_t n = fwrite( ENFileIdentifierStr, 1, ENFileIdentifierLen, fileHandle );
-	OSStatus err = map_global_value_errno( n == ENFileIdentifierLen, fileHandle );
-	require_return_no( !err, outError, ENErrorF( ENErrorCodeUnknown, "Write failed: %#m", err ) );
+	// All output goes through our own large buffer and is hashed as it's flushed so stdio buffering isn't needed.
+	
+	setvbuf( fileHandle, NULL, _IONBF, 0 );
+	
+	if( !_writeBuffer )
+	{
+		_writeBuffer = (uint8_t *) malloc( ENFileWriteBufferSize );
+		require_return_no( _writeBuffer, outError, ENErrorF( ENErrorCodeInsufficientMemory, "Alloc write buffer failed" ) );
+	}
+	_writeLen = 0;
+	
+	const struct ccdigest_info *di = ccsha256_di();
+	if( !_writeDigestCtx )
+	{
+		_writeDigestCtx = (struct ccdigest_ctx *) malloc( ccdigest_di_size( di ) );
+		require_return_no( _writeDigestCtx, outError, ENErrorF( ENErrorCodeInsufficientMemory, "Alloc digest failed" ) );
+	}
+	ccdigest_init( di, _writeDigestCtx );
+	
+	BOOL good = [self _writeBytes:ENFileIdentifierStr length:ENFileIdentifierLen error:outError];
+	require_return_value( good, NO );
 	
+	// Encode metadata to memory then append it to the output buffer.
+	
+	NSMutableData *metadataData = [[NSMutableData alloc] init];
 	_protobufCoder = [[ENProtobufCoder alloc] init];
-	[_protobufCoder setFileHandle:fileHandle];
+	[_protobufCoder setWriteMutableData:metadataData];
+	
+	good = [self _writeMetadataAndReturnError:outError];
+	require_return_value( good, NO );
+	
+	good = [self _writeBytes:metadataData.bytes length:metadataData.length error:outError];
+	require_return_value( good, NO );
+	
+	return( YES );
+}
+
+//===========================================================================================================================
+
+- (BOOL) _writeBytes:(const void *) inPtr length:(size_t) inLen error:(ENErrorOutType) outError
+{
+	if( inLen > ( ENFileWriteBufferSize - _writeLen ) )
+	{
+		BOOL good = [self _flushWriteBufferAndReturnError:outError];
+		require_return_value( good, NO );
+		
+		if( inLen > ENFileWriteBufferSize )
+		{
+			ccdigest_update( ccsha256_di(), _writeDigestCtx, inLen, inPtr );
+			size_t n = fwrite( inPtr, 1, inLen, _fileHandle );
+			require_return_no( n == inLen, outError, ENNSErrorF( kWriteErr, "write failed: %#m", errno ) );
+			return( YES );
+		}
+	}
+	memcpy( &_writeBuffer[ _writeLen ], inPtr, inLen );
+	_writeLen += inLen;
+	return( YES );
+}
+
+//===========================================================================================================================
+
+- (BOOL) _flushWriteBufferAndReturnError:(ENErrorOutType) outError
+{
+	size_t len = _writeLen;
+	if( len == 0 ) return( YES );
+	
+	ccdigest_update( ccsha256_di(), _writeDigestCtx, len, _writeBuffer );
+	_writeLen = 0;
 	
-	BOOL good = [self _writeMetadataAndReturnError:outError];
+	size_t n = fwrite( _writeBuffer, 1, len, _fileHandle );
+	require_return_no( n == len, outError, ENNSErrorF( kWriteErr, "write failed: %#m", errno ) );
+	return( YES );
+}
+
+//===========================================================================================================================
+
+- (BOOL) _writeFinishAndReturnError:(ENErrorOutType) outError
+{
+	BOOL good = [self _flushWriteBufferAndReturnError:outError];
 	require_return_value( good, NO );
 	
+	uint8_t hashBytes[ CCSHA256_OUTPUT_SIZE ];
+	ccdigest_final( ccsha256_di(), _writeDigestCtx, hashBytes );
+	_sha256Data = [[NSData alloc] initWithBytes:hashBytes length:sizeof( hashBytes )];
 	return( YES );
 }
 
@@ -430,7 +863,7 @@ typedef uint32_t		ENFileMetadataFlags;
 				{
 					size_t len = 0;
                     const uint8_t *ptr = [protobufCoder readLengthDelimited:&len error:outError];
-					require_return_value( good, nil );
+					require_return_value( ptr, nil );
 					
                     ENTemporaryExposureKey *tek = [self _readKeyWithPtr:ptr length:len error:&error];
 					require_return_nil( tek, outError, error );
@@ -525,7 +958,7 @@ typedef uint32_t		ENFileMetadataFlags;
 - (BOOL) writeTEK:(ENTemporaryExposureKey*) inKey error:(ENErrorOutType) outError
 {
 	FILE *fileHandle = _fileHandle;
-	require_return_no( fileHandle, outError, ENErrorF( ENErrorCodeAPIMisuse, "File not open" ) );
+	require_return_no( fileHandle && !_reading, outError, ENErrorF( ENErrorCodeAPIMisuse, "File not open for writing" ) );
 	
 	if( !_tekProtobufCoder ) _tekProtobufCoder = [[ENProtobufCoder alloc] init];
 	uint8_t buf[ 128 ];
@@ -557,13 +990,43 @@ typedef uint32_t		ENFileMetadataFlags;
 	size_t len = (size_t)( msgEnd - msgPtr );
 	if( len > 0 )
 	{
-		good = [_protobufCoder writeLengthDelimitedPtr:msgPtr length:len tag:ENFileTagKey error:outError];
+		uint8_t header[ 1 + 10 ]; // Key + max-sized varint length.
+		header[ 0 ] = ( ENFileTagKey << 3 ) | ProtobufTypeLengthDelimited;
+		uint8_t *headerEnd = _ENFileWriteVarInt( &header[ 1 ], len );
+		
+		good = [self _writeBytes:header length:(size_t)( headerEnd - header ) error:outError];
+		require_return_value( good, NO );
+		
+		good = [self _writeBytes:msgPtr length:len error:outError];
 		require_return_value( good, NO );
 	}
 	
 	return( YES );
 }
 
+//===========================================================================================================================
+
+- (BOOL) writeTEKs:(const ENFileKeyRecord *) inKeys count:(size_t) inCount error:(ENErrorOutType) outError
+{
+	require_return_no( _fileHandle && !_reading, outError, ENErrorF( ENErrorCodeAPIMisuse, "File not open for writing" ) );
+	
+	uint8_t * const writeBuffer = _writeBuffer;
+	size_t writeLen = _writeLen;
+	for( size_t i = 0; i < inCount; ++i )
+	{
+		if( ( ENFileWriteBufferSize - writeLen ) < ENFileKeyRecordMaxEncodedSize )
+		{
+			_writeLen = writeLen;
+			BOOL good = [self _flushWriteBufferAndReturnError:outError];
+			require_return_value( good, NO );
+			writeLen = 0;
+		}
+		writeLen += _ENFileEncodeKeyRecord( &writeBuffer[ writeLen ], &inKeys[ i ] );
+	}
+	_writeLen = writeLen;
+	return( YES );
+}
+
 @end
 
 // MARK: -
@@ -626,6 +1089,25 @@ typedef uint32_t		ENFileMetadataFlags;
 
 //===========================================================================================================================
 
++ (ENSignatureFile * _Nullable)
+	signatureFileWithArchiveFileSystemRepresentation:	(const char *)		inPath
+	memberName:											(const char *)		inMemberName
+	error:												(ENErrorOutType)	outError
+{
+    ENFileArchiveReader *archiveReader = [[ENFileArchiveReader alloc] initWithFileSystemRepresentation:inPath
+		memberName:inMemberName error:outError];
+	require_return_value( archiveReader, nil );
+	
+    NSData *data = [archiveReader readDataToEndWithMaxLength:ENFileSignatureMaxSize error:outError];
+	require_return_value( data, nil );
+	
+    ENSignatureFile *signatureFile = [self signatureFileWithBytes:(const uint8_t *) data.bytes length:data.length
+		error:outError];
+	return( signatureFile );
+}
+
+//===========================================================================================================================
+
 - (BOOL) openWithFileSystemRepresentation:(const char *) inPath reading:(BOOL) inReading error:(ENErrorOutType) outError
 {
 	require_return_no( !inReading, outError, ENErrorF( ENErrorCodeUnsupported, "Reading files not implemented" ) );
@@ -0,0 +1,72 @@
+/*
+ *      Copyright (C) 2020 Apple Inc. All Rights Reserved.
+ *
+ *      ExposureNotification is licensed under Apple Inc.’s
+ *      Sample Code License Agreement, which is contained in
+ *      the LICENSE file distributed with ExposureNotification,
+ *      and only to those who accept that license.
+ *
+ */
+
+#pragma once
+
+#import <ExposureNotification/ExposureNotification.h>
+#import <Foundation/Foundation.h>
+
+#import "ENProtobufUtils.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//===========================================================================================================================
+/*!	@brief	Constants
+*/
+
+/// Name of the key file member in the zip archives served to devices.
+#define ENFileArchiveMainMemberName				"export.bin"
+
+/// Name of the signature file member in the zip archives served to devices.
+#define ENFileArchiveSignatureMemberName		"export.sig"
+
+//===========================================================================================================================
+/*!	@brief	Reads the uncompressed contents of one member of a zip archive.
+
+	Supports stored and deflate members. Deflate data is decompressed in small chunks as it's read so the member is
+	never fully in memory or written to a temporary file. The CRC-32 of the member is verified when it's read from the
+	start to the end without seeking. Seeking forward decompresses and discards; seeking backward restarts from the
+	beginning of the member.
+*/
+EN_API_AVAILABLE_EXPORT
+@interface ENFileArchiveReader : NSObject <ENProtobufReadSource>
+
+/// Opens the archive and finds the member. The member name is the full path within the archive (e.g. "export.bin").
+- (instancetype _Nullable)
+	initWithFileSystemRepresentation:	(const char *)		inPath
+	memberName:							(const char *)		inMemberName
+	error:								(ENErrorOutType)	outError;
+
+/// Size of the member after decompression.
+@property (readonly, assign, nonatomic) uint64_t		uncompressedSize;
+
+/// Offset within the uncompressed member of the next byte to be read.
+@property (readonly, assign, nonatomic) uint64_t		offset;
+
+/// Reads up to inMaxLen bytes. Returns 0 with no error at the end of the member.
+- (size_t) readBytes:(void *) inBuffer maxLength:(size_t) inMaxLen error:(ENErrorOutType) outError;
+
+/// Reads from the current offset to the end of the member. Fails if that's more than inMaxLen bytes.
+- (NSData * _Nullable) readDataToEndWithMaxLength:(size_t) inMaxLen error:(ENErrorOutType) outError;
+
+/// Moves to an offset within the uncompressed member.
+- (BOOL) seekToOffset:(uint64_t) inOffset error:(ENErrorOutType) outError;
+
+@end
+
+#ifdef __cplusplus
+}
+#endif
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,431 @@
+/*
+ *      Copyright (C) 2020 Apple Inc. All Rights Reserved.
+ *
+ *      ExposureNotification is licensed under Apple Inc.’s
+ *      Sample Code License Agreement, which is contained in
+ *      the LICENSE file distributed with ExposureNotification,
+ *      and only to those who accept that license.
+ *
+ */
+
+#import <ExposureNotification/ExposureNotification.h>
+#import <zlib.h>
+
+#import "ENCommonPrivate.h"
+#import "ENFileArchive.h"
+#import "ENShims.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+//===========================================================================================================================
+
+// End of central directory record. It's at the end of the archive, followed by a comment of up to 64 KB.
+
+#define ENZipEndRecordSignature				0x06054b50
+#define ENZipEndRecordSize					22
+#define ENZipEndRecordMaxSearch				( ENZipEndRecordSize + 0xFFFF )
+
+// Central directory file header.
+
+#define ENZipCentralHeaderSignature			0x02014b50
+#define ENZipCentralHeaderSize				46
+
+// Local file header. Its name and extra field lengths may differ from the central directory so it's read to find the data.
+
+#define ENZipLocalHeaderSignature			0x04034b50
+#define ENZipLocalHeaderSize				30
+
+#define ENZipFlagEncrypted					( 1U << 0 )
+#define ENZipMethodStored					0
+#define ENZipMethodDeflate					8
+#define ENZip32Sentinel						0xFFFFFFFFU // Size or offset is in a ZIP64 extra field instead.
+
+// Largest central directory accepted. Key archives only have a couple of members.
+
+#define ENZipCentralDirectoryMaxSize		( 1024 * 1024 )
+
+#define ENFileArchiveInputBufferSize		( 64 * 1024 )
+#define ENFileArchiveDiscardBufferSize		( 16 * 1024 )
+
+//===========================================================================================================================
+
+@implementation ENFileArchiveReader
+{
+	FILE *			_fileHandle;
+	uint64_t		_dataOffset;		// Archive offset of the member's (possibly compressed) data.
+	uint64_t		_compressedSize;
+	uint64_t		_compressedRead;	// Compressed bytes read from the archive so far.
+	uint32_t		_expectedCRC;
+	uint32_t		_crc;				// CRC-32 of the uncompressed bytes read so far. Only valid if _crcValid.
+	BOOL			_crcValid;			// YES if every byte from the start of the member has been read in order.
+	uint16_t		_method;
+	z_stream		_zstream;
+	BOOL			_zstreamInitialized;
+	uint8_t *		_inputBuffer;
+}
+
+//===========================================================================================================================
+
+- (instancetype _Nullable)
+	initWithFileSystemRepresentation:	(const char *)		inPath
+	memberName:							(const char *)		inMemberName
+	error:								(ENErrorOutType)	outError
+{
+	self = [super init];
+	require_return_nil( self, outError, ENErrorF( ENErrorCodeInternal, "init failed" ) );
+
+	_fileHandle = fopen( inPath, "rb" );
+	OSStatus err = map_global_value_errno( _fileHandle, _fileHandle );
+	require_return_nil( !err, outError, ENErrorF( ENErrorCodeBadParameter, "Open archive failed: '%s', %#m", inPath, err ) );
+
+	BOOL good = [self _findMember:inMemberName error:outError];
+	require_return_value( good, nil );
+
+	if( _method == ENZipMethodDeflate )
+	{
+		_inputBuffer = (uint8_t *) malloc( ENFileArchiveInputBufferSize );
+		require_return_nil( _inputBuffer, outError, ENNSErrorF( kNoMemoryErr, "No memory for inflate buffer" ) );
+
+		int zerr = inflateInit2( &_zstream, -MAX_WBITS ); // Negative window bits for raw deflate data.
+		require_return_nil( zerr == Z_OK, outError, ENErrorF( ENErrorCodeInternal, "inflateInit failed: %d", zerr ) );
+		_zstreamInitialized = YES;
+	}
+
+	good = [self _rewindAndReturnError:outError];
+	require_return_value( good, nil );
+
+	EN_DEBUG_PRINTF( "Opened archive member '%s': method %u, %llu -> %llu bytes", inMemberName, _method,
+		_compressedSize, _uncompressedSize );
+	return( self );
+}
+
+//===========================================================================================================================
+
+- (void) dealloc
+{
+	if( _zstreamInitialized ) inflateEnd( &_zstream );
+	ForgetANSIFile( &_fileHandle );
+	free( _inputBuffer );
+}
+
+//===========================================================================================================================
+
+- (BOOL) _findMember:(const char *) inMemberName error:(ENErrorOutType) outError
+{
+	FILE *fileHandle = _fileHandle;
+
+	int err = fseeko( fileHandle, 0, SEEK_END );
+	err = map_global_value_errno( !err, fileHandle );
+	require_return_no( !err, outError, ENNSErrorF( err, "fseek end failed" ) );
+	off_t fileSize = ftello( fileHandle );
+	require_return_no( fileSize >= ENZipEndRecordSize, outError, ENErrorF( ENErrorCodeBadFormat, "Archive too small" ) );
+
+	// Search backward from the end for the end of central directory record.
+
+	size_t tailLen = (size_t) Min( (uint64_t) fileSize, (uint64_t) ENZipEndRecordMaxSearch );
+	NSMutableData *tailData = [[NSMutableData alloc] initWithLength:tailLen];
+	BOOL good = [self _readAtOffset:(uint64_t)( fileSize - (off_t) tailLen ) buffer:tailData.mutableBytes length:tailLen
+		error:outError];
+	require_return_value( good, NO );
+
+	const uint8_t * const tail = (const uint8_t *) tailData.bytes;
+	const uint8_t *end = NULL;
+	for( size_t i = tailLen - ENZipEndRecordSize + 1; i-- > 0; )
+	{
+		if( ReadLittle32( &tail[ i ] ) == ENZipEndRecordSignature )
+		{
+			end = &tail[ i ];
+			break;
+		}
+	}
+	require_return_no( end, outError, ENErrorF( ENErrorCodeBadFormat, "No zip end of central directory" ) );
+
+	uint16_t entryCount	= ReadLittle16( &end[ 10 ] );
+	uint32_t dirSize	= ReadLittle32( &end[ 12 ] );
+	uint32_t dirOffset	= ReadLittle32( &end[ 16 ] );
+	require_return_no( ( dirSize != ENZip32Sentinel ) && ( dirOffset != ENZip32Sentinel ), outError,
+		ENErrorF( ENErrorCodeUnsupported, "ZIP64 archives not supported" ) );
+	require_return_no( ( (uint64_t) dirOffset + dirSize ) <= (uint64_t) fileSize, outError,
+		ENErrorF( ENErrorCodeBadFormat, "Central directory out of range: %u + %u", dirOffset, dirSize ) );
+	require_return_no( dirSize <= ENZipCentralDirectoryMaxSize, outError,
+		ENErrorF( ENErrorCodeBadFormat, "Central directory too big: %u", dirSize ) );
+
+	NSMutableData *dirData = [[NSMutableData alloc] initWithLength:dirSize];
+	good = [self _readAtOffset:dirOffset buffer:dirData.mutableBytes length:dirSize error:outError];
+	require_return_value( good, NO );
+
+	// Walk the central directory for the member.
+
+	const uint8_t *ptr = (const uint8_t *) dirData.bytes;
+	const uint8_t * const dirEnd = ptr + dirSize;
+	size_t const memberNameLen = strlen( inMemberName );
+	const uint8_t *header = NULL;
+	for( uint16_t i = 0; i < entryCount; ++i )
+	{
+		require_return_no( ( dirEnd - ptr ) >= ENZipCentralHeaderSize, outError,
+			ENErrorF( ENErrorCodeBadFormat, "Central directory truncated" ) );
+		require_return_no( ReadLittle32( ptr ) == ENZipCentralHeaderSignature, outError,
+			ENErrorF( ENErrorCodeBadFormat, "Bad central directory signature" ) );
+
+		size_t nameLen		= ReadLittle16( &ptr[ 28 ] );
+		size_t extraLen		= ReadLittle16( &ptr[ 30 ] );
+		size_t commentLen	= ReadLittle16( &ptr[ 32 ] );
+		size_t headerLen	= ENZipCentralHeaderSize + nameLen + extraLen + commentLen;
+		require_return_no( (size_t)( dirEnd - ptr ) >= headerLen, outError,
+			ENErrorF( ENErrorCodeBadFormat, "Central directory entry truncated" ) );
+
+		if( ( nameLen == memberNameLen ) && ( memcmp( &ptr[ ENZipCentralHeaderSize ], inMemberName, nameLen ) == 0 ) )
+		{
+			header = ptr;
+			break;
+		}
+		ptr += headerLen;
+	}
+	require_return_no( header, outError, ENNSErrorF( kNotFoundErr, "Archive member not found: '%s'", inMemberName ) );
+
+	uint16_t flags				= ReadLittle16( &header[ 8 ] );
+	uint16_t method				= ReadLittle16( &header[ 10 ] );
+	uint32_t crc				= ReadLittle32( &header[ 16 ] );
+	uint32_t compressedSize		= ReadLittle32( &header[ 20 ] );
+	uint32_t uncompressedSize	= ReadLittle32( &header[ 24 ] );
+	uint32_t localOffset		= ReadLittle32( &header[ 42 ] );
+	require_return_no( !( flags & ENZipFlagEncrypted ), outError,
+		ENErrorF( ENErrorCodeUnsupported, "Encrypted archive members not supported" ) );
+	require_return_no( ( method == ENZipMethodStored ) || ( method == ENZipMethodDeflate ), outError,
+		ENErrorF( ENErrorCodeUnsupported, "Compression method not supported: %u", method ) );
+	require_return_no( ( compressedSize != ENZip32Sentinel ) && ( uncompressedSize != ENZip32Sentinel ) &&
+		( localOffset != ENZip32Sentinel ), outError, ENErrorF( ENErrorCodeUnsupported, "ZIP64 members not supported" ) );
+	require_return_no( ( method != ENZipMethodStored ) || ( compressedSize == uncompressedSize ), outError,
+		ENErrorF( ENErrorCodeBadFormat, "Stored member size mismatch: %u vs %u", compressedSize, uncompressedSize ) );
+
+	// Read the local header to find where the data starts.
+
+	uint8_t localHeader[ ENZipLocalHeaderSize ];
+	good = [self _readAtOffset:localOffset buffer:localHeader length:sizeof( localHeader ) error:outError];
+	require_return_value( good, NO );
+	require_return_no( ReadLittle32( localHeader ) == ENZipLocalHeaderSignature, outError,
+		ENErrorF( ENErrorCodeBadFormat, "Bad local header signature" ) );
+
+	uint64_t dataOffset = (uint64_t) localOffset + ENZipLocalHeaderSize + ReadLittle16( &localHeader[ 26 ] ) +
+		ReadLittle16( &localHeader[ 28 ] );
+	require_return_no( ( dataOffset + compressedSize ) <= (uint64_t) fileSize, outError,
+		ENErrorF( ENErrorCodeBadFormat, "Member data out of range: %llu + %u", dataOffset, compressedSize ) );
+
+	_dataOffset			= dataOffset;
+	_compressedSize		= compressedSize;
+	_uncompressedSize	= uncompressedSize;
+	_expectedCRC		= crc;
+	_method				= method;
+	return( YES );
+}
+
+//===========================================================================================================================
+
+- (BOOL) _readAtOffset:(uint64_t) inOffset buffer:(void *) inBuffer length:(size_t) inLen error:(ENErrorOutType) outError
+{
+	FILE *fileHandle = _fileHandle;
+	int err = fseeko( fileHandle, (off_t) inOffset, SEEK_SET );
+	err = map_global_value_errno( !err, fileHandle );
+	require_return_no( !err, outError, ENNSErrorF( err, "fseek failed: %llu", inOffset ) );
+
+	size_t n = fread( inBuffer, 1, inLen, fileHandle );
+	if( n != inLen )
+	{
+		err = feof( fileHandle ) ? kEndOfDataErr : errno ?: kReadErr;
+		if( outError ) *outError = ENErrorF( ENErrorCodeBadFormat, "Read archive failed: %zu of %zu bytes at %llu, %#m",
+			n, inLen, inOffset, err );
+		return( NO );
+	}
+	return( YES );
+}
+
+// MARK: -
+
+//===========================================================================================================================
+
+- (size_t) readBytes:(void *) inBuffer maxLength:(size_t) inMaxLen error:(ENErrorOutType) outError
+{
+	// Never return more than the central directory says there is, even if the compressed stream has more.
+
+	uint64_t remaining = _uncompressedSize - _offset;
+	size_t len = (size_t) Min( (uint64_t) inMaxLen, remaining );
+	if( len == 0 )
+	{
+		if( outError ) *outError = nil;
+		return( 0 );
+	}
+
+	size_t n;
+	if( _method == ENZipMethodStored )
+	{
+		FILE *fileHandle = _fileHandle;
+		n = fread( inBuffer, 1, len, fileHandle );
+		if( n == 0 )
+		{
+			OSStatus err = ferror( fileHandle ) ? ( errno ?: kReadErr ) : kUnderrunErr;
+			if( outError ) *outError = ENNSErrorF( err, "Read archive member failed at %llu", _offset );
+			return( 0 );
+		}
+		_compressedRead += n;
+	}
+	else
+	{
+		n = [self _inflateBytes:inBuffer length:len error:outError];
+		if( n == 0 ) return( 0 );
+	}
+
+	if( _crcValid ) _crc = (uint32_t) crc32( _crc, (const Bytef *) inBuffer, (uInt) n );
+	_offset += n;
+
+	// Verify the CRC once the whole member has been read in order.
+
+	if( ( _offset == _uncompressedSize ) && _crcValid )
+	{
+		_crcValid = NO;
+		require_return_with_error( _crc == _expectedCRC, 0, outError,
+			ENNSErrorF( kChecksumErr, "Archive member CRC mismatch: 0x%08X vs 0x%08X", _crc, _expectedCRC ) );
+	}
+	if( outError ) *outError = nil;
+	return( n );
+}
+
+//===========================================================================================================================
+
+- (size_t) _inflateBytes:(void *) inBuffer length:(size_t) inLen error:(ENErrorOutType) outError
+{
+	z_stream * const zstream = &_zstream;
+	zstream->next_out	= (Bytef *) inBuffer;
+	zstream->avail_out	= (uInt) Min( inLen, (size_t) UINT_MAX );
+
+	for( ;; )
+	{
+		if( ( zstream->avail_in == 0 ) && ( _compressedRead < _compressedSize ) )
+		{
+			size_t len = (size_t) Min( (uint64_t) ENFileArchiveInputBufferSize, _compressedSize - _compressedRead );
+			size_t n = fread( _inputBuffer, 1, len, _fileHandle );
+			if( n == 0 )
+			{
+				OSStatus err = ferror( _fileHandle ) ? ( errno ?: kReadErr ) : kUnderrunErr;
+				if( outError ) *outError = ENNSErrorF( err, "Read compressed data failed at %llu", _compressedRead );
+				return( 0 );
+			}
+			zstream->next_in	= _inputBuffer;
+			zstream->avail_in	= (uInt) n;
+			_compressedRead		+= n;
+		}
+
+		uInt availIn = zstream->avail_in;
+		int zerr = inflate( zstream, Z_NO_FLUSH );
+		size_t produced = (size_t)( zstream->next_out - (Bytef *) inBuffer );
+		if( produced > 0 ) return( produced );
+
+		// Nothing produced. Stop if the stream ended early, is corrupt, or can't make progress with the input available.
+
+		if( zerr == Z_STREAM_END )
+		{
+			if( outError ) *outError = ENNSErrorF( kUnderrunErr, "Compressed data ended at %llu of %llu bytes",
+				_offset, _uncompressedSize );
+			return( 0 );
+		}
+		if( ( zerr != Z_OK ) && ( zerr != Z_BUF_ERROR ) )
+		{
+			if( outError ) *outError = ENErrorF( ENErrorCodeBadFormat, "Inflate failed: %d, %s", zerr,
+				zstream->msg ? zstream->msg : "?" );
+			return( 0 );
+		}
+		if( ( zstream->avail_in == availIn ) && ( _compressedRead >= _compressedSize ) )
+		{
+			if( outError ) *outError = ENNSErrorF( kUnderrunErr, "Compressed data truncated at %llu of %llu bytes",
+				_offset, _uncompressedSize );
+			return( 0 );
+		}
+	}
+}
+
+//===========================================================================================================================
+
+- (NSData * _Nullable) readDataToEndWithMaxLength:(size_t) inMaxLen error:(ENErrorOutType) outError
+{
+	uint64_t remaining = _uncompressedSize - _offset;
+	require_return_nil( remaining <= inMaxLen, outError,
+		ENErrorF( ENErrorCodeBadFormat, "Archive member too big: %llu bytes, max %zu", remaining, inMaxLen ) );
+
+	NSMutableData *data = [[NSMutableData alloc] initWithLength:(size_t) remaining];
+	uint8_t *ptr = (uint8_t *) data.mutableBytes;
+	size_t len = 0;
+	while( len < remaining )
+	{
+		NSError *error = nil;
+		size_t n = [self readBytes:&ptr[ len ] maxLength:(size_t) remaining - len error:&error];
+		require_return_nil( n > 0, outError, error ?: ENNSErrorF( kUnderrunErr, "Archive member ended early" ) );
+		len += n;
+	}
+	return( data );
+}
+
+//===========================================================================================================================
+
+- (BOOL) seekToOffset:(uint64_t) inOffset error:(ENErrorOutType) outError
+{
+	if( inOffset == _offset ) return( YES );
+	require_return_no( inOffset <= _uncompressedSize, outError,
+		ENNSErrorF( kRangeErr, "Seek past end of archive member: %llu of %llu", inOffset, _uncompressedSize ) );
+
+	if( _method == ENZipMethodStored )
+	{
+		// Stored data maps directly to the archive so seek to it. The CRC can no longer be verified.
+
+		int err = fseeko( _fileHandle, (off_t)( _dataOffset + inOffset ), SEEK_SET );
+		err = map_global_value_errno( !err, _fileHandle );
+		require_return_no( !err, outError, ENNSErrorF( err, "fseek failed: %llu", inOffset ) );
+		_compressedRead = inOffset;
+		_offset = inOffset;
+		_crcValid = ( inOffset == 0 );
+		_crc = (uint32_t) crc32( 0, Z_NULL, 0 );
+		return( YES );
+	}
+
+	// Deflate streams can only be read forward so go back to the start if needed then decompress up to the offset.
+
+	if( inOffset < _offset )
+	{
+		BOOL good = [self _rewindAndReturnError:outError];
+		require_return_value( good, NO );
+	}
+
+	uint8_t discard[ ENFileArchiveDiscardBufferSize ];
+	while( _offset < inOffset )
+	{
+		NSError *error = nil;
+		size_t len = (size_t) Min( (uint64_t) sizeof( discard ), inOffset - _offset );
+		size_t n = [self readBytes:discard maxLength:len error:&error];
+		require_return_no( n > 0, outError, error ?: ENNSErrorF( kUnderrunErr, "Archive member ended early" ) );
+	}
+	return( YES );
+}
+
+//===========================================================================================================================
+
+- (BOOL) _rewindAndReturnError:(ENErrorOutType) outError
+{
+	int err = fseeko( _fileHandle, (off_t) _dataOffset, SEEK_SET );
+	err = map_global_value_errno( !err, _fileHandle );
+	require_return_no( !err, outError, ENNSErrorF( err, "fseek failed: %llu", _dataOffset ) );
+
+	if( _zstreamInitialized )
+	{
+		int zerr = inflateReset( &_zstream );
+		require_return_no( zerr == Z_OK, outError, ENErrorF( ENErrorCodeInternal, "inflateReset failed: %d", zerr ) );
+		_zstream.next_in	= _inputBuffer;
+		_zstream.avail_in	= 0;
+	}
+	_compressedRead = 0;
+	_offset = 0;
+	_crc = (uint32_t) crc32( 0, Z_NULL, 0 );
+	_crcValid = YES;
+	return( YES );
+}
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,65 @@
+/*
+ *      Copyright (C) 2020 Apple Inc. All Rights Reserved.
+ *
+ *      ExposureNotification is licensed under Apple Inc.’s
+ *      Sample Code License Agreement, which is contained in
+ *      the LICENSE file distributed with ExposureNotification,
+ *      and only to those who accept that license.
+ *
+ */
+
+#pragma once
+
+#import <ExposureNotification/ExposureNotification.h>
+#import <Foundation/Foundation.h>
+#import <Security/Security.h>
+
+#import "ENFile.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+@class ENSignature;
+
+//===========================================================================================================================
+/*!	@brief	Splits a large set of keys into batches of signed export.bin/export.sig files.
+
+	Each batch is written to its own directory named by its batch number (e.g. "<dir>/1/export.bin" and
+	"<dir>/1/export.sig"), matching the layout of the archives served to devices. Batches are written and signed in
+	parallel and each one carries the batch number and batch size in both its file metadata and its signature.
+*/
+EN_API_AVAILABLE_EXPORT
+@interface ENFileExporter : NSObject
+
+/// Metadata written to every file (e.g. region and start/end timestamps). Batch number and size are set per file.
+@property (readwrite, copy, nullable, nonatomic) NSDictionary *		metadata;
+
+/// Maximum number of keys in each file. 0 for no limit.
+@property (readwrite, assign, nonatomic) size_t						maxKeysPerFile;
+
+/// Maximum size of each export.bin in bytes. 0 for no limit.
+@property (readwrite, assign, nonatomic) size_t						maxBytesPerFile;
+
+/// Signature info (bundle IDs, key ID, key version, and algorithm) copied into each signature. Batch fields are set per file.
+@property (readwrite, strong, nullable, nonatomic) ENSignature *	signatureTemplate;
+
+/// EC P-256 private key used to sign each file with ECDSA over the SHA-256 of export.bin.
+@property (readwrite, assign, nullable, nonatomic) SecKeyRef		signingKey;
+
+/// Writes all the keys as one or more batches. Returns the batch directories in batch number order.
+- (NSArray <NSString *> * _Nullable)
+	exportKeys:		(const ENFileKeyRecord *)	inKeys
+	count:			(size_t)					inCount
+	toDirectory:	(NSString *)				inDirectory
+	error:			(ENErrorOutType)			outError;
+
+@end
+
+#ifdef __cplusplus
+}
+#endif
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,211 @@
+/*
+ *      Copyright (C) 2020 Apple Inc. All Rights Reserved.
+ *
+ *      ExposureNotification is licensed under Apple Inc.’s
+ *      Sample Code License Agreement, which is contained in
+ *      the LICENSE file distributed with ExposureNotification,
+ *      and only to those who accept that license.
+ *
+ */
+
+#import <ExposureNotification/ExposureNotification.h>
+#import <os/lock.h>
+#import <Security/Security.h>
+
+#import "ENCommonPrivate.h"
+#import "ENFile.h"
+#import "ENFileExporter.h"
+#import "ENShims.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+//===========================================================================================================================
+
+#define ENFileExporterMainFileName				@"export" ENFileExtensionMainProtoFull
+#define ENFileExporterSignatureFileName			@"export" ENFileExtensionSignatureProtoFull
+
+// Bytes reserved for the identifier and metadata when sizing files by maxBytesPerFile.
+
+#define ENFileExporterHeaderReserve				256
+
+//===========================================================================================================================
+
+@implementation ENFileExporter
+
+//===========================================================================================================================
+
+- (void) dealloc
+{
+	if( _signingKey ) CFRelease( _signingKey );
+}
+
+//===========================================================================================================================
+
+- (void) setSigningKey:(SecKeyRef _Nullable) inKey
+{
+	if( inKey ) CFRetain( inKey );
+	if( _signingKey ) CFRelease( _signingKey );
+	_signingKey = inKey;
+}
+
+//===========================================================================================================================
+
+- (size_t) _keysPerFileForCount:(size_t) inCount
+{
+	size_t keysPerFile = SIZE_MAX;
+	if( _maxKeysPerFile > 0 ) keysPerFile = _maxKeysPerFile;
+	if( _maxBytesPerFile > 0 )
+	{
+		size_t keyBytes = ( _maxBytesPerFile > ENFileExporterHeaderReserve ) ? ( _maxBytesPerFile - ENFileExporterHeaderReserve ) : 0;
+		keysPerFile = Min( keysPerFile, Max( keyBytes / ENFileKeyRecordMaxEncodedSize, 1U ) );
+	}
+	if( inCount == 0 ) return( 0 );
+
+	// Spread keys evenly across the minimum number of files so the last file isn't a small remainder.
+
+	size_t fileCount = ( inCount / keysPerFile ) + ( ( inCount % keysPerFile ) ? 1 : 0 );
+	return( ( inCount / fileCount ) + ( ( inCount % fileCount ) ? 1 : 0 ) );
+}
+
+//===========================================================================================================================
+
+- (NSArray <NSString *> * _Nullable)
+	exportKeys:		(const ENFileKeyRecord *)	inKeys
+	count:			(size_t)					inCount
+	toDirectory:	(NSString *)				inDirectory
+	error:			(ENErrorOutType)			outError
+{
+	require_return_nil( _signingKey, outError, ENErrorF( ENErrorCodeAPIMisuse, "No signing key" ) );
+
+	size_t keysPerFile = [self _keysPerFileForCount:inCount];
+	size_t fileCount = ( keysPerFile > 0 ) ? ( ( inCount + keysPerFile - 1 ) / keysPerFile ) : 1;
+	require_return_nil( fileCount <= UINT32_MAX, outError, ENErrorF( ENErrorCodeBadParameter, "Too many files: %zu", fileCount ) );
+	EN_NOTICE_PRINTF( "Export %zu keys as %zu file(s), %zu keys per file", inCount, fileCount, keysPerFile );
+
+    NSMutableArray <NSString *> *paths = [[NSMutableArray alloc] initWithCapacity:fileCount];
+	for( size_t i = 0; i < fileCount; ++i )
+	{
+		[paths addObject:[inDirectory stringByAppendingPathComponent:[NSString stringWithFormat:@"%zu", i + 1]]];
+	}
+
+	// Write and sign each file concurrently. Stop starting new files after the first failure.
+
+	__block os_unfair_lock errorLock = OS_UNFAIR_LOCK_INIT;
+	__block NSError *firstError = nil;
+	__block BOOL failed = NO;
+	dispatch_apply( fileCount, dispatch_get_global_queue( QOS_CLASS_UTILITY, 0 ),
+	^( size_t inIndex )
+	{
+		os_unfair_lock_lock( &errorLock );
+		BOOL skip = failed;
+		os_unfair_lock_unlock( &errorLock );
+		if( skip ) return;
+
+		@autoreleasepool
+		{
+			size_t start = inIndex * keysPerFile;
+			size_t count = ( inCount > start ) ? Min( keysPerFile, inCount - start ) : 0;
+			NSError *error = nil;
+			BOOL good = [self _exportFileAtPath:paths[ inIndex ] keys:&inKeys[ start ] count:count
+				batchNumber:(uint32_t)( inIndex + 1 ) batchCount:(uint32_t) fileCount error:&error];
+			if( !good )
+			{
+				os_unfair_lock_lock( &errorLock );
+				if( !failed ) firstError = error;
+				failed = YES;
+				os_unfair_lock_unlock( &errorLock );
+			}
+		}
+	} );
+	require_return_nil( !failed, outError, firstError );
+
+	return( paths );
+}
+
+//===========================================================================================================================
+
+- (BOOL)
+	_exportFileAtPath:	(NSString *)				inPath
+	keys:				(const ENFileKeyRecord *)	inKeys
+	count:				(size_t)					inCount
+	batchNumber:		(uint32_t)					inBatchNumber
+	batchCount:			(uint32_t)					inBatchCount
+	error:				(ENErrorOutType)			outError
+{
+	NSError *error = nil;
+	BOOL good = [[NSFileManager defaultManager] createDirectoryAtPath:inPath withIntermediateDirectories:YES
+		attributes:nil error:&error];
+	require_return_no( good, outError, ENNestedErrorF( error, ENErrorCodeUnknown, "Create directory failed: %@", inPath ) );
+
+	// Write the keys. The hash is computed as the file is written so it's ready to sign when the file is closed.
+
+    NSMutableDictionary *metadata = _metadata ? [_metadata mutableCopy] : [[NSMutableDictionary alloc] init];
+	metadata[ ENFileMetadataKeyBatchNumber ] = @(inBatchNumber);
+	metadata[ ENFileMetadataKeyBatchSize ] = @(inBatchCount);
+
+    ENFile *file = [[ENFile alloc] init];
+	file.metadata = metadata;
+
+    NSString *mainPath = [inPath stringByAppendingPathComponent:ENFileExporterMainFileName];
+	good = [file openWithFileSystemRepresentation:mainPath.fileSystemRepresentation reading:NO error:outError];
+	require_return_value( good, NO );
+
+	good = [file writeTEKs:inKeys count:inCount error:outError];
+	require_return_value( good, NO );
+
+	good = [file closeAndReturnError:outError];
+	require_return_value( good, NO );
+
+    NSData *hashData = file.sha256Data;
+	require_return_no( hashData, outError, ENErrorF( ENErrorCodeInternal, "No hash for batch %u", inBatchNumber ) );
+
+	// Sign the hash.
+
+	CFErrorRef cfError = NULL;
+	CFDataRef signatureData = SecKeyCreateSignature( _signingKey, kSecKeyAlgorithmECDSASignatureDigestX962SHA256,
+		(__bridge CFDataRef) hashData, &cfError );
+	if( !signatureData )
+	{
+		if( outError ) *outError = ENNestedErrorF( (__bridge NSError *) cfError, ENErrorCodeUnknown,
+			"Sign batch %u failed", inBatchNumber );
+		if( cfError ) CFRelease( cfError );
+		return( NO );
+	}
+
+    ENSignature *signature = [[ENSignature alloc] init];
+    ENSignature *signatureTemplate = _signatureTemplate;
+	signature.appleBundleID			= signatureTemplate.appleBundleID;
+	signature.androidBundleID		= signatureTemplate.androidBundleID;
+	signature.keyID					= signatureTemplate.keyID;
+	signature.keyVersion			= signatureTemplate.keyVersion;
+	signature.signatureAlgorithm	= signatureTemplate.signatureAlgorithm;
+	signature.batchNumber			= inBatchNumber;
+	signature.batchCount			= inBatchCount;
+	signature.signatureData			= (__bridge_transfer NSData *) signatureData;
+
+	// Write the signature file.
+
+    ENSignatureFile *signatureFile = [[ENSignatureFile alloc] init];
+	signatureFile.signatures = @[ signature ];
+
+    NSString *signaturePath = [inPath stringByAppendingPathComponent:ENFileExporterSignatureFileName];
+	good = [signatureFile openWithFileSystemRepresentation:signaturePath.fileSystemRepresentation reading:NO error:outError];
+	require_return_value( good, NO );
+
+	good = [signatureFile writeAndReturnError:outError];
+	if( !good )
+	{
+		[signatureFile closeAndReturnError:NULL];
+		return( NO );
+	}
+
+	good = [signatureFile closeAndReturnError:outError];
+	require_return_value( good, NO );
+
+	EN_DEBUG_PRINTF( "Exported batch %u of %u: %zu keys", inBatchNumber, inBatchCount, inCount );
+	return( YES );
+}
+
+@end
+
+NS_ASSUME_NONNULL_END
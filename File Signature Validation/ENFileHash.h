@@ -0,0 +1,110 @@
+/*
+ *      Copyright (C) 2020 Apple Inc. All Rights Reserved.
+ *
+ *      ExposureNotification is licensed under Apple Inc.’s
+ *      Sample Code License Agreement, which is contained in
+ *      the LICENSE file distributed with ExposureNotification,
+ *      and only to those who accept that license.
+ *
+ */
+
+#pragma once
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//===========================================================================================================================
+/*!	@brief	Constants
+*/
+
+#define ENFileHashLength						32 // SHA-256 output size.
+
+/// Number of buffers hashed together by the multi-buffer SHA-256, one per 32-bit lane of an AVX2 register.
+#define ENFileHashMultiBufferLanes				8
+
+//===========================================================================================================================
+/*!	@brief	State of an incremental SHA-256. It's plain data, so a state after a common prefix (e.g. an HMAC key block)
+			can be copied and continued from many times.
+*/
+typedef struct
+{
+	uint32_t		state[ 8 ];
+	uint64_t		totalLen;		// Bytes hashed so far, including those still in block.
+	uint8_t			block[ 64 ];	// Bytes of the current partial block.
+	size_t			blockLen;
+	
+}	ENFileHashSHA256Context;
+
+//===========================================================================================================================
+/*!	@brief	SHA-256 implementations for hashing key files.
+*/
+typedef enum
+{
+	ENFileHashBackendCoreCrypto		= 0,	// ccsha256_di(), which uses AVX2, AVX or SSSE3 on Intel when available.
+	ENFileHashBackendSHANI			= 1,	// Intel SHA extensions.
+	ENFileHashBackendARMv8			= 2,	// ARMv8 SHA-256 instructions.
+	ENFileHashBackendPortable		= 3,	// Plain C, for builds without corecrypto.
+	ENFileHashBackendCount
+
+}	ENFileHashBackend;
+
+/// Returns the fastest backend available on this CPU. This is what ENFileHashSHA256 uses.
+ENFileHashBackend	ENFileHashDefaultBackend( void );
+
+/// Returns true if the backend can run on this CPU.
+Boolean				ENFileHashBackendIsAvailable( ENFileHashBackend inBackend );
+
+/// Short name of the backend for logs and benchmarks (e.g. "sha-ni").
+const char *		ENFileHashBackendName( ENFileHashBackend inBackend );
+
+/// Returns true if ENFileHashSHA256MultiBuffer hashes several buffers per pass (AVX2 lanes) on this CPU.
+Boolean				ENFileHashMultiBufferIsAccelerated( void );
+
+//===========================================================================================================================
+/*!	@brief	Hashes a buffer with the default backend.
+*/
+void	ENFileHashSHA256( const void *inPtr, size_t inLen, uint8_t outHash[ ENFileHashLength ] );
+
+//===========================================================================================================================
+/*!	@brief	Hashes a buffer with a specific backend, e.g. to compare backends. Unavailable backends fall back to the
+			portable one.
+*/
+void
+	ENFileHashSHA256WithBackend(
+		ENFileHashBackend	inBackend,
+		const void *		inPtr,
+		size_t				inLen,
+		uint8_t				outHash[ ENFileHashLength ] );
+
+//===========================================================================================================================
+/*!	@brief	Incremental SHA-256 with the fastest compression available on this CPU (SHA extensions, ARMv8 SHA-256
+			instructions or plain C). Final clears the context.
+*/
+void	ENFileHashSHA256Init( ENFileHashSHA256Context *outContext );
+void	ENFileHashSHA256Update( ENFileHashSHA256Context *ioContext, const void *inPtr, size_t inLen );
+void	ENFileHashSHA256Final( ENFileHashSHA256Context *ioContext, uint8_t outHash[ ENFileHashLength ] );
+
+//===========================================================================================================================
+/*!	@brief	Hashes many buffers, writing one hash per buffer in order.
+
+	On CPUs with AVX2 but no SHA extensions, buffers are hashed ENFileHashMultiBufferLanes at a time, each in its own
+	32-bit lane of one SHA-256 compression, and grouped by length so lanes finish together. Otherwise each buffer is
+	hashed with the default backend. Groups are independent, so callers may split a large batch across threads.
+*/
+void
+	ENFileHashSHA256MultiBuffer(
+		const void * const *	inPtrs,
+		const size_t *			inLens,
+		size_t					inCount,
+		uint8_t					outHashes[ _Nonnull ][ ENFileHashLength ] );
+
+#ifdef __cplusplus
+}
+#endif
+
+NS_ASSUME_NONNULL_END
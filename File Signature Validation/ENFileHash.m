@@ -0,0 +1,580 @@
+/*
+ *      Copyright (C) 2020 Apple Inc. All Rights Reserved.
+ *
+ *      ExposureNotification is licensed under Apple Inc.’s
+ *      Sample Code License Agreement, which is contained in
+ *      the LICENSE file distributed with ExposureNotification,
+ *      and only to those who accept that license.
+ *
+ */
+
+#if( __has_include( <corecrypto/ccsha2.h> ) )
+	#import <corecrypto/ccdigest.h>
+	#import <corecrypto/ccsha2.h>
+	#define ENFileHashHasCoreCrypto	1
+#else
+	#define ENFileHashHasCoreCrypto	0
+#endif
+
+#if( defined( __x86_64__ ) || defined( __i386__ ) )
+	#import <immintrin.h>
+	#define ENFileHashHasX86		1
+#else
+	#define ENFileHashHasX86		0
+#endif
+
+#if( defined( __aarch64__ ) && ( defined( __ARM_FEATURE_SHA2 ) || defined( __ARM_FEATURE_CRYPTO ) ) )
+	#import <arm_neon.h>
+	#define ENFileHashHasARMv8		1
+#else
+	#define ENFileHashHasARMv8		0
+#endif
+
+#import "ENCommonPrivate.h"
+#import "ENFileHash.h"
+#import "ENShims.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+//===========================================================================================================================
+
+#define ENSHA256BlockSize			64
+#define ENSHA256MaxTailBlocks		2 // The last partial block, 0x80 and the 64-bit length may spill into a second block.
+
+typedef void ( *ENSHA256Compress_f )( uint32_t ioState[ 8 ], const uint8_t *inData, size_t inBlocks );
+
+static const uint32_t		kENSHA256InitialState[ 8 ] =
+{
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+static const uint32_t		kENSHA256K[ 64 ] __attribute__( ( aligned( 16 ) ) ) =
+{
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+//===========================================================================================================================
+
+// Writes the padded last blocks of a message: the bytes after its last full block, 0x80, zeros, and the bit length.
+// Returns the number of blocks written.
+
+static size_t _ENSHA256PadTail( const uint8_t *inTail, size_t inTailLen, uint64_t inTotalLen, uint8_t *outBlocks )
+{
+	size_t blocks = ( ( inTailLen + 1 + sizeof( uint64_t ) ) > ENSHA256BlockSize ) ? 2 : 1;
+	size_t len = blocks * ENSHA256BlockSize;
+
+	memset( outBlocks, 0, len );
+	if( inTailLen > 0 ) memcpy( outBlocks, inTail, inTailLen );
+	outBlocks[ inTailLen ] = 0x80;
+	WriteBig64( &outBlocks[ len - sizeof( uint64_t ) ], inTotalLen * 8 );
+	return( blocks );
+}
+
+//===========================================================================================================================
+
+static void _ENSHA256WithCompress( ENSHA256Compress_f inCompress, const uint8_t *inPtr, size_t inLen, uint8_t *outHash )
+{
+	uint32_t state[ 8 ];
+	memcpy( state, kENSHA256InitialState, sizeof( state ) );
+
+	size_t fullBlocks = inLen / ENSHA256BlockSize;
+	if( fullBlocks > 0 ) inCompress( state, inPtr, fullBlocks );
+
+	uint8_t tail[ ENSHA256MaxTailBlocks * ENSHA256BlockSize ];
+	size_t tailBlocks = _ENSHA256PadTail( inPtr + ( fullBlocks * ENSHA256BlockSize ), inLen % ENSHA256BlockSize, inLen, tail );
+	inCompress( state, tail, tailBlocks );
+
+	for( size_t i = 0; i < countof( state ); ++i ) WriteBig32( &outHash[ i * 4 ], state[ i ] );
+}
+
+// MARK: - Portable
+
+#define _ENRotr32( X, N )		( ( (X) >> (N) ) | ( (X) << ( 32 - (N) ) ) )
+
+//===========================================================================================================================
+
+static void _ENSHA256CompressPortable( uint32_t ioState[ 8 ], const uint8_t *inData, size_t inBlocks )
+{
+	for( ; inBlocks > 0; --inBlocks, inData += ENSHA256BlockSize )
+	{
+		uint32_t w[ 64 ];
+		for( int t = 0; t < 16; ++t ) w[ t ] = ReadBig32( &inData[ t * 4 ] );
+		for( int t = 16; t < 64; ++t )
+		{
+			uint32_t s0 = _ENRotr32( w[ t - 15 ], 7 ) ^ _ENRotr32( w[ t - 15 ], 18 ) ^ ( w[ t - 15 ] >> 3 );
+			uint32_t s1 = _ENRotr32( w[ t - 2 ], 17 ) ^ _ENRotr32( w[ t - 2 ], 19 ) ^ ( w[ t - 2 ] >> 10 );
+			w[ t ] = w[ t - 16 ] + s0 + w[ t - 7 ] + s1;
+		}
+
+		uint32_t a = ioState[ 0 ], b = ioState[ 1 ], c = ioState[ 2 ], d = ioState[ 3 ];
+		uint32_t e = ioState[ 4 ], f = ioState[ 5 ], g = ioState[ 6 ], h = ioState[ 7 ];
+		for( int t = 0; t < 64; ++t )
+		{
+			uint32_t t1 = h + ( _ENRotr32( e, 6 ) ^ _ENRotr32( e, 11 ) ^ _ENRotr32( e, 25 ) ) + ( ( e & f ) ^ ( ~e & g ) ) +
+				kENSHA256K[ t ] + w[ t ];
+			uint32_t t2 = ( _ENRotr32( a, 2 ) ^ _ENRotr32( a, 13 ) ^ _ENRotr32( a, 22 ) ) + ( ( a & b ) ^ ( a & c ) ^ ( b & c ) );
+			h = g; g = f; f = e;
+			e = d + t1;
+			d = c; c = b; b = a;
+			a = t1 + t2;
+		}
+		ioState[ 0 ] += a; ioState[ 1 ] += b; ioState[ 2 ] += c; ioState[ 3 ] += d;
+		ioState[ 4 ] += e; ioState[ 5 ] += f; ioState[ 6 ] += g; ioState[ 7 ] += h;
+	}
+}
+
+// MARK: - SHA-NI
+
+#if( ENFileHashHasX86 )
+
+//===========================================================================================================================
+
+__attribute__( ( target( "sha,sse4.1" ) ) )
+static void _ENSHA256CompressSHANI( uint32_t ioState[ 8 ], const uint8_t *inData, size_t inBlocks )
+{
+	const __m128i byteSwap = _mm_set_epi64x( 0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL );
+
+	// The SHA instructions take the state as ABEF and CDGH.
+
+	__m128i tmp	= _mm_shuffle_epi32( _mm_loadu_si128( (const __m128i *) &ioState[ 0 ] ), 0xB1 );	// CDAB
+	__m128i cdgh	= _mm_shuffle_epi32( _mm_loadu_si128( (const __m128i *) &ioState[ 4 ] ), 0x1B );	// HGFE
+	__m128i abef	= _mm_alignr_epi8( tmp, cdgh, 8 );
+	cdgh			= _mm_blend_epi16( cdgh, tmp, 0xF0 );
+
+	for( ; inBlocks > 0; --inBlocks, inData += ENSHA256BlockSize )
+	{
+		const __m128i abefSaved = abef;
+		const __m128i cdghSaved = cdgh;
+		__m128i w[ 4 ];
+
+		for( int i = 0; i < 4; ++i )
+		{
+			w[ i ] = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *) &inData[ i * 16 ] ), byteSwap );
+		}
+		for( int i = 0; i < 16; ++i )
+		{
+			if( i >= 4 )
+			{
+				// W[t] = W[t-16] + sigma0(W[t-15]) + W[t-7] + sigma1(W[t-2]), four words at a time.
+
+				tmp = _mm_sha256msg1_epu32( w[ i & 3 ], w[ ( i + 1 ) & 3 ] );
+				tmp = _mm_add_epi32( tmp, _mm_alignr_epi8( w[ ( i + 3 ) & 3 ], w[ ( i + 2 ) & 3 ], 4 ) );
+				w[ i & 3 ] = _mm_sha256msg2_epu32( tmp, w[ ( i + 3 ) & 3 ] );
+			}
+			__m128i wk = _mm_add_epi32( w[ i & 3 ], _mm_load_si128( (const __m128i *) &kENSHA256K[ i * 4 ] ) );
+			cdgh = _mm_sha256rnds2_epu32( cdgh, abef, wk );
+			abef = _mm_sha256rnds2_epu32( abef, cdgh, _mm_shuffle_epi32( wk, 0x0E ) );
+		}
+		abef = _mm_add_epi32( abef, abefSaved );
+		cdgh = _mm_add_epi32( cdgh, cdghSaved );
+	}
+
+	tmp		= _mm_shuffle_epi32( abef, 0x1B );		// FEBA
+	cdgh	= _mm_shuffle_epi32( cdgh, 0xB1 );		// DCHG
+	_mm_storeu_si128( (__m128i *) &ioState[ 0 ], _mm_blend_epi16( tmp, cdgh, 0xF0 ) );	// DCBA
+	_mm_storeu_si128( (__m128i *) &ioState[ 4 ], _mm_alignr_epi8( cdgh, tmp, 8 ) );		// HGFE
+}
+
+#endif // ENFileHashHasX86
+
+// MARK: - ARMv8
+
+#if( ENFileHashHasARMv8 )
+
+//===========================================================================================================================
+
+static void _ENSHA256CompressARMv8( uint32_t ioState[ 8 ], const uint8_t *inData, size_t inBlocks )
+{
+	uint32x4_t abcd = vld1q_u32( &ioState[ 0 ] );
+	uint32x4_t efgh = vld1q_u32( &ioState[ 4 ] );
+
+	for( ; inBlocks > 0; --inBlocks, inData += ENSHA256BlockSize )
+	{
+		const uint32x4_t abcdSaved = abcd;
+		const uint32x4_t efghSaved = efgh;
+		uint32x4_t w[ 4 ];
+
+		for( int i = 0; i < 4; ++i )
+		{
+			w[ i ] = vreinterpretq_u32_u8( vrev32q_u8( vld1q_u8( &inData[ i * 16 ] ) ) );
+		}
+		for( int i = 0; i < 16; ++i )
+		{
+			if( i >= 4 )
+			{
+				w[ i & 3 ] = vsha256su1q_u32( vsha256su0q_u32( w[ i & 3 ], w[ ( i + 1 ) & 3 ] ),
+					w[ ( i + 2 ) & 3 ], w[ ( i + 3 ) & 3 ] );
+			}
+			uint32x4_t wk = vaddq_u32( w[ i & 3 ], vld1q_u32( &kENSHA256K[ i * 4 ] ) );
+			uint32x4_t abcdPrev = abcd;
+			abcd = vsha256hq_u32( abcd, efgh, wk );
+			efgh = vsha256h2q_u32( efgh, abcdPrev, wk );
+		}
+		abcd = vaddq_u32( abcd, abcdSaved );
+		efgh = vaddq_u32( efgh, efghSaved );
+	}
+
+	vst1q_u32( &ioState[ 0 ], abcd );
+	vst1q_u32( &ioState[ 4 ], efgh );
+}
+
+#endif // ENFileHashHasARMv8
+
+// MARK: - Multi-Buffer
+
+#if( ENFileHashHasX86 )
+
+#define _ENRotr256( X, N )		_mm256_or_si256( _mm256_srli_epi32( (X), (N) ), _mm256_slli_epi32( (X), 32 - (N) ) )
+
+typedef struct
+{
+	const uint8_t *		ptr;
+	size_t				fullBlocks;
+	size_t				totalBlocks;
+	uint8_t				tail[ ENSHA256MaxTailBlocks * ENSHA256BlockSize ];
+
+}	ENSHA256Lane;
+
+//===========================================================================================================================
+
+// Hashes up to ENFileHashMultiBufferLanes messages together. Lane i of each state vector holds message i's state and
+// lanes past the end of their message keep their state while the others finish.
+
+__attribute__( ( target( "avx2" ) ) )
+static void
+	_ENSHA256MultiBufferAVX2(
+		const void * const *	inPtrs,
+		const size_t *			inLens,
+		const size_t *			inIndexes,
+		size_t					inCount,
+		uint8_t					outHashes[ _Nonnull ][ ENFileHashLength ] )
+{
+	ENSHA256Lane lanes[ ENFileHashMultiBufferLanes ];
+	size_t maxBlocks = 0;
+	for( size_t lane = 0; lane < ENFileHashMultiBufferLanes; ++lane )
+	{
+		ENSHA256Lane * const l = &lanes[ lane ];
+		if( lane < inCount )
+		{
+			size_t len = inLens[ inIndexes[ lane ] ];
+			l->ptr = (const uint8_t *) inPtrs[ inIndexes[ lane ] ];
+			l->fullBlocks = len / ENSHA256BlockSize;
+			l->totalBlocks = l->fullBlocks + _ENSHA256PadTail( l->ptr + ( l->fullBlocks * ENSHA256BlockSize ),
+				len % ENSHA256BlockSize, len, l->tail );
+		}
+		else
+		{
+			l->ptr = l->tail;
+			l->fullBlocks = 0;
+			l->totalBlocks = 0;
+		}
+		maxBlocks = Max( maxBlocks, l->totalBlocks );
+	}
+
+	__m256i state[ 8 ];
+	for( int i = 0; i < 8; ++i ) state[ i ] = _mm256_set1_epi32( (int) kENSHA256InitialState[ i ] );
+
+	uint32_t words[ 16 ][ ENFileHashMultiBufferLanes ] __attribute__( ( aligned( 32 ) ) );
+	for( size_t block = 0; block < maxBlocks; ++block )
+	{
+		// Transpose the next block of each lane so word t of every message is in one vector.
+
+		int32_t activeMask[ ENFileHashMultiBufferLanes ];
+		for( size_t lane = 0; lane < ENFileHashMultiBufferLanes; ++lane )
+		{
+			const ENSHA256Lane * const l = &lanes[ lane ];
+			const uint8_t *src;
+			if( block < l->fullBlocks )			src = l->ptr + ( block * ENSHA256BlockSize );
+			else if( block < l->totalBlocks )	src = &l->tail[ ( block - l->fullBlocks ) * ENSHA256BlockSize ];
+			else								src = l->tail;
+			activeMask[ lane ] = ( block < l->totalBlocks ) ? -1 : 0;
+			for( int t = 0; t < 16; ++t ) words[ t ][ lane ] = ReadBig32( &src[ t * 4 ] );
+		}
+
+		__m256i w[ 16 ];
+		for( int t = 0; t < 16; ++t ) w[ t ] = _mm256_load_si256( (const __m256i *) words[ t ] );
+
+		__m256i a = state[ 0 ], b = state[ 1 ], c = state[ 2 ], d = state[ 3 ];
+		__m256i e = state[ 4 ], f = state[ 5 ], g = state[ 6 ], h = state[ 7 ];
+		for( int t = 0; t < 64; ++t )
+		{
+			__m256i wt;
+			if( t < 16 )
+			{
+				wt = w[ t ];
+			}
+			else
+			{
+				__m256i w15 = w[ ( t - 15 ) & 15 ];
+				__m256i w2  = w[ ( t - 2 ) & 15 ];
+				__m256i s0  = _mm256_xor_si256( _mm256_xor_si256( _ENRotr256( w15, 7 ), _ENRotr256( w15, 18 ) ),
+					_mm256_srli_epi32( w15, 3 ) );
+				__m256i s1  = _mm256_xor_si256( _mm256_xor_si256( _ENRotr256( w2, 17 ), _ENRotr256( w2, 19 ) ),
+					_mm256_srli_epi32( w2, 10 ) );
+				wt = _mm256_add_epi32( _mm256_add_epi32( w[ t & 15 ], s0 ), _mm256_add_epi32( w[ ( t - 7 ) & 15 ], s1 ) );
+				w[ t & 15 ] = wt;
+			}
+
+			__m256i S1  = _mm256_xor_si256( _mm256_xor_si256( _ENRotr256( e, 6 ), _ENRotr256( e, 11 ) ), _ENRotr256( e, 25 ) );
+			__m256i ch  = _mm256_xor_si256( _mm256_and_si256( e, f ), _mm256_andnot_si256( e, g ) );
+			__m256i t1  = _mm256_add_epi32( _mm256_add_epi32( h, S1 ),
+				_mm256_add_epi32( ch, _mm256_add_epi32( wt, _mm256_set1_epi32( (int) kENSHA256K[ t ] ) ) ) );
+			__m256i S0  = _mm256_xor_si256( _mm256_xor_si256( _ENRotr256( a, 2 ), _ENRotr256( a, 13 ) ), _ENRotr256( a, 22 ) );
+			__m256i maj = _mm256_xor_si256( _mm256_and_si256( a, b ), _mm256_and_si256( c, _mm256_xor_si256( a, b ) ) );
+			__m256i t2  = _mm256_add_epi32( S0, maj );
+
+			h = g; g = f; f = e;
+			e = _mm256_add_epi32( d, t1 );
+			d = c; c = b; b = a;
+			a = _mm256_add_epi32( t1, t2 );
+		}
+
+		const __m256i mask = _mm256_loadu_si256( (const __m256i *) activeMask );
+		const __m256i out[ 8 ] = { a, b, c, d, e, f, g, h };
+		for( int i = 0; i < 8; ++i )
+		{
+			state[ i ] = _mm256_blendv_epi8( state[ i ], _mm256_add_epi32( state[ i ], out[ i ] ), mask );
+		}
+	}
+
+	uint32_t digestWords[ 8 ][ ENFileHashMultiBufferLanes ] __attribute__( ( aligned( 32 ) ) );
+	for( int i = 0; i < 8; ++i ) _mm256_store_si256( (__m256i *) digestWords[ i ], state[ i ] );
+	for( size_t lane = 0; lane < inCount; ++lane )
+	{
+		uint8_t * const hash = outHashes[ inIndexes[ lane ] ];
+		for( int i = 0; i < 8; ++i ) WriteBig32( &hash[ i * 4 ], digestWords[ i ][ lane ] );
+	}
+	memset( words, 0, sizeof( words ) );
+}
+
+#endif // ENFileHashHasX86
+
+// MARK: - API
+
+//===========================================================================================================================
+
+Boolean	ENFileHashBackendIsAvailable( ENFileHashBackend inBackend )
+{
+	switch( inBackend )
+	{
+		case ENFileHashBackendCoreCrypto:
+			return( ENFileHashHasCoreCrypto );
+
+		case ENFileHashBackendPortable:
+			return( true );
+
+	#if( ENFileHashHasX86 )
+		case ENFileHashBackendSHANI:
+			return( ( ENCPUFeatures() & kENCPUFeatureSHA256 ) != 0 );
+	#endif
+
+	#if( ENFileHashHasARMv8 )
+		case ENFileHashBackendARMv8:
+			return( ( ENCPUFeatures() & kENCPUFeatureSHA256 ) != 0 );
+	#endif
+
+		default:
+			return( false );
+	}
+}
+
+//===========================================================================================================================
+
+ENFileHashBackend	ENFileHashDefaultBackend( void )
+{
+	if( ENFileHashBackendIsAvailable( ENFileHashBackendSHANI ) ) return( ENFileHashBackendSHANI );
+	if( ENFileHashBackendIsAvailable( ENFileHashBackendARMv8 ) ) return( ENFileHashBackendARMv8 );
+	if( ENFileHashBackendIsAvailable( ENFileHashBackendCoreCrypto ) ) return( ENFileHashBackendCoreCrypto );
+	return( ENFileHashBackendPortable );
+}
+
+//===========================================================================================================================
+
+const char *	ENFileHashBackendName( ENFileHashBackend inBackend )
+{
+	switch( inBackend )
+	{
+		case ENFileHashBackendCoreCrypto:	return( "corecrypto" );
+		case ENFileHashBackendSHANI:		return( "sha-ni" );
+		case ENFileHashBackendARMv8:		return( "armv8" );
+		case ENFileHashBackendPortable:		return( "portable" );
+		default:							return( "?" );
+	}
+}
+
+//===========================================================================================================================
+
+Boolean	ENFileHashMultiBufferIsAccelerated( void )
+{
+#if( ENFileHashHasX86 )
+	// One SHA-NI stream is about as fast as eight AVX2 lanes, so lanes only pay off without SHA-NI.
+
+	ENCPUFeatureFlags features = ENCPUFeatures();
+	return( ( features & kENCPUFeatureAVX2 ) && !( features & kENCPUFeatureSHA256 ) );
+#else
+	return( false );
+#endif
+}
+
+//===========================================================================================================================
+
+// Compression of the incremental API. corecrypto's digest state isn't interchangeable with ours, so it isn't used here.
+
+static ENSHA256Compress_f _ENSHA256DefaultCompress( void )
+{
+#if( ENFileHashHasX86 )
+	if( ENFileHashBackendIsAvailable( ENFileHashBackendSHANI ) ) return( _ENSHA256CompressSHANI );
+#endif
+#if( ENFileHashHasARMv8 )
+	if( ENFileHashBackendIsAvailable( ENFileHashBackendARMv8 ) ) return( _ENSHA256CompressARMv8 );
+#endif
+	return( _ENSHA256CompressPortable );
+}
+
+//===========================================================================================================================
+
+void	ENFileHashSHA256Init( ENFileHashSHA256Context *outContext )
+{
+	memcpy( outContext->state, kENSHA256InitialState, sizeof( outContext->state ) );
+	outContext->totalLen = 0;
+	outContext->blockLen = 0;
+}
+
+//===========================================================================================================================
+
+void	ENFileHashSHA256Update( ENFileHashSHA256Context *ioContext, const void *inPtr, size_t inLen )
+{
+	ENSHA256Compress_f compress = _ENSHA256DefaultCompress();
+	const uint8_t *src = (const uint8_t *) inPtr;
+	ioContext->totalLen += inLen;
+	
+	if( ioContext->blockLen > 0 )
+	{
+		size_t len = Min( ENSHA256BlockSize - ioContext->blockLen, inLen );
+		memcpy( &ioContext->block[ ioContext->blockLen ], src, len );
+		ioContext->blockLen += len;
+		src += len;
+		inLen -= len;
+		if( ioContext->blockLen < ENSHA256BlockSize ) return;
+		compress( ioContext->state, ioContext->block, 1 );
+		ioContext->blockLen = 0;
+	}
+	
+	size_t fullBlocks = inLen / ENSHA256BlockSize;
+	if( fullBlocks > 0 ) compress( ioContext->state, src, fullBlocks );
+	src += fullBlocks * ENSHA256BlockSize;
+	inLen -= fullBlocks * ENSHA256BlockSize;
+	
+	if( inLen > 0 ) memcpy( ioContext->block, src, inLen );
+	ioContext->blockLen = inLen;
+}
+
+//===========================================================================================================================
+
+void	ENFileHashSHA256Final( ENFileHashSHA256Context *ioContext, uint8_t outHash[ ENFileHashLength ] )
+{
+	uint8_t tail[ ENSHA256MaxTailBlocks * ENSHA256BlockSize ];
+	size_t tailBlocks = _ENSHA256PadTail( ioContext->block, ioContext->blockLen, ioContext->totalLen, tail );
+	_ENSHA256DefaultCompress()( ioContext->state, tail, tailBlocks );
+	
+	for( size_t i = 0; i < countof( ioContext->state ); ++i ) WriteBig32( &outHash[ i * 4 ], ioContext->state[ i ] );
+	memset( tail, 0, sizeof( tail ) );
+	memset( ioContext, 0, sizeof( *ioContext ) );
+}
+
+//===========================================================================================================================
+
+void	ENFileHashSHA256( const void *inPtr, size_t inLen, uint8_t outHash[ ENFileHashLength ] )
+{
+	ENFileHashSHA256WithBackend( ENFileHashDefaultBackend(), inPtr, inLen, outHash );
+}
+
+//===========================================================================================================================
+
+void
+	ENFileHashSHA256WithBackend(
+		ENFileHashBackend	inBackend,
+		const void *		inPtr,
+		size_t				inLen,
+		uint8_t				outHash[ ENFileHashLength ] )
+{
+	switch( inBackend )
+	{
+	#if( ENFileHashHasX86 )
+		case ENFileHashBackendSHANI:
+			if( !ENFileHashBackendIsAvailable( inBackend ) ) break;
+			_ENSHA256WithCompress( _ENSHA256CompressSHANI, (const uint8_t *) inPtr, inLen, outHash );
+			return;
+	#endif
+
+	#if( ENFileHashHasARMv8 )
+		case ENFileHashBackendARMv8:
+			if( !ENFileHashBackendIsAvailable( inBackend ) ) break;
+			_ENSHA256WithCompress( _ENSHA256CompressARMv8, (const uint8_t *) inPtr, inLen, outHash );
+			return;
+	#endif
+
+	#if( ENFileHashHasCoreCrypto )
+		case ENFileHashBackendCoreCrypto:
+			ccdigest( ccsha256_di(), inLen, inPtr, outHash );
+			return;
+	#endif
+
+		default:
+			break;
+	}
+	_ENSHA256WithCompress( _ENSHA256CompressPortable, (const uint8_t *) inPtr, inLen, outHash );
+}
+
+//===========================================================================================================================
+
+void
+	ENFileHashSHA256MultiBuffer(
+		const void * const *	inPtrs,
+		const size_t *			inLens,
+		size_t					inCount,
+		uint8_t					outHashes[ _Nonnull ][ ENFileHashLength ] )
+{
+#if( ENFileHashHasX86 )
+	if( ENFileHashMultiBufferIsAccelerated() && ( inCount > 1 ) )
+	{
+		// Sort by length so each group's lanes need about the same number of blocks.
+
+		size_t *indexes = (size_t *) malloc( inCount * sizeof( *indexes ) );
+		if( indexes )
+		{
+			for( size_t i = 0; i < inCount; ++i ) indexes[ i ] = i;
+			qsort_b( indexes, inCount, sizeof( *indexes ),
+			^( const void *inLeft, const void *inRight )
+			{
+				size_t leftLen  = inLens[ *( (const size_t *) inLeft ) ];
+				size_t rightLen = inLens[ *( (const size_t *) inRight ) ];
+				return( ( leftLen < rightLen ) ? -1 : ( leftLen > rightLen ) ? 1 : 0 );
+			} );
+
+			for( size_t start = 0; start < inCount; start += ENFileHashMultiBufferLanes )
+			{
+				_ENSHA256MultiBufferAVX2( inPtrs, inLens, &indexes[ start ],
+					Min( inCount - start, (size_t) ENFileHashMultiBufferLanes ), outHashes );
+			}
+			free( indexes );
+			return;
+		}
+	}
+#endif
+
+	ENFileHashBackend backend = ENFileHashDefaultBackend();
+	for( size_t i = 0; i < inCount; ++i )
+	{
+		ENFileHashSHA256WithBackend( backend, inPtrs[ i ], inLens[ i ], outHashes[ i ] );
+	}
+}
+
+NS_ASSUME_NONNULL_END
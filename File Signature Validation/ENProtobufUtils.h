@@ -19,6 +19,33 @@ NS_ASSUME_NONNULL_BEGIN
 extern "C" {
 #endif
 
+//===========================================================================================================================
+/*!	@brief		Protobuf wire types.
+*/
+
+#define ProtobufTypeVarInt				0
+#define ProtobufType64Bit				1
+#define ProtobufTypeLengthDelimited		2
+#define ProtobufTypeStartGroup			3 // Deprecated
+#define ProtobufTypeEndGroup			4 // Deprecated
+#define ProtobufType32Bit				5
+
+//===========================================================================================================================
+/*!	@brief		Source of bytes for decoding something other than memory or a FILE (e.g. a decompressor).
+*/
+@protocol ENProtobufReadSource <NSObject>
+
+/// Offset of the next byte to be read.
+@property (readonly, assign, nonatomic) uint64_t		offset;
+
+/// Reads up to inMaxLen bytes. Returns 0 with no error at the end of the data.
+- (size_t) readBytes:(void *) inBuffer maxLength:(size_t) inMaxLen error:(ENErrorOutType) outError;
+
+/// Moves to an offset so the next read starts there.
+- (BOOL) seekToOffset:(uint64_t) inOffset error:(ENErrorOutType) outError;
+
+@end
+
 //===========================================================================================================================
 /*!	@brief		Encodes objects to or decodes objects in protobuf format.
 */
@@ -35,8 +62,20 @@ EN_API_AVAILABLE_EXPORT
 - (void) setWriteMutableData:(NSMutableData *) inData;
 
 /// Configures for encoding/decoding from a file.
+///
+/// Decoding reads the file through a large read-ahead buffer so the FILE position runs ahead of what has been decoded.
+/// Use fileOffset and seekToFileOffset:error: instead of ftello/fseeko on the FILE while decoding.
 - (void) setFileHandle:(FILE *) inFileHandle;
 
+/// Configures for decoding from a read source. Decoding uses the same read-ahead buffer as files.
+- (void) setReadSource:(id <ENProtobufReadSource>) inSource;
+
+/// Offset in the file or read source of the next byte to decode.
+@property (readonly, assign, nonatomic) uint64_t		fileOffset;
+
+/// Moves decoding to an offset in the file. Offsets within the read-ahead buffer don't touch the file.
+- (BOOL) seekToFileOffset:(uint64_t) inOffset error:(ENErrorOutType) outError;
+
 /// Reads a key (tag + type).
 - (BOOL) readType:(uint8_t *) outType tag:(uint64_t *) outTag eofOkay:(BOOL) inEOFOkay error:(ENErrorOutType) outError;
 
@@ -104,6 +143,9 @@ NS_RETURNS_INNER_POINTER;
 @property (readwrite, assign, nonatomic) size_t							bufferOffset;
 @property (readwrite, assign, nonatomic) size_t							bufferMaxSize;
 
+/// Initial size of the read-ahead buffer used when decoding from a file. Defaults to 256 KB.
+@property (readwrite, assign, nonatomic) size_t							readAheadSize;
+
 @end
 
 #ifdef __cplusplus
@@ -9,6 +9,7 @@
  */
 
 #import <ExposureNotification/ExposureNotification.h>
+#import <fcntl.h>
 
 #import "ENProtobufUtils.h"
 #import "ENCommonPrivate.h"
@@ -19,19 +20,17 @@ NS_ASSUME_NONNULL_BEGIN
 //===========================================================================================================================
 
 #define	BufferMaxSizeDefault			( 128 * 1024 )
-
-#define ProtobufTypeVarInt				0
-#define ProtobufType64Bit				1
-#define ProtobufTypeLengthDelimited		2
-#define ProtobufTypeStartGroup			3 // Deprecated
-#define ProtobufTypeEndGroup			4 // Deprecated
-#define ProtobufType32Bit				5
+#define	ReadAheadSizeDefault			( 256 * 1024 )
+#define	VarIntMaxLen					10
 
 //===========================================================================================================================
 
 @implementation ENProtobufCoder
 {
-	uint8_t		_staticBuffer[ 256 ];
+	uint8_t *		_readAheadBuffer;	// Window of the file being decoded when decoding from a file.
+	size_t			_readAheadCapacity;
+	uint64_t		_sourceOffset;		// File offset of the byte after the end of the read-ahead window.
+	id <ENProtobufReadSource>	_readSource;		// Source being decoded when decoding from a read source.
 }
 
 //===========================================================================================================================
@@ -42,12 +41,20 @@ NS_ASSUME_NONNULL_BEGIN
 	if( !self ) return( nil );
 	
 	_bufferMaxSize = BufferMaxSizeDefault;
+	_readAheadSize = ReadAheadSizeDefault;
 	
 	return( self );
 }
 
 //===========================================================================================================================
 
+- (void) dealloc
+{
+	free( _readAheadBuffer );
+}
+
+//===========================================================================================================================
+
 - (void) setReadMemory:(const void *) inPtr length:(size_t) inLen
 {
 	_readBase	= (const uint8_t *) inPtr;
@@ -59,6 +66,7 @@ NS_ASSUME_NONNULL_BEGIN
 	_writeLim	= NULL;
 	
 	_fileHandle	= NULL;
+	_readSource	= nil;
 	_bufferData = nil;
 	_bufferOffset = 0;
 }
@@ -76,6 +84,7 @@ NS_ASSUME_NONNULL_BEGIN
 	_writeLim	= _writeBase + inLen;
 	
 	_fileHandle	= NULL;
+	_readSource	= nil;
 	_bufferData = nil;
 	_bufferOffset = 0;
 }
@@ -93,6 +102,7 @@ NS_ASSUME_NONNULL_BEGIN
 	_writeLim	= NULL;
 	
 	_fileHandle	= NULL;
+	_readSource	= nil;
 	_bufferData = inData;
 	_bufferOffset = 0;
 }
@@ -101,17 +111,106 @@ NS_ASSUME_NONNULL_BEGIN
 
 - (void) setFileHandle:(FILE *) inFileHandle
 {
-	_readBase	= NULL;
-	_readSrc	= NULL;
-	_readEnd	= NULL;
+	_readBase	= _readAheadBuffer; // Empty read-ahead window.
+	_readSrc	= _readAheadBuffer;
+	_readEnd	= _readAheadBuffer;
 	
 	_writeBase	= NULL;
 	_writeDst	= NULL;
 	_writeLim	= NULL;
 	
 	_fileHandle	= inFileHandle;
+	_readSource	= nil;
+	_bufferData = nil;
+	_bufferOffset = 0;
+	
+	off_t offset = ftello( inFileHandle );
+	_sourceOffset = ( offset > 0 ) ? (uint64_t) offset : 0;
+	
+	// Files are decoded front to back so hint the kernel to read ahead aggressively.
+	
+	int fileFD = fileno( inFileHandle );
+#if( defined( F_RDAHEAD ) )
+	fcntl( fileFD, F_RDAHEAD, 1 );
+#elif( defined( POSIX_FADV_SEQUENTIAL ) )
+	posix_fadvise( fileFD, 0, 0, POSIX_FADV_SEQUENTIAL );
+#else
+	(void) fileFD;
+#endif
+}
+
+//===========================================================================================================================
+
+- (void) setReadSource:(id <ENProtobufReadSource>) inSource
+{
+	_readBase	= _readAheadBuffer; // Empty read-ahead window.
+	_readSrc	= _readAheadBuffer;
+	_readEnd	= _readAheadBuffer;
+	
+	_writeBase	= NULL;
+	_writeDst	= NULL;
+	_writeLim	= NULL;
+	
+	_fileHandle	= NULL;
+	_readSource	= inSource;
 	_bufferData = nil;
 	_bufferOffset = 0;
+	
+	_sourceOffset = inSource.offset;
+}
+
+//===========================================================================================================================
+
+- (uint64_t) fileOffset
+{
+	return( _sourceOffset - (uint64_t)( _readEnd - _readSrc ) );
+}
+
+//===========================================================================================================================
+
+- (BOOL) seekToFileOffset:(uint64_t) inOffset error:(ENErrorOutType) outError
+{
+	require_return_no( _fileHandle || _readSource, outError, ENNSErrorF( kNotPreparedErr, "seek, no file" ) );
+	
+	// If the offset is within the read-ahead window then just move the read pointer.
+	
+	const uint8_t *readBase = _readBase;
+	uint64_t windowStart = _sourceOffset - (uint64_t)( _readEnd - readBase );
+	if( readBase && ( inOffset >= windowStart ) && ( inOffset <= _sourceOffset ) )
+	{
+		_readSrc = readBase + ( inOffset - windowStart );
+		return( YES );
+	}
+	
+	BOOL good = [self _seekSourceToOffset:inOffset error:outError];
+	return( good );
+}
+
+//===========================================================================================================================
+
+- (BOOL) _seekSourceToOffset:(uint64_t) inOffset error:(ENErrorOutType) outError
+{
+	id <ENProtobufReadSource> readSource = _readSource;
+	if( readSource )
+	{
+		BOOL good = [readSource seekToOffset:inOffset error:outError];
+		require_return_value( good, NO );
+	}
+	else
+	{
+		FILE *fileHandle = _fileHandle;
+		require_return_no( inOffset <= INT64_MAX, outError, ENNSErrorF( kRangeErr, "seek offset too big: %llu", inOffset ) );
+		int err = fseeko( fileHandle, (off_t) inOffset, SEEK_SET );
+		err = map_global_value_errno( !err, fileHandle );
+		require_return_no( !err, outError, ENNSErrorF( err, "fseek failed: %llu", inOffset ) );
+	}
+	
+	// The read-ahead window is now empty at the new offset.
+	
+	_sourceOffset	= inOffset;
+	_readBase		= _readEnd;
+	_readSrc		= _readEnd;
+	return( YES );
 }
 
 // MARK: -
@@ -273,6 +372,28 @@ NS_ASSUME_NONNULL_BEGIN
 {
 	uint64_t value = 0;
 	uint8_t  shift = 0;
+	
+	// Decode directly from the buffer if there's room for the largest varint. Otherwise, read byte-by-byte.
+	
+    const uint8_t *src = _readSrc;
+	if( src && ( ( (size_t)( _readEnd - src ) ) >= VarIntMaxLen ) )
+	{
+		for( ;; )
+		{
+			uint8_t u8 = *src++;
+			uint8_t b = u8 & 0x7F;
+			uint64_t u64 = ( (uint64_t) b ) << shift;
+			require_return_no( ( u64 >> shift ) == b, outError, ENNSErrorF( kRangeErr, "readVarInt shift overflow" ) );
+			value |= u64;
+			if( !( u8 & 0x80 ) ) break;
+			shift += 7;
+			require_return_no( shift <= 63, outError, ENNSErrorF( kOverrunErr, "readVarInt overrun" ) );
+		}
+		_readSrc = src;
+		*outValue = value;
+		return( YES );
+	}
+	
 	for( ;; )
 	{
 		const uint8_t *ptr = [self _readLength:1 eofOkay:inEOFOkay error:outError];
@@ -514,49 +635,84 @@ NS_ASSUME_NONNULL_BEGIN
 NS_RETURNS_INNER_POINTER
 {
     const uint8_t *readSrc = _readSrc;
-	if( readSrc )
+	if( readSrc && ( ( (size_t)( _readEnd - readSrc ) ) >= inLen ) )
+	{
+		_readSrc = readSrc + inLen;
+		return( readSrc );
+	}
+	
+	if( _fileHandle || _readSource )
 	{
+		require_return_nil( inLen <= _bufferMaxSize, outError, ENNSErrorF( kSizeErr, "read too big: %zu", inLen ) );
+		BOOL good = [self _fillReadAhead:inLen error:outError];
+		require_return_value( good, nil );
+		
+		readSrc = _readSrc;
 		require_return_nil( ( (size_t)( _readEnd - readSrc ) ) >= inLen, outError, 
-			inEOFOkay ? nil : ENNSErrorF( kUnderrunErr, "read memory underrun" ) );
+			inEOFOkay ? nil : ENNSErrorF( kUnderrunErr, "read file underrun" ) );
 		_readSrc = readSrc + inLen;
 		return( readSrc );
 	}
 	
+	require_return_nil( !readSrc, outError, inEOFOkay ? nil : ENNSErrorF( kUnderrunErr, "read memory underrun" ) );
+	
+	if( outError ) *outError = ENNSErrorF( kNotPreparedErr, "read, no input sources" );
+	return( nil );
+}
+
+//===========================================================================================================================
+
+- (BOOL) _fillReadAhead:(size_t) inLen error:(ENErrorOutType) outError
+{
+	// Grow the buffer if needed. Grow geometrically so a series of increasingly large reads doesn't realloc each time.
+	
+	uint8_t *buffer = _readAheadBuffer;
+	size_t capacity = _readAheadCapacity;
+	if( !buffer || ( inLen > capacity ) )
+	{
+		size_t newCapacity = Max( Max( _readAheadSize, inLen ), capacity * 2 );
+		size_t srcOffset = buffer ? (size_t)( _readSrc - buffer ) : 0;
+		size_t endOffset = buffer ? (size_t)( _readEnd - buffer ) : 0;
+		buffer = (uint8_t *) realloc( buffer, newCapacity );
+		require_return_no( buffer, outError, ENNSErrorF( kNoMemoryErr, "alloc read-ahead failed: %zu", newCapacity ) );
+		_readSrc			= buffer + srcOffset;
+		_readEnd			= buffer + endOffset;
+		_readAheadBuffer	= buffer;
+		_readAheadCapacity	= newCapacity;
+		capacity			= newCapacity;
+	}
+	
+	// Move any unread bytes to the front and fill the rest of the buffer.
+	
+	size_t avail = (size_t)( _readEnd - _readSrc );
+	if( ( avail > 0 ) && ( _readSrc != buffer ) ) memmove( buffer, _readSrc, avail );
+	
+	id <ENProtobufReadSource> readSource = _readSource;
 	FILE *fileHandle = _fileHandle;
-	if( fileHandle )
+	while( avail < inLen )
 	{
-		require_return_nil( inLen <= _bufferMaxSize, outError, ENNSErrorF( kSizeErr, "read too big: %zu", inLen ) );
-		uint8_t *bufferPtr;
-		if( inLen <= sizeof( _staticBuffer ) )
+		size_t n;
+		if( readSource )
 		{
-			bufferPtr = _staticBuffer;
+			NSError *error = nil;
+			n = [readSource readBytes:&buffer[ avail ] maxLength:capacity - avail error:&error];
+			require_return_no( !error, outError, error );
 		}
 		else
 		{
-            NSMutableData *bufferData = _bufferData;
-			if( !bufferData )
-			{
-				bufferData = [[NSMutableData alloc] initWithLength:inLen];
-				_bufferData = bufferData;
-			}
-			else
-			{
-				bufferData.length = inLen;
-			}
-			bufferPtr = (uint8_t *) bufferData.mutableBytes;
+			n = fread( &buffer[ avail ], 1, capacity - avail, fileHandle );
+			require_return_no( ( n > 0 ) || !ferror( fileHandle ), outError, 
+				ENNSErrorF( kReadErr, "read failed: %#m", errno ) );
 		}
-		
-		size_t n = fread( bufferPtr, 1, inLen, fileHandle );
-		if( n != inLen )
-		{
-			if( outError ) *outError = feof( fileHandle ) ? nil : ENNSErrorF( kReadErr, "read failed: %#m", errno );
-			return( nil );
-		}
-		return( bufferPtr );
+		if( n == 0 ) break;
+		avail += n;
+		_sourceOffset += n;
 	}
 	
-	if( outError ) *outError = ENNSErrorF( kNotPreparedErr, "read, no input sources" );
-	return( nil );
+	_readBase	= buffer;
+	_readSrc	= buffer;
+	_readEnd	= buffer + avail;
+	return( YES );
 }
 
 //===========================================================================================================================
@@ -564,23 +720,23 @@ NS_RETURNS_INNER_POINTER
 - (BOOL) _skipLength:(size_t) inLen error:(ENErrorOutType) outError
 {
     const uint8_t *readSrc = _readSrc;
-	if( readSrc )
+	if( readSrc && ( ( (size_t)( _readEnd - readSrc ) ) >= inLen ) )
 	{
-		require_return_no( ( (size_t)( _readEnd - readSrc ) ) >= inLen, outError, 
-			ENNSErrorF( kUnderrunErr, "read memory underrun" ) );
 		_readSrc = readSrc + inLen;
 		return( YES );
 	}
 	
-	FILE *fileHandle = _fileHandle;
-	if( fileHandle )
+	if( _fileHandle || _readSource )
 	{
-		int err = fseeko( fileHandle, (off_t) inLen, SEEK_CUR );
-		err = map_global_value_errno( !err, fileHandle );
-		require_return_no( !err, outError, ENNSErrorF( err, "fseek failed: %zu bytes", inLen ) );
-		return( YES );
+		// Skip whatever is left in the read-ahead buffer then seek past the rest.
+		
+		size_t remaining = inLen - (size_t)( _readEnd - readSrc );
+		BOOL good = [self _seekSourceToOffset:_sourceOffset + remaining error:outError];
+		return( good );
 	}
 	
+	require_return_no( !readSrc, outError, ENNSErrorF( kUnderrunErr, "read memory underrun" ) );
+	
 	if( outError ) *outError = ENNSErrorF( kNotPreparedErr, "skip, no input sources" );
 	return( NO );
 }